@@ -29,10 +29,12 @@
 
 #include "buffers/ide-buffer-change-monitor.h"
 #include "buffers/ide-buffer.h"
+#include "buffers/ide-rope.h"
 #include "buffers/ide-unsaved-files.h"
 #include "diagnostics/ide-diagnostic.h"
 #include "diagnostics/ide-diagnostics.h"
 #include "diagnostics/ide-diagnostics-manager.h"
+#include "diagnostics/ide-diagnostics-tree-private.h"
 #include "diagnostics/ide-source-location.h"
 #include "diagnostics/ide-source-range.h"
 #include "files/ide-file-settings.h"
@@ -72,10 +74,11 @@ typedef struct
 {
   IdeContext             *context;
   IdeDiagnostics         *diagnostics;
-  GHashTable             *diagnostics_line_cache;
+  IdeDiagnosticsTree     *diagnostics_tree;
   DzlSignalGroup         *diagnostics_manager_signals;
   IdeFile                *file;
   GBytes                 *content;
+  IdeRope                *rope;
   IdeBufferChangeMonitor *change_monitor;
   IdeHighlightEngine     *highlight_engine;
   IdeExtensionAdapter    *formatter_adapter;
@@ -102,6 +105,7 @@ typedef struct
   gsize                   change_count;
 
   guint                   changed_on_volume : 1;
+  guint                   has_embedded_objects : 1;
   guint                   highlight_diagnostics : 1;
   guint                   loading : 1;
   guint                   mtime_set : 1;
@@ -233,24 +237,6 @@ ide_buffer_emit_cursor_moved (IdeBuffer *self)
   g_signal_emit (self, signals [CURSOR_MOVED], 0, &iter);
 }
 
-static void
-ide_buffer_get_iter_at_location (IdeBuffer         *self,
-                                 GtkTextIter       *iter,
-                                 IdeSourceLocation *location)
-{
-  guint line;
-  guint line_offset;
-
-  g_assert (IDE_IS_BUFFER (self));
-  g_assert (iter);
-  g_assert (location);
-
-  line = ide_source_location_get_line (location);
-  line_offset = ide_source_location_get_line_offset (location);
-
-  gtk_text_buffer_get_iter_at_line_offset (GTK_TEXT_BUFFER (self), iter, line, line_offset);
-}
-
 static void
 ide_buffer_release_context (gpointer  data,
                             GObject  *where_the_object_was)
@@ -300,207 +286,248 @@ ide_buffer_set_context (IdeBuffer  *self,
   dzl_signal_group_set_target (priv->diagnostics_manager_signals, diagnostics_manager);
 }
 
-void
-ide_buffer_sync_to_unsaved_files (IdeBuffer *self)
+static const gchar *
+ide_buffer_get_diagnostic_tag_name (IdeDiagnosticSeverity severity)
 {
-  GBytes *content;
+  switch (severity)
+    {
+    case IDE_DIAGNOSTIC_NOTE:
+      return TAG_NOTE;
 
-  g_assert (IDE_IS_BUFFER (self));
+    case IDE_DIAGNOSTIC_DEPRECATED:
+      return TAG_DEPRECATED;
+
+    case IDE_DIAGNOSTIC_WARNING:
+      return TAG_WARNING;
+
+    case IDE_DIAGNOSTIC_ERROR:
+    case IDE_DIAGNOSTIC_FATAL:
+      return TAG_ERROR;
 
-  if ((content = ide_buffer_get_content (self)))
-    g_bytes_unref (content);
+    case IDE_DIAGNOSTIC_IGNORED:
+    default:
+      return NULL;
+    }
 }
 
 static void
-ide_buffer_clear_diagnostics (IdeBuffer *self)
+ide_buffer_remove_diagnostic_tags (IdeBuffer *self,
+                                   guint      first_line,
+                                   guint      last_line)
 {
-  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  static const gchar *tag_names[] = { TAG_NOTE, TAG_WARNING, TAG_DEPRECATED, TAG_ERROR };
   GtkTextBuffer *buffer = (GtkTextBuffer *)self;
   GtkTextTagTable *table;
-  GtkTextTag *tag;
   GtkTextIter begin;
   GtkTextIter end;
 
   g_assert (IDE_IS_BUFFER (self));
 
-  if (priv->diagnostics_line_cache != NULL)
-    g_hash_table_remove_all (priv->diagnostics_line_cache);
+  gtk_text_buffer_get_iter_at_line (buffer, &begin, first_line);
+  gtk_text_buffer_get_iter_at_line (buffer, &end, last_line);
 
-  gtk_text_buffer_get_bounds (buffer, &begin, &end);
+  if (!gtk_text_iter_ends_line (&end))
+    gtk_text_iter_forward_to_line_end (&end);
 
   table = gtk_text_buffer_get_tag_table (buffer);
 
-  if (NULL != (tag = gtk_text_tag_table_lookup (table, TAG_NOTE)))
-    ide_gtk_text_buffer_remove_tag (buffer, tag, &begin, &end, TRUE);
+  for (guint i = 0; i < G_N_ELEMENTS (tag_names); i++)
+    {
+      GtkTextTag *tag;
 
-  if (NULL != (tag = gtk_text_tag_table_lookup (table, TAG_WARNING)))
-    ide_gtk_text_buffer_remove_tag (buffer, tag, &begin, &end, TRUE);
+      if (NULL != (tag = gtk_text_tag_table_lookup (table, tag_names [i])))
+        ide_gtk_text_buffer_remove_tag (buffer, tag, &begin, &end, TRUE);
+    }
+}
 
-  if (NULL != (tag = gtk_text_tag_table_lookup (table, TAG_DEPRECATED)))
-    ide_gtk_text_buffer_remove_tag (buffer, tag, &begin, &end, TRUE);
+/*
+ * Diagnostics are tracked as they move with the edits made since they were
+ * created, so @line_delta is the number of lines they have moved by. As the
+ * line may have been shortened since, the column is clamped to the line.
+ */
+static void
+ide_buffer_get_iter_at_diagnostic_location (IdeBuffer         *self,
+                                            GtkTextIter       *iter,
+                                            IdeSourceLocation *location,
+                                            gint               line_delta)
+{
+  gint line;
+  guint line_offset;
 
-  if (NULL != (tag = gtk_text_tag_table_lookup (table, TAG_ERROR)))
-    ide_gtk_text_buffer_remove_tag (buffer, tag, &begin, &end, TRUE);
+  g_assert (IDE_IS_BUFFER (self));
+  g_assert (iter);
+  g_assert (location);
+
+  line = (gint)ide_source_location_get_line (location) + line_delta;
+  line_offset = ide_source_location_get_line_offset (location);
+
+  gtk_text_buffer_get_iter_at_line (GTK_TEXT_BUFFER (self), iter, MAX (line, 0));
+
+  if (line_offset < (guint)gtk_text_iter_get_chars_in_line (iter))
+    gtk_text_iter_set_line_offset (iter, line_offset);
+  else if (!gtk_text_iter_ends_line (iter))
+    gtk_text_iter_forward_to_line_end (iter);
 }
 
 static void
-ide_buffer_cache_diagnostic_line (IdeBuffer             *self,
-                                  IdeSourceLocation     *begin,
-                                  IdeSourceLocation     *end,
-                                  IdeDiagnosticSeverity  severity)
+ide_buffer_get_diagnostic_part_lines (IdeDiagnostic *diagnostic,
+                                      gint           part,
+                                      guint         *begin_line,
+                                      guint         *end_line)
 {
-  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
-  gpointer new_value = GINT_TO_POINTER (severity);
-  gsize line_begin;
-  gsize line_end;
-  gsize i;
+  IdeSourceLocation *begin;
+  IdeSourceLocation *end;
+
+  g_assert (diagnostic);
+  g_assert (begin_line);
+  g_assert (end_line);
+
+  if (part == IDE_DIAGNOSTICS_TREE_LOCATION)
+    {
+      begin = end = ide_diagnostic_get_location (diagnostic);
+    }
+  else
+    {
+      IdeSourceRange *range = ide_diagnostic_get_range (diagnostic, part);
+
+      begin = ide_source_range_get_begin (range);
+      end = ide_source_range_get_end (range);
+    }
+
+  *begin_line = MIN (ide_source_location_get_line (begin),
+                     ide_source_location_get_line (end));
+  *end_line = MAX (ide_source_location_get_line (begin),
+                   ide_source_location_get_line (end));
+}
+
+static void
+ide_buffer_apply_diagnostic_part (IdeBuffer     *self,
+                                  IdeDiagnostic *diagnostic,
+                                  gint           part,
+                                  gint           line_delta)
+{
+  const gchar *tag_name;
+  GtkTextIter iter1;
+  GtkTextIter iter2;
 
   g_assert (IDE_IS_BUFFER (self));
-  g_assert (begin);
-  g_assert (end);
+  g_assert (diagnostic);
 
-  if (!priv->diagnostics_line_cache)
+  tag_name = ide_buffer_get_diagnostic_tag_name (ide_diagnostic_get_severity (diagnostic));
+
+  if (tag_name == NULL)
     return;
 
-  line_begin = MIN (ide_source_location_get_line (begin),
-                    ide_source_location_get_line (end));
-  line_end = MAX (ide_source_location_get_line (begin),
-                  ide_source_location_get_line (end));
+  if (part == IDE_DIAGNOSTICS_TREE_LOCATION)
+    {
+      IdeSourceLocation *location = ide_diagnostic_get_location (diagnostic);
 
-  for (i = line_begin; i <= line_end; i++)
+      ide_buffer_get_iter_at_diagnostic_location (self, &iter1, location, line_delta);
+      gtk_text_iter_assign (&iter2, &iter1);
+      if (!gtk_text_iter_ends_line (&iter2))
+        gtk_text_iter_forward_to_line_end (&iter2);
+      else
+        gtk_text_iter_backward_char (&iter1);
+    }
+  else
     {
-      gpointer old_value;
-      gpointer key = GINT_TO_POINTER (i);
+      IdeSourceRange *range = ide_diagnostic_get_range (diagnostic, part);
 
-      old_value = g_hash_table_lookup (priv->diagnostics_line_cache, key);
+      ide_buffer_get_iter_at_diagnostic_location (self, &iter1, ide_source_range_get_begin (range), line_delta);
+      ide_buffer_get_iter_at_diagnostic_location (self, &iter2, ide_source_range_get_end (range), line_delta);
 
-      if (new_value > old_value)
-        g_hash_table_replace (priv->diagnostics_line_cache, key, new_value);
+      if (gtk_text_iter_equal (&iter1, &iter2))
+        {
+          if (!gtk_text_iter_ends_line (&iter2))
+            gtk_text_iter_forward_char (&iter2);
+          else
+            gtk_text_iter_backward_char (&iter1);
+        }
     }
+
+  gtk_text_buffer_apply_tag_by_name (GTK_TEXT_BUFFER (self), tag_name, &iter1, &iter2);
 }
 
 static void
-ide_buffer_update_diagnostic (IdeBuffer     *self,
-                              IdeDiagnostic *diagnostic)
+ide_buffer_add_diagnostic (IdeBuffer     *self,
+                           IdeDiagnostic *diagnostic)
 {
   IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
-  IdeDiagnosticSeverity severity;
-  const gchar *tag_name = NULL;
   IdeSourceLocation *location;
+  guint begin_line;
+  guint end_line;
   gsize num_ranges;
-  gsize i;
 
   g_assert (IDE_IS_BUFFER (self));
   g_assert (diagnostic);
 
-  severity = ide_diagnostic_get_severity (diagnostic);
-
-  switch (severity)
-    {
-    case IDE_DIAGNOSTIC_NOTE:
-      tag_name = TAG_NOTE;
-      break;
-
-    case IDE_DIAGNOSTIC_DEPRECATED:
-      tag_name = TAG_DEPRECATED;
-      break;
-
-    case IDE_DIAGNOSTIC_WARNING:
-      tag_name = TAG_WARNING;
-      break;
-
-    case IDE_DIAGNOSTIC_ERROR:
-    case IDE_DIAGNOSTIC_FATAL:
-      tag_name = TAG_ERROR;
-      break;
-
-    case IDE_DIAGNOSTIC_IGNORED:
-    default:
-      return;
-    }
+  if (ide_buffer_get_diagnostic_tag_name (ide_diagnostic_get_severity (diagnostic)) == NULL)
+    return;
 
   if (NULL != (location = ide_diagnostic_get_location (diagnostic)))
     {
       IdeFile *file;
-      GtkTextIter iter1;
-      GtkTextIter iter2;
 
       file = ide_source_location_get_file (location);
 
       if (file && priv->file && !ide_file_equal (file, priv->file))
         return;
 
-      ide_buffer_cache_diagnostic_line (self, location, location, severity);
-
-      ide_buffer_get_iter_at_location (self, &iter1, location);
-      gtk_text_iter_assign (&iter2, &iter1);
-      if (!gtk_text_iter_ends_line (&iter2))
-        gtk_text_iter_forward_to_line_end (&iter2);
-      else
-        gtk_text_iter_backward_char (&iter1);
-
-      gtk_text_buffer_apply_tag_by_name (GTK_TEXT_BUFFER (self), tag_name, &iter1, &iter2);
+      ide_buffer_get_diagnostic_part_lines (diagnostic, IDE_DIAGNOSTICS_TREE_LOCATION, &begin_line, &end_line);
+      ide_diagnostics_tree_insert (priv->diagnostics_tree, diagnostic, IDE_DIAGNOSTICS_TREE_LOCATION, begin_line, end_line);
+      ide_buffer_apply_diagnostic_part (self, diagnostic, IDE_DIAGNOSTICS_TREE_LOCATION, 0);
     }
 
   num_ranges = ide_diagnostic_get_num_ranges (diagnostic);
 
-  for (i = 0; i < num_ranges; i++)
+  for (guint i = 0; i < num_ranges; i++)
     {
-      IdeSourceRange *range;
-      IdeSourceLocation *begin;
-      IdeSourceLocation *end;
-      IdeFile *file;
-      GtkTextIter iter1;
-      GtkTextIter iter2;
-
-      range = ide_diagnostic_get_range (diagnostic, i);
-      begin = ide_source_range_get_begin (range);
-      end = ide_source_range_get_end (range);
-
-      file = ide_source_location_get_file (begin);
+      ide_buffer_get_diagnostic_part_lines (diagnostic, i, &begin_line, &end_line);
+      ide_diagnostics_tree_insert (priv->diagnostics_tree, diagnostic, i, begin_line, end_line);
+      ide_buffer_apply_diagnostic_part (self, diagnostic, i, 0);
+    }
+}
 
-      if (file && priv->file && !ide_file_equal (file, priv->file))
-        {
-          /* Ignore */
-        }
+typedef struct
+{
+  GHashTable *incoming;
+  guint       first_line;
+  guint       last_line;
+} DiagnosticsUpdate;
 
-      ide_buffer_get_iter_at_location (self, &iter1, begin);
-      ide_buffer_get_iter_at_location (self, &iter2, end);
+static gboolean
+ide_buffer_remove_stale_diagnostic (IdeDiagnostic *diagnostic,
+                                    gint           part,
+                                    guint          begin_line,
+                                    guint          end_line,
+                                    gpointer       user_data)
+{
+  DiagnosticsUpdate *update = user_data;
 
-      ide_buffer_cache_diagnostic_line (self, begin, end, severity);
+  if (g_hash_table_contains (update->incoming, diagnostic))
+    return FALSE;
 
-      if (gtk_text_iter_equal (&iter1, &iter2))
-        {
-          if (!gtk_text_iter_ends_line (&iter2))
-            gtk_text_iter_forward_char (&iter2);
-          else
-            gtk_text_iter_backward_char (&iter1);
-        }
+  update->first_line = MIN (update->first_line, begin_line);
+  update->last_line = MAX (update->last_line, end_line);
 
-      gtk_text_buffer_apply_tag_by_name (GTK_TEXT_BUFFER (self), tag_name, &iter1, &iter2);
-    }
+  return TRUE;
 }
 
 static void
-ide_buffer_update_diagnostics (IdeBuffer      *self,
-                               IdeDiagnostics *diagnostics)
+ide_buffer_reapply_diagnostic (IdeDiagnostic *diagnostic,
+                               gint           part,
+                               guint          begin_line,
+                               guint          end_line,
+                               gpointer       user_data)
 {
-  gsize size;
-  gsize i;
+  IdeBuffer *self = user_data;
+  guint original_begin;
+  guint original_end;
 
   g_assert (IDE_IS_BUFFER (self));
-  g_assert (diagnostics);
-
-  size = ide_diagnostics_get_size (diagnostics);
 
-  for (i = 0; i < size; i++)
-    {
-      IdeDiagnostic *diagnostic;
-
-      diagnostic = ide_diagnostics_index (diagnostics, i);
-      if (diagnostic != NULL)
-        ide_buffer_update_diagnostic (self, diagnostic);
-    }
+  ide_buffer_get_diagnostic_part_lines (diagnostic, part, &original_begin, &original_end);
+  ide_buffer_apply_diagnostic_part (self, diagnostic, part, (gint)begin_line - (gint)original_begin);
 }
 
 static void
@@ -516,16 +543,50 @@ ide_buffer_set_diagnostics (IdeBuffer      *self,
 
   if (diagnostics != priv->diagnostics)
     {
-      ide_buffer_clear_diagnostics (self);
+      g_autoptr(GHashTable) incoming = g_hash_table_new (NULL, NULL);
+      DiagnosticsUpdate update = { incoming, G_MAXUINT, 0 };
+      gsize size = ide_diagnostics_get_size (diagnostics);
 
-      g_clear_pointer (&priv->diagnostics, ide_diagnostics_unref);
+      for (gsize i = 0; i < size; i++)
+        {
+          IdeDiagnostic *diagnostic = ide_diagnostics_index (diagnostics, i);
+
+          if (diagnostic != NULL)
+            g_hash_table_add (incoming, diagnostic);
+        }
+
+      /*
+       * The diagnostics manager hands us the same diagnostic instances for
+       * providers that have not reported anything new, so we only need to
+       * touch the diagnostics that went away or are new. Those we keep have
+       * been moved along with the edits to the buffer, both in the tree and
+       * in the text tags. Tags of other diagnostics on the lines we clear
+       * are applied again afterwards.
+       */
+      if (ide_diagnostics_tree_remove_if (priv->diagnostics_tree,
+                                          ide_buffer_remove_stale_diagnostic,
+                                          &update) > 0)
+        {
+          ide_buffer_remove_diagnostic_tags (self, update.first_line, update.last_line);
+          ide_diagnostics_tree_foreach_in_range (priv->diagnostics_tree,
+                                                 update.first_line,
+                                                 update.last_line,
+                                                 ide_buffer_reapply_diagnostic,
+                                                 self);
+        }
 
-      if (diagnostics != NULL)
+      for (gsize i = 0; i < size; i++)
         {
-          priv->diagnostics = ide_diagnostics_ref (diagnostics);
-          ide_buffer_update_diagnostics (self, diagnostics);
+          IdeDiagnostic *diagnostic = ide_diagnostics_index (diagnostics, i);
+
+          if (diagnostic != NULL &&
+              !ide_diagnostics_tree_contains (priv->diagnostics_tree, diagnostic))
+            ide_buffer_add_diagnostic (self, diagnostic);
         }
 
+      g_clear_pointer (&priv->diagnostics, ide_diagnostics_unref);
+      priv->diagnostics = ide_diagnostics_ref (diagnostics);
+
       g_signal_emit (self, signals [LINE_FLAGS_CHANGED], 0);
       g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_HAS_DIAGNOSTICS]);
     }
@@ -694,6 +755,11 @@ ide_buffer_delete_range (GtkTextBuffer *buffer,
                          GtkTextIter   *start,
                          GtkTextIter   *end)
 {
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  guint begin_offset;
+  guint end_offset;
+
   IDE_ENTRY;
 
 #ifdef IDE_ENABLE_TRACE
@@ -712,20 +778,73 @@ ide_buffer_delete_range (GtkTextBuffer *buffer,
   }
 #endif
 
+  begin_offset = gtk_text_iter_get_offset (start);
+  end_offset = gtk_text_iter_get_offset (end);
+
+  /*
+   * Keep the diagnostics on the text they were created for. The lines
+   * following the first line of the range are joined with it.
+   */
+  if (priv->diagnostics_tree != NULL)
+    {
+      gint first_line = gtk_text_iter_get_line (start);
+      gint last_line = gtk_text_iter_get_line (end);
+
+      if (first_line != last_line)
+        ide_diagnostics_tree_delete_lines (priv->diagnostics_tree,
+                                           MIN (first_line, last_line),
+                                           ABS (last_line - first_line));
+    }
+
   GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->delete_range (buffer, start, end);
 
+  if (priv->rope != NULL)
+    {
+      IdeRope *rope = NULL;
+
+      if (!priv->has_embedded_objects)
+        rope = ide_rope_delete (priv->rope,
+                                MIN (begin_offset, end_offset),
+                                MAX (begin_offset, end_offset));
+
+      g_clear_pointer (&priv->rope, ide_rope_unref);
+      priv->rope = rope;
+    }
+
   ide_buffer_emit_cursor_moved (IDE_BUFFER (buffer));
 
   IDE_EXIT;
 }
 
+static guint
+ide_buffer_count_lines (const gchar *text,
+                        gint         len)
+{
+  guint n_lines = 0;
+
+  for (gint i = 0; i < len; i++)
+    {
+      /* \r\n, \r and \n each end a line within a GtkTextBuffer */
+      if (text [i] == '\n')
+        n_lines++;
+      else if (text [i] == '\r' && (i + 1 == len || text [i + 1] != '\n'))
+        n_lines++;
+    }
+
+  return n_lines;
+}
+
 static void
 ide_buffer_insert_text (GtkTextBuffer *buffer,
                         GtkTextIter   *location,
                         const gchar   *text,
                         gint           len)
 {
+  IdeBuffer *self = (IdeBuffer *)buffer;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
   gboolean check_modeline = FALSE;
+  guint n_lines;
+  guint offset;
 
   g_assert (IDE_IS_BUFFER (buffer));
   g_assert (location);
@@ -741,14 +860,81 @@ ide_buffer_insert_text (GtkTextBuffer *buffer,
       ((text [0] == '\n') || ((len > 1) && (strchr (text, '\n') != NULL))))
     check_modeline = TRUE;
 
+  offset = gtk_text_iter_get_offset (location);
+
+  /*
+   * Keep the diagnostics on the text they were created for. If we insert
+   * at the start of a line, that line moves down along with the rest.
+   */
+  if (priv->diagnostics_tree != NULL && (n_lines = ide_buffer_count_lines (text, len)) > 0)
+    {
+      guint line = gtk_text_iter_get_line (location);
+
+      if (!gtk_text_iter_starts_line (location))
+        line++;
+
+      ide_diagnostics_tree_insert_lines (priv->diagnostics_tree, line, n_lines);
+    }
+
   GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_text (buffer, location, text, len);
 
+  if (priv->rope != NULL)
+    {
+      IdeRope *rope = NULL;
+
+      if (!priv->has_embedded_objects)
+        rope = ide_rope_insert (priv->rope, offset, text, len);
+
+      g_clear_pointer (&priv->rope, ide_rope_unref);
+      priv->rope = rope;
+    }
+
   ide_buffer_emit_cursor_moved (IDE_BUFFER (buffer));
 
   if (check_modeline)
     ide_buffer_do_modeline (IDE_BUFFER (buffer));
 }
 
+static void
+ide_buffer_embedded_object_inserted (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_assert (IDE_IS_BUFFER (self));
+
+  /*
+   * Embedded objects take up a character offset but are not part of the
+   * text returned from gtk_text_buffer_get_text(), so the rope can no longer
+   * be kept in sync using offsets. Fall back to rebuilding it on demand.
+   */
+  priv->has_embedded_objects = TRUE;
+  g_clear_pointer (&priv->rope, ide_rope_unref);
+}
+
+static void
+ide_buffer_insert_pixbuf (GtkTextBuffer *buffer,
+                          GtkTextIter   *location,
+                          GdkPixbuf     *pixbuf)
+{
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_pixbuf (buffer, location, pixbuf);
+
+  ide_buffer_embedded_object_inserted (IDE_BUFFER (buffer));
+}
+
+static void
+ide_buffer_insert_child_anchor (GtkTextBuffer      *buffer,
+                                GtkTextIter        *location,
+                                GtkTextChildAnchor *anchor)
+{
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  GTK_TEXT_BUFFER_CLASS (ide_buffer_parent_class)->insert_child_anchor (buffer, location, anchor);
+
+  ide_buffer_embedded_object_inserted (IDE_BUFFER (buffer));
+}
+
 static void
 ide_buffer_mark_set (GtkTextBuffer     *buffer,
                      const GtkTextIter *iter,
@@ -1308,9 +1494,10 @@ ide_buffer_dispose (GObject *object)
 
   dzl_signal_group_set_target (priv->diagnostics_manager_signals, NULL);
 
-  g_clear_pointer (&priv->diagnostics_line_cache, g_hash_table_unref);
+  g_clear_pointer (&priv->diagnostics_tree, ide_diagnostics_tree_free);
   g_clear_pointer (&priv->diagnostics, ide_diagnostics_unref);
   g_clear_pointer (&priv->content, g_bytes_unref);
+  g_clear_pointer (&priv->rope, ide_rope_unref);
   g_clear_pointer (&priv->title, g_free);
   g_clear_object (&priv->file);
   g_clear_object (&priv->highlight_engine);
@@ -1450,6 +1637,8 @@ ide_buffer_class_init (IdeBufferClass *klass)
 
   text_buffer_class->changed = ide_buffer_changed;
   text_buffer_class->delete_range = ide_buffer_delete_range;
+  text_buffer_class->insert_child_anchor = ide_buffer_insert_child_anchor;
+  text_buffer_class->insert_pixbuf = ide_buffer_insert_pixbuf;
   text_buffer_class->insert_text = ide_buffer_insert_text;
   text_buffer_class->mark_set = ide_buffer_mark_set;
 
@@ -1630,7 +1819,7 @@ ide_buffer_init (IdeBuffer *self)
                                    self,
                                    G_CONNECT_SWAPPED);
 
-  priv->diagnostics_line_cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->diagnostics_tree = ide_diagnostics_tree_new ();
 
   priv->diagnostics_manager_signals = dzl_signal_group_new (IDE_TYPE_DIAGNOSTICS_MANAGER);
   dzl_signal_group_connect_object (priv->diagnostics_manager_signals,
@@ -1744,6 +1933,18 @@ ide_buffer_get_context (IdeBuffer *self)
   return priv->context;
 }
 
+static void
+ide_buffer_collect_line_severity (IdeDiagnostic *diagnostic,
+                                  gint           part,
+                                  guint          begin_line,
+                                  guint          end_line,
+                                  gpointer       user_data)
+{
+  IdeDiagnosticSeverity *severity = user_data;
+
+  *severity = MAX (*severity, ide_diagnostic_get_severity (diagnostic));
+}
+
 /**
  * ide_buffer_get_line_flags:
  * @self: A #IdeBuffer.
@@ -1762,14 +1963,17 @@ ide_buffer_get_line_flags (IdeBuffer *self,
   IdeBufferLineFlags flags = 0;
   IdeBufferLineChange change = 0;
 
-  if (priv->diagnostics_line_cache)
+  if (priv->diagnostics_tree)
     {
-      gpointer key = GINT_TO_POINTER (line);
-      gpointer value;
+      IdeDiagnosticSeverity severity = IDE_DIAGNOSTIC_IGNORED;
 
-      value = g_hash_table_lookup (priv->diagnostics_line_cache, key);
+      ide_diagnostics_tree_foreach_in_range (priv->diagnostics_tree,
+                                             line,
+                                             line,
+                                             ide_buffer_collect_line_severity,
+                                             &severity);
 
-      switch (GPOINTER_TO_INT (value))
+      switch (severity)
         {
         case IDE_DIAGNOSTIC_FATAL:
         case IDE_DIAGNOSTIC_ERROR:
@@ -1865,6 +2069,69 @@ ide_buffer_set_highlight_diagnostics (IdeBuffer *self,
     }
 }
 
+typedef struct
+{
+  IdeBuffer     *self;
+  IdeDiagnostic *diagnostic;
+  gint           offset;
+  guint          distance;
+} NearestDiagnostic;
+
+static void
+ide_buffer_find_nearest_diagnostic (IdeDiagnostic *diagnostic,
+                                    gint           part,
+                                    guint          begin_line,
+                                    guint          end_line,
+                                    gpointer       user_data)
+{
+  NearestDiagnostic *nearest = user_data;
+  GtkTextIter begin;
+  GtkTextIter end;
+  guint orig_begin_line;
+  guint orig_end_line;
+  gint line_delta;
+  gint begin_offset;
+  gint end_offset;
+  guint distance;
+
+  ide_buffer_get_diagnostic_part_lines (diagnostic, part, &orig_begin_line, &orig_end_line);
+  line_delta = (gint)begin_line - (gint)orig_begin_line;
+
+  if (part == IDE_DIAGNOSTICS_TREE_LOCATION)
+    {
+      ide_buffer_get_iter_at_diagnostic_location (nearest->self,
+                                                  &begin,
+                                                  ide_diagnostic_get_location (diagnostic),
+                                                  line_delta);
+      end = begin;
+    }
+  else
+    {
+      IdeSourceRange *range = ide_diagnostic_get_range (diagnostic, part);
+
+      ide_buffer_get_iter_at_diagnostic_location (nearest->self, &begin, ide_source_range_get_begin (range), line_delta);
+      ide_buffer_get_iter_at_diagnostic_location (nearest->self, &end, ide_source_range_get_end (range), line_delta);
+      gtk_text_iter_order (&begin, &end);
+    }
+
+  begin_offset = gtk_text_iter_get_offset (&begin);
+  end_offset = gtk_text_iter_get_offset (&end);
+
+  /* A position within one of the ranges is as near as it gets */
+  if (nearest->offset < begin_offset)
+    distance = begin_offset - nearest->offset;
+  else if (nearest->offset > end_offset)
+    distance = nearest->offset - end_offset;
+  else
+    distance = 0;
+
+  if (distance < nearest->distance)
+    {
+      nearest->distance = distance;
+      nearest->diagnostic = diagnostic;
+    }
+}
+
 /**
  * ide_buffer_get_diagnostic_at_iter:
  * @self: A #IdeBuffer.
@@ -1883,87 +2150,76 @@ ide_buffer_get_diagnostic_at_iter (IdeBuffer         *self,
   g_return_val_if_fail (IDE_IS_BUFFER (self), NULL);
   g_return_val_if_fail (iter, NULL);
 
-  if (priv->diagnostics)
+  if (priv->diagnostics_tree)
     {
-      IdeDiagnostic *diagnostic = NULL;
-      IdeBufferLineFlags flags;
-      guint distance = G_MAXUINT;
-      gsize size;
-      gsize i;
+      NearestDiagnostic nearest = { self, NULL, gtk_text_iter_get_offset (iter), G_MAXUINT };
       guint line;
 
       line = gtk_text_iter_get_line (iter);
-      flags = ide_buffer_get_line_flags (self, line);
-
-      if ((flags & IDE_BUFFER_LINE_FLAGS_DIAGNOSTICS_MASK) == 0)
-        return NULL;
-
-      size = ide_diagnostics_get_size (priv->diagnostics);
-
-      for (i = 0; i < size; i++)
-        {
-          IdeDiagnostic *diag;
-          IdeSourceLocation *location;
-          GtkTextIter pos;
 
-          diag = ide_diagnostics_index (priv->diagnostics, i);
-          location = ide_diagnostic_get_location (diag);
-          if (!location)
-            continue;
-
-          /* TODO: This should look at the range for the diagnostic */
-
-          ide_buffer_get_iter_at_location (self, &pos, location);
-
-          if (line == (guint)gtk_text_iter_get_line (&pos))
-            {
-              guint offset;
-
-              offset = ABS (gtk_text_iter_get_offset (iter) - gtk_text_iter_get_offset (&pos));
-
-              if (offset < distance)
-                {
-                  distance = offset;
-                  diagnostic = diag;
-                }
-            }
-        }
+      ide_diagnostics_tree_foreach_in_range (priv->diagnostics_tree,
+                                             line,
+                                             line,
+                                             ide_buffer_find_nearest_diagnostic,
+                                             &nearest);
 
-      return diagnostic;
+      return nearest.diagnostic;
     }
 
   return NULL;
 }
 
-static gboolean
-ide_buffer_can_do_newline_hack (IdeBuffer *self,
-                                guint      len)
+static IdeRope *
+ide_buffer_ensure_rope (IdeBuffer *self)
 {
-  guint next_pow2;
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
 
   g_assert (IDE_IS_BUFFER (self));
 
   /*
-   * If adding two bytes to our length (one for \n and one for \0) is still under the next
-   * power of two, then we can avoid making a copy of the buffer when saving the buffer
-   * to our drafts.
-   *
-   * HACK: This relies on the fact that GtkTextBuffer returns a GString allocated string
-   *       which grows the string in powers of two.
+   * The rope is created the first time somebody asks for the buffer
+   * contents and is then updated incrementally from insert-text and
+   * delete-range, so that getting the contents after an edit does not
+   * require walking the whole GtkTextBuffer again.
    */
+  if (priv->rope == NULL)
+    {
+      g_autofree gchar *text = NULL;
+      GtkTextIter begin;
+      GtkTextIter end;
 
-  if ((len == 0) || (len & (len - 1)) == 0)
-    return FALSE;
+      gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (self), &begin, &end);
+      text = gtk_text_buffer_get_text (GTK_TEXT_BUFFER (self), &begin, &end, TRUE);
+      priv->rope = ide_rope_new (text, -1);
+    }
+
+  return priv->rope;
+}
+
+/*
+ * Hands the current rope snapshot to the unsaved files. This does not copy
+ * the buffer, the text is only flattened once a consumer asks for it and
+ * is then shared with ide_buffer_get_content().
+ */
+void
+ide_buffer_sync_to_unsaved_files (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+  IdeUnsavedFiles *unsaved_files;
+  GFile *gfile;
 
-  next_pow2 = len;
-  next_pow2 |= next_pow2 >> 1;
-  next_pow2 |= next_pow2 >> 2;
-  next_pow2 |= next_pow2 >> 4;
-  next_pow2 |= next_pow2 >> 8;
-  next_pow2 |= next_pow2 >> 16;
-  next_pow2++;
+  g_assert (IDE_IS_BUFFER (self));
 
-  return ((len + 2) < next_pow2);
+  if (priv->context == NULL ||
+      priv->file == NULL ||
+      !(gfile = ide_file_get_file (priv->file)))
+    return;
+
+  unsaved_files = ide_context_get_unsaved_files (priv->context);
+  _ide_unsaved_files_update_rope (unsaved_files,
+                                  gfile,
+                                  ide_buffer_ensure_rope (self),
+                                  gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self)));
 }
 
 /**
@@ -1989,59 +2245,49 @@ ide_buffer_get_content (IdeBuffer *self)
 
   if (!priv->content)
     {
-      IdeUnsavedFiles *unsaved_files;
-      gchar *text;
-      GtkTextIter begin;
-      GtkTextIter end;
-      GFile *gfile = NULL;
-      gsize len;
-
-      gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (self), &begin, &end);
-      text = gtk_text_buffer_get_text (GTK_TEXT_BUFFER (self), &begin, &end, TRUE);
-
       /*
-       * If implicit newline is set, add a \n in place of the \0 and avoid duplicating the buffer.
-       * Make sure to track length beforehand, since we would overwrite afterwards. Since
-       * conversion to \r\n is dealth with during save operations, this should be fine for both.
-       * The unsaved files will restore to a buffer, for which \n is acceptable.
+       * The flattened text is cached by the rope snapshot, so this only
+       * copies the buffer once per change no matter how many consumers ask
+       * for it, whether through us or through the unsaved files. Since
+       * conversion to \r\n is dealt with during save operations, the
+       * implicit trailing \n is fine for both. The unsaved files will
+       * restore to a buffer, for which \n is acceptable.
+       *
+       * The rope leaves a \0 after the data that is not included in the
+       * length. This way, compilers that don't want to see the trailing \0
+       * can ignore that data, but compilers that rely on valid C strings
+       * can also rely on the buffer to be valid.
        */
-      len = strlen (text);
-      if (gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self)))
-        {
-          if (!ide_buffer_can_do_newline_hack (self, len))
-            {
-              gchar *copy;
-
-              copy = g_malloc (len + 2);
-              memcpy (copy, text, len);
-              g_free (text);
-              text = copy;
-            }
-
-          text [len] = '\n';
-          text [++len] = '\0';
-        }
+      priv->content = ide_rope_flatten_full (ide_buffer_ensure_rope (self),
+                                             gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self)));
 
-      /*
-       * We pass a buffer that is longer than the length we tell GBytes about.
-       * This way, compilers that don't want to see the trailing \0 can ignore
-       * that data, but compilers that rely on valid C strings can also rely
-       * on the buffer to be valid.
-       */
-      priv->content = g_bytes_new_take (text, len);
-
-      if ((priv->context != NULL) &&
-          (priv->file != NULL) &&
-          (gfile = ide_file_get_file (priv->file)))
-        {
-          unsaved_files = ide_context_get_unsaved_files (priv->context);
-          ide_unsaved_files_update (unsaved_files, gfile, priv->content);
-        }
+      ide_buffer_sync_to_unsaved_files (self);
     }
 
   return g_bytes_ref (priv->content);
 }
 
+/**
+ * ide_buffer_get_rope:
+ * @self: A #IdeBuffer.
+ *
+ * Gets an immutable snapshot of the buffer contents. Unlike
+ * ide_buffer_get_content() this does not copy the text, the snapshot shares
+ * its storage with the buffer's future snapshots and may be used from any
+ * thread.
+ *
+ * The snapshot does not include the implicit trailing newline.
+ *
+ * Returns: (transfer full): An #IdeRope.
+ */
+IdeRope *
+ide_buffer_get_rope (IdeBuffer *self)
+{
+  g_return_val_if_fail (IDE_IS_BUFFER (self), NULL);
+
+  return ide_rope_ref (ide_buffer_ensure_rope (self));
+}
+
 /**
  * ide_buffer_trim_trailing_whitespace:
  * @self: A #IdeBuffer.
@@ -2189,6 +2435,16 @@ ide_buffer_set_style_scheme_name (IdeBuffer   *self,
     gtk_source_buffer_set_style_scheme (GTK_SOURCE_BUFFER (self), scheme);
 }
 
+IdeHighlightEngine *
+_ide_buffer_get_highlight_engine (IdeBuffer *self)
+{
+  IdeBufferPrivate *priv = ide_buffer_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_BUFFER (self), NULL);
+
+  return priv->highlight_engine;
+}
+
 gboolean
 _ide_buffer_get_loading (IdeBuffer *self)
 {
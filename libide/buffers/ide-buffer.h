@@ -23,6 +23,7 @@
 
 #include "ide-types.h"
 
+#include "buffers/ide-rope.h"
 #include "formatting/ide-formatter-options.h"
 
 G_BEGIN_DECLS
@@ -81,6 +82,7 @@ IdeFile            *ide_buffer_get_file                      (IdeBuffer
 IdeBufferLineFlags  ide_buffer_get_line_flags                (IdeBuffer            *self,
                                                               guint                 line);
 gboolean            ide_buffer_get_read_only                 (IdeBuffer            *self);
+IdeRope            *ide_buffer_get_rope                      (IdeBuffer            *self);
 gboolean            ide_buffer_get_spell_checking            (IdeBuffer            *self);
 gboolean            ide_buffer_get_highlight_diagnostics     (IdeBuffer            *self);
 const gchar        *ide_buffer_get_style_scheme_name         (IdeBuffer            *self);
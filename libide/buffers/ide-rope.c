@@ -0,0 +1,654 @@
+/* ide-rope.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-rope"
+
+#include <dazzle.h>
+#include <string.h>
+
+#include "buffers/ide-rope.h"
+
+/**
+ * SECTION:ide-rope
+ * @title: IdeRope
+ * @short_description: An immutable, structurally shared string
+ *
+ * #IdeRope is an immutable UTF-8 string stored as a balanced tree of small
+ * chunks. Inserting or deleting text creates a new rope that shares every
+ * chunk that was not touched by the edit with the original, so an edit
+ * costs O(log n) allocations rather than a copy of the whole text.
+ *
+ * Since a rope never changes after it has been created, it may be handed
+ * to worker threads freely. #IdeBuffer keeps one up to date as the user
+ * types, see ide_buffer_get_rope().
+ *
+ * Offsets are in characters, lengths are in bytes.
+ */
+
+/*
+ * Text inserted in one piece is stored in leaves of up to this many bytes,
+ * and neighbouring leaves are merged up to this size when joined so that
+ * typing one character at a time does not fragment the tree.
+ */
+#define LEAF_SIZE 1024
+
+G_DEFINE_BOXED_TYPE (IdeRope, ide_rope, ide_rope_ref, ide_rope_unref)
+
+DZL_DEFINE_COUNTER (nodes, "IdeRope", "Nodes", "Number of rope nodes")
+
+typedef struct _IdeRopeNode IdeRopeNode;
+
+struct _IdeRopeNode
+{
+  volatile gint  ref_count;
+
+  /* 0 for leaves, which have no children */
+  guint          height;
+
+  gsize          n_bytes;
+  gsize          n_chars;
+
+  IdeRopeNode   *left;
+  IdeRopeNode   *right;
+
+  /* Only allocated for leaves */
+  gchar          data[];
+};
+
+struct _IdeRope
+{
+  volatile gint  ref_count;
+
+  /* NULL for the empty rope */
+  IdeRopeNode   *root;
+
+  /* Lazily created by ide_rope_flatten_full(), with and without a newline */
+  GBytes        *bytes;
+  GBytes        *bytes_newline;
+};
+
+static IdeRopeNode *node_join (IdeRopeNode *left,
+                               IdeRopeNode *right);
+
+static gsize
+count_chars (const gchar *text,
+             gsize        len)
+{
+  gsize n_chars = 0;
+
+  /* Count everything but continuation bytes, unlike g_utf8_strlen()
+   * this does not stop at an embedded \0.
+   */
+  for (gsize i = 0; i < len; i++)
+    n_chars += ((guchar)text[i] & 0xC0) != 0x80;
+
+  return n_chars;
+}
+
+static IdeRopeNode *
+node_ref (IdeRopeNode *node)
+{
+  g_assert (node != NULL);
+  g_assert (node->ref_count > 0);
+
+  g_atomic_int_inc (&node->ref_count);
+
+  return node;
+}
+
+static void
+node_unref (IdeRopeNode *node)
+{
+  g_assert (node != NULL);
+  g_assert (node->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&node->ref_count))
+    {
+      if (node->height > 0)
+        {
+          node_unref (node->left);
+          node_unref (node->right);
+        }
+
+      g_free (node);
+
+      DZL_COUNTER_DEC (nodes);
+    }
+}
+
+static IdeRopeNode *
+leaf_new (const gchar *text,
+          gsize        n_bytes,
+          gsize        n_chars)
+{
+  IdeRopeNode *node;
+
+  g_assert (text != NULL);
+  g_assert (n_bytes > 0);
+
+  node = g_malloc (sizeof *node + n_bytes);
+  node->ref_count = 1;
+  node->height = 0;
+  node->n_bytes = n_bytes;
+  node->n_chars = n_chars;
+  node->left = NULL;
+  node->right = NULL;
+  memcpy (node->data, text, n_bytes);
+
+  DZL_COUNTER_INC (nodes);
+
+  return node;
+}
+
+/* Takes ownership of @left and @right */
+static IdeRopeNode *
+branch_new (IdeRopeNode *left,
+            IdeRopeNode *right)
+{
+  IdeRopeNode *node;
+
+  g_assert (left != NULL);
+  g_assert (right != NULL);
+
+  node = g_malloc (sizeof *node);
+  node->ref_count = 1;
+  node->height = MAX (left->height, right->height) + 1;
+  node->n_bytes = left->n_bytes + right->n_bytes;
+  node->n_chars = left->n_chars + right->n_chars;
+  node->left = left;
+  node->right = right;
+
+  DZL_COUNTER_INC (nodes);
+
+  return node;
+}
+
+static gboolean
+node_foreach_chunk (IdeRopeNode      *node,
+                    IdeRopeChunkFunc  func,
+                    gpointer          user_data)
+{
+  g_assert (node != NULL);
+  g_assert (func != NULL);
+
+  if (node->height == 0)
+    return func (node->data, node->n_bytes, user_data);
+
+  return node_foreach_chunk (node->left, func, user_data) ||
+         node_foreach_chunk (node->right, func, user_data);
+}
+
+static gboolean
+copy_chunk_cb (const gchar *data,
+               gsize        len,
+               gpointer     user_data)
+{
+  gchar **dest = user_data;
+
+  memcpy (*dest, data, len);
+  *dest += len;
+
+  return FALSE;
+}
+
+static IdeRopeNode *
+node_new_from_text (const gchar *text,
+                    gsize        len)
+{
+  gsize mid;
+
+  g_assert (text != NULL);
+  g_assert (len > 0);
+
+  if (len <= LEAF_SIZE)
+    return leaf_new (text, len, count_chars (text, len));
+
+  /* Split in the middle, backing up to the start of a character */
+  mid = len / 2;
+  while (mid > 0 && ((guchar)text[mid] & 0xC0) == 0x80)
+    mid--;
+
+  return node_join (node_new_from_text (text, mid),
+                    node_new_from_text (text + mid, len - mid));
+}
+
+/*
+ * Creates a branch from @left and @right (taking ownership of both),
+ * rotating if their heights differ by two as can happen after a join.
+ */
+static IdeRopeNode *
+node_balance (IdeRopeNode *left,
+              IdeRopeNode *right)
+{
+  IdeRopeNode *ret;
+
+  g_assert (left != NULL);
+  g_assert (right != NULL);
+
+  if (left->height > right->height + 1)
+    {
+      if (left->left->height >= left->right->height)
+        {
+          ret = branch_new (node_ref (left->left),
+                            branch_new (node_ref (left->right), right));
+        }
+      else
+        {
+          IdeRopeNode *lr = left->right;
+
+          ret = branch_new (branch_new (node_ref (left->left), node_ref (lr->left)),
+                            branch_new (node_ref (lr->right), right));
+        }
+
+      node_unref (left);
+
+      return ret;
+    }
+
+  if (right->height > left->height + 1)
+    {
+      if (right->right->height >= right->left->height)
+        {
+          ret = branch_new (branch_new (left, node_ref (right->left)),
+                            node_ref (right->right));
+        }
+      else
+        {
+          IdeRopeNode *rl = right->left;
+
+          ret = branch_new (branch_new (left, node_ref (rl->left)),
+                            branch_new (node_ref (rl->right), node_ref (right->right)));
+        }
+
+      node_unref (right);
+
+      return ret;
+    }
+
+  return branch_new (left, right);
+}
+
+/*
+ * Concatenates @left and @right, taking ownership of both. Either may be
+ * %NULL to represent empty text.
+ */
+static IdeRopeNode *
+node_join (IdeRopeNode *left,
+           IdeRopeNode *right)
+{
+  IdeRopeNode *ret;
+
+  if (left == NULL)
+    return right;
+
+  if (right == NULL)
+    return left;
+
+  if (left->n_bytes + right->n_bytes <= LEAF_SIZE)
+    {
+      gchar buf[LEAF_SIZE];
+      gchar *pos = buf;
+
+      node_foreach_chunk (left, copy_chunk_cb, &pos);
+      node_foreach_chunk (right, copy_chunk_cb, &pos);
+
+      ret = leaf_new (buf, pos - buf, left->n_chars + right->n_chars);
+
+      node_unref (left);
+      node_unref (right);
+
+      return ret;
+    }
+
+  if (left->height > right->height + 1)
+    {
+      ret = node_balance (node_ref (left->left),
+                          node_join (node_ref (left->right), right));
+      node_unref (left);
+      return ret;
+    }
+
+  if (right->height > left->height + 1)
+    {
+      ret = node_balance (node_join (left, node_ref (right->left)),
+                          node_ref (right->right));
+      node_unref (right);
+      return ret;
+    }
+
+  return branch_new (left, right);
+}
+
+/*
+ * Splits @node (which is not consumed) at the character @offset into two
+ * new references, either of which may be %NULL.
+ */
+static void
+node_split (IdeRopeNode  *node,
+            gsize         offset,
+            IdeRopeNode **left,
+            IdeRopeNode **right)
+{
+  g_assert (left != NULL);
+  g_assert (right != NULL);
+
+  if (node == NULL)
+    {
+      *left = NULL;
+      *right = NULL;
+    }
+  else if (offset == 0)
+    {
+      *left = NULL;
+      *right = node_ref (node);
+    }
+  else if (offset >= node->n_chars)
+    {
+      *left = node_ref (node);
+      *right = NULL;
+    }
+  else if (node->height == 0)
+    {
+      const gchar *split = g_utf8_offset_to_pointer (node->data, offset);
+      gsize n_bytes = split - node->data;
+
+      *left = leaf_new (node->data, n_bytes, offset);
+      *right = leaf_new (split, node->n_bytes - n_bytes, node->n_chars - offset);
+    }
+  else if (offset <= node->left->n_chars)
+    {
+      IdeRopeNode *tail;
+
+      node_split (node->left, offset, left, &tail);
+      *right = node_join (tail, node_ref (node->right));
+    }
+  else
+    {
+      IdeRopeNode *head;
+
+      node_split (node->right, offset - node->left->n_chars, &head, right);
+      *left = node_join (node_ref (node->left), head);
+    }
+}
+
+static IdeRope *
+ide_rope_new_for_node (IdeRopeNode *root)
+{
+  IdeRope *self;
+
+  self = g_slice_new0 (IdeRope);
+  self->ref_count = 1;
+  self->root = root;
+
+  return self;
+}
+
+/**
+ * ide_rope_new:
+ * @text: (nullable): UTF-8 encoded text
+ * @len: the length of @text in bytes, or -1 if it is %NULL terminated
+ *
+ * Creates a new rope containing a copy of @text.
+ *
+ * Returns: (transfer full): A new #IdeRope.
+ */
+IdeRope *
+ide_rope_new (const gchar *text,
+              gssize       len)
+{
+  g_return_val_if_fail (text != NULL || len <= 0, NULL);
+
+  if (len < 0)
+    len = strlen (text);
+
+  return ide_rope_new_for_node (len > 0 ? node_new_from_text (text, len) : NULL);
+}
+
+IdeRope *
+ide_rope_ref (IdeRope *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+ide_rope_unref (IdeRope *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->root, node_unref);
+      g_clear_pointer (&self->bytes, g_bytes_unref);
+      g_clear_pointer (&self->bytes_newline, g_bytes_unref);
+      g_slice_free (IdeRope, self);
+    }
+}
+
+/**
+ * ide_rope_get_length:
+ * @self: An #IdeRope
+ *
+ * Returns: the length of the text in bytes.
+ */
+gsize
+ide_rope_get_length (IdeRope *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->root != NULL ? self->root->n_bytes : 0;
+}
+
+/**
+ * ide_rope_get_n_chars:
+ * @self: An #IdeRope
+ *
+ * Returns: the length of the text in characters.
+ */
+gsize
+ide_rope_get_n_chars (IdeRope *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->root != NULL ? self->root->n_chars : 0;
+}
+
+/**
+ * ide_rope_insert:
+ * @self: An #IdeRope
+ * @offset: the character offset to insert at
+ * @text: UTF-8 encoded text
+ * @len: the length of @text in bytes, or -1 if it is %NULL terminated
+ *
+ * Creates a new rope with @text inserted at @offset. @self is not
+ * modified and shares all of the unchanged text with the new rope.
+ *
+ * Returns: (transfer full): A new #IdeRope.
+ */
+IdeRope *
+ide_rope_insert (IdeRope     *self,
+                 gsize        offset,
+                 const gchar *text,
+                 gssize       len)
+{
+  IdeRopeNode *left;
+  IdeRopeNode *right;
+  IdeRopeNode *middle;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (offset <= ide_rope_get_n_chars (self), NULL);
+  g_return_val_if_fail (text != NULL || len <= 0, NULL);
+
+  if (len < 0)
+    len = strlen (text);
+
+  if (len == 0)
+    return ide_rope_ref (self);
+
+  middle = node_new_from_text (text, len);
+  node_split (self->root, offset, &left, &right);
+
+  return ide_rope_new_for_node (node_join (node_join (left, middle), right));
+}
+
+/**
+ * ide_rope_delete:
+ * @self: An #IdeRope
+ * @begin: the character offset of the first character to delete
+ * @end: the character offset after the last character to delete
+ *
+ * Creates a new rope without the characters between @begin and @end.
+ * @self is not modified and shares all of the unchanged text with the
+ * new rope.
+ *
+ * Returns: (transfer full): A new #IdeRope.
+ */
+IdeRope *
+ide_rope_delete (IdeRope *self,
+                 gsize    begin,
+                 gsize    end)
+{
+  IdeRopeNode *left;
+  IdeRopeNode *middle;
+  IdeRopeNode *right;
+  IdeRopeNode *tail;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (begin <= end, NULL);
+  g_return_val_if_fail (end <= ide_rope_get_n_chars (self), NULL);
+
+  if (begin == end)
+    return ide_rope_ref (self);
+
+  node_split (self->root, begin, &left, &tail);
+  node_split (tail, end - begin, &middle, &right);
+
+  g_clear_pointer (&tail, node_unref);
+  g_clear_pointer (&middle, node_unref);
+
+  return ide_rope_new_for_node (node_join (left, right));
+}
+
+/**
+ * ide_rope_foreach_chunk:
+ * @self: An #IdeRope
+ * @func: (scope call): a function to call for each chunk of text
+ * @user_data: closure data for @func
+ *
+ * Calls @func for each chunk of text in @self, in order, until @func
+ * returns %TRUE. This allows consumers that can process text in pieces
+ * to avoid flattening the rope.
+ */
+void
+ide_rope_foreach_chunk (IdeRope          *self,
+                        IdeRopeChunkFunc  func,
+                        gpointer          user_data)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  if (self->root != NULL)
+    node_foreach_chunk (self->root, func, user_data);
+}
+
+/**
+ * ide_rope_flatten_into:
+ * @self: An #IdeRope
+ * @dest: a buffer of at least ide_rope_get_length() bytes
+ *
+ * Copies the text of @self into @dest. No trailing \0 is written.
+ */
+void
+ide_rope_flatten_into (IdeRope *self,
+                       gchar   *dest)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (dest != NULL || ide_rope_get_length (self) == 0);
+
+  if (self->root != NULL)
+    node_foreach_chunk (self->root, copy_chunk_cb, &dest);
+}
+
+/**
+ * ide_rope_flatten:
+ * @self: An #IdeRope
+ *
+ * Gets the text of @self as contiguous memory. The text is only copied
+ * the first time this is called for a given rope.
+ *
+ * The data is followed by a \0 which is not included in the length of
+ * the #GBytes so that it may be used as a C string.
+ *
+ * Returns: (transfer full): A #GBytes containing the text.
+ */
+GBytes *
+ide_rope_flatten (IdeRope *self)
+{
+  return ide_rope_flatten_full (self, FALSE);
+}
+
+/**
+ * ide_rope_flatten_full:
+ * @self: An #IdeRope
+ * @trailing_newline: if a \n should be appended to the text
+ *
+ * Like ide_rope_flatten(), but optionally appends a newline, such as the
+ * implicit trailing newline of a #GtkSourceBuffer. Both variants are cached
+ * separately, so every holder of the same rope shares a single copy.
+ *
+ * Returns: (transfer full): A #GBytes containing the text.
+ */
+GBytes *
+ide_rope_flatten_full (IdeRope  *self,
+                       gboolean  trailing_newline)
+{
+  GBytes **slot;
+  GBytes *bytes;
+  gchar *text;
+  gsize len;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  slot = trailing_newline ? &self->bytes_newline : &self->bytes;
+
+  if ((bytes = g_atomic_pointer_get (slot)))
+    return g_bytes_ref (bytes);
+
+  len = ide_rope_get_length (self);
+  text = g_malloc (len + 2);
+  ide_rope_flatten_into (self, text);
+  if (trailing_newline)
+    text[len++] = '\n';
+  text[len] = '\0';
+
+  bytes = g_bytes_new_take (text, len);
+
+  /* Another thread may have beaten us to it, in which case use theirs */
+  if (!g_atomic_pointer_compare_and_exchange (slot, NULL, bytes))
+    {
+      g_bytes_unref (bytes);
+      bytes = g_atomic_pointer_get (slot);
+    }
+
+  return g_bytes_ref (bytes);
+}
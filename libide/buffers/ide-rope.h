@@ -0,0 +1,69 @@
+/* ide-rope.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_ROPE_H
+#define IDE_ROPE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define IDE_TYPE_ROPE (ide_rope_get_type())
+
+typedef struct _IdeRope IdeRope;
+
+/**
+ * IdeRopeChunkFunc:
+ * @data: the chunk of UTF-8 text, which is not %NULL terminated
+ * @len: the length of @data in bytes
+ * @user_data: closure data provided to ide_rope_foreach_chunk()
+ *
+ * Returns: %TRUE to stop iterating, otherwise %FALSE.
+ */
+typedef gboolean (*IdeRopeChunkFunc) (const gchar *data,
+                                      gsize        len,
+                                      gpointer     user_data);
+
+GType     ide_rope_get_type      (void);
+IdeRope  *ide_rope_new           (const gchar      *text,
+                                  gssize            len);
+IdeRope  *ide_rope_ref           (IdeRope          *self);
+void      ide_rope_unref         (IdeRope          *self);
+gsize     ide_rope_get_length    (IdeRope          *self);
+gsize     ide_rope_get_n_chars   (IdeRope          *self);
+IdeRope  *ide_rope_insert        (IdeRope          *self,
+                                  gsize             offset,
+                                  const gchar      *text,
+                                  gssize            len);
+IdeRope  *ide_rope_delete        (IdeRope          *self,
+                                  gsize             begin,
+                                  gsize             end);
+void      ide_rope_foreach_chunk (IdeRope          *self,
+                                  IdeRopeChunkFunc  func,
+                                  gpointer          user_data);
+void      ide_rope_flatten_into  (IdeRope          *self,
+                                  gchar            *dest);
+GBytes   *ide_rope_flatten       (IdeRope          *self);
+GBytes   *ide_rope_flatten_full  (IdeRope          *self,
+                                  gboolean          trailing_newline);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeRope, ide_rope_unref)
+
+G_END_DECLS
+
+#endif /* IDE_ROPE_H */
@@ -20,6 +20,7 @@
 
 #include "ide-debug.h"
 
+#include "buffers/ide-rope.h"
 #include "buffers/ide-unsaved-file.h"
 
 G_DEFINE_BOXED_TYPE (IdeUnsavedFile, ide_unsaved_file,
@@ -28,10 +29,13 @@ G_DEFINE_BOXED_TYPE (IdeUnsavedFile, ide_unsaved_file,
 struct _IdeUnsavedFile
 {
   volatile gint  ref_count;
+  /* Flattened from rope on first use when created from a rope */
   GBytes        *content;
+  IdeRope       *rope;
   GFile         *file;
   gchar         *temp_path;
   gint64         sequence;
+  guint          trailing_newline : 1;
 };
 
 IdeUnsavedFile *
@@ -55,6 +59,33 @@ _ide_unsaved_file_new (GFile       *file,
   return ret;
 }
 
+/*
+ * Creates an unsaved file whose content is only flattened from @rope
+ * when somebody asks for it, which is often a worker thread.
+ */
+IdeUnsavedFile *
+_ide_unsaved_file_new_for_rope (GFile       *file,
+                                IdeRope     *rope,
+                                gboolean     trailing_newline,
+                                const gchar *temp_path,
+                                gint64       sequence)
+{
+  IdeUnsavedFile *ret;
+
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+  g_return_val_if_fail (rope != NULL, NULL);
+
+  ret = g_slice_new0 (IdeUnsavedFile);
+  ret->ref_count = 1;
+  ret->file = g_object_ref (file);
+  ret->rope = ide_rope_ref (rope);
+  ret->trailing_newline = !!trailing_newline;
+  ret->sequence = sequence;
+  ret->temp_path = g_strdup (temp_path);
+
+  return ret;
+}
+
 const gchar *
 ide_unsaved_file_get_temp_path (IdeUnsavedFile *self)
 {
@@ -69,6 +100,7 @@ ide_unsaved_file_persist (IdeUnsavedFile  *self,
                           GError         **error)
 {
   g_autoptr(GFile) file = NULL;
+  GBytes *content;
   gboolean ret;
 
   IDE_ENTRY;
@@ -78,10 +110,11 @@ ide_unsaved_file_persist (IdeUnsavedFile  *self,
 
   IDE_TRACE_MSG ("Saving draft to \"%s\"", self->temp_path);
 
+  content = ide_unsaved_file_get_content (self);
   file = g_file_new_for_path (self->temp_path);
   ret = g_file_replace_contents (file,
-                                 g_bytes_get_data (self->content, NULL),
-                                 g_bytes_get_size (self->content),
+                                 g_bytes_get_data (content, NULL),
+                                 g_bytes_get_size (content),
                                  NULL,
                                  FALSE,
                                  G_FILE_CREATE_REPLACE_DESTINATION,
@@ -121,6 +154,7 @@ ide_unsaved_file_unref (IdeUnsavedFile *self)
     {
       g_clear_pointer (&self->temp_path, g_free);
       g_clear_pointer (&self->content, g_bytes_unref);
+      g_clear_pointer (&self->rope, ide_rope_unref);
       g_clear_object (&self->file);
       g_slice_free (IdeUnsavedFile, self);
     }
@@ -137,9 +171,20 @@ ide_unsaved_file_unref (IdeUnsavedFile *self)
 GBytes *
 ide_unsaved_file_get_content (IdeUnsavedFile *self)
 {
+  GBytes *content;
+
   g_return_val_if_fail (self, NULL);
 
-  return self->content;
+  if ((content = g_atomic_pointer_get (&self->content)))
+    return content;
+
+  /* The rope caches the flattened text, so racing threads share it */
+  content = ide_rope_flatten_full (self->rope, self->trailing_newline);
+
+  if (!g_atomic_pointer_compare_and_exchange (&self->content, NULL, content))
+    g_bytes_unref (content);
+
+  return g_atomic_pointer_get (&self->content);
 }
 
 /**
@@ -33,26 +33,113 @@
 #include "buffers/ide-unsaved-files.h"
 #include "projects/ide-project.h"
 
+/*
+ * Drafts are stored in an append-only journal within the drafts directory.
+ * Each save appends a record for every file that changed since the previous
+ * save (or was removed), and the journal is rewritten from scratch on the
+ * first save of a session and whenever it has grown too large compared to
+ * the drafts it contains. A record that was only partially written when we
+ * crashed fails its checksum and ends the replay.
+ *
+ * A change is usually recorded as a delta against the previous record of
+ * the file, replacing a single range of bytes. Every few deltas, or when a
+ * delta would not be much smaller, the whole content is written instead so
+ * that replaying never has to walk a long chain.
+ */
+#define JOURNAL_NAME                "journal"
+#define JOURNAL_MAGIC               0x4A524E4C /* "JRNL" */
+#define JOURNAL_RECORD_UPDATE       'u'
+#define JOURNAL_RECORD_DELTA        'd'
+#define JOURNAL_RECORD_REMOVE       'r'
+#define JOURNAL_COMPACT_SIZE        (4 * 1024 * 1024)
+#define JOURNAL_CHECKPOINT_INTERVAL 32
+#define AUTOSAVE_INTERVAL_SECONDS   5
+
+typedef struct
+{
+  guint32 magic;
+  guint8  kind;
+  guint8  padding[3];
+  guint32 uri_len;
+  guint32 checksum;
+  gint64  sequence;
+  guint64 content_len;
+} JournalRecord;
+
+G_STATIC_ASSERT (sizeof (JournalRecord) == 32);
+
+/* The content of a delta record, followed by the inserted bytes */
+typedef struct
+{
+  guint64 offset;
+  guint64 n_deleted;
+} JournalDelta;
+
+G_STATIC_ASSERT (sizeof (JournalDelta) == 16);
+
+typedef struct
+{
+  gint64  sequence;
+  /* NULL if the file was removed */
+  GBytes *content;
+} JournalEntry;
+
 typedef struct
 {
   gint64           sequence;
   GFile           *file;
+  /* Flattened from rope on demand when the buffer handed us a rope */
   GBytes          *content;
+  IdeRope         *rope;
   gchar           *temp_path;
   gint             temp_fd;
   IdeUnsavedFiles *backptr;
+  /* Public wrapper for the current content, created on demand */
+  IdeUnsavedFile  *snapshot;
+  /* Content of the last journal record, which deltas are made against */
+  GBytes          *journal_content;
+  guint            journal_deltas;
+  guint            trailing_newline : 1;
 } UnsavedFile;
 
 typedef struct
 {
-  GPtrArray *unsaved_files;
-  gint64     sequence;
+  /* GFile -> UnsavedFile */
+  GHashTable *unsaved_files;
+
+  /*
+   * Immutable array of IdeUnsavedFile shared with consumers until the
+   * next change, see ide_unsaved_files_get_snapshot().
+   */
+  GPtrArray  *snapshot;
+
+  /* Set of GFile removed since the journal was last written */
+  GHashTable *removed;
+
+  /*
+   * Saves are run one at a time so that records are appended to the
+   * journal in sequence order. Requests made meanwhile wait here.
+   */
+  GQueue      save_queue;
+
+  gint64      sequence;
+  gint64      journal_sequence;
+  gsize       journal_size;
+
+  guint       autosave_source;
+
+  guint       saving : 1;
+  guint       journal_valid : 1;
 } IdeUnsavedFilesPrivate;
 
 typedef struct
 {
   GPtrArray *unsaved_files;
+  GPtrArray *removed;
   gchar     *drafts_directory;
+  gint64     sequence;
+  gsize      journal_size;
+  guint      compact : 1;
 } AsyncState;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IdeUnsavedFiles, ide_unsaved_files, IDE_TYPE_OBJECT)
@@ -82,10 +169,20 @@ async_state_free (gpointer data)
     {
       g_free (state->drafts_directory);
       g_ptr_array_unref (state->unsaved_files);
+      g_ptr_array_unref (state->removed);
       g_slice_free (AsyncState, state);
     }
 }
 
+static void
+journal_entry_free (gpointer data)
+{
+  JournalEntry *entry = data;
+
+  g_clear_pointer (&entry->content, g_bytes_unref);
+  g_slice_free (JournalEntry, entry);
+}
+
 static void
 unsaved_file_free (gpointer data)
 {
@@ -95,6 +192,9 @@ unsaved_file_free (gpointer data)
     {
       g_clear_object (&uf->file);
       g_clear_pointer (&uf->content, g_bytes_unref);
+      g_clear_pointer (&uf->rope, ide_rope_unref);
+      g_clear_pointer (&uf->snapshot, ide_unsaved_file_unref);
+      g_clear_pointer (&uf->journal_content, g_bytes_unref);
 
       if (uf->temp_path != NULL)
         {
@@ -119,27 +219,317 @@ unsaved_file_copy (const UnsavedFile *uf)
 
   copy = g_slice_new0 (UnsavedFile);
   copy->file = g_object_ref (uf->file);
-  copy->content = g_bytes_ref (uf->content);
+  if (uf->content != NULL)
+    copy->content = g_bytes_ref (uf->content);
+  if (uf->rope != NULL)
+    copy->rope = ide_rope_ref (uf->rope);
+  copy->trailing_newline = uf->trailing_newline;
+  copy->sequence = uf->sequence;
+  copy->temp_fd = -1;
+
+  if (uf->journal_content != NULL)
+    copy->journal_content = g_bytes_ref (uf->journal_content);
+  copy->journal_deltas = uf->journal_deltas;
 
   return copy;
 }
 
+/*
+ * Gets the content of @uf, flattening the rope if necessary. Copies made
+ * for the save worker flatten in that thread, and since the rope caches
+ * the result every holder of the same rope shares one copy of the text.
+ */
+static GBytes *
+unsaved_file_get_content (UnsavedFile *uf)
+{
+  g_assert (uf != NULL);
+  g_assert (uf->content != NULL || uf->rope != NULL);
+
+  if (uf->content == NULL)
+    uf->content = ide_rope_flatten_full (uf->rope, uf->trailing_newline);
+
+  return uf->content;
+}
+
+static gsize
+unsaved_file_get_size (const UnsavedFile *uf)
+{
+  g_assert (uf != NULL);
+
+  if (uf->content != NULL)
+    return g_bytes_get_size (uf->content);
+
+  return ide_rope_get_length (uf->rope) + (uf->trailing_newline ? 1 : 0);
+}
+
+static IdeUnsavedFile *
+unsaved_file_get_snapshot (UnsavedFile *uf)
+{
+  g_assert (uf != NULL);
+
+  if (uf->snapshot == NULL)
+    {
+      if (uf->content != NULL)
+        uf->snapshot = _ide_unsaved_file_new (uf->file, uf->content, uf->temp_path, uf->sequence);
+      else
+        uf->snapshot = _ide_unsaved_file_new_for_rope (uf->file,
+                                                       uf->rope,
+                                                       uf->trailing_newline,
+                                                       uf->temp_path,
+                                                       uf->sequence);
+    }
+
+  return uf->snapshot;
+}
+
+static guint32
+journal_checksum (guint32       hash,
+                  const guint8 *data,
+                  gsize         len)
+{
+  /* FNV-1a, we only need to notice torn writes */
+  for (gsize i = 0; i < len; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619;
+    }
+
+  return hash;
+}
+
 static gboolean
-unsaved_file_save (UnsavedFile  *uf,
-                   const gchar  *path,
-                   GError      **error)
+journal_write_record (GOutputStream  *stream,
+                      guint8          kind,
+                      gint64          sequence,
+                      const gchar    *uri,
+                      GBytes         *content,
+                      gsize          *written,
+                      GCancellable   *cancellable,
+                      GError        **error)
 {
-  gboolean ret;
+  JournalRecord record = { 0 };
+  const guint8 *data = NULL;
+  gsize uri_len;
+  gsize len = 0;
+  guint32 checksum;
 
-  g_assert (uf);
-  g_assert (uf->content);
-  g_assert (path);
+  g_assert (G_IS_OUTPUT_STREAM (stream));
+  g_assert (uri != NULL);
+  g_assert (written != NULL);
 
-  ret = g_file_set_contents (path,
-                             g_bytes_get_data (uf->content, NULL),
-                             g_bytes_get_size (uf->content),
-                             error);
-  return ret;
+  if (content != NULL)
+    data = g_bytes_get_data (content, &len);
+
+  uri_len = strlen (uri);
+
+  checksum = journal_checksum (2166136261U, (const guint8 *)uri, uri_len);
+  checksum = journal_checksum (checksum, data, len);
+
+  record.magic = GUINT32_TO_LE (JOURNAL_MAGIC);
+  record.kind = kind;
+  record.uri_len = GUINT32_TO_LE (uri_len);
+  record.checksum = GUINT32_TO_LE (checksum);
+  record.sequence = GINT64_TO_LE (sequence);
+  record.content_len = GUINT64_TO_LE (len);
+
+  if (!g_output_stream_write_all (stream, &record, sizeof record, NULL, cancellable, error) ||
+      !g_output_stream_write_all (stream, uri, uri_len, NULL, cancellable, error) ||
+      (len > 0 && !g_output_stream_write_all (stream, data, len, NULL, cancellable, error)))
+    return FALSE;
+
+  *written += sizeof record + uri_len + len;
+
+  return TRUE;
+}
+
+/*
+ * Creates the content of a delta record turning @old_content into
+ * @new_content, by replacing the range between their common prefix and
+ * common suffix.
+ */
+static GBytes *
+journal_delta_new (GBytes *old_content,
+                   GBytes *new_content)
+{
+  JournalDelta delta;
+  const guint8 *old_data;
+  const guint8 *new_data;
+  guint8 *data;
+  gsize old_len;
+  gsize new_len;
+  gsize prefix = 0;
+  gsize suffix = 0;
+  gsize n_inserted;
+
+  g_assert (old_content != NULL);
+  g_assert (new_content != NULL);
+
+  old_data = g_bytes_get_data (old_content, &old_len);
+  new_data = g_bytes_get_data (new_content, &new_len);
+
+  while (prefix < old_len && prefix < new_len && old_data[prefix] == new_data[prefix])
+    prefix++;
+
+  while (suffix < old_len - prefix &&
+         suffix < new_len - prefix &&
+         old_data[old_len - suffix - 1] == new_data[new_len - suffix - 1])
+    suffix++;
+
+  n_inserted = new_len - prefix - suffix;
+
+  delta.offset = GUINT64_TO_LE (prefix);
+  delta.n_deleted = GUINT64_TO_LE (old_len - prefix - suffix);
+
+  data = g_malloc (sizeof delta + n_inserted);
+  memcpy (data, &delta, sizeof delta);
+  memcpy (data + sizeof delta, new_data + prefix, n_inserted);
+
+  return g_bytes_new_take (data, sizeof delta + n_inserted);
+}
+
+/*
+ * Applies the delta record @data to @base, returning %NULL if the record
+ * does not fit.
+ */
+static GBytes *
+journal_delta_apply (GBytes       *base,
+                     const guint8 *data,
+                     gsize         len)
+{
+  JournalDelta delta;
+  const guint8 *base_data;
+  guint8 *content;
+  gsize base_len;
+  guint64 offset;
+  guint64 n_deleted;
+  gsize n_inserted;
+
+  g_assert (base != NULL);
+
+  if (len < sizeof delta)
+    return NULL;
+
+  memcpy (&delta, data, sizeof delta);
+  offset = GUINT64_FROM_LE (delta.offset);
+  n_deleted = GUINT64_FROM_LE (delta.n_deleted);
+  n_inserted = len - sizeof delta;
+
+  base_data = g_bytes_get_data (base, &base_len);
+
+  if (offset > base_len || n_deleted > base_len - offset)
+    return NULL;
+
+  content = g_malloc (base_len - n_deleted + n_inserted);
+  memcpy (content, base_data, offset);
+  memcpy (content + offset, data + sizeof delta, n_inserted);
+  memcpy (content + offset + n_inserted,
+          base_data + offset + n_deleted,
+          base_len - offset - n_deleted);
+
+  return g_bytes_new_take (content, base_len - n_deleted + n_inserted);
+}
+
+/*
+ * Replays the journal at @path, returning a hashtable of uri to
+ * JournalEntry for the last record of each file.
+ */
+static GHashTable *
+journal_replay (const gchar  *path,
+                GError      **error)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GHashTable) entries = NULL;
+  const guint8 *data;
+  gsize len;
+  gsize pos = 0;
+
+  g_assert (path != NULL);
+
+  if (!(mapped = g_mapped_file_new (path, FALSE, error)))
+    return NULL;
+
+  entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, journal_entry_free);
+
+  data = (const guint8 *)g_mapped_file_get_contents (mapped);
+  len = g_mapped_file_get_length (mapped);
+
+  while (len - pos >= sizeof (JournalRecord))
+    {
+      g_autofree gchar *key = NULL;
+      JournalRecord record;
+      JournalEntry *entry;
+      const guint8 *uri;
+      const guint8 *content;
+      gsize uri_len;
+      gsize content_len;
+      gsize avail;
+
+      memcpy (&record, data + pos, sizeof record);
+
+      if (GUINT32_FROM_LE (record.magic) != JOURNAL_MAGIC)
+        break;
+
+      uri_len = GUINT32_FROM_LE (record.uri_len);
+      content_len = GUINT64_FROM_LE (record.content_len);
+      avail = len - pos - sizeof record;
+
+      if (uri_len > avail || content_len > avail - uri_len)
+        break;
+
+      uri = data + pos + sizeof record;
+      content = uri + uri_len;
+
+      if (GUINT32_FROM_LE (record.checksum) !=
+          journal_checksum (journal_checksum (2166136261U, uri, uri_len), content, content_len))
+        break;
+
+      pos += sizeof record + uri_len + content_len;
+
+      key = g_strndup ((const gchar *)uri, uri_len);
+      entry = g_hash_table_lookup (entries, key);
+
+      /*
+       * Records are appended in sequence order, but be defensive so that a
+       * stale update can never replace newer content or resurrect a draft.
+       */
+      if (entry != NULL && GINT64_FROM_LE (record.sequence) < entry->sequence)
+        continue;
+
+      if (entry == NULL)
+        {
+          entry = g_slice_new0 (JournalEntry);
+          g_hash_table_insert (entries, g_steal_pointer (&key), entry);
+        }
+
+      entry->sequence = GINT64_FROM_LE (record.sequence);
+
+      if (record.kind == JOURNAL_RECORD_DELTA)
+        {
+          GBytes *applied = NULL;
+
+          /*
+           * Deltas are only written against the previous record of the file.
+           * If that is missing, drop the draft rather than restore garbage.
+           */
+          if (entry->content != NULL)
+            applied = journal_delta_apply (entry->content, content, content_len);
+
+          g_clear_pointer (&entry->content, g_bytes_unref);
+          entry->content = applied;
+
+          continue;
+        }
+
+      g_clear_pointer (&entry->content, g_bytes_unref);
+
+      if (record.kind == JOURNAL_RECORD_UPDATE)
+        entry->content = g_bytes_new (content, content_len);
+    }
+
+  if (pos < len)
+    g_debug ("Ignoring %"G_GSIZE_FORMAT" trailing bytes of drafts journal", len - pos);
+
+  return g_steal_pointer (&entries);
 }
 
 static gchar *
@@ -165,17 +555,55 @@ get_buffers_dir (void)
                            NULL);
 }
 
+/*
+ * Older versions stored a manifest of uris along with a file per draft,
+ * named after the hash of the uri. Those are removed once the journal has
+ * been written for the first time.
+ */
+static void
+remove_legacy_drafts (const gchar *drafts_directory)
+{
+  g_autofree gchar *manifest_path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  g_assert (drafts_directory != NULL);
+
+  manifest_path = g_build_filename (drafts_directory, "manifest", NULL);
+
+  if (!g_file_get_contents (manifest_path, &contents, NULL, NULL))
+    return;
+
+  lines = g_strsplit (contents, "\n", 0);
+
+  for (guint i = 0; lines [i]; i++)
+    {
+      g_autofree gchar *hash = NULL;
+      g_autofree gchar *path = NULL;
+
+      if (!*lines [i])
+        continue;
+
+      hash = hash_uri (lines [i]);
+      path = g_build_filename (drafts_directory, hash, NULL);
+      g_unlink (path);
+    }
+
+  g_unlink (manifest_path);
+}
+
 static void
 ide_unsaved_files_save_worker (GTask        *task,
                                gpointer      source_object,
                                gpointer      task_data,
                                GCancellable *cancellable)
 {
-  GString *manifest;
+  g_autoptr(GFileOutputStream) stream = NULL;
+  g_autoptr(GFile) journal = NULL;
+  g_autofree gchar *journal_path = NULL;
   AsyncState *state = task_data;
-  g_autofree gchar *manifest_path = NULL;
   GError *error = NULL;
-  gsize i;
+  gsize written = 0;
 
   g_assert (G_IS_TASK (task));
   g_assert (IDE_IS_UNSAVED_FILES (source_object));
@@ -191,46 +619,103 @@ ide_unsaved_files_save_worker (GTask        *task,
       return;
     }
 
-  manifest = g_string_new (NULL);
-  manifest_path = g_build_filename (state->drafts_directory,
-                                    "manifest",
-                                    NULL);
+  journal_path = g_build_filename (state->drafts_directory, JOURNAL_NAME, NULL);
+  journal = g_file_new_for_path (journal_path);
 
-  for (i = 0; i < state->unsaved_files->len; i++)
+  /* Replacing writes to a temporary file which is renamed over the old
+   * journal when closed, so compacting can never lose drafts.
+   */
+  if (state->compact)
+    stream = g_file_replace (journal,
+                             NULL,
+                             FALSE,
+                             G_FILE_CREATE_PRIVATE | G_FILE_CREATE_REPLACE_DESTINATION,
+                             cancellable,
+                             &error);
+  else
+    stream = g_file_append_to (journal, G_FILE_CREATE_PRIVATE, cancellable, &error);
+
+  if (stream == NULL)
     {
-      g_autofree gchar *path = NULL;
-      g_autofree gchar *uri = NULL;
-      g_autofree gchar *hash = NULL;
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (state->unsaved_files, i);
-
-      uri = g_file_get_uri (uf->file);
+      g_task_return_error (task, error);
+      return;
+    }
 
-      g_string_append_printf (manifest, "%s\n", uri);
+  for (guint i = 0; i < state->removed->len; i++)
+    {
+      const gchar *uri = g_ptr_array_index (state->removed, i);
+
+      if (!journal_write_record (G_OUTPUT_STREAM (stream),
+                                 JOURNAL_RECORD_REMOVE,
+                                 state->sequence,
+                                 uri,
+                                 NULL,
+                                 &written,
+                                 cancellable,
+                                 &error))
+        goto failure;
+    }
 
-      hash = hash_uri (uri);
-      path = g_build_filename (state->drafts_directory, hash, NULL);
+  for (guint i = 0; i < state->unsaved_files->len; i++)
+    {
+      UnsavedFile *uf = g_ptr_array_index (state->unsaved_files, i);
+      g_autofree gchar *uri = g_file_get_uri (uf->file);
+      g_autoptr(GBytes) delta = NULL;
+      GBytes *content = unsaved_file_get_content (uf);
+      guint8 kind = JOURNAL_RECORD_UPDATE;
 
-      if (!unsaved_file_save (uf, path, &error))
+      if (uf->journal_content != NULL && uf->journal_deltas < JOURNAL_CHECKPOINT_INTERVAL)
         {
-          g_task_return_error (task, error);
-          goto cleanup;
+          delta = journal_delta_new (uf->journal_content, content);
+
+          if (g_bytes_get_size (delta) < g_bytes_get_size (content) / 2)
+            kind = JOURNAL_RECORD_DELTA;
         }
+
+      if (!journal_write_record (G_OUTPUT_STREAM (stream),
+                                 kind,
+                                 uf->sequence,
+                                 uri,
+                                 kind == JOURNAL_RECORD_DELTA ? delta : content,
+                                 &written,
+                                 cancellable,
+                                 &error))
+        goto failure;
+
+      /* Reported back to the live file once the journal is closed */
+      g_clear_pointer (&uf->journal_content, g_bytes_unref);
+      uf->journal_content = g_bytes_ref (content);
+      uf->journal_deltas = kind == JOURNAL_RECORD_DELTA ? uf->journal_deltas + 1 : 0;
     }
 
-  if (!g_file_set_contents (manifest_path,
-                            manifest->str, manifest->len,
-                            &error))
+  if (!g_output_stream_close (G_OUTPUT_STREAM (stream), cancellable, &error))
+    goto failure;
+
+  if (state->compact)
+    remove_legacy_drafts (state->drafts_directory);
+  else
+    written += state->journal_size;
+
+  g_task_return_int (task, written);
+
+  return;
+
+failure:
+  /*
+   * Closing a replaced file renames the temporary file over the journal,
+   * even when it is only done by dispose. Close it with a cancelled
+   * cancellable instead so the partial journal is discarded and the
+   * previous one, with all of its drafts, is kept.
+   */
+  if (state->compact && !g_output_stream_is_closed (G_OUTPUT_STREAM (stream)))
     {
-      g_task_return_error (task, error);
-      goto cleanup;
-    }
+      g_autoptr(GCancellable) aborted = g_cancellable_new ();
 
-  g_task_return_boolean (task, TRUE);
+      g_cancellable_cancel (aborted);
+      g_output_stream_close (G_OUTPUT_STREAM (stream), aborted, NULL);
+    }
 
-cleanup:
-  g_string_free (manifest, TRUE);
+  g_task_return_error (task, error);
 }
 
 static AsyncState *
@@ -243,13 +728,157 @@ async_state_new (IdeUnsavedFiles *files)
 
   context = ide_object_get_context (IDE_OBJECT (files));
 
-  state = g_slice_new (AsyncState);
+  state = g_slice_new0 (AsyncState);
   state->unsaved_files = g_ptr_array_new_with_free_func (unsaved_file_free);
+  state->removed = g_ptr_array_new_with_free_func (g_free);
   state->drafts_directory = get_drafts_directory (context);
 
   return state;
 }
 
+static void ide_unsaved_files_save_begin (IdeUnsavedFiles *self,
+                                          GTask           *task);
+
+static void
+ide_unsaved_files_save_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+  IdeUnsavedFiles *self = (IdeUnsavedFiles *)object;
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  g_autoptr(GTask) task = user_data;
+  AsyncState *state;
+  GError *error = NULL;
+  gssize size;
+
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+  g_assert (G_IS_TASK (result));
+  g_assert (G_IS_TASK (task));
+
+  state = g_task_get_task_data (G_TASK (result));
+  size = g_task_propagate_int (G_TASK (result), &error);
+
+  priv->saving = FALSE;
+
+  if (error != NULL)
+    {
+      /* The journal may end with a partial record, so rewrite it next time */
+      priv->journal_valid = FALSE;
+      g_task_return_error (task, error);
+    }
+  else
+    {
+      priv->journal_valid = TRUE;
+      priv->journal_sequence = state->sequence;
+      priv->journal_size = size;
+
+      /* Later deltas are made against what we just wrote */
+      for (guint i = 0; i < state->unsaved_files->len; i++)
+        {
+          UnsavedFile *written = g_ptr_array_index (state->unsaved_files, i);
+          UnsavedFile *uf = g_hash_table_lookup (priv->unsaved_files, written->file);
+
+          if (uf != NULL)
+            {
+              g_clear_pointer (&uf->journal_content, g_bytes_unref);
+              uf->journal_content = g_bytes_ref (written->journal_content);
+              uf->journal_deltas = written->journal_deltas;
+            }
+        }
+
+      g_task_return_boolean (task, TRUE);
+    }
+
+  /* Saves with nothing to write complete immediately, so keep going */
+  while (!priv->saving && priv->save_queue.length > 0)
+    {
+      g_autoptr(GTask) next = g_queue_pop_head (&priv->save_queue);
+
+      ide_unsaved_files_save_begin (self, next);
+    }
+}
+
+static void
+ide_unsaved_files_save_begin (IdeUnsavedFiles *self,
+                              GTask           *task)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  g_autoptr(GTask) worker = NULL;
+  GHashTableIter iter;
+  AsyncState *state;
+  UnsavedFile *uf;
+  GFile *file;
+  gsize live_size = 0;
+
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+  g_assert (G_IS_TASK (task));
+  g_assert (!priv->saving);
+
+  state = async_state_new (self);
+  state->sequence = priv->sequence;
+  state->journal_size = priv->journal_size;
+
+  g_hash_table_iter_init (&iter, priv->unsaved_files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uf))
+    live_size += unsaved_file_get_size (uf);
+
+  /*
+   * Rewrite the journal if it might contain drafts from a previous
+   * session or a failed write, or once it is mostly stale records.
+   */
+  state->compact = !priv->journal_valid ||
+                   priv->journal_size > MAX (JOURNAL_COMPACT_SIZE, live_size * 2);
+
+  g_hash_table_iter_init (&iter, priv->unsaved_files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uf))
+    {
+      if (state->compact || uf->sequence > priv->journal_sequence)
+        {
+          UnsavedFile *copy = unsaved_file_copy (uf);
+
+          /* A new journal starts with the full content of every file */
+          if (state->compact)
+            g_clear_pointer (&copy->journal_content, g_bytes_unref);
+
+          g_ptr_array_add (state->unsaved_files, copy);
+        }
+    }
+
+  if (!state->compact)
+    {
+      g_hash_table_iter_init (&iter, priv->removed);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&file, NULL))
+        g_ptr_array_add (state->removed, g_file_get_uri (file));
+    }
+
+  g_hash_table_remove_all (priv->removed);
+
+  if (!state->compact && state->unsaved_files->len == 0 && state->removed->len == 0)
+    {
+      priv->journal_sequence = state->sequence;
+      async_state_free (state);
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  priv->saving = TRUE;
+
+  worker = g_task_new (self,
+                       g_task_get_cancellable (task),
+                       ide_unsaved_files_save_cb,
+                       g_object_ref (task));
+  g_task_set_source_tag (worker, ide_unsaved_files_save_begin);
+  g_task_set_task_data (worker, state, async_state_free);
+  g_task_run_in_thread (worker, ide_unsaved_files_save_worker);
+}
+
+/**
+ * ide_unsaved_files_save_async:
+ *
+ * Saves the drafts of all unsaved files so that they can be restored with
+ * ide_unsaved_files_restore_async(). Only the files that changed since the
+ * last save are written.
+ */
 void
 ide_unsaved_files_save_async (IdeUnsavedFiles     *files,
                               GCancellable        *cancellable,
@@ -258,29 +887,19 @@ ide_unsaved_files_save_async (IdeUnsavedFiles     *files,
 {
   IdeUnsavedFilesPrivate *priv;
   g_autoptr(GTask) task = NULL;
-  AsyncState *state;
-  gsize i;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (files));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   priv = ide_unsaved_files_get_instance_private (files);
 
-  state = async_state_new (files);
-
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      UnsavedFile *uf;
-      UnsavedFile *uf_copy;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-      uf_copy = unsaved_file_copy (uf);
-      g_ptr_array_add (state->unsaved_files, uf_copy);
-    }
-
   task = g_task_new (files, cancellable, callback, user_data);
-  g_task_set_task_data (task, state, async_state_free);
-  g_task_run_in_thread (task, ide_unsaved_files_save_worker);
+  g_task_set_source_tag (task, ide_unsaved_files_save_async);
+
+  if (priv->saving)
+    g_queue_push_tail (&priv->save_queue, g_steal_pointer (&task));
+  else
+    ide_unsaved_files_save_begin (files, task);
 }
 
 gboolean
@@ -294,25 +913,45 @@ ide_unsaved_files_save_finish (IdeUnsavedFiles  *files,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+static gboolean
+ide_unsaved_files_autosave_cb (gpointer data)
+{
+  IdeUnsavedFiles *self = data;
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+
+  priv->autosave_source = 0;
+
+  if (ide_object_get_context (IDE_OBJECT (self)) != NULL)
+    ide_unsaved_files_save_async (self, NULL, NULL, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
-ide_unsaved_files_restore_worker (GTask        *task,
-                                  gpointer      source_object,
-                                  gpointer      task_data,
-                                  GCancellable *cancellable)
+ide_unsaved_files_queue_autosave (IdeUnsavedFiles *self)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+
+  if (priv->autosave_source == 0 && ide_object_get_context (IDE_OBJECT (self)) != NULL)
+    priv->autosave_source = g_timeout_add_seconds (AUTOSAVE_INTERVAL_SECONDS,
+                                                   ide_unsaved_files_autosave_cb,
+                                                   self);
+}
+
+static void
+restore_legacy_drafts (AsyncState *state)
 {
-  AsyncState *state = task_data;
   g_autofree gchar *manifest_contents = NULL;
   g_autofree gchar *manifest_path = NULL;
-  gchar **lines;
+  g_auto(GStrv) lines = NULL;
   GError *error = NULL;
   gsize len;
-  gsize i;
-
-  IDE_ENTRY;
 
-  g_assert (G_IS_TASK (task));
-  g_assert (IDE_IS_UNSAVED_FILES (source_object));
-  g_assert (state);
+  g_assert (state != NULL);
 
   manifest_path = g_build_filename (state->drafts_directory,
                                     "manifest",
@@ -320,21 +959,17 @@ ide_unsaved_files_restore_worker (GTask        *task,
 
   g_debug ("Loading drafts manifest %s", manifest_path);
 
-  if (!g_file_test (manifest_path, G_FILE_TEST_IS_REGULAR))
-    {
-      g_task_return_boolean (task, TRUE);
-      return;
-    }
-
   if (!g_file_get_contents (manifest_path, &manifest_contents, &len, &error))
     {
-      g_task_return_error (task, error);
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        g_warning ("%s", error->message);
+      g_clear_error (&error);
       return;
     }
 
   lines = g_strsplit (manifest_contents, "\n", 0);
 
-  for (i = 0; lines [i]; i++)
+  for (guint i = 0; lines [i]; i++)
     {
       g_autoptr(GFile) file = NULL;
       gchar *contents = NULL;
@@ -365,13 +1000,76 @@ ide_unsaved_files_restore_worker (GTask        *task,
       unsaved = g_slice_new0 (UnsavedFile);
       unsaved->file = g_object_ref (file);
       unsaved->content = g_bytes_new_take (contents, data_len);
+      unsaved->temp_fd = -1;
 
       g_ptr_array_add (state->unsaved_files, unsaved);
     }
+}
 
-  g_strfreev (lines);
+static void
+ide_unsaved_files_restore_worker (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  AsyncState *state = task_data;
+  g_autoptr(GHashTable) entries = NULL;
+  g_autofree gchar *journal_path = NULL;
+  GHashTableIter iter;
+  JournalEntry *entry;
+  const gchar *uri;
+  GError *error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_UNSAVED_FILES (source_object));
+  g_assert (state);
+
+  journal_path = g_build_filename (state->drafts_directory, JOURNAL_NAME, NULL);
+
+  g_debug ("Replaying drafts journal %s", journal_path);
+
+  if (!(entries = journal_replay (journal_path, &error)))
+    {
+      if (!g_error_matches (error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+        {
+          g_task_return_error (task, error);
+          IDE_EXIT;
+        }
+
+      g_clear_error (&error);
+      restore_legacy_drafts (state);
+      g_task_return_boolean (task, TRUE);
+      IDE_EXIT;
+    }
+
+  g_hash_table_iter_init (&iter, entries);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&uri, (gpointer *)&entry))
+    {
+      g_autoptr(GFile) file = NULL;
+      UnsavedFile *unsaved;
+
+      if (entry->content == NULL)
+        continue;
+
+      file = g_file_new_for_uri (uri);
+      if (!g_file_query_exists (file, NULL))
+        continue;
+
+      g_debug ("Loading draft for \"%s\"", uri);
+
+      unsaved = g_slice_new0 (UnsavedFile);
+      unsaved->file = g_steal_pointer (&file);
+      unsaved->content = g_bytes_ref (entry->content);
+      unsaved->temp_fd = -1;
+
+      g_ptr_array_add (state->unsaved_files, unsaved);
+    }
 
   g_task_return_boolean (task, TRUE);
+
+  IDE_EXIT;
 }
 
 void
@@ -418,78 +1116,21 @@ ide_unsaved_files_restore_finish (IdeUnsavedFiles  *files,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
-static void
-ide_unsaved_files_move_to_front (IdeUnsavedFiles *self,
-                                 guint            index)
-{
-  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  UnsavedFile *new_front;
-  UnsavedFile *old_front;
-
-  g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
-
-  new_front = g_ptr_array_index (priv->unsaved_files, index);
-  old_front = g_ptr_array_index (priv->unsaved_files, 0);
-
-  /*
-   * TODO: We could shift all these items down, but it probably isnt' worth
-   *       the effort. We will just move-to-front after a miss and ping
-   *       pong the old item back to the front.
-   */
-  priv->unsaved_files->pdata[0] = new_front;
-  priv->unsaved_files->pdata[index] = old_front;
-}
-
-static void
-ide_unsaved_files_remove_draft (IdeUnsavedFiles *self,
-                                GFile           *file)
-{
-  IdeContext *context;
-  g_autofree gchar *drafts_directory = NULL;
-  g_autofree gchar *uri = NULL;
-  g_autofree gchar *hash = NULL;
-  g_autofree gchar *path = NULL;
-
-  IDE_ENTRY;
-
-  g_assert (IDE_IS_UNSAVED_FILES (self));
-  g_assert (G_IS_FILE (file));
-
-  context = ide_object_get_context (IDE_OBJECT (self));
-  drafts_directory = get_drafts_directory (context);
-  uri = g_file_get_uri (file);
-  hash = hash_uri (uri);
-  path = g_build_filename (drafts_directory, hash, NULL);
-
-  g_debug ("Removing draft for \"%s\"", uri);
-
-  g_unlink (path);
-
-  IDE_EXIT;
-}
-
 void
 ide_unsaved_files_remove (IdeUnsavedFiles *self,
                           GFile           *file)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  guint i;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
   g_return_if_fail (G_IS_FILE (file));
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  if (g_hash_table_contains (priv->unsaved_files, file))
     {
-      UnsavedFile *unsaved;
-
-      unsaved = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (file, unsaved->file))
-        {
-          ide_unsaved_files_remove_draft (self, file);
-          g_ptr_array_remove_index_fast (priv->unsaved_files, i);
-          break;
-        }
+      g_hash_table_add (priv->removed, g_object_ref (file));
+      g_hash_table_remove (priv->unsaved_files, file);
+      g_clear_pointer (&priv->snapshot, g_ptr_array_unref);
+      ide_unsaved_files_queue_autosave (self);
     }
 }
 
@@ -540,14 +1181,60 @@ setup_tempfile (GFile  *file,
     *temp_path_out = g_steal_pointer (&tmpl_path);
 }
 
+static void
+ide_unsaved_files_replace (IdeUnsavedFiles *self,
+                           GFile           *file,
+                           GBytes          *content,
+                           IdeRope         *rope,
+                           gboolean         trailing_newline)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  UnsavedFile *unsaved;
+
+  g_assert (IDE_IS_UNSAVED_FILES (self));
+  g_assert (G_IS_FILE (file));
+  g_assert (content != NULL || rope != NULL);
+
+  if ((unsaved = g_hash_table_lookup (priv->unsaved_files, file)))
+    {
+      if (rope != NULL ?
+          (rope == unsaved->rope && !!trailing_newline == unsaved->trailing_newline) :
+          (content == unsaved->content))
+        return;
+
+      g_clear_pointer (&unsaved->content, g_bytes_unref);
+      g_clear_pointer (&unsaved->rope, ide_rope_unref);
+      g_clear_pointer (&unsaved->snapshot, ide_unsaved_file_unref);
+    }
+  else
+    {
+      unsaved = g_slice_new0 (UnsavedFile);
+      unsaved->file = g_object_ref (file);
+      setup_tempfile (file, &unsaved->temp_fd, &unsaved->temp_path);
+
+      g_hash_table_insert (priv->unsaved_files, unsaved->file, unsaved);
+      g_hash_table_remove (priv->removed, file);
+    }
+
+  if (content != NULL)
+    unsaved->content = g_bytes_ref (content);
+
+  if (rope != NULL)
+    unsaved->rope = ide_rope_ref (rope);
+
+  unsaved->trailing_newline = !!trailing_newline;
+  unsaved->sequence = priv->sequence;
+
+  g_clear_pointer (&priv->snapshot, g_ptr_array_unref);
+  ide_unsaved_files_queue_autosave (self);
+}
+
 void
 ide_unsaved_files_update (IdeUnsavedFiles *self,
                           GFile           *file,
                           GBytes          *content)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  UnsavedFile *unsaved;
-  guint i;
 
   g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
   g_return_if_fail (G_IS_FILE (file));
@@ -560,39 +1247,42 @@ ide_unsaved_files_update (IdeUnsavedFiles *self,
       return;
     }
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      unsaved = g_ptr_array_index (priv->unsaved_files, i);
+  ide_unsaved_files_replace (self, file, content, NULL, FALSE);
+}
 
-      if (g_file_equal (file, unsaved->file))
-        {
-          if (content != unsaved->content)
-            {
-              g_clear_pointer (&unsaved->content, g_bytes_unref);
-              unsaved->content = g_bytes_ref (content);
-              unsaved->sequence = priv->sequence;
-            }
+/**
+ * _ide_unsaved_files_update_rope:
+ * @self: An #IdeUnsavedFiles
+ * @file: a #GFile
+ * @rope: a snapshot of the buffer contents
+ * @trailing_newline: if a newline should be appended to @rope
+ *
+ * Like ide_unsaved_files_update() but takes the rope snapshot of a buffer,
+ * which is only flattened once somebody needs the contents. This keeps the
+ * main loop from copying the whole buffer every time it is synchronized.
+ */
+void
+_ide_unsaved_files_update_rope (IdeUnsavedFiles *self,
+                                GFile           *file,
+                                IdeRope         *rope,
+                                gboolean         trailing_newline)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+  UnsavedFile *unsaved;
 
-          /*
-           * A file that get's updated is the most likely to get updated on
-           * the next attempt. Therefore, we will simply move this entry to
-           * the beginning of the array to increase its chances of being the
-           * first entry we check.
-           */
-          if (i != 0)
-            ide_unsaved_files_move_to_front (self, i);
+  g_return_if_fail (IDE_IS_UNSAVED_FILES (self));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (rope != NULL);
 
-          return;
-        }
-    }
+  /* Nothing changed since the last sync, keep the sequence as is */
+  if ((unsaved = g_hash_table_lookup (priv->unsaved_files, file)) &&
+      unsaved->rope == rope &&
+      unsaved->trailing_newline == !!trailing_newline)
+    return;
 
-  unsaved = g_slice_new0 (UnsavedFile);
-  unsaved->file = g_object_ref (file);
-  unsaved->content = g_bytes_ref (content);
-  unsaved->sequence = priv->sequence;
-  setup_tempfile (file, &unsaved->temp_fd, &unsaved->temp_path);
+  priv->sequence++;
 
-  g_ptr_array_insert (priv->unsaved_files, 0, unsaved);
+  ide_unsaved_files_replace (self, file, NULL, rope, trailing_newline);
 }
 
 /**
@@ -613,29 +1303,66 @@ ide_unsaved_files_update (IdeUnsavedFiles *self,
 GPtrArray *
 ide_unsaved_files_to_array (IdeUnsavedFiles *self)
 {
-  IdeUnsavedFilesPrivate *priv;
+  g_autoptr(GPtrArray) snapshot = NULL;
   GPtrArray *ar;
-  gsize i;
 
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), NULL);
 
-  priv = ide_unsaved_files_get_instance_private (self);
+  snapshot = ide_unsaved_files_get_snapshot (self, NULL);
 
-  ar = g_ptr_array_new ();
+  ar = g_ptr_array_sized_new (snapshot->len);
   g_ptr_array_set_free_func (ar, (GDestroyNotify)ide_unsaved_file_unref);
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  for (guint i = 0; i < snapshot->len; i++)
+    g_ptr_array_add (ar, ide_unsaved_file_ref (g_ptr_array_index (snapshot, i)));
+
+  return ar;
+}
+
+/**
+ * ide_unsaved_files_get_snapshot:
+ * @self: An #IdeUnsavedFiles
+ * @sequence: (out) (optional): a location for the sequence number of
+ *   the snapshot
+ *
+ * Gets an immutable array of the unsaved files. The same array is shared
+ * by all callers until one of the unsaved files changes, so this is cheap
+ * to call for every parse and the result may be handed to worker threads.
+ *
+ * The resulting array must not be modified. Use
+ * ide_unsaved_files_to_array() if you need a private copy.
+ *
+ * @sequence is set to the value ide_unsaved_files_get_sequence() had at
+ * the time of the call, which may be used to version the result.
+ *
+ * Returns: (transfer full) (element-type Ide.UnsavedFile): A #GPtrArray
+ *   containing #IdeUnsavedFile elements.
+ */
+GPtrArray *
+ide_unsaved_files_get_snapshot (IdeUnsavedFiles *self,
+                                gint64          *sequence)
+{
+  IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
+
+  g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), NULL);
+
+  if (priv->snapshot == NULL)
     {
-      IdeUnsavedFile *item;
+      GHashTableIter iter;
       UnsavedFile *uf;
 
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-      item = _ide_unsaved_file_new (uf->file, uf->content, uf->temp_path, uf->sequence);
+      priv->snapshot = g_ptr_array_sized_new (g_hash_table_size (priv->unsaved_files));
+      g_ptr_array_set_free_func (priv->snapshot, (GDestroyNotify)ide_unsaved_file_unref);
 
-      g_ptr_array_add (ar, item);
+      g_hash_table_iter_init (&iter, priv->unsaved_files);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&uf))
+        g_ptr_array_add (priv->snapshot, ide_unsaved_file_ref (unsaved_file_get_snapshot (uf)));
     }
 
-  return ar;
+  if (sequence != NULL)
+    *sequence = priv->sequence;
+
+  return g_ptr_array_ref (priv->snapshot);
 }
 
 gboolean
@@ -643,22 +1370,11 @@ ide_unsaved_files_contains (IdeUnsavedFiles *self,
                             GFile           *file)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  guint i;
 
   g_return_val_if_fail (IDE_IS_UNSAVED_FILES (self), FALSE);
   g_return_val_if_fail (G_IS_FILE (file), FALSE);
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
-    {
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (uf->file, file))
-        return TRUE;
-    }
-
-  return FALSE;
+  return g_hash_table_contains (priv->unsaved_files, file);
 }
 
 /**
@@ -674,8 +1390,7 @@ ide_unsaved_files_get_unsaved_file (IdeUnsavedFiles *self,
                                     GFile           *file)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
-  IdeUnsavedFile *ret = NULL;
-  gsize i;
+  UnsavedFile *uf;
 
   IDE_ENTRY;
 
@@ -691,24 +1406,15 @@ ide_unsaved_files_get_unsaved_file (IdeUnsavedFiles *self,
   }
 #endif
 
-  for (i = 0; i < priv->unsaved_files->len; i++)
+  if ((uf = g_hash_table_lookup (priv->unsaved_files, file)))
     {
-      UnsavedFile *uf;
-
-      uf = g_ptr_array_index (priv->unsaved_files, i);
-
-      if (g_file_equal (uf->file, file))
-        {
-          IDE_TRACE_MSG ("Hit");
-          ret = _ide_unsaved_file_new (uf->file, uf->content, uf->temp_path, uf->sequence);
-          goto complete;
-        }
+      IDE_TRACE_MSG ("Hit");
+      IDE_RETURN (ide_unsaved_file_ref (unsaved_file_get_snapshot (uf)));
     }
 
   IDE_TRACE_MSG ("Miss");
 
-complete:
-  IDE_RETURN (ret);
+  IDE_RETURN (NULL);
 }
 
 gint64
@@ -755,7 +1461,17 @@ ide_unsaved_files_finalize (GObject *object)
   IdeUnsavedFiles *self = (IdeUnsavedFiles *)object;
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
 
-  g_clear_pointer (&priv->unsaved_files, g_ptr_array_unref);
+  if (priv->autosave_source != 0)
+    {
+      g_source_remove (priv->autosave_source);
+      priv->autosave_source = 0;
+    }
+
+  g_assert (priv->save_queue.length == 0);
+
+  g_clear_pointer (&priv->snapshot, g_ptr_array_unref);
+  g_clear_pointer (&priv->unsaved_files, g_hash_table_unref);
+  g_clear_pointer (&priv->removed, g_hash_table_unref);
 
   G_OBJECT_CLASS (ide_unsaved_files_parent_class)->finalize (object);
 }
@@ -776,7 +1492,15 @@ ide_unsaved_files_init (IdeUnsavedFiles *self)
 {
   IdeUnsavedFilesPrivate *priv = ide_unsaved_files_get_instance_private (self);
 
-  priv->unsaved_files = g_ptr_array_new_with_free_func (unsaved_file_free);
+  priv->unsaved_files = g_hash_table_new_full ((GHashFunc)g_file_hash,
+                                               (GEqualFunc)g_file_equal,
+                                               NULL,
+                                               unsaved_file_free);
+  priv->removed = g_hash_table_new_full ((GHashFunc)g_file_hash,
+                                         (GEqualFunc)g_file_equal,
+                                         g_object_unref,
+                                         NULL);
+  g_queue_init (&priv->save_queue);
 }
 
 void
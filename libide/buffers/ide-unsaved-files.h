@@ -52,6 +52,8 @@ gboolean        ide_unsaved_files_restore_finish    (IdeUnsavedFiles      *files
                                                      GAsyncResult         *result,
                                                      GError              **error);
 GPtrArray      *ide_unsaved_files_to_array          (IdeUnsavedFiles      *files);
+GPtrArray      *ide_unsaved_files_get_snapshot      (IdeUnsavedFiles      *self,
+                                                     gint64               *sequence);
 gint64          ide_unsaved_files_get_sequence      (IdeUnsavedFiles      *files);
 IdeUnsavedFile *ide_unsaved_files_get_unsaved_file  (IdeUnsavedFiles      *self,
                                                      GFile                *file);
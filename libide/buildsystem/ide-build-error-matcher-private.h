@@ -0,0 +1,50 @@
+/* ide-build-error-matcher-private.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_BUILD_ERROR_MATCHER_PRIVATE_H
+#define IDE_BUILD_ERROR_MATCHER_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeBuildErrorMatcher IdeBuildErrorMatcher;
+
+/*
+ * Called for each error format matching a line, in the order the formats
+ * were added. Return %TRUE to stop trying the remaining formats.
+ */
+typedef gboolean (*IdeBuildErrorMatcherFunc) (GMatchInfo *match_info,
+                                              gpointer    user_data);
+
+IdeBuildErrorMatcher *ide_build_error_matcher_new    (void);
+void                  ide_build_error_matcher_free   (IdeBuildErrorMatcher      *self);
+guint                 ide_build_error_matcher_add    (IdeBuildErrorMatcher      *self,
+                                                      const gchar               *regex,
+                                                      GRegexCompileFlags         flags,
+                                                      GError                   **error);
+gboolean              ide_build_error_matcher_remove (IdeBuildErrorMatcher      *self,
+                                                      guint                      id);
+gboolean              ide_build_error_matcher_match  (IdeBuildErrorMatcher      *self,
+                                                      const gchar               *line,
+                                                      IdeBuildErrorMatcherFunc   func,
+                                                      gpointer                   user_data);
+
+G_END_DECLS
+
+#endif /* IDE_BUILD_ERROR_MATCHER_PRIVATE_H */
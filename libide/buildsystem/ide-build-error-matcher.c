@@ -0,0 +1,572 @@
+/* ide-build-error-matcher.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-build-error-matcher"
+
+#include <string.h>
+
+#include "ide-debug.h"
+
+#include "buildsystem/ide-build-error-matcher-private.h"
+
+/*
+ * The build pipeline runs every line of build output through the error
+ * formats registered by addins. Nearly all of those lines are not errors,
+ * so we want to reject them as cheaply as possible.
+ *
+ * To do that, we extract a literal from each pattern that any match must
+ * contain (such as ": " for GCC-style messages) and check for those with
+ * strstr() first. Lines passing that test are checked against a single
+ * regex alternating all of the error formats, and only when that matches
+ * do we run the individual formats in order to extract the fields.
+ *
+ * Lines are matched from the threads reading build output while error
+ * formats are added and removed from the main thread, so the formats are
+ * protected by a reader-writer lock.
+ */
+
+#define COMBINABLE_FLAGS \
+  (G_REGEX_CASELESS | G_REGEX_MULTILINE | G_REGEX_DOTALL | \
+   G_REGEX_EXTENDED | G_REGEX_UNGREEDY | G_REGEX_OPTIMIZE | G_REGEX_DUPNAMES)
+
+typedef struct
+{
+  guint               id;
+  GRegexCompileFlags  flags;
+  gchar              *pattern;
+  gchar              *literal;
+  GRegex             *regex;
+} ErrorFormat;
+
+struct _IdeBuildErrorMatcher
+{
+  GRWLock lock;
+
+  /* Array of ErrorFormat, in the order they were added */
+  GArray *formats;
+
+  /*
+   * Literals of which at least one must be found in a line for it to
+   * match. This is NULL if we failed to find a literal for any of the
+   * formats, in which case every line must be checked.
+   */
+  GPtrArray *literals;
+
+  /* An alternation of all the formats, or NULL if that is not possible */
+  GRegex *combined;
+
+  guint seqnum;
+  guint dirty : 1;
+  guint has_uncombined : 1;
+};
+
+static void
+clear_error_format (gpointer data)
+{
+  ErrorFormat *errfmt = data;
+
+  errfmt->id = 0;
+  g_clear_pointer (&errfmt->pattern, g_free);
+  g_clear_pointer (&errfmt->literal, g_free);
+  g_clear_pointer (&errfmt->regex, g_regex_unref);
+}
+
+static gboolean
+skip_char_class (const gchar **iter)
+{
+  const gchar *p = *iter;
+
+  g_assert (iter != NULL && *iter != NULL);
+
+  /* A leading "]" (possibly after "^") is part of the class */
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+
+  while (*p != '\0')
+    {
+      if (*p == ']')
+        {
+          *iter = p + 1;
+          return TRUE;
+        }
+
+      if (*p == '\\' && p[1] != '\0')
+        {
+          p += 2;
+        }
+      else if (*p == '[' && p[1] == ':')
+        {
+          /* POSIX class such as [:alpha:] */
+          if (NULL == (p = strstr (p + 2, ":]")))
+            return FALSE;
+          p += 2;
+        }
+      else
+        p++;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Finds the longest literal that any match of @pattern must contain. We
+ * only look at the top-level of the pattern and give up as soon as we see
+ * something we do not understand, so this errs on the side of returning
+ * %NULL rather than a literal that is not actually required.
+ */
+static gchar *
+extract_literal (const gchar        *pattern,
+                 GRegexCompileFlags  flags)
+{
+  const gchar *iter = pattern;
+  gchar *best = NULL;
+  GString *run;
+  guint depth = 0;
+  gboolean caseless = !!(flags & G_REGEX_CASELESS);
+
+  g_assert (pattern != NULL);
+
+  /* Whitespace and comments are not literals in extended patterns */
+  if (flags & G_REGEX_EXTENDED)
+    return NULL;
+
+  run = g_string_new (NULL);
+
+#define END_RUN()                                               \
+  G_STMT_START {                                                \
+    if (run->len > 0 && (best == NULL || run->len > strlen (best))) \
+      {                                                         \
+        g_free (best);                                          \
+        best = g_strndup (run->str, run->len);                  \
+      }                                                         \
+    g_string_truncate (run, 0);                                 \
+  } G_STMT_END
+
+  while (*iter != '\0')
+    {
+      gchar ch = *iter++;
+
+      switch (ch)
+        {
+        case '\\':
+          if (*iter == '\0')
+            goto failure;
+
+          if (g_ascii_isalnum (*iter) || (guchar)*iter >= 0x80)
+            {
+              /* Character types, assertions and simple escapes only */
+              if (strchr ("dDwWsSbBAzZGhHvVRKEntrfea", *iter) == NULL)
+                goto failure;
+              END_RUN ();
+              iter++;
+              continue;
+            }
+
+          ch = *iter++;
+          break;
+
+        case '[':
+          END_RUN ();
+          if (!skip_char_class (&iter))
+            goto failure;
+          continue;
+
+        case '(':
+          END_RUN ();
+
+          /* Inline options would change how the rest of the pattern matches */
+          if (*iter == '?' && strchr ("imsxXUJ-", iter[1]) != NULL)
+            goto failure;
+
+          depth++;
+          continue;
+
+        case ')':
+          END_RUN ();
+          if (depth == 0)
+            goto failure;
+          depth--;
+          continue;
+
+        case '|':
+          /* Alternation at the top-level means nothing is required */
+          if (depth == 0)
+            goto failure;
+          continue;
+
+        case '{':
+          /* Skip the bounds of {n,m} so they are not taken as literals */
+          if (g_ascii_isdigit (*iter) || *iter == ',')
+            {
+              const gchar *end = strchr (iter, '}');
+
+              if (end == NULL)
+                goto failure;
+              iter = end + 1;
+            }
+          /* fallthrough */
+
+        case '?':
+        case '*':
+        case '+':
+          /* The quantified character may not be there at all */
+          if (run->len > 0)
+            g_string_truncate (run, run->len - 1);
+          END_RUN ();
+          continue;
+
+        case '.':
+        case '^':
+        case '$':
+          END_RUN ();
+          continue;
+
+        default:
+          break;
+        }
+
+      if (depth > 0)
+        continue;
+
+      if ((guchar)ch >= 0x80 || (caseless && g_ascii_isalpha (ch)))
+        {
+          END_RUN ();
+          continue;
+        }
+
+      g_string_append_c (run, ch);
+    }
+
+  if (depth != 0)
+    goto failure;
+
+  END_RUN ();
+
+#undef END_RUN
+
+  g_string_free (run, TRUE);
+
+  return best;
+
+failure:
+  g_string_free (run, TRUE);
+  g_free (best);
+
+  return NULL;
+}
+
+/*
+ * Patterns can be wrapped in a group of the combined regex as long as their
+ * compile flags can be expressed inline and nothing in them refers to a
+ * group by number, as the numbers change once combined.
+ */
+static gboolean
+can_combine (const ErrorFormat *errfmt)
+{
+  g_assert (errfmt != NULL);
+
+  if ((errfmt->flags & ~COMBINABLE_FLAGS) != 0)
+    return FALSE;
+
+  for (const gchar *p = errfmt->pattern; *p != '\0'; p++)
+    {
+      if (p[0] == '\\' && p[1] != '\0')
+        {
+          if ((p[1] >= '1' && p[1] <= '9') || p[1] == 'g' || p[1] == 'k')
+            return FALSE;
+          p++;
+        }
+      else if (p[0] == '(' && p[1] == '?' && p[2] != '\0')
+        {
+          if (strchr ("R&(+-0123456789", p[2]) != NULL ||
+              (p[2] == 'P' && (p[3] == '=' || p[3] == '>')))
+            return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static gboolean
+has_literal (GPtrArray   *literals,
+             const gchar *literal)
+{
+  for (guint i = 0; i < literals->len; i++)
+    {
+      if (g_str_equal (literal, g_ptr_array_index (literals, i)))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+ide_build_error_matcher_compile (IdeBuildErrorMatcher *self)
+{
+  g_autoptr(GError) error = NULL;
+  GString *str;
+  guint n_combined = 0;
+
+  g_assert (self != NULL);
+  g_assert (self->dirty);
+
+  self->dirty = FALSE;
+  self->has_uncombined = FALSE;
+
+  g_clear_pointer (&self->combined, g_regex_unref);
+  g_clear_pointer (&self->literals, g_ptr_array_unref);
+
+  self->literals = g_ptr_array_new ();
+  str = g_string_new (NULL);
+
+  for (guint i = 0; i < self->formats->len; i++)
+    {
+      const ErrorFormat *errfmt = &g_array_index (self->formats, ErrorFormat, i);
+
+      if (self->literals != NULL)
+        {
+          if (errfmt->literal == NULL)
+            g_clear_pointer (&self->literals, g_ptr_array_unref);
+          else if (!has_literal (self->literals, errfmt->literal))
+            g_ptr_array_add (self->literals, errfmt->literal);
+        }
+
+      if (!can_combine (errfmt))
+        {
+          self->has_uncombined = TRUE;
+          continue;
+        }
+
+      if (n_combined++ > 0)
+        g_string_append_c (str, '|');
+
+      g_string_append (str, "(?");
+      if (errfmt->flags & G_REGEX_CASELESS)
+        g_string_append_c (str, 'i');
+      if (errfmt->flags & G_REGEX_MULTILINE)
+        g_string_append_c (str, 'm');
+      if (errfmt->flags & G_REGEX_DOTALL)
+        g_string_append_c (str, 's');
+      if (errfmt->flags & G_REGEX_EXTENDED)
+        g_string_append_c (str, 'x');
+      if (errfmt->flags & G_REGEX_UNGREEDY)
+        g_string_append_c (str, 'U');
+      g_string_append_c (str, ':');
+      g_string_append (str, errfmt->pattern);
+
+      /* A trailing comment in an extended pattern would swallow the ")" */
+      if (errfmt->flags & G_REGEX_EXTENDED)
+        g_string_append_c (str, '\n');
+
+      g_string_append_c (str, ')');
+    }
+
+  /* Nothing to gain from an alternation of a single format */
+  if (n_combined > 1)
+    {
+      self->combined = g_regex_new (str->str, G_REGEX_OPTIMIZE | G_REGEX_DUPNAMES, 0, &error);
+
+      if (self->combined == NULL)
+        {
+          g_debug ("Failed to combine error formats: %s", error->message);
+          self->has_uncombined = TRUE;
+        }
+    }
+
+  IDE_TRACE_MSG ("Compiled %u error formats, %u combined, prefilter %s",
+                 self->formats->len, n_combined,
+                 self->literals != NULL ? "enabled" : "disabled");
+
+  g_string_free (str, TRUE);
+}
+
+IdeBuildErrorMatcher *
+ide_build_error_matcher_new (void)
+{
+  IdeBuildErrorMatcher *self;
+
+  self = g_slice_new0 (IdeBuildErrorMatcher);
+  g_rw_lock_init (&self->lock);
+  self->formats = g_array_new (FALSE, FALSE, sizeof (ErrorFormat));
+  g_array_set_clear_func (self->formats, clear_error_format);
+
+  return self;
+}
+
+void
+ide_build_error_matcher_free (IdeBuildErrorMatcher *self)
+{
+  if (self != NULL)
+    {
+      g_clear_pointer (&self->formats, g_array_unref);
+      g_clear_pointer (&self->literals, g_ptr_array_unref);
+      g_clear_pointer (&self->combined, g_regex_unref);
+      g_rw_lock_clear (&self->lock);
+      g_slice_free (IdeBuildErrorMatcher, self);
+    }
+}
+
+/**
+ * ide_build_error_matcher_add:
+ * @self: an #IdeBuildErrorMatcher
+ * @regex: a regex with named capture groups
+ * @flags: compile flags for @regex
+ * @error: a location for a #GError, or %NULL
+ *
+ * Adds an error format to the matcher. See
+ * ide_build_pipeline_add_error_format() for the groups @regex should
+ * provide.
+ *
+ * Returns: an identifier > 0 for the error format, or 0 and @error is set.
+ */
+guint
+ide_build_error_matcher_add (IdeBuildErrorMatcher  *self,
+                             const gchar           *regex,
+                             GRegexCompileFlags     flags,
+                             GError               **error)
+{
+  ErrorFormat errfmt = { 0 };
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (regex != NULL, 0);
+
+  errfmt.regex = g_regex_new (regex, G_REGEX_OPTIMIZE | flags, 0, error);
+
+  if (errfmt.regex == NULL)
+    return 0;
+
+  errfmt.flags = flags;
+  errfmt.pattern = g_strdup (regex);
+  errfmt.literal = extract_literal (regex, flags);
+
+  g_rw_lock_writer_lock (&self->lock);
+  errfmt.id = ++self->seqnum;
+  g_array_append_val (self->formats, errfmt);
+  self->dirty = TRUE;
+  g_rw_lock_writer_unlock (&self->lock);
+
+  IDE_TRACE_MSG ("Error format %u requires literal \"%s\"",
+                 errfmt.id, errfmt.literal ? errfmt.literal : "");
+
+  return errfmt.id;
+}
+
+gboolean
+ide_build_error_matcher_remove (IdeBuildErrorMatcher *self,
+                                guint                 id)
+{
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (id > 0, FALSE);
+
+  g_rw_lock_writer_lock (&self->lock);
+
+  for (guint i = 0; i < self->formats->len; i++)
+    {
+      const ErrorFormat *errfmt = &g_array_index (self->formats, ErrorFormat, i);
+
+      if (errfmt->id == id)
+        {
+          g_array_remove_index (self->formats, i);
+          self->dirty = TRUE;
+          ret = TRUE;
+          break;
+        }
+    }
+
+  g_rw_lock_writer_unlock (&self->lock);
+
+  return ret;
+}
+
+/**
+ * ide_build_error_matcher_match:
+ * @self: an #IdeBuildErrorMatcher
+ * @line: a line of build output, without color codes
+ * @func: (scope call): a function to call for matching formats
+ * @user_data: closure data for @func
+ *
+ * Tries the error formats against @line in the order they were added,
+ * calling @func for each one that matches until @func returns %TRUE.
+ *
+ * This may be called from any thread. @func must not add or remove
+ * error formats.
+ *
+ * Returns: %TRUE if @func returned %TRUE.
+ */
+gboolean
+ide_build_error_matcher_match (IdeBuildErrorMatcher     *self,
+                               const gchar              *line,
+                               IdeBuildErrorMatcherFunc  func,
+                               gpointer                  user_data)
+{
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (line != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  /* Compiling needs the writer lock, another thread may beat us to it */
+  while G_UNLIKELY (self->dirty)
+    {
+      g_rw_lock_reader_unlock (&self->lock);
+      g_rw_lock_writer_lock (&self->lock);
+      if (self->dirty)
+        ide_build_error_matcher_compile (self);
+      g_rw_lock_writer_unlock (&self->lock);
+      g_rw_lock_reader_lock (&self->lock);
+    }
+
+  if (self->formats->len == 0)
+    goto unlock;
+
+  if (self->literals != NULL)
+    {
+      gboolean found = FALSE;
+
+      for (guint i = 0; !found && i < self->literals->len; i++)
+        found = strstr (line, g_ptr_array_index (self->literals, i)) != NULL;
+
+      if (!found)
+        goto unlock;
+    }
+
+  if (self->combined != NULL &&
+      !self->has_uncombined &&
+      !g_regex_match (self->combined, line, 0, NULL))
+    goto unlock;
+
+  for (guint i = 0; !ret && i < self->formats->len; i++)
+    {
+      const ErrorFormat *errfmt = &g_array_index (self->formats, ErrorFormat, i);
+      g_autoptr(GMatchInfo) match_info = NULL;
+
+      if (g_regex_match (errfmt->regex, line, 0, &match_info))
+        ret = func (match_info, user_data);
+    }
+
+unlock:
+  g_rw_lock_reader_unlock (&self->lock);
+
+  return ret;
+}
@@ -24,20 +24,22 @@
 #include "buildsystem/ide-build-log.h"
 #include "buildsystem/ide-build-log-private.h"
 
-#define POINTER_MARK(p)   GSIZE_TO_POINTER(GPOINTER_TO_SIZE(p)|1)
-#define POINTER_UNMARK(p) GSIZE_TO_POINTER(GPOINTER_TO_SIZE(p)&~(gsize)1)
-#define POINTER_MARKED(p) (GPOINTER_TO_SIZE(p)&1)
-#define DISPATCH_MAX      20
-
 struct _IdeBuildLog
 {
-  GObject      parent_instance;
+  GObject     parent_instance;
+
+  GArray     *observers;
+  GSource    *log_source;
 
-  GArray      *observers;
-  GAsyncQueue *log_queue;
-  GSource     *log_source;
+  /*
+   * Messages logged from threads are appended to this arena, each as a
+   * byte for the stream followed by the \0 terminated message, and are
+   * dispatched in batches from the main thread. Protected by log_mutex.
+   */
+  GMutex      log_mutex;
+  GByteArray *log_pending;
 
-  guint        sequence;
+  guint       sequence;
 };
 
 typedef struct
@@ -54,41 +56,31 @@ static gboolean
 emit_log_from_main (gpointer user_data)
 {
   IdeBuildLog *self = user_data;
-  g_autoptr(GPtrArray) ar = g_ptr_array_new ();
-  gpointer item;
+  g_autoptr(GByteArray) pending = NULL;
+  const gchar *iter;
+  const gchar *end;
 
   g_assert (IDE_IS_BUILD_LOG (self));
 
   /*
-   * Pull up to DISPATCH_MAX items from the log queue. We have an upper
-   * bound here so that we don't stall the main loop. Additionally, we
-   * update the ready-time when we run out of items while holding the
-   * async queue lock to synchronize with the caller for further wakeups.
+   * Take everything that has been logged so far in one go. We update the
+   * ready-time while holding the lock to synchronize with the threads
+   * appending to the arena for further wakeups.
    */
-  g_async_queue_lock (self->log_queue);
-  for (guint i = 0; i < DISPATCH_MAX; i++)
-    {
-      if (NULL == (item = g_async_queue_try_pop_unlocked (self->log_queue)))
-        {
-          g_source_set_ready_time (self->log_source, -1);
-          break;
-        }
-      g_ptr_array_add (ar, item);
-    }
-  g_async_queue_unlock (self->log_queue);
-
-  for (guint i = 0; i < ar->len; i++)
-    {
-      IdeBuildLogStream stream = IDE_BUILD_LOG_STDOUT;
-      gchar *message;
-      gsize message_len;
+  g_mutex_lock (&self->log_mutex);
+  pending = self->log_pending;
+  self->log_pending = g_byte_array_new ();
+  g_source_set_ready_time (self->log_source, -1);
+  g_mutex_unlock (&self->log_mutex);
 
-      item = g_ptr_array_index (ar, i);
-      message = POINTER_UNMARK (item);
-      message_len = strlen (message);
+  iter = (const gchar *)pending->data;
+  end = iter + pending->len;
 
-      if (POINTER_MARKED (item))
-        stream = IDE_BUILD_LOG_STDERR;
+  while (iter < end)
+    {
+      IdeBuildLogStream stream = *iter++;
+      const gchar *message = iter;
+      gsize message_len = strlen (message);
 
       for (guint j = 0; j < self->observers->len; j++)
         {
@@ -97,7 +89,7 @@ emit_log_from_main (gpointer user_data)
           observer->callback (stream, message, message_len, observer->data);
         }
 
-      g_free (message);
+      iter += message_len + 1;
     }
 
   return G_SOURCE_CONTINUE;
@@ -108,8 +100,9 @@ ide_build_log_finalize (GObject *object)
 {
   IdeBuildLog *self = (IdeBuildLog *)object;
 
-  g_clear_pointer (&self->log_queue, g_async_queue_unref);
   g_clear_pointer (&self->log_source, g_source_destroy);
+  g_clear_pointer (&self->log_pending, g_byte_array_unref);
+  g_mutex_clear (&self->log_mutex);
   g_clear_pointer (&self->observers, g_array_unref);
 
   G_OBJECT_CLASS (ide_build_log_parent_class)->finalize (object);
@@ -128,7 +121,8 @@ ide_build_log_init (IdeBuildLog *self)
 {
   self->observers = g_array_new (FALSE, FALSE, sizeof (Observer));
 
-  self->log_queue = g_async_queue_new ();
+  self->log_pending = g_byte_array_new ();
+  g_mutex_init (&self->log_mutex);
 
   self->log_source = g_timeout_source_new (G_MAXINT);
   g_source_set_priority (self->log_source, G_PRIORITY_LOW);
@@ -144,24 +138,19 @@ ide_build_log_via_main (IdeBuildLog       *self,
                         const gchar       *message,
                         gsize              message_len)
 {
-  gchar *copied = g_strndup (message, message_len);
-
-  if G_UNLIKELY (stream == IDE_BUILD_LOG_STDERR)
-    copied = POINTER_MARK (copied);
+  guint8 stream_byte = stream;
 
   /*
-   * Add the log entry to our queue to be dispatched in the main thread.
-   * However, we hold the async queue lock while updating the source ready
-   * time so we are synchronized with the main thread for setting the
-   * ready time. This is needed because the main thread may not dispatch
-   * all available items in a single dispatch (to avoid stalling the
-   * main loop).
+   * Append the log entry to the arena to be dispatched in the main thread.
+   * We hold the lock while updating the source ready time so that we are
+   * synchronized with the main thread, which resets it when it takes the
+   * pending entries.
    */
-
-  g_async_queue_lock (self->log_queue);
-  g_async_queue_push_unlocked (self->log_queue, copied);
+  g_mutex_lock (&self->log_mutex);
+  g_byte_array_append (self->log_pending, &stream_byte, 1);
+  g_byte_array_append (self->log_pending, (const guint8 *)message, message_len + 1);
   g_source_set_ready_time (self->log_source, 0);
-  g_async_queue_unlock (self->log_queue);
+  g_mutex_unlock (&self->log_mutex);
 }
 
 void
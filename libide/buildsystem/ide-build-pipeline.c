@@ -29,6 +29,7 @@
 #include "ide-macros.h"
 
 #include "application/ide-application.h"
+#include "buildsystem/ide-build-error-matcher-private.h"
 #include "buildsystem/ide-build-log.h"
 #include "buildsystem/ide-build-log-private.h"
 #include "buildsystem/ide-build-pipeline.h"
@@ -96,12 +97,6 @@ typedef struct
   IdeBuildStage *stage;
 } PipelineEntry;
 
-typedef struct
-{
-  guint   id;
-  GRegex *regex;
-} ErrorFormat;
-
 struct _IdeBuildPipeline
 {
   IdeObject         parent_instance;
@@ -151,12 +146,16 @@ struct _IdeBuildPipeline
    * This are used for ErrorFormat registration so that we have a
    * single place to extract "GCC-style" warnings and errors. Other
    * languages can also register these so they show up in the build
-   * errors panel.
+   * errors panel. The matcher compiles them together so that lines
+   * which cannot be errors are rejected cheaply.
+   *
+   * Lines are matched on the threads reading the build output, so the
+   * directories tracked from make's output are protected by errfmt_mutex.
    */
-  GArray *errfmts;
-  gchar  *errfmt_current_dir;
-  gchar  *errfmt_top_dir;
-  guint   errfmt_seqnum;
+  IdeBuildErrorMatcher *errfmts;
+  GMutex                errfmt_mutex;
+  gchar                *errfmt_current_dir;
+  gchar                *errfmt_top_dir;
 
   /*
    * No reference to the current stage. It is only available during
@@ -215,6 +214,21 @@ struct _IdeBuildPipeline
   guint errors_on_stdout : 1;
 };
 
+typedef struct
+{
+  gchar                 *filename;
+  gchar                 *message;
+  gint64                 line;
+  gint64                 column;
+  IdeDiagnosticSeverity  severity;
+} ErrorMatch;
+
+typedef struct
+{
+  IdeBuildPipeline *self;
+  ErrorMatch       *match;
+} ErrorMatchState;
+
 typedef enum
 {
   TASK_BUILD   = 1,
@@ -327,15 +341,6 @@ task_data_new (GTask    *task,
   return td;
 }
 
-static void
-clear_error_format (gpointer data)
-{
-  ErrorFormat *errfmt = data;
-
-  errfmt->id = 0;
-  g_clear_pointer (&errfmt->regex, g_regex_unref);
-}
-
 static inline const gchar *
 build_phase_nick (IdeBuildPhase phase)
 {
@@ -384,8 +389,22 @@ parse_severity (const gchar *str)
   return IDE_DIAGNOSTIC_WARNING;
 }
 
-static IdeDiagnostic *
-create_diagnostic (IdeBuildPipeline *self,
+static void
+error_match_free (gpointer data)
+{
+  ErrorMatch *match = data;
+
+  g_free (match->filename);
+  g_free (match->message);
+  g_slice_free (ErrorMatch, match);
+}
+
+/*
+ * Extracts the fields of an error from @match_info. This is called from
+ * the threads reading build output, so it must not touch the context.
+ */
+static ErrorMatch *
+parse_error_match (IdeBuildPipeline *self,
                    GMatchInfo       *match_info)
 {
   g_autofree gchar *filename = NULL;
@@ -393,9 +412,7 @@ create_diagnostic (IdeBuildPipeline *self,
   g_autofree gchar *column = NULL;
   g_autofree gchar *message = NULL;
   g_autofree gchar *level = NULL;
-  g_autoptr(IdeFile) file = NULL;
-  g_autoptr(IdeSourceLocation) location = NULL;
-  IdeContext *context;
+  ErrorMatch *match;
   struct {
     gint64 line;
     gint64 column;
@@ -442,6 +459,8 @@ create_diagnostic (IdeBuildPipeline *self,
     {
       gchar *path;
 
+      g_mutex_lock (&self->errfmt_mutex);
+
       if (self->errfmt_current_dir != NULL)
         {
           const gchar *basedir = self->errfmt_current_dir;
@@ -463,9 +482,34 @@ create_diagnostic (IdeBuildPipeline *self,
           g_free (filename);
           filename = path;
         }
+
+      g_mutex_unlock (&self->errfmt_mutex);
     }
 
+  match = g_slice_new0 (ErrorMatch);
+  match->filename = g_steal_pointer (&filename);
+  match->message = g_steal_pointer (&message);
+  match->line = parsed.line;
+  match->column = parsed.column;
+  match->severity = parsed.severity;
+
+  return match;
+}
+
+static IdeDiagnostic *
+create_diagnostic (IdeBuildPipeline *self,
+                   const ErrorMatch *match)
+{
+  g_autofree gchar *filename = NULL;
+  g_autoptr(IdeFile) file = NULL;
+  g_autoptr(IdeSourceLocation) location = NULL;
+  IdeContext *context;
+
+  g_assert (IDE_IS_BUILD_PIPELINE (self));
+  g_assert (match != NULL);
+
   context = ide_object_get_context (IDE_OBJECT (self));
+  filename = g_strdup (match->filename);
 
   if (!g_path_is_absolute (filename))
     {
@@ -485,19 +529,42 @@ create_diagnostic (IdeBuildPipeline *self,
     }
 
   file = ide_file_new_for_path (context, filename);
-  location = ide_source_location_new (file, parsed.line, parsed.column, 0);
+  location = ide_source_location_new (file, match->line, match->column, 0);
 
-  return ide_diagnostic_new (parsed.severity, message, location);
+  return ide_diagnostic_new (match->severity, match->message, location);
 }
 
-static void
-ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
-                                 const gchar       *message,
-                                 gssize             message_len,
-                                 gpointer           user_data)
+static gboolean
+ide_build_pipeline_error_format_matched (GMatchInfo *match_info,
+                                         gpointer    user_data)
 {
-  IdeBuildPipeline *self = user_data;
+  ErrorMatchState *state = user_data;
+
+  g_assert (match_info != NULL);
+  g_assert (state != NULL);
+  g_assert (IDE_IS_BUILD_PIPELINE (state->self));
+
+  /* Let the next error format have a try */
+  state->match = parse_error_match (state->self, match_info);
+
+  return state->match != NULL;
+}
+
+/*
+ * Called from the threads reading build output (or the main thread for
+ * lines logged directly by a stage) to find errors in @message. Only the
+ * lines that match are handed to the main thread.
+ */
+static gpointer
+ide_build_pipeline_match_line (GObject           *instance,
+                               IdeBuildLogStream  stream,
+                               const gchar       *message,
+                               gsize              message_len)
+{
+  IdeBuildPipeline *self = (IdeBuildPipeline *)instance;
   g_autofree gchar *filtered_message = NULL;
+  ErrorMatchState state = { self, NULL };
+  const gchar *line;
   const gchar *enterdir;
 
   g_assert (stream == IDE_BUILD_LOG_STDOUT || stream == IDE_BUILD_LOG_STDERR);
@@ -507,13 +574,15 @@ ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
 #define ENTERING_DIRECTORY_BEGIN "Entering directory '"
 #define ENTERING_DIRECTORY_END   "'"
 
-  if (message_len < 0)
-    message_len = strlen (message);
-
-  if (self->log != NULL)
-    ide_build_log_observer (stream, message, message_len, self->log);
-
-  filtered_message = ide_build_utils_color_codes_filtering (message);
+  /*
+   * Most lines do not contain color codes, so avoid copying them unless
+   * there is an escape sequence to strip.
+   */
+  if (memchr (message, '\033', message_len) != NULL ||
+      memchr (message, '\\', message_len) != NULL)
+    line = filtered_message = ide_build_utils_color_codes_filtering (message);
+  else
+    line = message;
 
   if (stream == IDE_BUILD_LOG_STDOUT)
     {
@@ -522,7 +591,7 @@ ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
        * Not the most ideal decoupling of logic, but we don't have a whole
        * lot to work with here.
        */
-      if (NULL != (enterdir = strstr (filtered_message, ENTERING_DIRECTORY_BEGIN)) &&
+      if (NULL != (enterdir = strstr (line, ENTERING_DIRECTORY_BEGIN)) &&
           g_str_has_suffix (enterdir, ENTERING_DIRECTORY_END))
         {
           gssize len;
@@ -541,13 +610,15 @@ ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
 
           if (len > 0)
             {
+              g_mutex_lock (&self->errfmt_mutex);
               g_free (self->errfmt_current_dir);
               self->errfmt_current_dir = g_strndup (enterdir, len);
               if (self->errfmt_top_dir == NULL)
                 self->errfmt_top_dir = g_strndup (enterdir, len);
+              g_mutex_unlock (&self->errfmt_mutex);
             }
 
-          return;
+          return NULL;
         }
     }
 
@@ -557,29 +628,50 @@ ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
    * to stderr to extract errors.
    */
   if (stream == IDE_BUILD_LOG_STDERR || self->errors_on_stdout)
-    {
-      for (guint i = 0; i < self->errfmts->len; i++)
-        {
-          const ErrorFormat *errfmt = &g_array_index (self->errfmts, ErrorFormat, i);
-          g_autoptr(GMatchInfo) match_info = NULL;
+    ide_build_error_matcher_match (self->errfmts,
+                                   line,
+                                   ide_build_pipeline_error_format_matched,
+                                   &state);
 
-          if (g_regex_match (errfmt->regex, filtered_message, 0, &match_info))
-            {
-              g_autoptr(IdeDiagnostic) diagnostic = create_diagnostic (self, match_info);
-
-              if (diagnostic != NULL)
-                {
-                  ide_build_pipeline_emit_diagnostic (self, diagnostic);
-                  return;
-                }
-            }
-        }
-    }
+  return state.match;
 
 #undef ENTERING_DIRECTORY_BEGIN
 #undef ENTERING_DIRECTORY_END
 }
 
+static void
+ide_build_pipeline_error_matched (GObject  *instance,
+                                  gpointer  match)
+{
+  IdeBuildPipeline *self = (IdeBuildPipeline *)instance;
+  g_autoptr(IdeDiagnostic) diagnostic = NULL;
+
+  g_assert (IDE_IS_BUILD_PIPELINE (self));
+  g_assert (match != NULL);
+
+  diagnostic = create_diagnostic (self, match);
+  ide_build_pipeline_emit_diagnostic (self, diagnostic);
+}
+
+static void
+ide_build_pipeline_log_observer (IdeBuildLogStream  stream,
+                                 const gchar       *message,
+                                 gssize             message_len,
+                                 gpointer           user_data)
+{
+  IdeBuildPipeline *self = user_data;
+
+  g_assert (stream == IDE_BUILD_LOG_STDOUT || stream == IDE_BUILD_LOG_STDERR);
+  g_assert (IDE_IS_BUILD_PIPELINE (self));
+  g_assert (message != NULL);
+
+  if (message_len < 0)
+    message_len = strlen (message);
+
+  if (self->log != NULL)
+    ide_build_log_observer (stream, message, message_len, self->log);
+}
+
 static void
 ide_build_pipeline_release_transients (IdeBuildPipeline *self)
 {
@@ -650,6 +742,7 @@ clear_pipeline_entry (gpointer data)
   if (entry->stage != NULL)
     {
       ide_build_stage_set_log_observer (entry->stage, NULL, NULL, NULL);
+      _ide_build_stage_set_line_matcher (entry->stage, NULL, NULL, NULL, NULL);
       g_clear_object (&entry->stage);
     }
 }
@@ -951,9 +1044,10 @@ ide_build_pipeline_finalize (GObject *object)
   g_clear_pointer (&self->pipeline, g_array_unref);
   g_clear_pointer (&self->srcdir, g_free);
   g_clear_pointer (&self->builddir, g_free);
-  g_clear_pointer (&self->errfmts, g_array_unref);
+  g_clear_pointer (&self->errfmts, ide_build_error_matcher_free);
   g_clear_pointer (&self->errfmt_top_dir, g_free);
   g_clear_pointer (&self->errfmt_current_dir, g_free);
+  g_mutex_clear (&self->errfmt_mutex);
   g_clear_pointer (&self->chained_bindings, g_ptr_array_free);
 
   G_OBJECT_CLASS (ide_build_pipeline_parent_class)->finalize (object);
@@ -1198,8 +1292,8 @@ ide_build_pipeline_init (IdeBuildPipeline *self)
   self->pipeline = g_array_new (FALSE, FALSE, sizeof (PipelineEntry));
   g_array_set_clear_func (self->pipeline, clear_pipeline_entry);
 
-  self->errfmts = g_array_new (FALSE, FALSE, sizeof (ErrorFormat));
-  g_array_set_clear_func (self->errfmts, clear_error_format);
+  self->errfmts = ide_build_error_matcher_new ();
+  g_mutex_init (&self->errfmt_mutex);
 
   self->chained_bindings = g_ptr_array_new_with_free_func ((GDestroyNotify)chained_binding_clear);
 
@@ -1711,6 +1805,11 @@ ide_build_pipeline_connect (IdeBuildPipeline *self,
                                             ide_build_pipeline_log_observer,
                                             self,
                                             NULL);
+          _ide_build_stage_set_line_matcher (stage,
+                                             G_OBJECT (self),
+                                             ide_build_pipeline_match_line,
+                                             ide_build_pipeline_error_matched,
+                                             error_match_free);
 
           IDE_GOTO (cleanup);
         }
@@ -2165,24 +2264,17 @@ ide_build_pipeline_add_error_format (IdeBuildPipeline   *self,
                                      const gchar        *regex,
                                      GRegexCompileFlags  flags)
 {
-  ErrorFormat errfmt = { 0 };
   g_autoptr(GError) error = NULL;
+  guint id;
 
   g_return_val_if_fail (IDE_IS_BUILD_PIPELINE (self), 0);
 
-  errfmt.regex = g_regex_new (regex, G_REGEX_OPTIMIZE | flags, 0, &error);
-
-  if (errfmt.regex == NULL)
-    {
-      g_warning ("%s", error->message);
-      return 0;
-    }
-
-  errfmt.id = ++self->errfmt_seqnum;
+  id = ide_build_error_matcher_add (self->errfmts, regex, flags, &error);
 
-  g_array_append_val (self->errfmts, errfmt);
+  if (id == 0)
+    g_warning ("%s", error->message);
 
-  return errfmt.id;
+  return id;
 }
 
 /**
@@ -2202,18 +2294,7 @@ ide_build_pipeline_remove_error_format (IdeBuildPipeline *self,
   g_return_val_if_fail (IDE_IS_BUILD_PIPELINE (self), FALSE);
   g_return_val_if_fail (error_format_id > 0, FALSE);
 
-  for (guint i = 0; i < self->errfmts->len; i++)
-    {
-      const ErrorFormat *errfmt = &g_array_index (self->errfmts, ErrorFormat, i);
-
-      if (errfmt->id == error_format_id)
-        {
-          g_array_remove_index (self->errfmts, i);
-          return TRUE;
-        }
-    }
-
-  return FALSE;
+  return ide_build_error_matcher_remove (self->errfmts, error_format_id);
 }
 
 gboolean
@@ -24,15 +24,32 @@
 
 G_BEGIN_DECLS
 
-gboolean _ide_build_stage_has_query                 (IdeBuildStage        *self);
-void     _ide_build_stage_execute_with_query_async  (IdeBuildStage        *self,
-                                                     IdeBuildPipeline     *pipeline,
-                                                     GCancellable         *cancellable,
-                                                     GAsyncReadyCallback   callback,
-                                                     gpointer              user_data);
-gboolean _ide_build_stage_execute_with_query_finish (IdeBuildStage        *self,
-                                                     GAsyncResult         *result,
-                                                     GError              **error);
+/*
+ * Called for each line logged by a stage, from the thread reading the
+ * output when it comes from a subprocess. The result, if any, is handed
+ * to the IdeBuildStageMatchNotify from the main thread in log order.
+ */
+typedef gpointer (*IdeBuildStageMatchFunc)   (GObject           *instance,
+                                              IdeBuildLogStream  stream,
+                                              const gchar       *line,
+                                              gsize              line_len);
+typedef void     (*IdeBuildStageMatchNotify) (GObject           *instance,
+                                              gpointer           match);
+
+gboolean _ide_build_stage_has_query                 (IdeBuildStage             *self);
+void     _ide_build_stage_execute_with_query_async  (IdeBuildStage             *self,
+                                                     IdeBuildPipeline          *pipeline,
+                                                     GCancellable              *cancellable,
+                                                     GAsyncReadyCallback        callback,
+                                                     gpointer                   user_data);
+gboolean _ide_build_stage_execute_with_query_finish (IdeBuildStage             *self,
+                                                     GAsyncResult              *result,
+                                                     GError                   **error);
+void     _ide_build_stage_set_line_matcher          (IdeBuildStage             *self,
+                                                     GObject                   *instance,
+                                                     IdeBuildStageMatchFunc     match_func,
+                                                     IdeBuildStageMatchNotify   notify_func,
+                                                     GDestroyNotify             match_free);
 
 G_END_DECLS
 
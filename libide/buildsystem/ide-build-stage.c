@@ -18,26 +18,34 @@
 
 #define G_LOG_DOMAIN "ide-build-stage"
 
+#include <string.h>
+
 #include "ide-debug.h"
 
 #include "buildsystem/ide-build-pipeline.h"
 #include "buildsystem/ide-build-stage.h"
+#include "buildsystem/ide-build-stage-private.h"
 #include "subprocess/ide-subprocess.h"
 
 typedef struct
 {
-  gchar               *name;
-  IdeBuildLogObserver  observer;
-  gpointer             observer_data;
-  GDestroyNotify       observer_data_destroy;
-  GTask               *queued_execute;
-  gchar               *stdout_path;
-  GOutputStream       *stdout_stream;
-  gint                 n_pause;
-  guint                completed : 1;
-  guint                disabled : 1;
-  guint                transient : 1;
-  guint                check_stdout : 1;
+  gchar                    *name;
+  IdeBuildLogObserver       observer;
+  gpointer                  observer_data;
+  GDestroyNotify            observer_data_destroy;
+  /* Unowned, the pipeline owns us and clears the matcher */
+  GObject                  *match_instance;
+  IdeBuildStageMatchFunc    match_func;
+  IdeBuildStageMatchNotify  notify_func;
+  GDestroyNotify            match_free;
+  GTask                    *queued_execute;
+  gchar                    *stdout_path;
+  GOutputStream            *stdout_stream;
+  gint                      n_pause;
+  guint                     completed : 1;
+  guint                     disabled : 1;
+  guint                     transient : 1;
+  guint                     check_stdout : 1;
 } IdeBuildStagePrivate;
 
 G_DEFINE_TYPE_WITH_PRIVATE (IdeBuildStage, ide_build_stage, IDE_TYPE_OBJECT)
@@ -63,42 +71,140 @@ enum {
 static GParamSpec *properties [N_PROPS];
 static guint signals [N_SIGNALS];
 
+/*
+ * Build output is read on a dedicated thread in large blocks so that a
+ * noisy build does not cost us a main loop iteration per line. Complete
+ * lines are split in place (newlines become \0) and appended to a shared
+ * arena which the main thread drains in a single dispatch. Lines are also
+ * run through the line matcher on that thread, so the main thread only
+ * has to handle the (rare) matches.
+ */
+#define TAIL_READ_SIZE   (64 * 1024)
+#define TAIL_MAX_PENDING (1024 * 1024)
+
+typedef struct
+{
+  gsize    offset;
+  gpointer match;
+} TailMatch;
+
 typedef struct
 {
-  IdeBuildStage     *self;
-  GOutputStream     *stream;
-  IdeBuildLogStream  stream_type;
+  volatile gint             ref_count;
+  IdeBuildStage            *self;
+  GInputStream             *input;
+  GOutputStream            *stream;
+  IdeBuildLogStream         stream_type;
+  GObject                  *match_instance;
+  IdeBuildStageMatchFunc    match_func;
+  IdeBuildStageMatchNotify  notify_func;
+  GDestroyNotify            match_free;
+
+  /* Everything below is protected by mutex */
+  GMutex                    mutex;
+  GCond                     cond;
+  GByteArray               *pending;
+  GArray                   *pending_matches;
+  guint                     dispatch_queued : 1;
 } Tail;
 
 static Tail *
 tail_new (IdeBuildStage     *self,
+          GInputStream      *input,
           GOutputStream     *stream,
           IdeBuildLogStream  stream_type)
 {
+  IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
   Tail *tail;
 
   g_assert (IDE_IS_BUILD_STAGE (self));
+  g_assert (G_IS_INPUT_STREAM (input));
   g_assert (!stream || G_IS_OUTPUT_STREAM (stream));
   g_assert (stream_type == IDE_BUILD_LOG_STDOUT || stream_type == IDE_BUILD_LOG_STDERR);
 
   tail = g_slice_new0 (Tail);
+  tail->ref_count = 1;
   tail->self = g_object_ref (self);
+  tail->input = g_object_ref (input);
   tail->stream = stream ? g_object_ref (stream) : NULL;
   tail->stream_type = stream_type;
 
+  /* Lines written to the stdout file are not logged, so never matched */
+  if (stream == NULL && priv->match_func != NULL)
+    {
+      tail->match_instance = g_object_ref (priv->match_instance);
+      tail->match_func = priv->match_func;
+      tail->notify_func = priv->notify_func;
+      tail->match_free = priv->match_free;
+    }
+
+  tail->pending = g_byte_array_new ();
+  tail->pending_matches = g_array_new (FALSE, FALSE, sizeof (TailMatch));
+  g_mutex_init (&tail->mutex);
+  g_cond_init (&tail->cond);
+
+  return tail;
+}
+
+static Tail *
+tail_ref (Tail *tail)
+{
+  g_assert (tail != NULL);
+  g_assert (tail->ref_count > 0);
+
+  g_atomic_int_inc (&tail->ref_count);
+
   return tail;
 }
 
 static void
-tail_free (Tail *tail)
+tail_clear_matches (Tail   *tail,
+                    GArray *matches)
 {
-  IDE_ENTRY;
+  g_assert (tail != NULL);
+  g_assert (matches != NULL);
 
-  g_clear_object (&tail->self);
-  g_clear_object (&tail->stream);
-  g_slice_free (Tail, tail);
+  for (guint i = 0; i < matches->len; i++)
+    {
+      TailMatch *tm = &g_array_index (matches, TailMatch, i);
 
-  IDE_EXIT;
+      if (tail->match_free != NULL)
+        tail->match_free (tm->match);
+    }
+
+  g_array_set_size (matches, 0);
+}
+
+static void
+tail_unref (Tail *tail)
+{
+  g_assert (tail != NULL);
+  g_assert (tail->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&tail->ref_count))
+    {
+      tail_clear_matches (tail, tail->pending_matches);
+      g_clear_pointer (&tail->pending_matches, g_array_unref);
+      g_clear_object (&tail->match_instance);
+      g_clear_object (&tail->self);
+      g_clear_object (&tail->input);
+      g_clear_object (&tail->stream);
+      g_clear_pointer (&tail->pending, g_byte_array_unref);
+      g_mutex_clear (&tail->mutex);
+      g_cond_clear (&tail->cond);
+      g_slice_free (Tail, tail);
+    }
+}
+
+static void
+ide_build_stage_clear_line_matcher (IdeBuildStage *self)
+{
+  IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
+
+  priv->match_func = NULL;
+  priv->notify_func = NULL;
+  priv->match_free = NULL;
+  priv->match_instance = NULL;
 }
 
 static void
@@ -248,6 +354,7 @@ ide_build_stage_finalize (GObject *object)
   IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
 
   ide_build_stage_clear_observer (self);
+  ide_build_stage_clear_line_matcher (self);
 
   g_clear_pointer (&priv->name, g_free);
   g_clear_pointer (&priv->stdout_path, g_free);
@@ -533,8 +640,8 @@ ide_build_stage_execute_finish (IdeBuildStage  *self,
    * anyway, so its safe (if only delayed rename()).
    *
    * We can just unref the stream, and the close will happen silently. We need
-   * to do this as some async reads to be proxied to the stream may occur after
-   * the execute_finish() completes.
+   * to do this as some lines read by the tail thread may be proxied to the
+   * stream after the execute_finish() completes.
    *
    * The Tail structure has it's own reference to stdout_stream.
    */
@@ -575,6 +682,44 @@ ide_build_stage_set_log_observer (IdeBuildStage       *self,
   priv->observer_data_destroy = observer_data_destroy;
 }
 
+/**
+ * _ide_build_stage_set_line_matcher: (skip)
+ * @self: An #IdeBuildStage
+ * @instance: (nullable) (transfer none): the instance passed to @match_func
+ *   and @notify_func, which must clear the matcher before it is finalized
+ * @match_func: (nullable): a thread-safe function to match lines
+ * @notify_func: (nullable): called on the main thread for each match
+ * @match_free: (nullable): frees the matches returned from @match_func
+ *
+ * Sets the function used to look for interesting lines in the log, such as
+ * compiler errors. Output read from a subprocess is matched on the thread
+ * reading it, which the pipeline uses to keep the regex matching off of the
+ * main thread.
+ */
+void
+_ide_build_stage_set_line_matcher (IdeBuildStage            *self,
+                                   GObject                  *instance,
+                                   IdeBuildStageMatchFunc    match_func,
+                                   IdeBuildStageMatchNotify  notify_func,
+                                   GDestroyNotify            match_free)
+{
+  IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
+
+  g_return_if_fail (IDE_IS_BUILD_STAGE (self));
+  g_return_if_fail (!match_func || G_IS_OBJECT (instance));
+  g_return_if_fail (!match_func || notify_func);
+
+  ide_build_stage_clear_line_matcher (self);
+
+  if (match_func != NULL)
+    {
+      priv->match_instance = instance;
+      priv->match_func = match_func;
+      priv->notify_func = notify_func;
+      priv->match_free = match_free;
+    }
+}
+
 static void
 ide_build_stage_log_internal (IdeBuildStage     *self,
                               IdeBuildLogStream  stream_type,
@@ -612,11 +757,33 @@ ide_build_stage_log (IdeBuildStage     *self,
                      gssize             message_len)
 {
   IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
+  GOutputStream *stream = NULL;
 
   if (stream_type == IDE_BUILD_LOG_STDOUT)
-    ide_build_stage_log_internal (self, stream_type, priv->stdout_stream, message, message_len);
-  else
-    ide_build_stage_log_internal (self, stream_type, NULL, message, message_len);
+    stream = priv->stdout_stream;
+
+  ide_build_stage_log_internal (self, stream_type, stream, message, message_len);
+
+  /* Lines not read by a tail thread are matched right away */
+  if (stream == NULL && priv->match_func != NULL)
+    {
+      g_autoptr(GObject) instance = g_object_ref (priv->match_instance);
+      IdeBuildStageMatchNotify notify_func = priv->notify_func;
+      GDestroyNotify match_free = priv->match_free;
+      gpointer match;
+
+      if G_UNLIKELY (message_len < 0)
+        message_len = strlen (message);
+
+      match = priv->match_func (instance, stream_type, message, message_len);
+
+      if (match != NULL)
+        {
+          notify_func (instance, match);
+          if (match_free != NULL)
+            match_free (match);
+        }
+    }
 }
 
 gboolean
@@ -673,48 +840,248 @@ ide_build_stage_get_transient (IdeBuildStage *self)
   return priv->transient;
 }
 
+static gboolean
+ide_build_stage_tail_dispatch (gpointer data)
+{
+  Tail *tail = data;
+  IdeBuildStagePrivate *priv;
+  g_autoptr(GByteArray) lines = NULL;
+  g_autoptr(GArray) matches = NULL;
+  const gchar *begin;
+  const gchar *line;
+  const gchar *end;
+  gboolean notify;
+  guint pos = 0;
+
+  g_assert (tail != NULL);
+  g_assert (IDE_IS_BUILD_STAGE (tail->self));
+
+  priv = ide_build_stage_get_instance_private (tail->self);
+
+  g_mutex_lock (&tail->mutex);
+  lines = tail->pending;
+  matches = tail->pending_matches;
+  tail->pending = g_byte_array_new ();
+  tail->pending_matches = g_array_new (FALSE, FALSE, sizeof (TailMatch));
+  tail->dispatch_queued = FALSE;
+  g_cond_signal (&tail->cond);
+  g_mutex_unlock (&tail->mutex);
+
+  /* Drop the matches if the stage was removed from the pipeline meanwhile */
+  notify = tail->match_instance != NULL && tail->match_instance == priv->match_instance;
+
+  begin = line = (const gchar *)lines->data;
+  end = line + lines->len;
+
+  while (line < end)
+    {
+      gsize len = strlen (line);
+
+      ide_build_stage_log_internal (tail->self, tail->stream_type, tail->stream, line, len);
+
+      if (pos < matches->len &&
+          g_array_index (matches, TailMatch, pos).offset == (gsize)(line - begin))
+        {
+          if (notify)
+            tail->notify_func (tail->match_instance,
+                               g_array_index (matches, TailMatch, pos).match);
+          pos++;
+        }
+
+      line += len + 1;
+    }
+
+  tail_clear_matches (tail, matches);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+ide_build_stage_tail_finished (gpointer data)
+{
+  Tail *tail = data;
+
+  g_assert (tail != NULL);
+
+  IDE_TRACE_MSG ("Finished reading %s of %s",
+                 tail->stream_type == IDE_BUILD_LOG_STDOUT ? "stdout" : "stderr",
+                 G_OBJECT_TYPE_NAME (tail->self));
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Replaces bytes that are not valid UTF-8 (including embedded \0) so that
+ * observers can treat each line as a regular string. This is done in place
+ * so that the line keeps its length.
+ */
 static void
-ide_build_stage_observe_stream_cb (GObject      *object,
-                                   GAsyncResult *result,
-                                   gpointer      user_data)
+tail_make_valid (gchar *line,
+                 gsize  len)
 {
-  GDataInputStream *stream = (GDataInputStream *)object;
-  g_autofree gchar *line = NULL;
-  g_autoptr(GError) error = NULL;
-  Tail *tail = user_data;
-  gsize n_read = 0;
+  const gchar *invalid;
+
+  g_assert (line != NULL);
+
+  while (!g_utf8_validate (line, len, &invalid))
+    {
+      gsize offset = invalid - line;
+
+      line[offset] = '?';
+      line += offset + 1;
+      len -= offset + 1;
+    }
+}
+
+/*
+ * Splits @len bytes of complete lines at @data and queues them for the
+ * main thread. If the main thread has fallen too far behind, we block
+ * until it catches up, which in turn stops the subprocess once the pipe
+ * is full rather than buffering an unbounded amount of output.
+ */
+static void
+tail_push_lines (Tail  *tail,
+                 gchar *data,
+                 gsize  len)
+{
+  g_autoptr(GArray) matches = NULL;
+  gchar *line = data;
+  gchar *end = data + len;
 
-  g_assert (G_IS_DATA_INPUT_STREAM (stream));
-  g_assert (G_IS_ASYNC_RESULT (result));
   g_assert (tail != NULL);
+  g_assert (len > 0);
+  g_assert (data[len - 1] == '\n');
 
-  line = g_data_input_stream_read_line_finish_utf8 (stream, result, &n_read, &error);
+  if (tail->match_func != NULL)
+    matches = g_array_new (FALSE, FALSE, sizeof (TailMatch));
 
-  if (error == NULL)
+  while (line < end)
     {
-      if (line == NULL)
-        goto cleanup;
+      gchar *eol = memchr (line, '\n', end - line);
 
-      ide_build_stage_log_internal (tail->self, tail->stream_type, tail->stream, line, (gssize)n_read);
+      g_assert (eol != NULL);
 
-      if G_UNLIKELY (g_input_stream_is_closed (G_INPUT_STREAM (stream)))
-        goto cleanup;
+      tail_make_valid (line, eol - line);
+      *eol = '\0';
 
-      g_data_input_stream_read_line_async (stream,
-                                           G_PRIORITY_DEFAULT,
-                                           NULL,
-                                           ide_build_stage_observe_stream_cb,
-                                           tail);
+      if (matches != NULL)
+        {
+          TailMatch tm;
 
-      return;
+          tm.offset = line - data;
+          tm.match = tail->match_func (tail->match_instance, tail->stream_type, line, eol - line);
+
+          if (tm.match != NULL)
+            g_array_append_val (matches, tm);
+        }
+
+      line = eol + 1;
+    }
+
+  g_mutex_lock (&tail->mutex);
+
+  while (tail->pending->len >= TAIL_MAX_PENDING)
+    g_cond_wait (&tail->cond, &tail->mutex);
+
+  /* Offsets are relative to the arena the lines are appended to */
+  if (matches != NULL)
+    {
+      for (guint i = 0; i < matches->len; i++)
+        {
+          TailMatch tm = g_array_index (matches, TailMatch, i);
+
+          tm.offset += tail->pending->len;
+          g_array_append_val (tail->pending_matches, tm);
+        }
     }
 
-  g_debug ("%s", error->message);
+  g_byte_array_append (tail->pending, (const guint8 *)data, len);
 
-cleanup:
-  tail_free (tail);
+  if (!tail->dispatch_queued)
+    {
+      tail->dispatch_queued = TRUE;
+      g_idle_add_full (G_PRIORITY_DEFAULT,
+                       ide_build_stage_tail_dispatch,
+                       tail_ref (tail),
+                       (GDestroyNotify)tail_unref);
+    }
+
+  g_mutex_unlock (&tail->mutex);
 }
 
+static gpointer
+ide_build_stage_tail_worker (gpointer data)
+{
+  Tail *tail = data;
+  g_autoptr(GByteArray) buffer = NULL;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (tail != NULL);
+  g_assert (G_IS_INPUT_STREAM (tail->input));
+
+  buffer = g_byte_array_sized_new (TAIL_READ_SIZE);
+
+  for (;;)
+    {
+      guint len = buffer->len;
+      gssize n_read;
+      gsize complete = 0;
+
+      g_byte_array_set_size (buffer, len + TAIL_READ_SIZE);
+
+      n_read = g_input_stream_read (tail->input,
+                                    buffer->data + len,
+                                    TAIL_READ_SIZE,
+                                    NULL,
+                                    &error);
+
+      if (n_read <= 0)
+        {
+          g_byte_array_set_size (buffer, len);
+          break;
+        }
+
+      g_byte_array_set_size (buffer, len + n_read);
+
+      /*
+       * Find the end of the last complete line, the rest waits for more
+       * data. Only the new data can contain a newline since anything left
+       * over from previous reads is a partial line.
+       */
+      for (gsize i = buffer->len; i > len; i--)
+        {
+          if (buffer->data[i - 1] == '\n')
+            {
+              complete = i;
+              break;
+            }
+        }
+
+      if (complete > 0)
+        {
+          tail_push_lines (tail, (gchar *)buffer->data, complete);
+          g_byte_array_remove_range (buffer, 0, complete);
+        }
+    }
+
+  if (error != NULL)
+    g_debug ("%s", error->message);
+
+  /* Flush the trailing line that was not terminated by a newline */
+  if (buffer->len > 0)
+    {
+      g_byte_array_append (buffer, (const guint8 *)"\n", 1);
+      tail_push_lines (tail, (gchar *)buffer->data, buffer->len);
+    }
+
+  /* Drop our reference from the main thread, which owns the stage */
+  g_idle_add_full (G_PRIORITY_DEFAULT,
+                   ide_build_stage_tail_finished,
+                   tail,
+                   (GDestroyNotify)tail_unref);
+
+  return NULL;
+}
 
 static void
 ide_build_stage_observe_stream (IdeBuildStage     *self,
@@ -722,32 +1089,36 @@ ide_build_stage_observe_stream (IdeBuildStage     *self,
                                 GInputStream      *stream)
 {
   IdeBuildStagePrivate *priv = ide_build_stage_get_instance_private (self);
-  g_autoptr(GDataInputStream) data_stream = NULL;
+  g_autoptr(GError) error = NULL;
+  GThread *thread;
   Tail *tail;
 
   g_assert (IDE_IS_BUILD_STAGE (self));
   g_assert (stream_type == IDE_BUILD_LOG_STDOUT || stream_type == IDE_BUILD_LOG_STDERR);
   g_assert (G_IS_INPUT_STREAM (stream));
 
-  if (G_IS_DATA_INPUT_STREAM (stream))
-    data_stream = g_object_ref (stream);
-  else
-    data_stream = g_data_input_stream_new (stream);
-
   IDE_TRACE_MSG ("Logging subprocess stream of type %s as %s",
-                 G_OBJECT_TYPE_NAME (data_stream),
+                 G_OBJECT_TYPE_NAME (stream),
                  stream_type == IDE_BUILD_LOG_STDOUT ? "stdout" : "stderr");
 
   if (stream_type == IDE_BUILD_LOG_STDOUT)
-    tail = tail_new (self, priv->stdout_stream, stream_type);
+    tail = tail_new (self, stream, priv->stdout_stream, stream_type);
   else
-    tail = tail_new (self, NULL, stream_type);
+    tail = tail_new (self, stream, NULL, stream_type);
+
+  thread = g_thread_try_new ("ide-build-stage-tail",
+                             ide_build_stage_tail_worker,
+                             tail,
+                             &error);
+
+  if (thread == NULL)
+    {
+      g_warning ("Failed to spawn thread to read build output: %s", error->message);
+      tail_unref (tail);
+      return;
+    }
 
-  g_data_input_stream_read_line_async (data_stream,
-                                       G_PRIORITY_DEFAULT,
-                                       NULL,
-                                       ide_build_stage_observe_stream_cb,
-                                       tail);
+  g_thread_unref (thread);
 }
 
 /**
@@ -0,0 +1,758 @@
+/* ide-compile-commands.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-compile-commands"
+
+#include <dazzle.h>
+#include <string.h>
+
+#include "ide-debug.h"
+
+#include "buildsystem/ide-compile-commands.h"
+
+/**
+ * SECTION:ide-compile-commands
+ * @title: IdeCompileCommands
+ * @short_description: Access to a compile_commands.json database
+ *
+ * #IdeCompileCommands provides access to the "compile_commands.json"
+ * compilation database generated by build systems such as meson and cmake.
+ *
+ * The database is parsed in a single streaming pass over the mapped file,
+ * without building a JSON tree, so that only the resulting table of file
+ * to command is kept in memory. The file is only parsed again when its
+ * modification time changes.
+ *
+ * Since: 3.26
+ */
+
+typedef struct
+{
+  /* Owned by the GStringChunk, shared among commands */
+  const gchar  *directory;
+  gchar        *command;
+  gchar       **arguments;
+} CompileCommand;
+
+typedef struct
+{
+  const gchar *pos;
+  const gchar *begin;
+  const gchar *end;
+  GString     *str;
+} Scanner;
+
+struct _IdeCompileCommands
+{
+  GObject       parent_instance;
+
+  GMutex        mutex;
+  GFile        *file;
+  guint64       mtime;
+  GHashTable   *commands;
+  GStringChunk *chunk;
+};
+
+G_DEFINE_TYPE (IdeCompileCommands, ide_compile_commands, G_TYPE_OBJECT)
+
+DZL_DEFINE_COUNTER (loads, "IdeCompileCommands", "Loads", "Number of times compile_commands.json was parsed")
+
+static void
+compile_command_free (gpointer data)
+{
+  CompileCommand *command = data;
+
+  g_clear_pointer (&command->command, g_free);
+  g_clear_pointer (&command->arguments, g_strfreev);
+  g_slice_free (CompileCommand, command);
+}
+
+static gboolean
+scanner_error (Scanner  *scanner,
+               GError  **error)
+{
+  g_set_error (error,
+               G_IO_ERROR,
+               G_IO_ERROR_INVALID_DATA,
+               "Invalid compile_commands.json at offset %"G_GSIZE_FORMAT,
+               (gsize)(scanner->pos - scanner->begin));
+  return FALSE;
+}
+
+static void
+scanner_skip_space (Scanner *scanner)
+{
+  while (scanner->pos < scanner->end && g_ascii_isspace (*scanner->pos))
+    scanner->pos++;
+}
+
+static gboolean
+scanner_expect (Scanner  *scanner,
+                gchar     ch,
+                GError  **error)
+{
+  scanner_skip_space (scanner);
+
+  if (scanner->pos >= scanner->end || *scanner->pos != ch)
+    return scanner_error (scanner, error);
+
+  scanner->pos++;
+
+  return TRUE;
+}
+
+static gboolean
+scanner_peek (Scanner *scanner,
+              gchar    ch)
+{
+  scanner_skip_space (scanner);
+
+  return scanner->pos < scanner->end && *scanner->pos == ch;
+}
+
+static gboolean
+scanner_accept (Scanner *scanner,
+                gchar    ch)
+{
+  if (scanner_peek (scanner, ch))
+    {
+      scanner->pos++;
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+static gboolean
+scanner_read_hex (Scanner  *scanner,
+                  gunichar *ch)
+{
+  *ch = 0;
+
+  if (scanner->end - scanner->pos < 4)
+    return FALSE;
+
+  for (guint i = 0; i < 4; i++)
+    {
+      gint value = g_ascii_xdigit_value (scanner->pos[i]);
+
+      if (value < 0)
+        return FALSE;
+
+      *ch = (*ch << 4) | value;
+    }
+
+  scanner->pos += 4;
+
+  return TRUE;
+}
+
+/*
+ * Reads a JSON string into scanner->str, decoding escapes. The contents
+ * are only valid until the next string is read.
+ */
+static gboolean
+scanner_read_string (Scanner  *scanner,
+                     GError  **error)
+{
+  if (!scanner_expect (scanner, '"', error))
+    return FALSE;
+
+  g_string_truncate (scanner->str, 0);
+
+  while (scanner->pos < scanner->end)
+    {
+      const gchar *begin = scanner->pos;
+      gunichar ch;
+
+      while (scanner->pos < scanner->end && *scanner->pos != '"' && *scanner->pos != '\\')
+        scanner->pos++;
+
+      g_string_append_len (scanner->str, begin, scanner->pos - begin);
+
+      if (scanner->pos >= scanner->end)
+        break;
+
+      if (*scanner->pos == '"')
+        {
+          scanner->pos++;
+          return TRUE;
+        }
+
+      /* Escape sequence */
+      if (++scanner->pos >= scanner->end)
+        break;
+
+      switch (*scanner->pos++)
+        {
+        case '"':  g_string_append_c (scanner->str, '"');  break;
+        case '\\': g_string_append_c (scanner->str, '\\'); break;
+        case '/':  g_string_append_c (scanner->str, '/');  break;
+        case 'b':  g_string_append_c (scanner->str, '\b'); break;
+        case 'f':  g_string_append_c (scanner->str, '\f'); break;
+        case 'n':  g_string_append_c (scanner->str, '\n'); break;
+        case 'r':  g_string_append_c (scanner->str, '\r'); break;
+        case 't':  g_string_append_c (scanner->str, '\t'); break;
+
+        case 'u':
+          if (!scanner_read_hex (scanner, &ch))
+            return scanner_error (scanner, error);
+
+          /* Combine UTF-16 surrogate pairs */
+          if (ch >= 0xD800 && ch <= 0xDBFF &&
+              scanner->end - scanner->pos >= 6 &&
+              scanner->pos[0] == '\\' && scanner->pos[1] == 'u')
+            {
+              gunichar low;
+
+              scanner->pos += 2;
+
+              if (!scanner_read_hex (scanner, &low) || low < 0xDC00 || low > 0xDFFF)
+                return scanner_error (scanner, error);
+
+              ch = 0x10000 + ((ch - 0xD800) << 10) + (low - 0xDC00);
+            }
+
+          g_string_append_unichar (scanner->str, ch);
+          break;
+
+        default:
+          return scanner_error (scanner, error);
+        }
+    }
+
+  return scanner_error (scanner, error);
+}
+
+static gboolean
+scanner_skip_value (Scanner  *scanner,
+                    GError  **error)
+{
+  guint depth = 0;
+
+  scanner_skip_space (scanner);
+
+  do
+    {
+      if (scanner->pos >= scanner->end)
+        return scanner_error (scanner, error);
+
+      switch (*scanner->pos)
+        {
+        case '"':
+          if (!scanner_read_string (scanner, error))
+            return FALSE;
+          break;
+
+        case '{':
+        case '[':
+          depth++;
+          scanner->pos++;
+          break;
+
+        case '}':
+        case ']':
+          if (depth == 0)
+            return scanner_error (scanner, error);
+          depth--;
+          scanner->pos++;
+          break;
+
+        case ',':
+        case ':':
+          if (depth == 0)
+            return scanner_error (scanner, error);
+          scanner->pos++;
+          break;
+
+        default:
+          {
+            const gchar *begin = scanner->pos;
+
+            /* Numbers and literals */
+            while (scanner->pos < scanner->end &&
+                   *scanner->pos != '\0' &&
+                   !g_ascii_isspace (*scanner->pos) &&
+                   !strchr (",:[]{}\"", *scanner->pos))
+              scanner->pos++;
+
+            if (scanner->pos == begin)
+              return scanner_error (scanner, error);
+          }
+          break;
+        }
+
+      scanner_skip_space (scanner);
+    }
+  while (depth > 0);
+
+  return TRUE;
+}
+
+static gchar **
+scanner_read_string_array (Scanner  *scanner,
+                           GError  **error)
+{
+  g_autoptr(GPtrArray) ar = NULL;
+
+  if (!scanner_expect (scanner, '[', error))
+    return NULL;
+
+  ar = g_ptr_array_new_with_free_func (g_free);
+
+  if (!scanner_peek (scanner, ']'))
+    {
+      do
+        {
+          if (!scanner_read_string (scanner, error))
+            return NULL;
+          g_ptr_array_add (ar, g_strndup (scanner->str->str, scanner->str->len));
+        }
+      while (scanner_accept (scanner, ','));
+    }
+
+  if (!scanner_expect (scanner, ']', error))
+    return NULL;
+
+  g_ptr_array_add (ar, NULL);
+
+  return (gchar **)g_ptr_array_free (g_steal_pointer (&ar), FALSE);
+}
+
+static gchar *
+canonicalize_path (const gchar *directory,
+                   const gchar *file)
+{
+  g_autofree gchar *path = NULL;
+  g_autoptr(GFile) gfile = NULL;
+
+  if (g_path_is_absolute (file) || directory == NULL)
+    path = g_strdup (file);
+  else
+    path = g_build_filename (directory, file, NULL);
+
+  /* GFile will resolve "." and ".." for us */
+  gfile = g_file_new_for_path (path);
+
+  return g_file_get_path (gfile);
+}
+
+static gboolean
+ide_compile_commands_parse (const gchar   *data,
+                            gsize          len,
+                            GHashTable    *commands,
+                            GStringChunk  *chunk,
+                            GError       **error)
+{
+  Scanner scanner = { data, data, data + len, NULL };
+  gboolean ret = FALSE;
+
+  g_assert (data != NULL || len == 0);
+  g_assert (commands != NULL);
+  g_assert (chunk != NULL);
+
+  scanner.str = g_string_new (NULL);
+
+  if (!scanner_expect (&scanner, '[', error))
+    goto failure;
+
+  if (scanner_peek (&scanner, ']'))
+    goto finish;
+
+  do
+    {
+      g_autofree gchar *file = NULL;
+      g_autofree gchar *path = NULL;
+      const gchar *directory = NULL;
+      CompileCommand *command;
+      gchar *command_line = NULL;
+      gchar **arguments = NULL;
+
+      if (!scanner_expect (&scanner, '{', error))
+        goto failure;
+
+      if (!scanner_peek (&scanner, '}'))
+        {
+          do
+            {
+              if (!scanner_read_string (&scanner, error) ||
+                  !scanner_expect (&scanner, ':', error))
+                goto entry_failure;
+
+              if (g_str_equal (scanner.str->str, "directory"))
+                {
+                  if (!scanner_read_string (&scanner, error))
+                    goto entry_failure;
+                  directory = g_string_chunk_insert_const (chunk, scanner.str->str);
+                }
+              else if (g_str_equal (scanner.str->str, "file"))
+                {
+                  if (!scanner_read_string (&scanner, error))
+                    goto entry_failure;
+                  g_free (file);
+                  file = g_strndup (scanner.str->str, scanner.str->len);
+                }
+              else if (g_str_equal (scanner.str->str, "command"))
+                {
+                  if (!scanner_read_string (&scanner, error))
+                    goto entry_failure;
+                  g_free (command_line);
+                  command_line = g_strndup (scanner.str->str, scanner.str->len);
+                }
+              else if (g_str_equal (scanner.str->str, "arguments"))
+                {
+                  g_strfreev (arguments);
+                  if (!(arguments = scanner_read_string_array (&scanner, error)))
+                    goto entry_failure;
+                }
+              else if (!scanner_skip_value (&scanner, error))
+                goto entry_failure;
+            }
+          while (scanner_accept (&scanner, ','));
+        }
+
+      if (!scanner_expect (&scanner, '}', error))
+        goto entry_failure;
+
+      /* The first entry for a file wins, just like other consumers */
+      if (file == NULL ||
+          (command_line == NULL && arguments == NULL) ||
+          NULL == (path = canonicalize_path (directory, file)) ||
+          g_hash_table_contains (commands, path))
+        {
+          g_free (command_line);
+          g_strfreev (arguments);
+          continue;
+        }
+
+      command = g_slice_new0 (CompileCommand);
+      command->directory = directory;
+      command->command = command_line;
+      command->arguments = arguments;
+
+      g_hash_table_insert (commands, g_steal_pointer (&path), command);
+
+      continue;
+
+    entry_failure:
+      g_free (command_line);
+      g_strfreev (arguments);
+      goto failure;
+    }
+  while (scanner_accept (&scanner, ','));
+
+finish:
+  if (!scanner_expect (&scanner, ']', error))
+    goto failure;
+
+  ret = TRUE;
+
+failure:
+  g_string_free (scanner.str, TRUE);
+
+  return ret;
+}
+
+static void
+ide_compile_commands_finalize (GObject *object)
+{
+  IdeCompileCommands *self = (IdeCompileCommands *)object;
+
+  g_clear_object (&self->file);
+  g_clear_pointer (&self->commands, g_hash_table_unref);
+  g_clear_pointer (&self->chunk, g_string_chunk_free);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (ide_compile_commands_parent_class)->finalize (object);
+}
+
+static void
+ide_compile_commands_class_init (IdeCompileCommandsClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = ide_compile_commands_finalize;
+}
+
+static void
+ide_compile_commands_init (IdeCompileCommands *self)
+{
+  g_mutex_init (&self->mutex);
+}
+
+IdeCompileCommands *
+ide_compile_commands_new (void)
+{
+  return g_object_new (IDE_TYPE_COMPILE_COMMANDS, NULL);
+}
+
+/**
+ * ide_compile_commands_load:
+ * @self: An #IdeCompileCommands
+ * @file: A #GFile for a compile_commands.json
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @error: A location for a #GError, or %NULL
+ *
+ * Synchronously loads @file into @self, replacing any previously loaded
+ * commands.
+ *
+ * If @file was already loaded and has not been modified since, this
+ * returns immediately without parsing the file again.
+ *
+ * This is safe to call from a thread.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ *
+ * Since: 3.26
+ */
+gboolean
+ide_compile_commands_load (IdeCompileCommands  *self,
+                           GFile               *file,
+                           GCancellable        *cancellable,
+                           GError             **error)
+{
+  g_autoptr(GFileInfo) info = NULL;
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GHashTable) commands = NULL;
+  g_autofree gchar *path = NULL;
+  GStringChunk *chunk;
+  gboolean unchanged;
+  guint64 mtime;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_COMPILE_COMMANDS (self), FALSE);
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+
+  info = g_file_query_info (file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            error);
+
+  if (info == NULL)
+    IDE_RETURN (FALSE);
+
+  mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+          g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+
+  g_mutex_lock (&self->mutex);
+  unchanged = self->file != NULL && g_file_equal (self->file, file) && self->mtime == mtime;
+  g_mutex_unlock (&self->mutex);
+
+  if (unchanged)
+    IDE_RETURN (TRUE);
+
+  if (!(path = g_file_get_path (file)))
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_SUPPORTED,
+                   "compile_commands.json must be on a local filesystem");
+      IDE_RETURN (FALSE);
+    }
+
+  if (!(mapped = g_mapped_file_new (path, FALSE, error)))
+    IDE_RETURN (FALSE);
+
+  DZL_COUNTER_INC (loads);
+
+  commands = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, compile_command_free);
+  chunk = g_string_chunk_new (4096);
+
+  if (!ide_compile_commands_parse (g_mapped_file_get_contents (mapped),
+                                   g_mapped_file_get_length (mapped),
+                                   commands,
+                                   chunk,
+                                   error))
+    {
+      g_string_chunk_free (chunk);
+      IDE_RETURN (FALSE);
+    }
+
+  IDE_TRACE_MSG ("Loaded %u compile commands from %s", g_hash_table_size (commands), path);
+
+  g_mutex_lock (&self->mutex);
+  g_set_object (&self->file, file);
+  self->mtime = mtime;
+  g_clear_pointer (&self->commands, g_hash_table_unref);
+  g_clear_pointer (&self->chunk, g_string_chunk_free);
+  self->commands = g_steal_pointer (&commands);
+  self->chunk = chunk;
+  g_mutex_unlock (&self->mutex);
+
+  IDE_RETURN (TRUE);
+}
+
+static void
+ide_compile_commands_load_worker (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  IdeCompileCommands *self = source_object;
+  GFile *file = task_data;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_COMPILE_COMMANDS (self));
+  g_assert (G_IS_FILE (file));
+
+  if (!ide_compile_commands_load (self, file, cancellable, &error))
+    g_task_return_error (task, error);
+  else
+    g_task_return_boolean (task, TRUE);
+}
+
+/**
+ * ide_compile_commands_load_async:
+ * @self: An #IdeCompileCommands
+ * @file: A #GFile for a compile_commands.json
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: A callback to execute upon completion
+ * @user_data: user data for @callback
+ *
+ * Asynchronously loads @file using a thread. See ide_compile_commands_load()
+ * for details.
+ *
+ * Since: 3.26
+ */
+void
+ide_compile_commands_load_async (IdeCompileCommands  *self,
+                                 GFile               *file,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_COMPILE_COMMANDS (self));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_compile_commands_load_async);
+  g_task_set_priority (task, G_PRIORITY_LOW);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+  g_task_run_in_thread (task, ide_compile_commands_load_worker);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_compile_commands_load_finish:
+ * @self: An #IdeCompileCommands
+ * @result: A #GAsyncResult provided to the callback
+ * @error: A location for a #GError, or %NULL
+ *
+ * Completes an asynchronous request to ide_compile_commands_load_async().
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ *
+ * Since: 3.26
+ */
+gboolean
+ide_compile_commands_load_finish (IdeCompileCommands  *self,
+                                  GAsyncResult        *result,
+                                  GError             **error)
+{
+  gboolean ret;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_COMPILE_COMMANDS (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (result), FALSE);
+
+  ret = g_task_propagate_boolean (G_TASK (result), error);
+
+  IDE_RETURN (ret);
+}
+
+/**
+ * ide_compile_commands_lookup:
+ * @self: An #IdeCompileCommands
+ * @file: A #GFile for a source file
+ * @directory: (out) (optional) (transfer full): A location for the
+ *   directory the command is run from, or %NULL
+ * @error: A location for a #GError, or %NULL
+ *
+ * Locates the command used to compile @file.
+ *
+ * Returns: (transfer full) (array zero-terminated=1) (element-type utf8):
+ *   The arguments to the compiler, or %NULL and @error is set.
+ *
+ * Since: 3.26
+ */
+gchar **
+ide_compile_commands_lookup (IdeCompileCommands  *self,
+                             GFile               *file,
+                             GFile              **directory,
+                             GError             **error)
+{
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *command_line = NULL;
+  g_autofree gchar *dir = NULL;
+  const CompileCommand *command;
+  gchar **argv = NULL;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_COMPILE_COMMANDS (self), NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
+
+  if (directory != NULL)
+    *directory = NULL;
+
+  path = g_file_get_path (file);
+
+  g_mutex_lock (&self->mutex);
+  if (path != NULL &&
+      self->commands != NULL &&
+      NULL != (command = g_hash_table_lookup (self->commands, path)))
+    {
+      if (command->arguments != NULL)
+        argv = g_strdupv (command->arguments);
+      else
+        command_line = g_strdup (command->command);
+      dir = g_strdup (command->directory);
+    }
+  g_mutex_unlock (&self->mutex);
+
+  /* Parse outside the lock, we might have many lookups in flight */
+  if (command_line != NULL && !g_shell_parse_argv (command_line, NULL, &argv, error))
+    IDE_RETURN (NULL);
+
+  if (argv == NULL)
+    {
+      g_set_error (error,
+                   G_IO_ERROR,
+                   G_IO_ERROR_NOT_FOUND,
+                   "Failed to locate command for %s",
+                   path ? path : "file");
+      IDE_RETURN (NULL);
+    }
+
+  if (directory != NULL && dir != NULL)
+    *directory = g_file_new_for_path (dir);
+
+  IDE_RETURN (argv);
+}
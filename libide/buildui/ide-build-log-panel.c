@@ -21,8 +21,21 @@
 #include <dazzle.h>
 #include <glib/gi18n.h>
 #include <ide.h>
+#include <string.h>
+
+#include "buildsystem/ide-build-utils.h"
 
 #include "ide-build-log-panel.h"
+#include "ide-build-log-store.h"
+
+/*
+ * The text buffer only contains a window of the lines in the log store so
+ * that a long build does not leave us with an enormous buffer to lay out.
+ * The window follows the end of the log, and is moved through the store in
+ * steps when scrolling reaches either edge of the buffer.
+ */
+#define WINDOW_LINES 2000
+#define WINDOW_STEP  500
 
 typedef struct _ColorCodeState
 {
@@ -44,7 +57,20 @@ struct _IdeBuildLogPanel
   IdeBuildPipeline  *pipeline;
   GtkCssProvider    *css;
   GSettings         *settings;
+  GSettings         *build_settings;
   GtkTextBuffer     *buffer;
+  IdeBuildLogStore  *store;
+
+  /*
+   * The buffer contains the lines of the store from window_first up to
+   * window_end. While following the end of the log, new lines are loaded
+   * on the next frame, so a panel that is not visible costs us very little.
+   */
+  guint              window_first;
+  guint              window_end;
+  guint              pending_tick;
+  guint              follow : 1;
+  guint              in_update : 1;
 
   GtkScrolledWindow *scroller;
   GtkTextView       *text_view;
@@ -60,6 +86,12 @@ struct _IdeBuildLogPanel
   guint              log_observer;
 };
 
+typedef struct
+{
+  IdeBuildLogPanel *self;
+  GtkTextIter      *iter;
+} LoadState;
+
 enum {
   PROP_0,
   PROP_PIPELINE,
@@ -448,11 +480,10 @@ ide_build_log_panel_insert_text (IdeBuildLogPanel  *self,
   gsize len;
 
   g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (message != NULL);
   g_assert (iter != NULL);
 
-  if (ide_str_empty0 (message))
-    return;
-
+  /* Empty lines are kept so that each line of the store is a buffer line */
   while (*cursor != '\0')
     {
       tag_type = find_color_code (self, cursor, &self->color_codes_state, &tag_start, &tag_end);
@@ -483,6 +514,8 @@ ide_build_log_panel_insert_text (IdeBuildLogPanel  *self,
     }
 
   gtk_text_buffer_insert (self->buffer, &pos, "\n", 1);
+
+  *iter = pos;
 }
 
 static void
@@ -527,6 +560,377 @@ ide_build_log_panel_reset_view (IdeBuildLogPanel *self)
   gtk_container_add (GTK_CONTAINER (self->scroller), GTK_WIDGET (self->text_view));
 }
 
+static void
+ide_build_log_panel_cancel_flush (IdeBuildLogPanel *self)
+{
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  if (self->pending_tick != 0)
+    {
+      gtk_widget_remove_tick_callback (GTK_WIDGET (self), self->pending_tick);
+      self->pending_tick = 0;
+    }
+}
+
+static gboolean
+ide_build_log_panel_insert_line (IdeBuildLogStream  stream,
+                                 const gchar       *message,
+                                 gsize              message_len,
+                                 gpointer           user_data)
+{
+  LoadState *state = user_data;
+
+  ide_build_log_panel_insert_text (state->self, message, state->iter, stream);
+
+  return TRUE;
+}
+
+/*
+ * Inserts the lines of the store from @first_line up to @end_line at @iter.
+ * Color codes are only parsed for the lines that make it to the buffer.
+ */
+static void
+ide_build_log_panel_load (IdeBuildLogPanel *self,
+                          guint             first_line,
+                          guint             end_line,
+                          GtkTextIter      *iter)
+{
+  g_autoptr(GError) error = NULL;
+  LoadState state = { self, iter };
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (first_line <= end_line);
+  g_assert (iter != NULL);
+
+  if (!ide_build_log_store_foreach_range (self->store,
+                                          first_line,
+                                          end_line - first_line,
+                                          ide_build_log_panel_insert_line,
+                                          &state,
+                                          &error))
+    g_warning ("%s", error->message);
+}
+
+/* Replaces the contents of the buffer with the lines from @first_line to @end_line */
+static void
+ide_build_log_panel_reset_window (IdeBuildLogPanel *self,
+                                  guint             first_line,
+                                  guint             end_line)
+{
+  GtkTextIter iter;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  gtk_text_buffer_set_text (self->buffer, "", 0);
+  color_codes_state_reset (&self->current_color_codes_state);
+  color_codes_state_reset (&self->color_codes_state);
+
+  gtk_text_buffer_get_start_iter (self->buffer, &iter);
+  ide_build_log_panel_load (self, first_line, end_line, &iter);
+
+  self->window_first = first_line;
+  self->window_end = end_line;
+}
+
+/* Drops lines from the start of the buffer until the window fits */
+static void
+ide_build_log_panel_trim_start (IdeBuildLogPanel *self)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  guint n_lines;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  n_lines = self->window_end - self->window_first;
+
+  if (n_lines <= WINDOW_LINES)
+    return;
+
+  n_lines -= WINDOW_LINES;
+
+  gtk_text_buffer_get_start_iter (self->buffer, &begin);
+  gtk_text_buffer_get_iter_at_line (self->buffer, &end, n_lines);
+  gtk_text_buffer_delete (self->buffer, &begin, &end);
+
+  self->window_first += n_lines;
+}
+
+/* Drops lines from the end of the buffer until the window fits */
+static void
+ide_build_log_panel_trim_end (IdeBuildLogPanel *self)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  guint n_lines;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  n_lines = self->window_end - self->window_first;
+
+  if (n_lines <= WINDOW_LINES)
+    return;
+
+  gtk_text_buffer_get_iter_at_line (self->buffer, &begin, WINDOW_LINES);
+  gtk_text_buffer_get_end_iter (self->buffer, &end);
+  gtk_text_buffer_delete (self->buffer, &begin, &end);
+
+  self->window_end -= n_lines - WINDOW_LINES;
+
+  /* Colors in effect at the new end are unknown, don't carry on stale ones */
+  color_codes_state_reset (&self->current_color_codes_state);
+  color_codes_state_reset (&self->color_codes_state);
+}
+
+/*
+ * Marks the first visible line so that it can be scrolled back into place
+ * after lines are added or removed above it. The mark has right gravity so
+ * that it stays after lines inserted at the very start of the buffer.
+ */
+static GtkTextMark *
+ide_build_log_panel_save_position (IdeBuildLogPanel *self)
+{
+  GdkRectangle rect;
+  GtkTextIter iter;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  gtk_text_view_get_visible_rect (self->text_view, &rect);
+  gtk_text_view_get_line_at_y (self->text_view, &iter, rect.y, NULL);
+
+  return gtk_text_buffer_create_mark (self->buffer, NULL, &iter, FALSE);
+}
+
+static void
+ide_build_log_panel_restore_position (IdeBuildLogPanel *self,
+                                      GtkTextMark      *mark)
+{
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (GTK_IS_TEXT_MARK (mark));
+
+  gtk_text_view_scroll_to_mark (self->text_view, mark, 0.0, TRUE, 0.0, 0.0);
+  gtk_text_buffer_delete_mark (self->buffer, mark);
+}
+
+static void
+ide_build_log_panel_scroll_to_end (IdeBuildLogPanel *self)
+{
+  GtkTextMark *insert;
+  GtkTextIter iter;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  gtk_text_buffer_get_end_iter (self->buffer, &iter);
+  gtk_text_buffer_place_cursor (self->buffer, &iter);
+
+  insert = gtk_text_buffer_get_insert (self->buffer);
+  gtk_text_view_scroll_to_mark (self->text_view, insert, 0.0, TRUE, 1.0, 0.0);
+}
+
+static void
+ide_build_log_panel_flush (IdeBuildLogPanel *self)
+{
+  GtkTextIter iter;
+  guint store_first;
+  guint store_end;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  store_first = ide_build_log_store_get_first_line (self->store);
+  store_end = store_first + ide_build_log_store_get_n_lines (self->store);
+
+  /* When scrolled back, new lines are loaded once scrolled down to them */
+  if (!self->follow || self->window_end == store_end)
+    return;
+
+  self->in_update = TRUE;
+
+  /* Start over from the end of the log if we have fallen a window behind */
+  if (self->window_end < store_first || store_end - self->window_end >= WINDOW_LINES)
+    {
+      ide_build_log_panel_reset_window (self,
+                                        MAX (store_first, store_end - MIN (store_end, WINDOW_LINES)),
+                                        store_end);
+    }
+  else
+    {
+      gtk_text_buffer_get_end_iter (self->buffer, &iter);
+      ide_build_log_panel_load (self, self->window_end, store_end, &iter);
+      self->window_end = store_end;
+      ide_build_log_panel_trim_start (self);
+    }
+
+  ide_build_log_panel_scroll_to_end (self);
+
+  self->in_update = FALSE;
+}
+
+static gboolean
+ide_build_log_panel_flush_tick (GtkWidget     *widget,
+                                GdkFrameClock *frame_clock,
+                                gpointer       user_data)
+{
+  IdeBuildLogPanel *self = (IdeBuildLogPanel *)widget;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  self->pending_tick = 0;
+
+  ide_build_log_panel_flush (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+ide_build_log_panel_queue_flush (IdeBuildLogPanel *self)
+{
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  /* Display new lines on the next frame, which only happens when visible */
+  if (self->pending_tick == 0)
+    self->pending_tick = gtk_widget_add_tick_callback (GTK_WIDGET (self),
+                                                       ide_build_log_panel_flush_tick,
+                                                       NULL,
+                                                       NULL);
+}
+
+static void
+ide_build_log_panel_load_previous (IdeBuildLogPanel *self)
+{
+  GtkTextMark *mark;
+  ColorCodeState current_state;
+  ColorCodeState state;
+  GtkTextIter iter;
+  guint store_first;
+  guint first_line;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  store_first = ide_build_log_store_get_first_line (self->store);
+
+  if (self->window_first <= store_first)
+    return;
+
+  first_line = self->window_first - MIN (WINDOW_STEP, self->window_first - store_first);
+
+  self->in_update = TRUE;
+
+  mark = ide_build_log_panel_save_position (self);
+
+  /* Colors in effect at the end of the buffer must survive the insertion */
+  current_state = self->current_color_codes_state;
+  state = self->color_codes_state;
+  color_codes_state_reset (&self->current_color_codes_state);
+  color_codes_state_reset (&self->color_codes_state);
+
+  gtk_text_buffer_get_start_iter (self->buffer, &iter);
+  ide_build_log_panel_load (self, first_line, self->window_first, &iter);
+  self->window_first = first_line;
+
+  self->current_color_codes_state = current_state;
+  self->color_codes_state = state;
+
+  ide_build_log_panel_trim_end (self);
+  ide_build_log_panel_restore_position (self, mark);
+
+  self->in_update = FALSE;
+}
+
+static void
+ide_build_log_panel_load_next (IdeBuildLogPanel *self)
+{
+  GtkTextMark *mark;
+  GtkTextIter iter;
+  guint store_first;
+  guint store_end;
+  guint end_line;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+
+  store_first = ide_build_log_store_get_first_line (self->store);
+  store_end = store_first + ide_build_log_store_get_n_lines (self->store);
+
+  if (self->window_end >= store_end)
+    return;
+
+  self->in_update = TRUE;
+
+  /* The lines after the window may have been dropped meanwhile */
+  if (self->window_end < store_first)
+    {
+      ide_build_log_panel_reset_window (self,
+                                        store_first,
+                                        store_first + MIN (WINDOW_LINES, store_end - store_first));
+      self->in_update = FALSE;
+      return;
+    }
+
+  end_line = self->window_end + MIN (WINDOW_STEP, store_end - self->window_end);
+
+  mark = ide_build_log_panel_save_position (self);
+
+  gtk_text_buffer_get_end_iter (self->buffer, &iter);
+  ide_build_log_panel_load (self, self->window_end, end_line, &iter);
+  self->window_end = end_line;
+
+  ide_build_log_panel_trim_start (self);
+  ide_build_log_panel_restore_position (self, mark);
+
+  self->in_update = FALSE;
+}
+
+static void
+ide_build_log_panel_edge_reached (IdeBuildLogPanel  *self,
+                                  GtkPositionType    pos,
+                                  GtkScrolledWindow *scroller)
+{
+  guint store_end;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (GTK_IS_SCROLLED_WINDOW (scroller));
+
+  if (self->in_update)
+    return;
+
+  if (pos == GTK_POS_TOP)
+    {
+      self->follow = FALSE;
+      ide_build_log_panel_load_previous (self);
+    }
+  else if (pos == GTK_POS_BOTTOM)
+    {
+      store_end = ide_build_log_store_get_first_line (self->store) +
+                  ide_build_log_store_get_n_lines (self->store);
+
+      if (self->window_end < store_end)
+        ide_build_log_panel_load_next (self);
+      else
+        self->follow = TRUE;
+    }
+}
+
+static void
+ide_build_log_panel_value_changed (IdeBuildLogPanel *self,
+                                   GtkAdjustment    *adj)
+{
+  gdouble page_size;
+
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (GTK_IS_ADJUSTMENT (adj));
+
+  if (self->in_update)
+    return;
+
+  /*
+   * Stop following the end of the log once scrolled back. We allow for a
+   * page so that the height estimates changing during layout do not count.
+   */
+  page_size = gtk_adjustment_get_page_size (adj);
+
+  if (gtk_adjustment_get_value (adj) + 2 * page_size < gtk_adjustment_get_upper (adj))
+    self->follow = FALSE;
+}
+
 static void
 ide_build_log_panel_log_observer (IdeBuildLogStream  stream,
                                   const gchar       *message,
@@ -534,22 +938,28 @@ ide_build_log_panel_log_observer (IdeBuildLogStream  stream,
                                   gpointer           user_data)
 {
   IdeBuildLogPanel *self = user_data;
-  GtkTextMark *insert;
-  GtkTextIter iter, enditer;
 
   g_assert (IDE_IS_BUILD_LOG_PANEL (self));
   g_assert (message != NULL);
   g_assert (message_len >= 0);
   g_assert (message[message_len] == '\0');
 
-  gtk_text_buffer_get_end_iter (self->buffer, &iter);
-  ide_build_log_panel_insert_text (self, message, &iter, stream);
+  ide_build_log_store_append (self->store, stream, message, message_len);
 
-  insert = gtk_text_buffer_get_insert (self->buffer);
-  gtk_text_view_scroll_to_mark (self->text_view, insert, 0.0, TRUE, 1.0, 0.0);
+  if (self->follow)
+    ide_build_log_panel_queue_flush (self);
+}
 
-  gtk_text_buffer_get_end_iter (self->buffer, &enditer);
-  gtk_text_buffer_place_cursor (self->buffer, &enditer);
+static void
+ide_build_log_panel_changed_retention (IdeBuildLogPanel *self,
+                                       const gchar      *key,
+                                       GSettings        *settings)
+{
+  g_assert (IDE_IS_BUILD_LOG_PANEL (self));
+  g_assert (g_strcmp0 (key, "log-retention-lines") == 0);
+  g_assert (G_IS_SETTINGS (settings));
+
+  ide_build_log_store_set_max_lines (self->store, g_settings_get_int (settings, key));
 }
 
 void
@@ -623,6 +1033,8 @@ ide_build_log_panel_finalize (GObject *object)
   g_clear_object (&self->pipeline);
   g_clear_object (&self->css);
   g_clear_object (&self->settings);
+  g_clear_object (&self->build_settings);
+  g_clear_pointer (&self->store, ide_build_log_store_free);
 
   g_clear_pointer (&self->color_codes_foreground_tags, g_ptr_array_unref);
   g_clear_pointer (&self->color_codes_background_tags, g_ptr_array_unref);
@@ -638,6 +1050,7 @@ ide_build_log_panel_dispose (GObject *object)
   IdeBuildLogPanel *self = (IdeBuildLogPanel *)object;
 
   ide_build_log_panel_set_pipeline (self, NULL);
+  ide_build_log_panel_cancel_flush (self);
 
   G_OBJECT_CLASS (ide_build_log_panel_parent_class)->dispose (object);
 }
@@ -715,7 +1128,39 @@ ide_build_log_panel_clear_activate (GSimpleAction *action,
   g_assert (G_IS_SIMPLE_ACTION (action));
   g_assert (IDE_IS_BUILD_LOG_PANEL (self));
 
-  gtk_text_buffer_set_text (self->buffer, "", 0);
+  ide_build_log_panel_cancel_flush (self);
+  ide_build_log_store_clear (self->store);
+  ide_build_log_panel_reset_window (self,
+                                    ide_build_log_store_get_first_line (self->store),
+                                    ide_build_log_store_get_first_line (self->store));
+  self->follow = TRUE;
+}
+
+static gboolean
+ide_build_log_panel_save_line (IdeBuildLogStream  stream,
+                               const gchar       *message,
+                               gsize              message_len,
+                               gpointer           user_data)
+{
+  GString *str = user_data;
+
+  g_assert (message != NULL);
+  g_assert (str != NULL);
+
+  /* Only lines with an escape sequence need filtering */
+  if (memchr (message, '\033', message_len) != NULL ||
+      memchr (message, '\\', message_len) != NULL)
+    {
+      g_autofree gchar *filtered = ide_build_utils_color_codes_filtering (message);
+
+      g_string_append (str, filtered);
+    }
+  else
+    g_string_append_len (str, message, message_len);
+
+  g_string_append_c (str, '\n');
+
+  return TRUE;
 }
 
 static void
@@ -745,13 +1190,15 @@ ide_build_log_panel_save_in_file (GSimpleAction *action,
   if (res == GTK_RESPONSE_ACCEPT)
     {
       g_autofree gchar *filename = gtk_file_chooser_get_filename (GTK_FILE_CHOOSER (native));
-      g_autofree gchar *text = NULL;
-      GtkTextIter begin;
-      GtkTextIter end;
+      g_autoptr(GError) error = NULL;
+      GString *str = g_string_new (NULL);
+
+      /* Save everything we retained, not just what is displayed */
+      if (!ide_build_log_store_foreach (self->store, ide_build_log_panel_save_line, str, &error) ||
+          !g_file_set_contents (filename, str->str, str->len, &error))
+        g_warning ("Failed to save build log: %s", error->message);
 
-      gtk_text_buffer_get_bounds (self->buffer, &begin, &end);
-      text = gtk_text_buffer_get_text (self->buffer, &begin, &end, FALSE);
-      g_file_set_contents (filename, text, -1, NULL);
+      g_string_free (str, TRUE);
     }
 
   IDE_EXIT;
@@ -767,6 +1214,7 @@ ide_build_log_panel_init (IdeBuildLogPanel *self)
   g_autoptr(GSimpleActionGroup) actions = NULL;
 
   self->css = gtk_css_provider_new ();
+  self->follow = TRUE;
 
   gtk_widget_init_template (GTK_WIDGET (self));
 
@@ -774,6 +1222,17 @@ ide_build_log_panel_init (IdeBuildLogPanel *self)
 
   ide_build_log_panel_reset_view (self);
 
+  g_signal_connect_object (self->scroller,
+                           "edge-reached",
+                           G_CALLBACK (ide_build_log_panel_edge_reached),
+                           self,
+                           G_CONNECT_SWAPPED);
+  g_signal_connect_object (gtk_scrolled_window_get_vadjustment (self->scroller),
+                           "value-changed",
+                           G_CALLBACK (ide_build_log_panel_value_changed),
+                           self,
+                           G_CONNECT_SWAPPED);
+
   self->settings = g_settings_new ("org.gnome.builder.terminal");
   g_signal_connect_object (self->settings,
                            "changed::font-name",
@@ -782,6 +1241,14 @@ ide_build_log_panel_init (IdeBuildLogPanel *self)
                            G_CONNECT_SWAPPED);
   ide_build_log_panel_changed_font_name (self, "font-name", self->settings);
 
+  self->build_settings = g_settings_new ("org.gnome.builder.build");
+  self->store = ide_build_log_store_new (g_settings_get_int (self->build_settings, "log-retention-lines"));
+  g_signal_connect_object (self->build_settings,
+                           "changed::log-retention-lines",
+                           G_CALLBACK (ide_build_log_panel_changed_retention),
+                           self,
+                           G_CONNECT_SWAPPED);
+
   actions = g_simple_action_group_new ();
   g_action_map_add_action_entries (G_ACTION_MAP (actions), entries, G_N_ELEMENTS (entries), self);
   gtk_widget_insert_action_group (GTK_WIDGET (self), "build-log", G_ACTION_GROUP (actions));
@@ -0,0 +1,530 @@
+/* ide-build-log-store.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-build-log-store"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ide-build-log-store.h"
+
+/*
+ * The build log store keeps the raw build output (including color codes)
+ * for the log panel, which only loads the lines around what is visible.
+ *
+ * Lines are appended to fixed size segments. Only the newest segments are
+ * kept in memory, older segments are spilled to an unlinked temporary file
+ * and only read back when the whole log is needed, such as when saving it.
+ * Once the retention limit is reached, the oldest segments are dropped and
+ * the spill file is compacted when it is mostly made up of dropped data.
+ *
+ * Each line is stored as a byte for the stream followed by the message and
+ * a trailing \0. Lines are addressed by their index since the store was
+ * created, so that an index stays valid as the oldest lines are dropped.
+ */
+
+#define SEGMENT_MAX_LINES  4096
+#define SEGMENT_MAX_BYTES  (256 * 1024)
+#define N_MEMORY_SEGMENTS  4
+#define COPY_BUFFER_SIZE   (64 * 1024)
+
+typedef struct
+{
+  /* The contents of the segment, or NULL if spilled to disk */
+  GByteArray *data;
+  goffset     offset;
+  gsize       length;
+  guint       n_lines;
+} Segment;
+
+struct _IdeBuildLogStore
+{
+  /* Segments, oldest first. Spilled segments always come first. */
+  GQueue   segments;
+
+  guint    first_line;
+  guint    n_lines;
+  guint    max_lines;
+  guint    n_in_memory;
+
+  /*
+   * The spill file, or -1 if we have not needed one yet. Data between
+   * spill_head and spill_tail belongs to live segments, anything before
+   * spill_head belongs to segments that have been dropped.
+   */
+  gint     spill_fd;
+  goffset  spill_head;
+  goffset  spill_tail;
+
+  guint    spill_failed : 1;
+};
+
+static void
+segment_free (gpointer data)
+{
+  Segment *segment = data;
+
+  g_clear_pointer (&segment->data, g_byte_array_unref);
+  g_slice_free (Segment, segment);
+}
+
+static gboolean
+write_all (gint          fd,
+           const guint8 *data,
+           gsize         len,
+           goffset       offset)
+{
+  while (len > 0)
+    {
+      gssize n_written = pwrite (fd, data, len, offset);
+
+      if (n_written < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          return FALSE;
+        }
+
+      data += n_written;
+      len -= n_written;
+      offset += n_written;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+read_all (gint     fd,
+          guint8  *data,
+          gsize    len,
+          goffset  offset)
+{
+  while (len > 0)
+    {
+      gssize n_read = pread (fd, data, len, offset);
+
+      if (n_read < 0 && errno == EINTR)
+        continue;
+
+      if (n_read <= 0)
+        return FALSE;
+
+      data += n_read;
+      len -= n_read;
+      offset += n_read;
+    }
+
+  return TRUE;
+}
+
+static gboolean
+ide_build_log_store_open_spill (IdeBuildLogStore *self)
+{
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+
+  g_assert (self != NULL);
+
+  if (self->spill_fd != -1)
+    return TRUE;
+
+  if (self->spill_failed)
+    return FALSE;
+
+  self->spill_fd = g_file_open_tmp ("gnome-builder-build-log-XXXXXX", &path, &error);
+
+  if (self->spill_fd == -1)
+    {
+      /* Keep everything in memory, the retention limit still applies */
+      g_warning ("Failed to create build log spill file: %s", error->message);
+      self->spill_failed = TRUE;
+      return FALSE;
+    }
+
+  /* Nobody else needs to see the file, and it goes away with us */
+  g_unlink (path);
+
+  return TRUE;
+}
+
+static void
+ide_build_log_store_spill (IdeBuildLogStore *self)
+{
+  g_assert (self != NULL);
+
+  while (self->n_in_memory > N_MEMORY_SEGMENTS)
+    {
+      Segment *segment = NULL;
+
+      for (GList *iter = self->segments.head; iter != NULL; iter = iter->next)
+        {
+          segment = iter->data;
+          if (segment->data != NULL)
+            break;
+        }
+
+      g_assert (segment != NULL);
+      g_assert (segment->data != NULL);
+
+      if (!ide_build_log_store_open_spill (self))
+        return;
+
+      if (!write_all (self->spill_fd, segment->data->data, segment->data->len, self->spill_tail))
+        {
+          g_warning ("Failed to write build log spill file: %s", g_strerror (errno));
+          return;
+        }
+
+      segment->offset = self->spill_tail;
+      segment->length = segment->data->len;
+      g_clear_pointer (&segment->data, g_byte_array_unref);
+
+      self->spill_tail += segment->length;
+      self->n_in_memory--;
+    }
+}
+
+/*
+ * Moves the live data to the start of the spill file once more than half of
+ * the file belongs to dropped segments. As the live data is then smaller than
+ * the dropped data in front of it, the copy never overlaps itself.
+ */
+static void
+ide_build_log_store_compact (IdeBuildLogStore *self)
+{
+  g_autofree guint8 *buffer = NULL;
+  goffset live;
+
+  g_assert (self != NULL);
+
+  live = self->spill_tail - self->spill_head;
+
+  if (self->spill_fd == -1 || self->spill_head < live || self->spill_head == 0)
+    return;
+
+  buffer = g_malloc (COPY_BUFFER_SIZE);
+
+  for (goffset pos = 0; pos < live; pos += COPY_BUFFER_SIZE)
+    {
+      gsize len = MIN (COPY_BUFFER_SIZE, live - pos);
+
+      if (!read_all (self->spill_fd, buffer, len, self->spill_head + pos) ||
+          !write_all (self->spill_fd, buffer, len, pos))
+        {
+          g_warning ("Failed to compact build log spill file: %s", g_strerror (errno));
+          return;
+        }
+    }
+
+  for (GList *iter = self->segments.head; iter != NULL; iter = iter->next)
+    {
+      Segment *segment = iter->data;
+
+      if (segment->data != NULL)
+        break;
+
+      segment->offset -= self->spill_head;
+    }
+
+  if (ftruncate (self->spill_fd, live) != 0)
+    g_debug ("Failed to truncate build log spill file: %s", g_strerror (errno));
+
+  self->spill_head = 0;
+  self->spill_tail = live;
+}
+
+static void
+ide_build_log_store_trim (IdeBuildLogStore *self)
+{
+  gboolean dropped_spilled = FALSE;
+
+  g_assert (self != NULL);
+
+  /* Always keep the segment being appended to */
+  while (self->n_lines > self->max_lines && self->segments.length > 1)
+    {
+      Segment *segment = g_queue_pop_head (&self->segments);
+
+      self->first_line += segment->n_lines;
+      self->n_lines -= segment->n_lines;
+
+      if (segment->data == NULL)
+        {
+          self->spill_head = segment->offset + segment->length;
+          dropped_spilled = TRUE;
+        }
+      else
+        self->n_in_memory--;
+
+      segment_free (segment);
+    }
+
+  if (dropped_spilled)
+    ide_build_log_store_compact (self);
+}
+
+/**
+ * ide_build_log_store_new:
+ * @max_lines: the number of lines to retain
+ *
+ * Creates a new store for build output which keeps approximately the
+ * most recent @max_lines lines.
+ *
+ * Returns: (transfer full): an #IdeBuildLogStore
+ */
+IdeBuildLogStore *
+ide_build_log_store_new (guint max_lines)
+{
+  IdeBuildLogStore *self;
+
+  self = g_slice_new0 (IdeBuildLogStore);
+  g_queue_init (&self->segments);
+  self->max_lines = MAX (max_lines, 1);
+  self->spill_fd = -1;
+
+  return self;
+}
+
+void
+ide_build_log_store_free (IdeBuildLogStore *self)
+{
+  if (self != NULL)
+    {
+      g_queue_foreach (&self->segments, (GFunc)segment_free, NULL);
+      g_queue_clear (&self->segments);
+
+      if (self->spill_fd != -1)
+        close (self->spill_fd);
+
+      g_slice_free (IdeBuildLogStore, self);
+    }
+}
+
+guint
+ide_build_log_store_get_max_lines (IdeBuildLogStore *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->max_lines;
+}
+
+void
+ide_build_log_store_set_max_lines (IdeBuildLogStore *self,
+                                   guint             max_lines)
+{
+  g_return_if_fail (self != NULL);
+
+  self->max_lines = MAX (max_lines, 1);
+
+  ide_build_log_store_trim (self);
+}
+
+/**
+ * ide_build_log_store_get_first_line:
+ * @self: an #IdeBuildLogStore
+ *
+ * Gets the index of the oldest retained line. Retained lines are indexed
+ * from this up to (but not including) this plus the number of lines.
+ *
+ * Returns: the index of the oldest line
+ */
+guint
+ide_build_log_store_get_first_line (IdeBuildLogStore *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->first_line;
+}
+
+guint
+ide_build_log_store_get_n_lines (IdeBuildLogStore *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_lines;
+}
+
+void
+ide_build_log_store_append (IdeBuildLogStore  *self,
+                            IdeBuildLogStream  stream,
+                            const gchar       *message,
+                            gsize              message_len)
+{
+  Segment *segment;
+  guint8 stream_byte = stream;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (message != NULL);
+
+  segment = g_queue_peek_tail (&self->segments);
+
+  if (segment == NULL ||
+      segment->data == NULL ||
+      segment->n_lines >= SEGMENT_MAX_LINES ||
+      segment->data->len >= SEGMENT_MAX_BYTES)
+    {
+      segment = g_slice_new0 (Segment);
+      segment->data = g_byte_array_sized_new (SEGMENT_MAX_BYTES / 4);
+      g_queue_push_tail (&self->segments, segment);
+      self->n_in_memory++;
+
+      ide_build_log_store_spill (self);
+    }
+
+  g_byte_array_append (segment->data, &stream_byte, 1);
+  g_byte_array_append (segment->data, (const guint8 *)message, message_len);
+  g_byte_array_append (segment->data, (const guint8 *)"", 1);
+
+  segment->n_lines++;
+  self->n_lines++;
+
+  ide_build_log_store_trim (self);
+}
+
+void
+ide_build_log_store_clear (IdeBuildLogStore *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_queue_foreach (&self->segments, (GFunc)segment_free, NULL);
+  g_queue_clear (&self->segments);
+
+  self->first_line += self->n_lines;
+  self->n_lines = 0;
+  self->n_in_memory = 0;
+  self->spill_head = 0;
+  self->spill_tail = 0;
+
+  if (self->spill_fd != -1 && ftruncate (self->spill_fd, 0) != 0)
+    g_debug ("Failed to truncate build log spill file: %s", g_strerror (errno));
+}
+
+/**
+ * ide_build_log_store_foreach:
+ * @self: an #IdeBuildLogStore
+ * @func: (scope call): a function to call for each line
+ * @user_data: closure data for @func
+ * @error: a location for a #GError, or %NULL
+ *
+ * Calls @func for each retained line, oldest first, reading spilled
+ * segments back from disk as necessary. Iteration stops early if @func
+ * returns %FALSE.
+ *
+ * Returns: %TRUE unless reading the spill file failed.
+ */
+gboolean
+ide_build_log_store_foreach (IdeBuildLogStore      *self,
+                             IdeBuildLogStoreFunc   func,
+                             gpointer               user_data,
+                             GError               **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  return ide_build_log_store_foreach_range (self, self->first_line, self->n_lines, func, user_data, error);
+}
+
+/**
+ * ide_build_log_store_foreach_range:
+ * @self: an #IdeBuildLogStore
+ * @first_line: the index of the first line
+ * @n_lines: the number of lines
+ * @func: (scope call): a function to call for each line
+ * @user_data: closure data for @func
+ * @error: a location for a #GError, or %NULL
+ *
+ * Like ide_build_log_store_foreach() but only for the lines from
+ * @first_line to @first_line + @n_lines that are still retained. Only the
+ * segments containing those lines are read back from disk.
+ *
+ * Returns: %TRUE unless reading the spill file failed.
+ */
+gboolean
+ide_build_log_store_foreach_range (IdeBuildLogStore      *self,
+                                   guint                  first_line,
+                                   guint                  n_lines,
+                                   IdeBuildLogStoreFunc   func,
+                                   gpointer               user_data,
+                                   GError               **error)
+{
+  guint segment_first;
+  guint end_line;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+
+  segment_first = self->first_line;
+  end_line = first_line + MIN (n_lines, G_MAXUINT - first_line);
+
+  for (GList *iter = self->segments.head;
+       iter != NULL && segment_first < end_line;
+       iter = iter->next)
+    {
+      Segment *segment = iter->data;
+      g_autofree guint8 *spilled = NULL;
+      guint line = segment_first;
+      const gchar *pos;
+      const gchar *end;
+
+      segment_first += segment->n_lines;
+
+      /* Skip segments entirely before the range without reading them */
+      if (segment_first <= first_line)
+        continue;
+
+      if (segment->data != NULL)
+        {
+          pos = (const gchar *)segment->data->data;
+          end = pos + segment->data->len;
+        }
+      else
+        {
+          spilled = g_malloc (segment->length);
+
+          if (!read_all (self->spill_fd, spilled, segment->length, segment->offset))
+            {
+              int errsv = errno;
+
+              g_set_error (error,
+                           G_IO_ERROR,
+                           g_io_error_from_errno (errsv),
+                           "Failed to read build log: %s",
+                           g_strerror (errsv));
+              return FALSE;
+            }
+
+          pos = (const gchar *)spilled;
+          end = pos + segment->length;
+        }
+
+      for (; pos < end && line < end_line; line++)
+        {
+          IdeBuildLogStream stream = *pos++;
+          gsize len = strlen (pos);
+
+          if (line >= first_line && !func (stream, pos, len, user_data))
+            return TRUE;
+
+          pos += len + 1;
+        }
+    }
+
+  return TRUE;
+}
@@ -0,0 +1,58 @@
+/* ide-build-log-store.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_BUILD_LOG_STORE_H
+#define IDE_BUILD_LOG_STORE_H
+
+#include <ide.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeBuildLogStore IdeBuildLogStore;
+
+typedef gboolean (*IdeBuildLogStoreFunc) (IdeBuildLogStream  stream,
+                                          const gchar       *message,
+                                          gsize              message_len,
+                                          gpointer           user_data);
+
+IdeBuildLogStore *ide_build_log_store_new            (guint                   max_lines);
+void              ide_build_log_store_free           (IdeBuildLogStore       *self);
+guint             ide_build_log_store_get_max_lines  (IdeBuildLogStore       *self);
+void              ide_build_log_store_set_max_lines  (IdeBuildLogStore       *self,
+                                                      guint                   max_lines);
+guint             ide_build_log_store_get_first_line (IdeBuildLogStore       *self);
+guint             ide_build_log_store_get_n_lines    (IdeBuildLogStore       *self);
+void              ide_build_log_store_append         (IdeBuildLogStore       *self,
+                                                      IdeBuildLogStream       stream,
+                                                      const gchar            *message,
+                                                      gsize                   message_len);
+void              ide_build_log_store_clear          (IdeBuildLogStore       *self);
+gboolean          ide_build_log_store_foreach        (IdeBuildLogStore       *self,
+                                                      IdeBuildLogStoreFunc    func,
+                                                      gpointer                user_data,
+                                                      GError                **error);
+gboolean          ide_build_log_store_foreach_range  (IdeBuildLogStore       *self,
+                                                      guint                   first_line,
+                                                      guint                   n_lines,
+                                                      IdeBuildLogStoreFunc    func,
+                                                      gpointer                user_data,
+                                                      GError                **error);
+
+G_END_DECLS
+
+#endif /* IDE_BUILD_LOG_STORE_H */
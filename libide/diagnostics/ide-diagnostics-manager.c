@@ -31,8 +31,28 @@
 #include "diagnostics/ide-diagnostics.h"
 #include "diagnostics/ide-diagnostics-manager.h"
 #include "plugins/ide-extension-set-adapter.h"
+#include "util/ide-battery-monitor.h"
 
-#define DEFAULT_DIAGNOSE_DELAY 100
+#define DEFAULT_DIAGNOSE_DELAY     100
+#define MAX_DIAGNOSE_DELAY         1000
+#define MAX_IN_FLIGHT_PER_PROVIDER 2
+
+typedef struct
+{
+  /*
+   * The number of diagnoses currently running for a given provider type,
+   * across all of the groups. We use this to avoid starting a diagnosis
+   * for every open buffer at once when many buffers change together.
+   */
+  guint in_flight;
+
+  /*
+   * A moving average of how long the provider type takes to complete a
+   * diagnosis, in microseconds. Slow providers widen the delay before we
+   * diagnose again so that more changes are coalesced into one request.
+   */
+  gint64 latency;
+} IdeDiagnosticsProviderStats;
 
 typedef struct
 {
@@ -89,6 +109,15 @@ typedef struct
    */
   guint in_diagnose;
 
+  /*
+   * The monotonic time at which a diagnose was last requested, and at
+   * which the current diagnosis started. The former is used to prefer
+   * recently edited files when scheduling, the latter to measure how
+   * long each provider takes.
+   */
+  gint64 queued_at;
+  gint64 begin_time;
+
   /*
    * If we need a diagnose this bit will be set. If we complete a
    * diagnosis and this bit is set, then we will automatically queue
@@ -130,6 +159,19 @@ struct _IdeDiagnosticsManager
    * we can coalesce the dispatch of everything at the same time.
    */
   guint queued_diagnose_source;
+
+  /*
+   * This hashtable contains a mapping of the GType of a provider to
+   * the IdeDiagnosticsProviderStats for all providers of that type.
+   */
+  GHashTable *stats_by_type;
+
+  /*
+   * This bit is set when a group could not be diagnosed because its
+   * providers were already busy. The next completion will schedule
+   * another pass so that the group is not forgotten.
+   */
+  guint has_deferred : 1;
 };
 
 enum {
@@ -152,6 +194,7 @@ static void     ide_diagnostics_manager_add_diagnostic    (IdeDiagnosticsManager
                                                            IdeDiagnostic         *diagnostic);
 static void     ide_diagnostics_group_queue_diagnose      (IdeDiagnosticsGroup   *group,
                                                            IdeDiagnosticsManager *self);
+static void     ide_diagnostics_manager_queue_begin       (IdeDiagnosticsManager *self);
 
 
 static GParamSpec *properties [N_PROPS];
@@ -171,6 +214,31 @@ free_diagnostics (gpointer data)
     ide_diagnostics_unref (diagnostics);
 }
 
+static void
+ide_diagnostics_provider_stats_free (gpointer data)
+{
+  g_slice_free (IdeDiagnosticsProviderStats, data);
+}
+
+static IdeDiagnosticsProviderStats *
+ide_diagnostics_manager_get_stats (IdeDiagnosticsManager *self,
+                                   GType                  provider_type)
+{
+  IdeDiagnosticsProviderStats *stats;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  stats = g_hash_table_lookup (self->stats_by_type, GSIZE_TO_POINTER (provider_type));
+
+  if (stats == NULL)
+    {
+      stats = g_slice_new0 (IdeDiagnosticsProviderStats);
+      g_hash_table_insert (self->stats_by_type, GSIZE_TO_POINTER (provider_type), stats);
+    }
+
+  return stats;
+}
+
 static void
 ide_diagnostics_group_free (gpointer data)
 {
@@ -306,8 +374,10 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
   g_autoptr(IdeDiagnosticsManager) self = user_data;
   g_autoptr(IdeDiagnostics) diagnostics = NULL;
   g_autoptr(GError) error = NULL;
+  IdeDiagnosticsProviderStats *stats;
   IdeDiagnosticsGroup *group;
   gboolean changed;
+  gint64 elapsed;
 
   IDE_ENTRY;
 
@@ -365,6 +435,25 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
 
   group->in_diagnose--;
 
+  /*
+   * Release our slot for this provider type and fold the time it took into
+   * the average. Providers within a group all start at the same time, so
+   * the group's begin time is the start of this provider's diagnosis too.
+   */
+  stats = ide_diagnostics_manager_get_stats (self, G_OBJECT_TYPE (provider));
+  g_assert (stats->in_flight > 0);
+  stats->in_flight--;
+
+  elapsed = g_get_monotonic_time () - group->begin_time;
+
+  if (stats->latency == 0)
+    stats->latency = elapsed;
+  else
+    stats->latency = (stats->latency * 3 + elapsed) / 4;
+
+  IDE_TRACE_MSG ("%s completed in %"G_GINT64_FORMAT" usec (average %"G_GINT64_FORMAT")",
+                 G_OBJECT_TYPE_NAME (provider), elapsed, stats->latency);
+
   /*
    * Ensure we increment our sequence number even when no diagnostics were
    * reported. This ensures that the gutter gets cleared and line-flags
@@ -397,9 +486,15 @@ ide_diagnostics_group_diagnose_cb (GObject      *object,
     {
       group->was_removed = TRUE;
       g_hash_table_remove (self->groups_by_file, group->file);
-      IDE_EXIT;
     }
 
+  /*
+   * Now that a slot has been released, give groups that were waiting on
+   * this provider a chance to run.
+   */
+  if (self->has_deferred)
+    ide_diagnostics_manager_queue_begin (self);
+
   IDE_EXIT;
 }
 
@@ -426,6 +521,8 @@ ide_diagnostics_group_diagnose_foreach (IdeExtensionSetAdapter *adapter,
   group = g_object_get_data (G_OBJECT (provider), "IDE_DIAGNOSTICS_GROUP");
   group->in_diagnose++;
 
+  ide_diagnostics_manager_get_stats (self, G_OBJECT_TYPE (provider))->in_flight++;
+
   context = ide_object_get_context (IDE_OBJECT (self));
 
   file = g_object_new (IDE_TYPE_FILE,
@@ -465,6 +562,7 @@ ide_diagnostics_group_diagnose (IdeDiagnosticsGroup   *group,
 
   group->needs_diagnose = FALSE;
   group->has_diagnostics = FALSE;
+  group->begin_time = g_get_monotonic_time ();
 
   /*
    * We need to ensure that all the diagnostic providers have access to the
@@ -483,10 +581,110 @@ ide_diagnostics_group_diagnose (IdeDiagnosticsGroup   *group,
   IDE_EXIT;
 }
 
+typedef struct
+{
+  IdeDiagnosticsManager *self;
+  guint                  max_in_flight;
+  gboolean               has_capacity;
+} CapacityCheck;
+
+static void
+ide_diagnostics_group_check_capacity_foreach (IdeExtensionSetAdapter *adapter,
+                                              PeasPluginInfo         *plugin_info,
+                                              PeasExtension          *exten,
+                                              gpointer                user_data)
+{
+  CapacityCheck *check = user_data;
+  IdeDiagnosticsProviderStats *stats;
+
+  g_assert (IDE_IS_EXTENSION_SET_ADAPTER (adapter));
+  g_assert (IDE_IS_DIAGNOSTIC_PROVIDER (exten));
+  g_assert (check != NULL);
+
+  stats = ide_diagnostics_manager_get_stats (check->self, G_OBJECT_TYPE (exten));
+
+  if (stats->in_flight >= check->max_in_flight)
+    check->has_capacity = FALSE;
+}
+
+static gboolean
+ide_diagnostics_group_has_capacity (IdeDiagnosticsGroup   *group,
+                                    IdeDiagnosticsManager *self)
+{
+  CapacityCheck check = { self, MAX_IN_FLIGHT_PER_PROVIDER, TRUE };
+
+  g_assert (group != NULL);
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+  g_assert (IDE_IS_EXTENSION_SET_ADAPTER (group->adapter));
+
+  /*
+   * A group is diagnosed by all of its providers at once, so we only start
+   * it if none of them are saturated. When we are asked to conserve power,
+   * we only allow a single diagnosis per provider at a time.
+   */
+  if (ide_battery_monitor_get_should_conserve ())
+    check.max_in_flight = 1;
+
+  ide_extension_set_adapter_foreach (group->adapter,
+                                     ide_diagnostics_group_check_capacity_foreach,
+                                     &check);
+
+  return check.has_capacity;
+}
+
+static gint
+ide_diagnostics_group_compare_priority (gconstpointer a,
+                                        gconstpointer b,
+                                        gpointer      user_data)
+{
+  IdeDiagnosticsGroup *group_a = *(IdeDiagnosticsGroup **)a;
+  IdeDiagnosticsGroup *group_b = *(IdeDiagnosticsGroup **)b;
+  IdeDiagnosticsGroup *focus_group = user_data;
+
+  /*
+   * The group for the buffer the user is looking at always goes first,
+   * followed by the most recently changed files, as those are the most
+   * likely to still be visible.
+   */
+  if (group_a == focus_group)
+    return -1;
+  else if (group_b == focus_group)
+    return 1;
+  else if (group_a->queued_at > group_b->queued_at)
+    return -1;
+  else if (group_a->queued_at < group_b->queued_at)
+    return 1;
+  else
+    return 0;
+}
+
+static IdeDiagnosticsGroup *
+ide_diagnostics_manager_get_focus_group (IdeDiagnosticsManager *self)
+{
+  IdeBufferManager *buffer_manager;
+  IdeContext *context;
+  IdeBuffer *buffer;
+  IdeFile *ifile;
+  GFile *gfile;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  buffer_manager = ide_context_get_buffer_manager (context);
+
+  if (NULL == (buffer = ide_buffer_manager_get_focus_buffer (buffer_manager)) ||
+      NULL == (ifile = ide_buffer_get_file (buffer)) ||
+      NULL == (gfile = ide_file_get_file (ifile)))
+    return NULL;
+
+  return g_hash_table_lookup (self->groups_by_file, gfile);
+}
+
 static gboolean
 ide_diagnostics_manager_begin_diagnose (gpointer data)
 {
   IdeDiagnosticsManager *self = data;
+  g_autoptr(GPtrArray) ready = NULL;
   GHashTableIter iter;
   gpointer value;
 
@@ -495,6 +693,15 @@ ide_diagnostics_manager_begin_diagnose (gpointer data)
   g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
 
   self->queued_diagnose_source = 0;
+  self->has_deferred = FALSE;
+
+  /*
+   * Collect the groups that are ready to be diagnosed and start them in
+   * order of priority. Groups whose providers are already busy are left
+   * alone with needs_diagnose set, and will be picked up again when one of
+   * the running diagnoses completes.
+   */
+  ready = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostics_group_unref);
 
   g_hash_table_iter_init (&iter, self->groups_by_file);
 
@@ -503,12 +710,78 @@ ide_diagnostics_manager_begin_diagnose (gpointer data)
       IdeDiagnosticsGroup *group = value;
 
       if (group->needs_diagnose && group->adapter != NULL && group->in_diagnose == 0)
+        g_ptr_array_add (ready, ide_diagnostics_group_ref (group));
+    }
+
+  g_ptr_array_sort_with_data (ready,
+                              ide_diagnostics_group_compare_priority,
+                              ide_diagnostics_manager_get_focus_group (self));
+
+  for (guint i = 0; i < ready->len; i++)
+    {
+      IdeDiagnosticsGroup *group = g_ptr_array_index (ready, i);
+
+      /* The adapter may have been released by a previous diagnosis */
+      if (group->was_removed || group->adapter == NULL)
+        continue;
+
+      if (ide_diagnostics_group_has_capacity (group, self))
         ide_diagnostics_group_diagnose (group, self);
+      else
+        self->has_deferred = TRUE;
     }
 
   IDE_RETURN (G_SOURCE_REMOVE);
 }
 
+static guint
+ide_diagnostics_manager_get_delay (IdeDiagnosticsManager *self)
+{
+  GHashTableIter iter;
+  gpointer value;
+  gint64 latency = 0;
+  guint delay;
+
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  /*
+   * There is little point in diagnosing more often than our slowest
+   * provider can keep up with, so we wait for about half of its average
+   * run time. That coalesces more changes into a single diagnosis without
+   * delaying fast providers such as those that run in-process.
+   */
+  g_hash_table_iter_init (&iter, self->stats_by_type);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      IdeDiagnosticsProviderStats *stats = value;
+
+      latency = MAX (latency, stats->latency);
+    }
+
+  delay = CLAMP (latency / 2000, DEFAULT_DIAGNOSE_DELAY, MAX_DIAGNOSE_DELAY);
+
+  if (ide_battery_monitor_get_should_conserve ())
+    delay *= 4;
+  else if (ide_battery_monitor_get_on_battery ())
+    delay *= 2;
+
+  return delay;
+}
+
+static void
+ide_diagnostics_manager_queue_begin (IdeDiagnosticsManager *self)
+{
+  g_assert (IDE_IS_DIAGNOSTICS_MANAGER (self));
+
+  if (self->queued_diagnose_source == 0)
+    self->queued_diagnose_source = g_timeout_add_full (G_PRIORITY_LOW,
+                                                       ide_diagnostics_manager_get_delay (self),
+                                                       ide_diagnostics_manager_begin_diagnose,
+                                                       g_object_ref (self),
+                                                       g_object_unref);
+}
+
 static void
 ide_diagnostics_group_queue_diagnose (IdeDiagnosticsGroup   *group,
                                       IdeDiagnosticsManager *self)
@@ -523,13 +796,10 @@ ide_diagnostics_group_queue_diagnose (IdeDiagnosticsGroup   *group,
    */
 
   group->needs_diagnose = TRUE;
+  group->queued_at = g_get_monotonic_time ();
 
-  if (group->in_diagnose == 0 && self->queued_diagnose_source == 0)
-    self->queued_diagnose_source = g_timeout_add_full (G_PRIORITY_LOW,
-                                                       DEFAULT_DIAGNOSE_DELAY,
-                                                       ide_diagnostics_manager_begin_diagnose,
-                                                       g_object_ref (self),
-                                                       g_object_unref);
+  if (group->in_diagnose == 0)
+    ide_diagnostics_manager_queue_begin (self);
 }
 
 static void
@@ -539,6 +809,7 @@ ide_diagnostics_manager_finalize (GObject *object)
 
   ide_clear_source (&self->queued_diagnose_source);
   g_clear_pointer (&self->groups_by_file, g_hash_table_unref);
+  g_clear_pointer (&self->stats_by_type, g_hash_table_unref);
 
   G_OBJECT_CLASS (ide_diagnostics_manager_parent_class)->finalize (object);
 }
@@ -600,6 +871,10 @@ ide_diagnostics_manager_init (IdeDiagnosticsManager *self)
                                                 (GEqualFunc)g_file_equal,
                                                 NULL,
                                                 (GDestroyNotify)ide_diagnostics_group_unref);
+  self->stats_by_type = g_hash_table_new_full (NULL,
+                                               NULL,
+                                               NULL,
+                                               ide_diagnostics_provider_stats_free);
 }
 
 static void
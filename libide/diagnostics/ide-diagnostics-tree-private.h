@@ -0,0 +1,74 @@
+/* ide-diagnostics-tree-private.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_DIAGNOSTICS_TREE_PRIVATE_H
+#define IDE_DIAGNOSTICS_TREE_PRIVATE_H
+
+#include "diagnostics/ide-diagnostic.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The part of a diagnostic an entry was created for. This is either
+ * IDE_DIAGNOSTICS_TREE_LOCATION for the location of the diagnostic, or
+ * the index of one of its ranges.
+ */
+#define IDE_DIAGNOSTICS_TREE_LOCATION (-1)
+
+typedef struct _IdeDiagnosticsTree IdeDiagnosticsTree;
+
+typedef void     (*IdeDiagnosticsTreeForeach) (IdeDiagnostic *diagnostic,
+                                               gint           part,
+                                               guint          begin_line,
+                                               guint          end_line,
+                                               gpointer       user_data);
+typedef gboolean (*IdeDiagnosticsTreeFilter)  (IdeDiagnostic *diagnostic,
+                                               gint           part,
+                                               guint          begin_line,
+                                               guint          end_line,
+                                               gpointer       user_data);
+
+IdeDiagnosticsTree *ide_diagnostics_tree_new              (void);
+void                ide_diagnostics_tree_free             (IdeDiagnosticsTree        *self);
+guint               ide_diagnostics_tree_get_size         (IdeDiagnosticsTree        *self);
+gboolean            ide_diagnostics_tree_contains         (IdeDiagnosticsTree        *self,
+                                                           IdeDiagnostic             *diagnostic);
+void                ide_diagnostics_tree_insert           (IdeDiagnosticsTree        *self,
+                                                           IdeDiagnostic             *diagnostic,
+                                                           gint                       part,
+                                                           guint                      begin_line,
+                                                           guint                      end_line);
+guint               ide_diagnostics_tree_remove_if        (IdeDiagnosticsTree        *self,
+                                                           IdeDiagnosticsTreeFilter   filter,
+                                                           gpointer                   user_data);
+void                ide_diagnostics_tree_clear            (IdeDiagnosticsTree        *self);
+void                ide_diagnostics_tree_foreach_in_range (IdeDiagnosticsTree        *self,
+                                                           guint                      first_line,
+                                                           guint                      last_line,
+                                                           IdeDiagnosticsTreeForeach  func,
+                                                           gpointer                   user_data);
+void                ide_diagnostics_tree_insert_lines     (IdeDiagnosticsTree        *self,
+                                                           guint                      line,
+                                                           guint                      n_lines);
+void                ide_diagnostics_tree_delete_lines     (IdeDiagnosticsTree        *self,
+                                                           guint                      line,
+                                                           guint                      n_lines);
+
+G_END_DECLS
+
+#endif /* IDE_DIAGNOSTICS_TREE_PRIVATE_H */
@@ -0,0 +1,645 @@
+/* ide-diagnostics-tree.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-diagnostics-tree"
+
+#include "diagnostics/ide-diagnostics-tree-private.h"
+
+/*
+ * IdeDiagnosticsTree is an interval tree of the lines covered by the
+ * diagnostics of a buffer. It is implemented as a treap, where every node
+ * is keyed by the first line of its interval and additionally tracks the
+ * last line of any interval within its subtree so that we can skip over
+ * subtrees which cannot overlap the lines we are looking for.
+ *
+ * The first line of a node is stored relative to its parent (the root
+ * stores an absolute line). That allows us to move every diagnostic after
+ * a given line by splitting the tree and adjusting a single node, so
+ * keeping the diagnostics in place while the user edits the buffer does
+ * not require visiting every node.
+ */
+
+typedef struct _Node Node;
+
+struct _Node
+{
+  Node          *left;
+  Node          *right;
+  IdeDiagnostic *diagnostic;
+  guint32        priority;
+  gint           part;
+
+  /* The first line, relative to the parent's first line */
+  gint           offset;
+
+  /* The number of lines after the first line covered by the node */
+  gint           span;
+
+  /* The last line covered within the subtree, relative to our first line */
+  gint           max_end;
+};
+
+struct _IdeDiagnosticsTree
+{
+  Node       *root;
+
+  /* The number of nodes for each diagnostic within the tree */
+  GHashTable *counts;
+
+  guint       size;
+  guint32     seed;
+};
+
+static guint32
+ide_diagnostics_tree_next_priority (IdeDiagnosticsTree *self)
+{
+  /* xorshift32, we only need the priorities to be well distributed */
+  self->seed ^= self->seed << 13;
+  self->seed ^= self->seed >> 17;
+  self->seed ^= self->seed << 5;
+
+  return self->seed;
+}
+
+static void
+node_update (Node *node)
+{
+  gint max_end = node->span;
+
+  if (node->left != NULL)
+    max_end = MAX (max_end, node->left->offset + node->left->max_end);
+
+  if (node->right != NULL)
+    max_end = MAX (max_end, node->right->offset + node->right->max_end);
+
+  node->max_end = max_end;
+}
+
+/*
+ * The following detach a child from @node, converting the child's first
+ * line to an absolute line so it can be treated as a tree of its own,
+ * and attach such a tree back as a child of @node.
+ */
+
+static inline Node *
+node_take_left (Node *node)
+{
+  Node *child = node->left;
+
+  node->left = NULL;
+  if (child != NULL)
+    child->offset += node->offset;
+
+  return child;
+}
+
+static inline Node *
+node_take_right (Node *node)
+{
+  Node *child = node->right;
+
+  node->right = NULL;
+  if (child != NULL)
+    child->offset += node->offset;
+
+  return child;
+}
+
+static inline void
+node_set_left (Node *node,
+               Node *child)
+{
+  if (child != NULL)
+    child->offset -= node->offset;
+  node->left = child;
+}
+
+static inline void
+node_set_right (Node *node,
+                Node *child)
+{
+  if (child != NULL)
+    child->offset -= node->offset;
+  node->right = child;
+}
+
+static void
+ide_diagnostics_tree_release (IdeDiagnosticsTree *self,
+                              Node               *node)
+{
+  guint count;
+
+  g_assert (self != NULL);
+  g_assert (node != NULL);
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->counts, node->diagnostic));
+
+  if (count > 1)
+    g_hash_table_insert (self->counts, node->diagnostic, GUINT_TO_POINTER (count - 1));
+  else
+    g_hash_table_remove (self->counts, node->diagnostic);
+
+  self->size--;
+
+  ide_diagnostic_unref (node->diagnostic);
+  g_slice_free (Node, node);
+}
+
+static void
+node_free_all (Node *node)
+{
+  if (node != NULL)
+    {
+      node_free_all (node->left);
+      node_free_all (node->right);
+      ide_diagnostic_unref (node->diagnostic);
+      g_slice_free (Node, node);
+    }
+}
+
+/*
+ * Joins two trees where every node of @left starts on or before the first
+ * line of every node of @right.
+ */
+static Node *
+tree_merge (Node *left,
+            Node *right)
+{
+  if (left == NULL)
+    return right;
+
+  if (right == NULL)
+    return left;
+
+  if (left->priority > right->priority)
+    {
+      node_set_right (left, tree_merge (node_take_right (left), right));
+      node_update (left);
+      return left;
+    }
+  else
+    {
+      node_set_left (right, tree_merge (left, node_take_left (right)));
+      node_update (right);
+      return right;
+    }
+}
+
+/*
+ * Splits @tree into the nodes starting before @line and those starting
+ * on or after @line.
+ */
+static void
+tree_split (Node  *tree,
+            gint   line,
+            Node **left,
+            Node **right)
+{
+  Node *a;
+  Node *b;
+
+  if (tree == NULL)
+    {
+      *left = NULL;
+      *right = NULL;
+      return;
+    }
+
+  if (tree->offset < line)
+    {
+      tree_split (node_take_right (tree), line, &a, &b);
+      node_set_right (tree, a);
+      node_update (tree);
+      *left = tree;
+      *right = b;
+    }
+  else
+    {
+      tree_split (node_take_left (tree), line, &a, &b);
+      node_set_left (tree, b);
+      node_update (tree);
+      *left = a;
+      *right = tree;
+    }
+}
+
+/* Grows every interval containing @line by @n_lines */
+static void
+tree_extend (Node *tree,
+             gint  base,
+             gint  line,
+             gint  n_lines)
+{
+  gint begin;
+
+  if (tree == NULL)
+    return;
+
+  begin = base + tree->offset;
+
+  if (begin + tree->max_end < line)
+    return;
+
+  tree_extend (tree->left, begin, line, n_lines);
+  tree_extend (tree->right, begin, line, n_lines);
+
+  if (begin < line && begin + tree->span >= line)
+    tree->span += n_lines;
+
+  node_update (tree);
+}
+
+static inline gint
+collapse_line (gint line,
+               gint first,
+               gint n_lines)
+{
+  if (line <= first)
+    return line;
+  else if (line <= first + n_lines)
+    return first;
+  else
+    return line - n_lines;
+}
+
+/*
+ * Updates the end of every interval extending past @first after the
+ * @n_lines lines following @first were deleted. Every node within @tree
+ * starts on or before @first.
+ */
+static void
+tree_collapse (Node *tree,
+               gint  base,
+               gint  first,
+               gint  n_lines)
+{
+  gint begin;
+
+  if (tree == NULL)
+    return;
+
+  begin = base + tree->offset;
+
+  if (begin + tree->max_end <= first)
+    return;
+
+  tree_collapse (tree->left, begin, first, n_lines);
+  tree_collapse (tree->right, begin, first, n_lines);
+
+  tree->span = collapse_line (begin + tree->span, first, n_lines) - begin;
+
+  node_update (tree);
+}
+
+/*
+ * Flattens @tree into @nodes while moving every node to @first, as all of
+ * the nodes within @tree started on one of the deleted lines.
+ */
+static void
+tree_flatten_collapsed (Node      *tree,
+                        gint       base,
+                        gint       first,
+                        gint       n_lines,
+                        GPtrArray *nodes)
+{
+  Node *left;
+  Node *right;
+  gint begin;
+
+  if (tree == NULL)
+    return;
+
+  begin = base + tree->offset;
+  left = tree->left;
+  right = tree->right;
+
+  tree_flatten_collapsed (left, begin, first, n_lines, nodes);
+
+  tree->span = collapse_line (begin + tree->span, first, n_lines) - first;
+  tree->offset = first;
+  tree->left = NULL;
+  tree->right = NULL;
+  node_update (tree);
+
+  g_ptr_array_add (nodes, tree);
+
+  tree_flatten_collapsed (right, begin, first, n_lines, nodes);
+}
+
+static Node *
+tree_remove_if (IdeDiagnosticsTree       *self,
+                Node                     *tree,
+                IdeDiagnosticsTreeFilter  filter,
+                gpointer                  user_data,
+                guint                    *n_removed)
+{
+  Node *left;
+  Node *right;
+
+  if (tree == NULL)
+    return NULL;
+
+  left = tree_remove_if (self, node_take_left (tree), filter, user_data, n_removed);
+  right = tree_remove_if (self, node_take_right (tree), filter, user_data, n_removed);
+
+  if (filter (tree->diagnostic, tree->part, tree->offset, tree->offset + tree->span, user_data))
+    {
+      ide_diagnostics_tree_release (self, tree);
+      (*n_removed)++;
+      return tree_merge (left, right);
+    }
+
+  node_set_left (tree, left);
+  node_set_right (tree, right);
+  node_update (tree);
+
+  return tree;
+}
+
+static void
+tree_foreach_in_range (Node                      *tree,
+                       gint                       base,
+                       gint                       first,
+                       gint                       last,
+                       IdeDiagnosticsTreeForeach  func,
+                       gpointer                   user_data)
+{
+  gint begin;
+
+  if (tree == NULL)
+    return;
+
+  begin = base + tree->offset;
+
+  if (begin + tree->max_end < first)
+    return;
+
+  tree_foreach_in_range (tree->left, begin, first, last, func, user_data);
+
+  /* Everything to the right starts after us */
+  if (begin > last)
+    return;
+
+  if (begin + tree->span >= first)
+    func (tree->diagnostic, tree->part, begin, begin + tree->span, user_data);
+
+  tree_foreach_in_range (tree->right, begin, first, last, func, user_data);
+}
+
+IdeDiagnosticsTree *
+ide_diagnostics_tree_new (void)
+{
+  IdeDiagnosticsTree *self;
+
+  self = g_slice_new0 (IdeDiagnosticsTree);
+  self->counts = g_hash_table_new (NULL, NULL);
+  self->seed = 2463534242u;
+
+  return self;
+}
+
+void
+ide_diagnostics_tree_free (IdeDiagnosticsTree *self)
+{
+  if (self != NULL)
+    {
+      node_free_all (self->root);
+      g_hash_table_unref (self->counts);
+      g_slice_free (IdeDiagnosticsTree, self);
+    }
+}
+
+guint
+ide_diagnostics_tree_get_size (IdeDiagnosticsTree *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->size;
+}
+
+/**
+ * ide_diagnostics_tree_contains:
+ * @self: an #IdeDiagnosticsTree
+ * @diagnostic: an #IdeDiagnostic
+ *
+ * Checks if any part of @diagnostic has been inserted into the tree.
+ *
+ * Returns: %TRUE if @diagnostic is within the tree.
+ */
+gboolean
+ide_diagnostics_tree_contains (IdeDiagnosticsTree *self,
+                               IdeDiagnostic      *diagnostic)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (diagnostic != NULL, FALSE);
+
+  return g_hash_table_contains (self->counts, diagnostic);
+}
+
+/**
+ * ide_diagnostics_tree_insert:
+ * @self: an #IdeDiagnosticsTree
+ * @diagnostic: an #IdeDiagnostic
+ * @part: %IDE_DIAGNOSTICS_TREE_LOCATION or the index of a range
+ * @begin_line: the first line covered
+ * @end_line: the last line covered
+ *
+ * Adds the lines covered by @part of @diagnostic to the tree. A diagnostic
+ * may be inserted once for each of its parts.
+ */
+void
+ide_diagnostics_tree_insert (IdeDiagnosticsTree *self,
+                             IdeDiagnostic      *diagnostic,
+                             gint                part,
+                             guint               begin_line,
+                             guint               end_line)
+{
+  Node *node;
+  Node *left;
+  Node *right;
+  guint count;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (diagnostic != NULL);
+  g_return_if_fail (begin_line <= G_MAXINT);
+  g_return_if_fail (end_line <= G_MAXINT);
+
+  node = g_slice_new0 (Node);
+  node->diagnostic = ide_diagnostic_ref (diagnostic);
+  node->priority = ide_diagnostics_tree_next_priority (self);
+  node->part = part;
+  node->offset = MIN (begin_line, end_line);
+  node->span = MAX (begin_line, end_line) - node->offset;
+  node_update (node);
+
+  tree_split (self->root, node->offset, &left, &right);
+  self->root = tree_merge (tree_merge (left, node), right);
+
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->counts, diagnostic));
+  g_hash_table_insert (self->counts, diagnostic, GUINT_TO_POINTER (count + 1));
+
+  self->size++;
+}
+
+/**
+ * ide_diagnostics_tree_remove_if:
+ * @self: an #IdeDiagnosticsTree
+ * @filter: (scope call): a function returning %TRUE for entries to remove
+ * @user_data: closure data for @filter
+ *
+ * Removes every entry for which @filter returns %TRUE. @filter is given
+ * the current lines of the entry and must not modify the tree.
+ *
+ * Returns: the number of entries removed.
+ */
+guint
+ide_diagnostics_tree_remove_if (IdeDiagnosticsTree       *self,
+                                IdeDiagnosticsTreeFilter  filter,
+                                gpointer                  user_data)
+{
+  guint n_removed = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (filter != NULL, 0);
+
+  self->root = tree_remove_if (self, self->root, filter, user_data, &n_removed);
+
+  return n_removed;
+}
+
+void
+ide_diagnostics_tree_clear (IdeDiagnosticsTree *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_clear_pointer (&self->root, node_free_all);
+  g_hash_table_remove_all (self->counts);
+  self->size = 0;
+}
+
+/**
+ * ide_diagnostics_tree_foreach_in_range:
+ * @self: an #IdeDiagnosticsTree
+ * @first_line: the first line of the range
+ * @last_line: the last line of the range
+ * @func: (scope call): a function to call for each entry
+ * @user_data: closure data for @func
+ *
+ * Calls @func for every entry overlapping the lines from @first_line to
+ * @last_line (inclusive), ordered by their first line.
+ */
+void
+ide_diagnostics_tree_foreach_in_range (IdeDiagnosticsTree        *self,
+                                       guint                      first_line,
+                                       guint                      last_line,
+                                       IdeDiagnosticsTreeForeach  func,
+                                       gpointer                   user_data)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  if (first_line > last_line)
+    return;
+
+  tree_foreach_in_range (self->root,
+                         0,
+                         MIN (first_line, G_MAXINT),
+                         MIN (last_line, G_MAXINT),
+                         func,
+                         user_data);
+}
+
+/**
+ * ide_diagnostics_tree_insert_lines:
+ * @self: an #IdeDiagnosticsTree
+ * @line: the line at which lines were inserted
+ * @n_lines: the number of lines inserted
+ *
+ * Moves every entry starting on or after @line down by @n_lines, and grows
+ * the entries which started before @line but extend onto it.
+ */
+void
+ide_diagnostics_tree_insert_lines (IdeDiagnosticsTree *self,
+                                   guint               line,
+                                   guint               n_lines)
+{
+  Node *left;
+  Node *right;
+
+  g_return_if_fail (self != NULL);
+
+  if (n_lines == 0 || self->root == NULL)
+    return;
+
+  tree_split (self->root, line, &left, &right);
+
+  if (right != NULL)
+    right->offset += n_lines;
+
+  tree_extend (left, 0, line, n_lines);
+
+  self->root = tree_merge (left, right);
+}
+
+/**
+ * ide_diagnostics_tree_delete_lines:
+ * @self: an #IdeDiagnosticsTree
+ * @line: the line the deleted lines were joined with
+ * @n_lines: the number of lines deleted
+ *
+ * Updates the tree after the @n_lines lines following @line have been
+ * joined with @line. Entries on the deleted lines move to @line and those
+ * after them move up by @n_lines.
+ */
+void
+ide_diagnostics_tree_delete_lines (IdeDiagnosticsTree *self,
+                                   guint               line,
+                                   guint               n_lines)
+{
+  g_autoptr(GPtrArray) nodes = NULL;
+  Node *before;
+  Node *deleted;
+  Node *after;
+  Node *rest;
+
+  g_return_if_fail (self != NULL);
+
+  if (n_lines == 0 || self->root == NULL)
+    return;
+
+  tree_split (self->root, line + 1, &before, &rest);
+  tree_split (rest, line + n_lines + 1, &deleted, &after);
+
+  if (after != NULL)
+    after->offset -= n_lines;
+
+  tree_collapse (before, 0, line, n_lines);
+
+  /*
+   * Everything that started on a deleted line now starts on @line, so we
+   * rebuild that part of the tree. It is usually a handful of nodes.
+   */
+  nodes = g_ptr_array_new ();
+  tree_flatten_collapsed (deleted, 0, line, n_lines, nodes);
+
+  deleted = NULL;
+  for (guint i = 0; i < nodes->len; i++)
+    deleted = tree_merge (deleted, g_ptr_array_index (nodes, i));
+
+  self->root = tree_merge (tree_merge (before, deleted), after);
+}
@@ -29,8 +29,69 @@
 #include "highlighting/ide-highlight-engine.h"
 #include "plugins/ide-extension-adapter.h"
 
-#define HIGHLIGHT_QUANTA_USEC 5000
-#define PRIVATE_TAG_PREFIX    "gb-private-tag"
+#define HIGHLIGHT_QUANTA_USEC  5000
+#define HIGHLIGHT_WINDOW_LINES 100
+#define HIGHLIGHT_RUNS_CHUNK   4096
+#define MAX_DIRTY_RANGES       32
+#define MAX_RUNS_EDITS         64
+#define PRIVATE_TAG_PREFIX     "gb-private-tag"
+
+/*
+ * Runs computed by a threaded highlighter that are waiting to be applied
+ * to the buffer. The window around the cursor is applied first, then the
+ * rest of the region in chunks of HIGHLIGHT_RUNS_CHUNK characters.
+ */
+typedef struct
+{
+  GArray     *runs;
+  GHashTable *tags;
+  guint       begin;
+  guint       end;
+  guint       window_begin;
+  guint       window_end;
+  guint       cursor;
+  guint       pos;
+  guint       window_done : 1;
+} PendingRuns;
+
+/*
+ * A region of the buffer that needs to be highlighted. The marks keep the
+ * range up to date as the buffer is edited.
+ */
+typedef struct
+{
+  GtkTextMark *begin;
+  GtkTextMark *end;
+} DirtyRange;
+
+/*
+ * The region of the buffer shown by a single view. Each view of the buffer
+ * reports its own range so that split views do not fight over it.
+ */
+typedef struct
+{
+  gconstpointer  view;
+  GtkTextMark   *begin;
+  GtkTextMark   *end;
+} VisibleRange;
+
+/*
+ * An edit made to the buffer while runs were being computed, in the
+ * coordinates of the buffer right before the edit.
+ */
+typedef struct
+{
+  guint offset;
+  guint n_deleted;
+  guint n_inserted;
+} RunsEdit;
+
+typedef struct
+{
+  IdeHighlighter       *highlighter;
+  IdeHighlightSnapshot *snapshot;
+  guint                 change_seq;
+} RunsRequest;
 
 struct _IdeHighlightEngine
 {
@@ -43,17 +104,28 @@ struct _IdeHighlightEngine
 
   IdeExtensionAdapter *extension;
 
-  GtkTextMark         *invalid_begin;
-  GtkTextMark         *invalid_end;
+  /* Array of DirtyRange, disjoint and never touching each other */
+  GArray              *dirty;
+
+  /* Array of VisibleRange, the most recently updated view is last */
+  GArray              *visible;
 
   GSList              *private_tags;
   GSList              *public_tags;
 
   gint64               quanta_expiration;
 
+  GCancellable        *runs_cancellable;
+  PendingRuns         *pending;
+
+  /* Array of RunsEdit since the in-flight snapshot was taken, or NULL */
+  GArray              *runs_edits;
+  guint                change_seq;
+
   guint                work_timeout;
 
   guint                enabled : 1;
+  guint                runs_in_flight : 1;
 };
 
 G_DEFINE_TYPE (IdeHighlightEngine, ide_highlight_engine, IDE_TYPE_OBJECT)
@@ -68,6 +140,8 @@ enum {
 static GParamSpec *properties [LAST_PROP];
 static GQuark      engineQuark;
 
+static void ide_highlight_engine_queue_work (IdeHighlightEngine *self);
+
 static gboolean
 get_invalidation_area (GtkTextIter *begin,
                        GtkTextIter *end)
@@ -212,87 +286,848 @@ sync_tag_style (GtkSourceStyleScheme *style_scheme,
   if (italic_set && italic)
     g_object_set (tag, "style", PANGO_STYLE_ITALIC, NULL);
 
-  if (underline_set && underline)
-    g_object_set (tag, "underline", PANGO_UNDERLINE_SINGLE, NULL);
+  if (underline_set && underline)
+    g_object_set (tag, "underline", PANGO_UNDERLINE_SINGLE, NULL);
+}
+
+static GtkTextTag *
+create_tag_from_style (IdeHighlightEngine *self,
+                       const gchar        *style_name)
+{
+  GtkSourceStyleScheme *style_scheme;
+  GtkTextTag *tag;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (IDE_IS_BUFFER (self->buffer));
+  g_assert (style_name != NULL);
+
+  tag = gtk_text_buffer_create_tag (GTK_TEXT_BUFFER (self->buffer), style_name, NULL);
+  gtk_text_tag_set_priority (tag, 0);
+  style_scheme = gtk_source_buffer_get_style_scheme (GTK_SOURCE_BUFFER (self->buffer));
+  sync_tag_style (style_scheme, tag);
+
+  return tag;
+}
+
+GtkTextTag *
+get_tag_from_style (IdeHighlightEngine *self,
+                    const gchar        *style_name,
+                    gboolean            private_tag)
+{
+  GtkTextTagTable *tag_table;
+  GtkTextTag *tag;
+  g_autofree gchar *tmp_style_name = NULL;
+
+  g_return_val_if_fail (IDE_IS_HIGHLIGHT_ENGINE (self), NULL);
+  g_return_val_if_fail (style_name != NULL, NULL);
+
+  /*
+   * If is private tag prepend the PRIVATE_TAG_PREFIX (gb-private-tag)
+   * to the string.This is used because tag name is the key used
+   * for saving tags in GtkTextTagTable and we dont want conflicts between
+   * public and private tags.
+   */
+  if (private_tag)
+    tmp_style_name = g_strdup_printf ("%s:%s", PRIVATE_TAG_PREFIX, style_name);
+  else
+    tmp_style_name = g_strdup (style_name);
+
+  tag_table = gtk_text_buffer_get_tag_table (GTK_TEXT_BUFFER (self->buffer));
+  tag = gtk_text_tag_table_lookup (tag_table, tmp_style_name);
+
+  if (tag == NULL)
+    {
+      tag = create_tag_from_style (self, tmp_style_name);
+      if (private_tag)
+        self->private_tags = g_slist_prepend (self->private_tags, tag);
+      else
+        self->public_tags = g_slist_prepend (self->public_tags, tag);
+    }
+
+  return tag;
+}
+
+
+static IdeHighlightResult
+ide_highlight_engine_apply_style (const GtkTextIter *begin,
+                                  const GtkTextIter *end,
+                                  const gchar       *style_name)
+{
+  IdeHighlightEngine *self;
+  GtkTextBuffer *buffer;
+  GtkTextTag *tag;
+
+  buffer = gtk_text_iter_get_buffer (begin);
+  self = g_object_get_qdata (G_OBJECT (buffer), engineQuark);
+  tag = get_tag_from_style (self, style_name, TRUE);
+
+  gtk_text_buffer_apply_tag (buffer, tag, begin, end);
+
+  if (g_get_monotonic_time () >= self->quanta_expiration)
+    return IDE_HIGHLIGHT_STOP;
+
+  return IDE_HIGHLIGHT_CONTINUE;
+}
+
+static void
+visible_range_clear (gpointer data)
+{
+  VisibleRange *range = data;
+  GtkTextBuffer *buffer;
+
+  if ((buffer = gtk_text_mark_get_buffer (range->begin)))
+    gtk_text_buffer_delete_mark (buffer, range->begin);
+
+  if ((buffer = gtk_text_mark_get_buffer (range->end)))
+    gtk_text_buffer_delete_mark (buffer, range->end);
+}
+
+static void
+dirty_range_clear (gpointer data)
+{
+  DirtyRange *range = data;
+  GtkTextBuffer *buffer;
+
+  if ((buffer = gtk_text_mark_get_buffer (range->begin)))
+    gtk_text_buffer_delete_mark (buffer, range->begin);
+
+  if ((buffer = gtk_text_mark_get_buffer (range->end)))
+    gtk_text_buffer_delete_mark (buffer, range->end);
+}
+
+static void
+dirty_range_get_bounds (const DirtyRange *range,
+                        GtkTextIter      *begin,
+                        GtkTextIter      *end)
+{
+  GtkTextBuffer *buffer = gtk_text_mark_get_buffer (range->begin);
+
+  gtk_text_buffer_get_iter_at_mark (buffer, begin, range->begin);
+  gtk_text_buffer_get_iter_at_mark (buffer, end, range->end);
+}
+
+static void
+ide_highlight_engine_add_dirty (IdeHighlightEngine *self,
+                                const GtkTextIter  *begin,
+                                const GtkTextIter  *end)
+{
+  GtkTextBuffer *buffer;
+  GtkTextIter merged_begin = *begin;
+  GtkTextIter merged_end = *end;
+  DirtyRange range;
+  gboolean collapse;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (self->dirty != NULL);
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+
+  /*
+   * Fold every range we touch into the new one. If there are too many
+   * ranges to track, give up and collapse them all into one.
+   */
+  collapse = self->dirty->len >= MAX_DIRTY_RANGES;
+
+  for (guint i = self->dirty->len; i > 0; i--)
+    {
+      const DirtyRange *other = &g_array_index (self->dirty, DirtyRange, i - 1);
+      GtkTextIter other_begin;
+      GtkTextIter other_end;
+
+      dirty_range_get_bounds (other, &other_begin, &other_end);
+
+      if (!collapse &&
+          (gtk_text_iter_compare (&other_end, &merged_begin) < 0 ||
+           gtk_text_iter_compare (&other_begin, &merged_end) > 0))
+        continue;
+
+      if (gtk_text_iter_compare (&other_begin, &merged_begin) < 0)
+        merged_begin = other_begin;
+
+      if (gtk_text_iter_compare (&other_end, &merged_end) > 0)
+        merged_end = other_end;
+
+      g_array_remove_index_fast (self->dirty, i - 1);
+    }
+
+  range.begin = gtk_text_buffer_create_mark (buffer, NULL, &merged_begin, TRUE);
+  range.end = gtk_text_buffer_create_mark (buffer, NULL, &merged_end, FALSE);
+  g_array_append_val (self->dirty, range);
+}
+
+static void
+ide_highlight_engine_clear_dirty (IdeHighlightEngine *self,
+                                  const GtkTextIter  *begin,
+                                  const GtkTextIter  *end)
+{
+  GtkTextBuffer *buffer;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (self->dirty != NULL);
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+
+  for (guint i = self->dirty->len; i > 0; i--)
+    {
+      DirtyRange *range = &g_array_index (self->dirty, DirtyRange, i - 1);
+      GtkTextIter range_begin;
+      GtkTextIter range_end;
+
+      dirty_range_get_bounds (range, &range_begin, &range_end);
+
+      if (gtk_text_iter_compare (&range_end, begin) <= 0 ||
+          gtk_text_iter_compare (&range_begin, end) >= 0)
+        continue;
+
+      if (gtk_text_iter_compare (&range_begin, begin) < 0 &&
+          gtk_text_iter_compare (&range_end, end) > 0)
+        {
+          DirtyRange tail;
+
+          /* Cleared the middle of the range, split it in two */
+          tail.begin = gtk_text_buffer_create_mark (buffer, NULL, end, TRUE);
+          tail.end = gtk_text_buffer_create_mark (buffer, NULL, &range_end, FALSE);
+          gtk_text_buffer_move_mark (buffer, range->end, begin);
+          g_array_append_val (self->dirty, tail);
+        }
+      else if (gtk_text_iter_compare (&range_begin, begin) < 0)
+        gtk_text_buffer_move_mark (buffer, range->end, begin);
+      else if (gtk_text_iter_compare (&range_end, end) > 0)
+        gtk_text_buffer_move_mark (buffer, range->begin, end);
+      else
+        g_array_remove_index_fast (self->dirty, i - 1);
+    }
+}
+
+static void
+ide_highlight_engine_reset_dirty (IdeHighlightEngine *self)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (self->buffer != NULL);
+
+  g_array_set_size (self->dirty, 0);
+
+  gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (self->buffer), &begin, &end);
+  ide_highlight_engine_add_dirty (self, &begin, &end);
+}
+
+static void
+visible_range_get_bounds (const VisibleRange *range,
+                          GtkTextIter        *begin,
+                          GtkTextIter        *end)
+{
+  GtkTextBuffer *buffer = gtk_text_mark_get_buffer (range->begin);
+
+  gtk_text_buffer_get_iter_at_mark (buffer, begin, range->begin);
+  gtk_text_buffer_get_iter_at_mark (buffer, end, range->end);
+}
+
+/*
+ * Gets the range shown by the view that was most recently scrolled, which
+ * is the best guess we have for where the user is looking.
+ */
+static gboolean
+ide_highlight_engine_get_visible (IdeHighlightEngine *self,
+                                  GtkTextIter        *begin,
+                                  GtkTextIter        *end)
+{
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if (self->visible == NULL || self->visible->len == 0)
+    return FALSE;
+
+  visible_range_get_bounds (&g_array_index (self->visible, VisibleRange, self->visible->len - 1),
+                            begin, end);
+
+  return TRUE;
+}
+
+/*
+ * Gets the distance in characters from @begin..@end to the nearest range
+ * shown by any view. If the region is on screen, 0 is returned and the
+ * region is clipped to the view it overlaps.
+ */
+static guint
+ide_highlight_engine_distance_to_visible (IdeHighlightEngine *self,
+                                          GtkTextIter        *begin,
+                                          GtkTextIter        *end)
+{
+  guint best = G_MAXUINT;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (begin != NULL);
+  g_assert (end != NULL);
+
+  if (self->visible == NULL || self->visible->len == 0)
+    return gtk_text_iter_get_offset (begin);
+
+  for (guint i = self->visible->len; i > 0; i--)
+    {
+      const VisibleRange *range = &g_array_index (self->visible, VisibleRange, i - 1);
+      GtkTextIter visible_begin;
+      GtkTextIter visible_end;
+      guint distance;
+
+      visible_range_get_bounds (range, &visible_begin, &visible_end);
+
+      if (gtk_text_iter_compare (begin, &visible_end) >= 0)
+        distance = gtk_text_iter_get_offset (begin) - gtk_text_iter_get_offset (&visible_end);
+      else if (gtk_text_iter_compare (end, &visible_begin) <= 0)
+        distance = gtk_text_iter_get_offset (&visible_begin) - gtk_text_iter_get_offset (end);
+      else
+        {
+          if (gtk_text_iter_compare (begin, &visible_begin) < 0)
+            *begin = visible_begin;
+
+          if (gtk_text_iter_compare (end, &visible_end) > 0)
+            *end = visible_end;
+
+          return 0;
+        }
+
+      best = MIN (best, distance);
+    }
+
+  return best;
+}
+
+/*
+ * Locates the next region to highlight. Dirty regions on screen come
+ * first, clipped to the visible area, followed by whatever is closest to
+ * the visible area. Returns %TRUE if the region is on screen.
+ */
+static gboolean
+ide_highlight_engine_get_next_dirty (IdeHighlightEngine *self,
+                                     GtkTextIter        *begin,
+                                     GtkTextIter        *end,
+                                     gboolean           *visible)
+{
+  guint best_distance = G_MAXUINT;
+  gint best = -1;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (begin != NULL);
+  g_assert (end != NULL);
+
+  if (visible != NULL)
+    *visible = FALSE;
+
+  for (guint i = self->dirty->len; i > 0; i--)
+    {
+      const DirtyRange *range = &g_array_index (self->dirty, DirtyRange, i - 1);
+      GtkTextIter range_begin;
+      GtkTextIter range_end;
+      guint distance;
+
+      dirty_range_get_bounds (range, &range_begin, &range_end);
+
+      /* Deletions can leave empty ranges behind */
+      if (gtk_text_iter_compare (&range_begin, &range_end) >= 0)
+        {
+          g_array_remove_index_fast (self->dirty, i - 1);
+          continue;
+        }
+
+      distance = ide_highlight_engine_distance_to_visible (self, &range_begin, &range_end);
+
+      if (distance == 0)
+        {
+          *begin = range_begin;
+          *end = range_end;
+
+          if (visible != NULL)
+            *visible = TRUE;
+
+          return TRUE;
+        }
+
+      if (distance < best_distance)
+        {
+          best_distance = distance;
+          best = i - 1;
+        }
+    }
+
+  if (best < 0)
+    return FALSE;
+
+  dirty_range_get_bounds (&g_array_index (self->dirty, DirtyRange, best), begin, end);
+
+  return TRUE;
+}
+
+static void
+pending_runs_free (gpointer data)
+{
+  PendingRuns *pending = data;
+
+  g_clear_pointer (&pending->runs, g_array_unref);
+  g_clear_pointer (&pending->tags, g_hash_table_unref);
+  g_slice_free (PendingRuns, pending);
+}
+
+static void
+runs_request_free (gpointer data)
+{
+  RunsRequest *request = data;
+
+  g_clear_object (&request->highlighter);
+  g_clear_pointer (&request->snapshot, ide_highlight_snapshot_unref);
+  g_slice_free (RunsRequest, request);
+}
+
+static void
+ide_highlight_engine_cancel_runs (IdeHighlightEngine *self)
+{
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  /* Any result still in flight is now stale */
+  self->change_seq++;
+  self->runs_in_flight = FALSE;
+
+  g_cancellable_cancel (self->runs_cancellable);
+  g_clear_object (&self->runs_cancellable);
+  g_clear_pointer (&self->pending, pending_runs_free);
+  g_clear_pointer (&self->runs_edits, g_array_unref);
+}
+
+static inline guint
+runs_edit_map_begin (const RunsEdit *edit,
+                     guint           offset)
+{
+  if (offset <= edit->offset)
+    return offset;
+  else if (offset >= edit->offset + edit->n_deleted)
+    return offset - edit->n_deleted + edit->n_inserted;
+  else
+    return edit->offset;
+}
+
+static inline guint
+runs_edit_map_end (const RunsEdit *edit,
+                   guint           offset)
+{
+  if (offset <= edit->offset)
+    return offset;
+  else if (offset >= edit->offset + edit->n_deleted)
+    return offset - edit->n_deleted + edit->n_inserted;
+  else
+    return edit->offset + edit->n_inserted;
+}
+
+/*
+ * Moves @runs, computed before @edits were made, to where their text is
+ * now. Runs touching an edit are dropped, the edit is dirty anyway and
+ * will be highlighted again.
+ */
+static void
+runs_edits_remap (GArray *edits,
+                  GArray *runs)
+{
+  guint j = 0;
+
+  g_assert (edits != NULL);
+  g_assert (runs != NULL);
+
+  for (guint i = 0; i < runs->len; i++)
+    {
+      IdeHighlightRun run = g_array_index (runs, IdeHighlightRun, i);
+      gboolean keep = TRUE;
+
+      for (guint k = 0; keep && k < edits->len; k++)
+        {
+          const RunsEdit *edit = &g_array_index (edits, RunsEdit, k);
+
+          if (run.offset + run.length <= edit->offset)
+            continue;
+          else if (run.offset >= edit->offset + edit->n_deleted)
+            run.offset = run.offset - edit->n_deleted + edit->n_inserted;
+          else
+            keep = FALSE;
+        }
+
+      if (keep)
+        g_array_index (runs, IdeHighlightRun, j++) = run;
+    }
+
+  g_array_set_size (runs, j);
+}
+
+static GtkTextTag *
+pending_runs_get_tag (IdeHighlightEngine *self,
+                      PendingRuns        *pending,
+                      const gchar        *style_name)
+{
+  GtkTextTag *tag;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (pending != NULL);
+  g_assert (style_name != NULL);
+
+  /* Style names are static strings, so the pointer is a fine key */
+  if (NULL == (tag = g_hash_table_lookup (pending->tags, style_name)))
+    {
+      tag = get_tag_from_style (self, style_name, TRUE);
+      g_hash_table_insert (pending->tags, (gchar *)style_name, tag);
+    }
+
+  return tag;
+}
+
+static guint
+pending_runs_search (PendingRuns *pending,
+                     guint        offset)
+{
+  guint lo = 0;
+  guint hi = pending->runs->len;
+
+  g_assert (pending != NULL);
+
+  /* Find the first run that ends after @offset */
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+      const IdeHighlightRun *run = &g_array_index (pending->runs, IdeHighlightRun, mid);
+
+      if (run->offset + run->length <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static guint
+ide_highlight_engine_apply_runs (IdeHighlightEngine *self,
+                                 PendingRuns        *pending,
+                                 guint               pos,
+                                 guint               begin,
+                                 guint               end,
+                                 guint              *real_end)
+{
+  GtkTextBuffer *buffer;
+  GtkTextIter iter_begin;
+  GtkTextIter iter_end;
+  guint limit = end;
+  guint last = pos;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (pending != NULL);
+  g_assert (begin <= end);
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+
+  /* Extend the range so that we never split a run in half */
+  for (; last < pending->runs->len; last++)
+    {
+      const IdeHighlightRun *run = &g_array_index (pending->runs, IdeHighlightRun, last);
+
+      if (run->offset >= end)
+        break;
+
+      limit = MAX (limit, run->offset + run->length);
+    }
+
+  gtk_text_buffer_get_iter_at_offset (buffer, &iter_begin, begin);
+  gtk_text_buffer_get_iter_at_offset (buffer, &iter_end, limit);
+
+  for (const GSList *iter = self->private_tags; iter; iter = iter->next)
+    gtk_text_buffer_remove_tag (buffer, iter->data, &iter_begin, &iter_end);
+
+  for (guint i = pos; i < last; i++)
+    {
+      const IdeHighlightRun *run = &g_array_index (pending->runs, IdeHighlightRun, i);
+      GtkTextTag *tag = pending_runs_get_tag (self, pending, run->style_name);
+
+      gtk_text_iter_set_offset (&iter_begin, run->offset);
+      iter_end = iter_begin;
+      gtk_text_iter_forward_chars (&iter_end, run->length);
+
+      gtk_text_buffer_apply_tag (buffer, tag, &iter_begin, &iter_end);
+    }
+
+  if (real_end != NULL)
+    *real_end = limit;
+
+  return last;
+}
+
+/*
+ * Applies the next batch of pending runs. Returns %TRUE if there is more
+ * to apply after the current time slice has expired.
+ */
+static gboolean
+ide_highlight_engine_apply_pending (IdeHighlightEngine *self)
+{
+  PendingRuns *pending = self->pending;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (pending != NULL);
+
+  if (!pending->window_done)
+    {
+      guint begin = MAX (pending->begin, pending->window_begin);
+      guint end = MIN (pending->end, pending->window_end);
+
+      if (begin < end)
+        ide_highlight_engine_apply_runs (self,
+                                         pending,
+                                         pending_runs_search (pending, begin),
+                                         begin,
+                                         end,
+                                         NULL);
+
+      pending->window_done = TRUE;
+    }
+
+  while (pending->cursor < pending->end)
+    {
+      guint chunk_end;
+
+      if (pending->cursor >= pending->window_begin && pending->cursor < pending->window_end)
+        {
+          pending->cursor = pending->window_end;
+          pending->pos = pending_runs_search (pending, pending->cursor);
+          continue;
+        }
+
+      chunk_end = MIN (pending->cursor + HIGHLIGHT_RUNS_CHUNK, pending->end);
+
+      if (pending->cursor < pending->window_begin && chunk_end > pending->window_begin)
+        chunk_end = pending->window_begin;
+
+      pending->pos = ide_highlight_engine_apply_runs (self,
+                                                      pending,
+                                                      pending->pos,
+                                                      pending->cursor,
+                                                      chunk_end,
+                                                      &pending->cursor);
+
+      if (g_get_monotonic_time () >= self->quanta_expiration)
+        return pending->cursor < pending->end;
+    }
+
+  return FALSE;
+}
+
+static void
+ide_highlight_engine_get_window (IdeHighlightEngine *self,
+                                 guint              *begin,
+                                 guint              *end)
+{
+  GtkTextBuffer *buffer;
+  GtkTextIter iter;
+  GtkTextIter iter_end;
+  gint line;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (begin != NULL);
+  g_assert (end != NULL);
+
+  if (ide_highlight_engine_get_visible (self, &iter, &iter_end))
+    {
+      *begin = gtk_text_iter_get_offset (&iter);
+      *end = gtk_text_iter_get_offset (&iter_end);
+      return;
+    }
+
+  /*
+   * Until a view tells us what is on screen, the lines around the
+   * insertion cursor are the best guess we have.
+   */
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+  gtk_text_buffer_get_iter_at_mark (buffer, &iter, gtk_text_buffer_get_insert (buffer));
+  line = gtk_text_iter_get_line (&iter);
+
+  gtk_text_buffer_get_iter_at_line (buffer, &iter, MAX (0, line - HIGHLIGHT_WINDOW_LINES));
+  *begin = gtk_text_iter_get_offset (&iter);
+
+  gtk_text_buffer_get_iter_at_line (buffer, &iter, line + HIGHLIGHT_WINDOW_LINES);
+  if (!gtk_text_iter_ends_line (&iter))
+    gtk_text_iter_forward_to_line_end (&iter);
+  *end = gtk_text_iter_get_offset (&iter);
+}
+
+static void
+ide_highlight_engine_runs_worker (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  RunsRequest *request = task_data;
+  GArray *runs;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (source_object));
+  g_assert (request != NULL);
+  g_assert (IDE_IS_HIGHLIGHTER (request->highlighter));
+  g_assert (request->snapshot != NULL);
+
+  runs = ide_highlighter_compute_runs (request->highlighter, request->snapshot, cancellable);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      g_clear_pointer (&runs, g_array_unref);
+      return;
+    }
+
+  if (runs == NULL)
+    runs = g_array_new (FALSE, FALSE, sizeof (IdeHighlightRun));
+
+  g_task_return_pointer (task, runs, (GDestroyNotify)g_array_unref);
 }
 
-static GtkTextTag *
-create_tag_from_style (IdeHighlightEngine *self,
-                       const gchar        *style_name)
+static void
+ide_highlight_engine_runs_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
 {
-  GtkSourceStyleScheme *style_scheme;
-  GtkTextTag *tag;
+  IdeHighlightEngine *self = (IdeHighlightEngine *)object;
+  g_autoptr(GArray) runs = NULL;
+  g_autoptr(GArray) edits = NULL;
+  GTask *task = (GTask *)result;
+  GtkTextBuffer *buffer;
+  PendingRuns *pending;
+  RunsRequest *request;
+  GtkTextIter begin;
+  GtkTextIter end;
+
+  IDE_ENTRY;
 
   g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
-  g_assert (IDE_IS_BUFFER (self->buffer));
-  g_assert (style_name != NULL);
+  g_assert (G_IS_TASK (task));
 
-  tag = gtk_text_buffer_create_tag (GTK_TEXT_BUFFER (self->buffer), style_name, NULL);
-  gtk_text_tag_set_priority (tag, 0);
-  style_scheme = gtk_source_buffer_get_style_scheme (GTK_SOURCE_BUFFER (self->buffer));
-  sync_tag_style (style_scheme, tag);
+  /* Ignore results from requests that were cancelled and replaced */
+  if (g_task_get_cancellable (task) != self->runs_cancellable)
+    IDE_EXIT;
 
-  return tag;
-}
+  self->runs_in_flight = FALSE;
+  g_clear_object (&self->runs_cancellable);
+  edits = g_steal_pointer (&self->runs_edits);
 
-GtkTextTag *
-get_tag_from_style (IdeHighlightEngine *self,
-                    const gchar        *style_name,
-                    gboolean            private_tag)
-{
-  GtkTextTagTable *tag_table;
-  GtkTextTag *tag;
-  g_autofree gchar *tmp_style_name = NULL;
+  if (!(runs = g_task_propagate_pointer (task, NULL)))
+    IDE_EXIT;
 
-  g_return_val_if_fail (IDE_IS_HIGHLIGHT_ENGINE (self), NULL);
-  g_return_val_if_fail (style_name != NULL, NULL);
+  if (self->buffer == NULL)
+    IDE_EXIT;
+
+  request = g_task_get_task_data (task);
 
   /*
-   * If is private tag prepend the PRIVATE_TAG_PREFIX (gb-private-tag)
-   * to the string.This is used because tag name is the key used
-   * for saving tags in GtkTextTagTable and we dont want conflicts between
-   * public and private tags.
+   * If the buffer was invalidated for some other reason than typing while
+   * we were working, the runs can no longer be trusted. The dirty ranges
+   * still cover everything we snapshotted so just try again.
    */
-  if (private_tag)
-    tmp_style_name = g_strdup_printf ("%s:%s", PRIVATE_TAG_PREFIX, style_name);
-  else
-    tmp_style_name = g_strdup (style_name);
+  if (edits == NULL ||
+      request->change_seq != self->change_seq ||
+      request->highlighter != self->highlighter)
+    {
+      ide_highlight_engine_queue_work (self);
+      IDE_EXIT;
+    }
 
-  tag_table = gtk_text_buffer_get_tag_table (GTK_TEXT_BUFFER (self->buffer));
-  tag = gtk_text_tag_table_lookup (tag_table, tmp_style_name);
+  pending = g_slice_new0 (PendingRuns);
+  pending->tags = g_hash_table_new (NULL, NULL);
+  pending->begin = ide_highlight_snapshot_get_begin_offset (request->snapshot);
+  pending->end = ide_highlight_snapshot_get_end_offset (request->snapshot);
 
-  if (tag == NULL)
+  /*
+   * Otherwise only offsets moved, so install what we have rather than
+   * waiting for a pause in typing that may never come. The edited text
+   * stays dirty and gets fresh runs on the next pass.
+   */
+  if (edits->len > 0)
+    runs_edits_remap (edits, runs);
+
+  for (guint i = 0; i < edits->len; i++)
     {
-      tag = create_tag_from_style (self, tmp_style_name);
-      if (private_tag)
-        self->private_tags = g_slist_prepend (self->private_tags, tag);
-      else
-        self->public_tags = g_slist_prepend (self->public_tags, tag);
+      const RunsEdit *edit = &g_array_index (edits, RunsEdit, i);
+
+      pending->begin = runs_edit_map_begin (edit, pending->begin);
+      pending->end = runs_edit_map_end (edit, pending->end);
     }
 
-  return tag;
-}
+  pending->runs = g_steal_pointer (&runs);
+  pending->cursor = pending->begin;
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+  gtk_text_buffer_get_iter_at_offset (buffer, &begin, pending->begin);
+  gtk_text_buffer_get_iter_at_offset (buffer, &end, pending->end);
+  ide_highlight_engine_clear_dirty (self, &begin, &end);
 
+  for (guint i = 0; i < edits->len; i++)
+    {
+      const RunsEdit *edit = &g_array_index (edits, RunsEdit, i);
+      guint edit_begin = edit->offset;
+      guint edit_end = edit->offset + edit->n_inserted;
 
-static IdeHighlightResult
-ide_highlight_engine_apply_style (const GtkTextIter *begin,
-                                  const GtkTextIter *end,
-                                  const gchar       *style_name)
+      for (guint k = i + 1; k < edits->len; k++)
+        {
+          edit_begin = runs_edit_map_begin (&g_array_index (edits, RunsEdit, k), edit_begin);
+          edit_end = runs_edit_map_end (&g_array_index (edits, RunsEdit, k), edit_end);
+        }
+
+      gtk_text_buffer_get_iter_at_offset (buffer, &begin, edit_begin);
+      gtk_text_buffer_get_iter_at_offset (buffer, &end, edit_end);
+
+      if (get_invalidation_area (&begin, &end))
+        ide_highlight_engine_add_dirty (self, &begin, &end);
+    }
+  ide_highlight_engine_get_window (self, &pending->window_begin, &pending->window_end);
+
+  g_clear_pointer (&self->pending, pending_runs_free);
+  self->pending = pending;
+
+  ide_highlight_engine_queue_work (self);
+
+  IDE_EXIT;
+}
+
+/*
+ * Snapshots the invalid region and hands it to the highlighter on a
+ * worker thread. Returns %FALSE if the highlighter cannot process this
+ * region off the main thread right now.
+ */
+static gboolean
+ide_highlight_engine_queue_runs (IdeHighlightEngine *self,
+                                 const GtkTextIter  *begin,
+                                 const GtkTextIter  *end)
 {
-  IdeHighlightEngine *self;
-  GtkTextBuffer *buffer;
-  GtkTextTag *tag;
+  g_autoptr(IdeHighlightSnapshot) snapshot = NULL;
+  g_autoptr(GTask) task = NULL;
+  RunsRequest *request;
 
-  buffer = gtk_text_iter_get_buffer (begin);
-  self = g_object_get_qdata (G_OBJECT (buffer), engineQuark);
-  tag = get_tag_from_style (self, style_name, TRUE);
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (begin != NULL);
+  g_assert (end != NULL);
 
-  gtk_text_buffer_apply_tag (buffer, tag, begin, end);
+  snapshot = ide_highlight_snapshot_new (begin, end);
 
-  if (g_get_monotonic_time () >= self->quanta_expiration)
-    return IDE_HIGHLIGHT_STOP;
+  if (!ide_highlighter_prepare_snapshot (self->highlighter, snapshot))
+    return FALSE;
 
-  return IDE_HIGHLIGHT_CONTINUE;
+  request = g_slice_new0 (RunsRequest);
+  request->highlighter = g_object_ref (self->highlighter);
+  request->snapshot = g_steal_pointer (&snapshot);
+  request->change_seq = self->change_seq;
+
+  g_clear_object (&self->runs_cancellable);
+  self->runs_cancellable = g_cancellable_new ();
+  self->runs_in_flight = TRUE;
+
+  g_clear_pointer (&self->runs_edits, g_array_unref);
+  self->runs_edits = g_array_new (FALSE, FALSE, sizeof (RunsEdit));
+
+  task = g_task_new (self, self->runs_cancellable, ide_highlight_engine_runs_cb, NULL);
+  g_task_set_source_tag (task, ide_highlight_engine_queue_runs);
+  g_task_set_task_data (task, request, runs_request_free);
+  g_task_run_in_thread (task, ide_highlight_engine_runs_worker);
+
+  return TRUE;
 }
 
 static gboolean
@@ -309,15 +1144,25 @@ ide_highlight_engine_tick (IdeHighlightEngine *self)
   g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
   g_assert (self->buffer != NULL);
   g_assert (self->highlighter != NULL);
-  g_assert (self->invalid_begin != NULL);
-  g_assert (self->invalid_end != NULL);
+  g_assert (self->dirty != NULL);
 
   self->quanta_expiration = g_get_monotonic_time () + HIGHLIGHT_QUANTA_USEC;
 
   buffer = GTK_TEXT_BUFFER (self->buffer);
 
-  gtk_text_buffer_get_iter_at_mark (buffer, &invalid_begin, self->invalid_begin);
-  gtk_text_buffer_get_iter_at_mark (buffer, &invalid_end, self->invalid_end);
+  if (self->pending != NULL)
+    {
+      if (ide_highlight_engine_apply_pending (self))
+        return TRUE;
+      g_clear_pointer (&self->pending, pending_runs_free);
+    }
+
+  /* We will be queued again when the worker completes */
+  if (self->runs_in_flight)
+    return FALSE;
+
+  if (!ide_highlight_engine_get_next_dirty (self, &invalid_begin, &invalid_end, NULL))
+    return FALSE;
 
   IDE_TRACE_MSG ("Highlight Range [%u:%u,%u:%u] (%s)",
                  gtk_text_iter_get_line (&invalid_begin),
@@ -326,8 +1171,9 @@ ide_highlight_engine_tick (IdeHighlightEngine *self)
                  gtk_text_iter_get_line_offset (&invalid_end),
                  G_OBJECT_TYPE_NAME (self->highlighter));
 
-  if (gtk_text_iter_compare (&invalid_begin, &invalid_end) >= 0)
-    IDE_GOTO (up_to_date);
+  if (ide_highlighter_get_is_threaded (self->highlighter) &&
+      ide_highlight_engine_queue_runs (self, &invalid_begin, &invalid_end))
+    return FALSE;
 
   /*Clear all our tags*/
   for (tags_iter = self->private_tags; tags_iter; tags_iter = tags_iter->next)
@@ -341,23 +1187,49 @@ ide_highlight_engine_tick (IdeHighlightEngine *self)
   ide_highlighter_update (self->highlighter, ide_highlight_engine_apply_style,
                           &invalid_begin, &invalid_end, &iter);
 
-  if (gtk_text_iter_compare (&iter, &invalid_end) >= 0)
-    IDE_GOTO (up_to_date);
-
   /* Stop processing until further instruction if no movement was made */
   if (gtk_text_iter_equal (&iter, &invalid_begin))
     return FALSE;
 
-  gtk_text_buffer_move_mark (buffer, self->invalid_begin, &iter);
+  if (gtk_text_iter_compare (&iter, &invalid_end) > 0)
+    iter = invalid_end;
 
-  return TRUE;
+  ide_highlight_engine_clear_dirty (self, &invalid_begin, &iter);
 
-up_to_date:
-  gtk_text_buffer_get_start_iter (buffer, &iter);
-  gtk_text_buffer_move_mark (buffer, self->invalid_begin, &iter);
-  gtk_text_buffer_move_mark (buffer, self->invalid_end, &iter);
+  return self->dirty->len > 0;
+}
 
-  return FALSE;
+/*
+ * Work on screen runs at default idle priority so it lands before the
+ * next few frames. Everything else waits for the main loop to be idle.
+ */
+static gint
+ide_highlight_engine_get_priority (IdeHighlightEngine *self)
+{
+  GtkTextIter begin;
+  GtkTextIter end;
+  gboolean visible = FALSE;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if (self->pending != NULL)
+    visible = !self->pending->window_done;
+  else if (!self->runs_in_flight)
+    ide_highlight_engine_get_next_dirty (self, &begin, &end, &visible);
+
+  return visible ? G_PRIORITY_DEFAULT_IDLE : G_PRIORITY_LOW;
+}
+
+static void
+ide_highlight_engine_update_priority (IdeHighlightEngine *self)
+{
+  GSource *source;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if (self->work_timeout != 0 &&
+      (source = g_main_context_find_source_by_id (NULL, self->work_timeout)))
+    g_source_set_priority (source, ide_highlight_engine_get_priority (self));
 }
 
 static gboolean
@@ -370,7 +1242,10 @@ ide_highlight_engine_work_timeout_handler (gpointer data)
   if (self->enabled)
     {
       if (ide_highlight_engine_tick (self))
-        return G_SOURCE_CONTINUE;
+        {
+          ide_highlight_engine_update_priority (self);
+          return G_SOURCE_CONTINUE;
+        }
     }
 
   self->work_timeout = 0;
@@ -383,15 +1258,63 @@ ide_highlight_engine_queue_work (IdeHighlightEngine *self)
 {
   g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
 
-  if ((self->highlighter == NULL) || (self->buffer == NULL) || (self->work_timeout != 0))
+  if ((self->highlighter == NULL) || (self->buffer == NULL))
     return;
 
-  self->work_timeout =  gdk_threads_add_idle_full (G_PRIORITY_LOW,
+  if (self->work_timeout != 0)
+    {
+      ide_highlight_engine_update_priority (self);
+      return;
+    }
+
+  self->work_timeout =  gdk_threads_add_idle_full (ide_highlight_engine_get_priority (self),
                                                    ide_highlight_engine_work_timeout_handler,
                                                    self,
                                                    NULL);
 }
 
+/*
+ * Called when the buffer is modified, in the coordinates from before the
+ * change. Runs still being computed are remapped through the edit once
+ * they arrive. Pending runs refer to offsets from before the change, so
+ * throw them away and invalidate what was left of their region (grown by
+ * @n_inserted characters to account for shifting).
+ */
+static void
+ide_highlight_engine_buffer_changed (IdeHighlightEngine *self,
+                                     guint               offset,
+                                     guint               n_deleted,
+                                     guint               n_inserted)
+{
+  GtkTextBuffer *buffer;
+  GtkTextIter begin;
+  GtkTextIter end;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if (self->runs_edits != NULL)
+    {
+      RunsEdit edit = { offset, n_deleted, n_inserted };
+
+      if (self->runs_edits->len < MAX_RUNS_EDITS)
+        g_array_append_val (self->runs_edits, edit);
+      else
+        g_clear_pointer (&self->runs_edits, g_array_unref);
+    }
+
+  if (self->pending == NULL)
+    return;
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+
+  gtk_text_buffer_get_iter_at_offset (buffer, &begin, self->pending->begin);
+  gtk_text_buffer_get_iter_at_offset (buffer, &end, self->pending->end + n_inserted);
+
+  g_clear_pointer (&self->pending, pending_runs_free);
+
+  ide_highlight_engine_invalidate (self, &begin, &end);
+}
+
 static gboolean
 invalidate_and_highlight (IdeHighlightEngine *self,
                           GtkTextIter        *begin,
@@ -407,26 +1330,7 @@ invalidate_and_highlight (IdeHighlightEngine *self,
 
   if (get_invalidation_area (begin, end))
     {
-      GtkTextIter begin_tmp;
-      GtkTextIter end_tmp;
-      GtkTextBuffer *text_buffer = GTK_TEXT_BUFFER (self->buffer);
-
-      gtk_text_buffer_get_iter_at_mark (text_buffer, &begin_tmp, self->invalid_begin);
-      gtk_text_buffer_get_iter_at_mark (text_buffer, &end_tmp, self->invalid_end);
-
-      if (gtk_text_iter_equal (&begin_tmp, &end_tmp))
-        {
-          gtk_text_buffer_move_mark (text_buffer, self->invalid_begin, begin);
-          gtk_text_buffer_move_mark (text_buffer, self->invalid_end, end);
-        }
-      else
-        {
-          if (gtk_text_iter_compare (begin, &begin_tmp) < 0)
-            gtk_text_buffer_move_mark (text_buffer, self->invalid_begin, begin);
-          if (gtk_text_iter_compare (end, &end_tmp) > 0)
-            gtk_text_buffer_move_mark (text_buffer, self->invalid_end, end);
-        }
-
+      ide_highlight_engine_add_dirty (self, begin, end);
       ide_highlight_engine_queue_work (self);
 
       return TRUE;
@@ -453,6 +1357,8 @@ ide_highlight_engine_reload (IdeHighlightEngine *self)
       self->work_timeout = 0;
     }
 
+  ide_highlight_engine_cancel_runs (self);
+
   if (self->buffer == NULL)
     IDE_EXIT;
 
@@ -463,8 +1369,7 @@ ide_highlight_engine_reload (IdeHighlightEngine *self)
   /*
    * Invalidate the whole buffer.
    */
-  gtk_text_buffer_move_mark (buffer, self->invalid_begin, &begin);
-  gtk_text_buffer_move_mark (buffer, self->invalid_end, &end);
+  ide_highlight_engine_reset_dirty (self);
 
   /*
    * Remove our highlight tags from the buffer.
@@ -514,6 +1419,7 @@ ide_highlight_engine__buffer_insert_text_cb (IdeHighlightEngine *self,
 {
   GtkTextIter begin;
   GtkTextIter end;
+  glong n_chars;
 
   IDE_ENTRY;
 
@@ -525,13 +1431,20 @@ ide_highlight_engine__buffer_insert_text_cb (IdeHighlightEngine *self,
   if (!self->enabled)
     IDE_EXIT;
 
+  n_chars = g_utf8_strlen (text, len);
+
+  ide_highlight_engine_buffer_changed (self,
+                                       gtk_text_iter_get_offset (location) - n_chars,
+                                       0,
+                                       n_chars);
+
   /*
    * Backward the begin iter len characters from location
    * (location points to the end of the string) in order to get
    * the iter position where our inserted text was started.
    */
   begin = *location;
-  gtk_text_iter_backward_chars (&begin, g_utf8_strlen (text, len));
+  gtk_text_iter_backward_chars (&begin, n_chars);
 
   end = *location;
 
@@ -540,6 +1453,33 @@ ide_highlight_engine__buffer_insert_text_cb (IdeHighlightEngine *self,
   IDE_EXIT;
 }
 
+static void
+ide_highlight_engine__buffer_before_delete_range_cb (IdeHighlightEngine *self,
+                                                     GtkTextIter        *range_begin,
+                                                     GtkTextIter        *range_end,
+                                                     IdeBuffer          *buffer)
+{
+  guint begin;
+  guint end;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_assert (range_begin);
+  g_assert (range_end);
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  if (!self->enabled)
+    IDE_EXIT;
+
+  begin = gtk_text_iter_get_offset (range_begin);
+  end = gtk_text_iter_get_offset (range_end);
+
+  ide_highlight_engine_buffer_changed (self, MIN (begin, end), MAX (begin, end) - MIN (begin, end), 0);
+
+  IDE_EXIT;
+}
+
 static void
 ide_highlight_engine__buffer_delete_range_cb (IdeHighlightEngine *self,
                                               GtkTextIter        *range_begin,
@@ -647,8 +1587,11 @@ ide_highlight_engine__bind_buffer_cb (IdeHighlightEngine *self,
 
   gtk_text_buffer_get_bounds (text_buffer, &begin, &end);
 
-  self->invalid_begin = gtk_text_buffer_create_mark (text_buffer, NULL, &begin, TRUE);
-  self->invalid_end = gtk_text_buffer_create_mark (text_buffer, NULL, &end, FALSE);
+  self->dirty = g_array_new (FALSE, FALSE, sizeof (DirtyRange));
+  g_array_set_clear_func (self->dirty, dirty_range_clear);
+
+  self->visible = g_array_new (FALSE, FALSE, sizeof (VisibleRange));
+  g_array_set_clear_func (self->visible, visible_range_clear);
 
   ide_highlight_engine_reload (self);
 
@@ -678,15 +1621,15 @@ ide_highlight_engine__unbind_buffer_cb (IdeHighlightEngine  *self,
       self->work_timeout = 0;
     }
 
+  ide_highlight_engine_cancel_runs (self);
+
   g_object_set_qdata (G_OBJECT (text_buffer), engineQuark, NULL);
 
   tag_table = gtk_text_buffer_get_tag_table (text_buffer);
 
-  gtk_text_buffer_delete_mark (text_buffer, self->invalid_begin);
-  gtk_text_buffer_delete_mark (text_buffer, self->invalid_end);
+  g_clear_pointer (&self->dirty, g_array_unref);
 
-  self->invalid_begin = NULL;
-  self->invalid_end = NULL;
+  g_clear_pointer (&self->visible, g_array_unref);
 
   gtk_text_buffer_get_bounds (text_buffer, &begin, &end);
 
@@ -885,6 +1828,12 @@ ide_highlight_engine_init (IdeHighlightEngine *self)
                                    self,
                                    G_CONNECT_SWAPPED | G_CONNECT_AFTER);
 
+  dzl_signal_group_connect_object (self->signal_group,
+                                   "delete-range",
+                                   G_CALLBACK (ide_highlight_engine__buffer_before_delete_range_cb),
+                                   self,
+                                   G_CONNECT_SWAPPED);
+
   dzl_signal_group_connect_object (self->signal_group,
                                    "delete-range",
                                    G_CALLBACK (ide_highlight_engine__buffer_delete_range_cb),
@@ -978,13 +1927,9 @@ ide_highlight_engine_rebuild (IdeHighlightEngine *self)
 
   if (self->buffer != NULL)
     {
-      GtkTextBuffer *buffer = GTK_TEXT_BUFFER (self->buffer);
-      GtkTextIter begin;
-      GtkTextIter end;
+      self->change_seq++;
 
-      gtk_text_buffer_get_bounds (buffer, &begin, &end);
-      gtk_text_buffer_move_mark (buffer, self->invalid_begin, &begin);
-      gtk_text_buffer_move_mark (buffer, self->invalid_end, &end);
+      ide_highlight_engine_reset_dirty (self);
       ide_highlight_engine_queue_work (self);
     }
 
@@ -997,11 +1942,11 @@ ide_highlight_engine_rebuild (IdeHighlightEngine *self)
  * @begin: the beginning of the range to invalidate
  * @end: the end of the range to invalidate
  *
- * This function will extend the invalidated range of the buffer to include
- * the range of @begin to @end.
+ * This function will add the range of @begin to @end to the invalidated
+ * regions of the buffer, merging it with any region it overlaps.
  *
  * The highlighter will be queued to interactively update the invalidated
- * region.
+ * regions, starting with those that are visible.
  *
  * Updating the invalidated region of the buffer may take some time, as it is
  * important that the highlighter does not block for more than 1-2 milliseconds
@@ -1012,10 +1957,6 @@ ide_highlight_engine_invalidate (IdeHighlightEngine *self,
                                  const GtkTextIter  *begin,
                                  const GtkTextIter  *end)
 {
-  GtkTextBuffer *buffer;
-  GtkTextIter mark_begin;
-  GtkTextIter mark_end;
-
   IDE_ENTRY;
 
   g_return_if_fail (IDE_IS_HIGHLIGHT_ENGINE (self));
@@ -1024,24 +1965,9 @@ ide_highlight_engine_invalidate (IdeHighlightEngine *self,
   g_return_if_fail (gtk_text_iter_get_buffer (begin) == GTK_TEXT_BUFFER (self->buffer));
   g_return_if_fail (gtk_text_iter_get_buffer (end) == GTK_TEXT_BUFFER (self->buffer));
 
-  buffer = GTK_TEXT_BUFFER (self->buffer);
-
-  gtk_text_buffer_get_iter_at_mark (buffer, &mark_begin, self->invalid_begin);
-  gtk_text_buffer_get_iter_at_mark (buffer, &mark_end, self->invalid_end);
-
-  if (gtk_text_iter_equal (&mark_begin, &mark_end))
-    {
-      gtk_text_buffer_move_mark (buffer, self->invalid_begin, begin);
-      gtk_text_buffer_move_mark (buffer, self->invalid_end, end);
-    }
-  else
-    {
-      if (gtk_text_iter_compare (begin, &mark_begin) < 0)
-        gtk_text_buffer_move_mark (buffer, self->invalid_begin, begin);
-      if (gtk_text_iter_compare (end, &mark_end) > 0)
-        gtk_text_buffer_move_mark (buffer, self->invalid_end, end);
-    }
+  self->change_seq++;
 
+  ide_highlight_engine_add_dirty (self, begin, end);
   ide_highlight_engine_queue_work (self);
 
   IDE_EXIT;
@@ -1062,3 +1988,112 @@ ide_highlight_engine_get_style (IdeHighlightEngine *self,
 {
   return get_tag_from_style (self, style_name, FALSE);
 }
+
+static gint
+ide_highlight_engine_find_visible (IdeHighlightEngine *self,
+                                   gconstpointer       view)
+{
+  g_assert (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if (self->visible == NULL)
+    return -1;
+
+  for (guint i = 0; i < self->visible->len; i++)
+    {
+      if (g_array_index (self->visible, VisibleRange, i).view == view)
+        return i;
+    }
+
+  return -1;
+}
+
+/**
+ * _ide_highlight_engine_set_visible_range:
+ * @self: An #IdeHighlightEngine.
+ * @view: the view showing the range
+ * @begin: the first visible position
+ * @end: the last visible position
+ *
+ * Views call this as they are scrolled so that invalidated regions on
+ * screen are highlighted before the rest of the buffer. Each view keeps
+ * its own range, and regions shown by any of them are prioritized.
+ */
+void
+_ide_highlight_engine_set_visible_range (IdeHighlightEngine *self,
+                                         gconstpointer       view,
+                                         const GtkTextIter  *begin,
+                                         const GtkTextIter  *end)
+{
+  GtkTextBuffer *buffer;
+  GtkTextIter old_begin;
+  GtkTextIter old_end;
+  GtkTextIter dirty_begin;
+  GtkTextIter dirty_end;
+  VisibleRange range;
+  gboolean visible = FALSE;
+  gint index;
+
+  g_return_if_fail (IDE_IS_HIGHLIGHT_ENGINE (self));
+  g_return_if_fail (view != NULL);
+  g_return_if_fail (begin != NULL);
+  g_return_if_fail (end != NULL);
+
+  if (self->buffer == NULL || self->visible == NULL)
+    return;
+
+  buffer = GTK_TEXT_BUFFER (self->buffer);
+
+  g_return_if_fail (gtk_text_iter_get_buffer (begin) == buffer);
+  g_return_if_fail (gtk_text_iter_get_buffer (end) == buffer);
+
+  index = ide_highlight_engine_find_visible (self, view);
+
+  if (index >= 0)
+    {
+      range = g_array_index (self->visible, VisibleRange, index);
+      visible_range_get_bounds (&range, &old_begin, &old_end);
+
+      if (gtk_text_iter_equal (&old_begin, begin) && gtk_text_iter_equal (&old_end, end))
+        return;
+
+      /* Move the range to the end, it is now the most recently scrolled */
+      g_array_set_clear_func (self->visible, NULL);
+      g_array_remove_index (self->visible, index);
+      g_array_set_clear_func (self->visible, visible_range_clear);
+
+      gtk_text_buffer_move_mark (buffer, range.begin, begin);
+      gtk_text_buffer_move_mark (buffer, range.end, end);
+    }
+  else
+    {
+      range.view = view;
+      range.begin = gtk_text_buffer_create_mark (buffer, NULL, begin, TRUE);
+      range.end = gtk_text_buffer_create_mark (buffer, NULL, end, FALSE);
+    }
+
+  g_array_append_val (self->visible, range);
+
+  if (self->enabled &&
+      ide_highlight_engine_get_next_dirty (self, &dirty_begin, &dirty_end, &visible) &&
+      visible)
+    ide_highlight_engine_queue_work (self);
+}
+
+/**
+ * _ide_highlight_engine_clear_visible_range:
+ * @self: An #IdeHighlightEngine.
+ * @view: the view that is no longer showing the buffer
+ *
+ * Removes the range previously reported by @view.
+ */
+void
+_ide_highlight_engine_clear_visible_range (IdeHighlightEngine *self,
+                                           gconstpointer       view)
+{
+  gint index;
+
+  g_return_if_fail (IDE_IS_HIGHLIGHT_ENGINE (self));
+
+  if ((index = ide_highlight_engine_find_visible (self, view)) >= 0)
+    g_array_remove_index (self->visible, index);
+}
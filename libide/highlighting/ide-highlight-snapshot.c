@@ -0,0 +1,340 @@
+/* ide-highlight-snapshot.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-highlight-snapshot"
+
+#include <dazzle.h>
+#include <string.h>
+
+#include "highlighting/ide-highlight-snapshot.h"
+
+/**
+ * SECTION:ide-highlight-snapshot
+ * @title: IdeHighlightSnapshot
+ * @short_description: An immutable copy of a buffer region for highlighters
+ *
+ * The snapshot is created on the main thread and contains everything a
+ * highlighter needs to compute #IdeHighlightRun<!-- -->s from a worker
+ * thread: the text of the region, the character offset it starts at, and
+ * the ranges covered by the context classes the highlighter asked for.
+ *
+ * Once a snapshot has been handed to a worker it must not be modified.
+ */
+
+G_DEFINE_BOXED_TYPE (IdeHighlightSnapshot, ide_highlight_snapshot,
+                     ide_highlight_snapshot_ref, ide_highlight_snapshot_unref)
+
+DZL_DEFINE_COUNTER (instances, "IdeHighlightSnapshot", "Instances", "Number of snapshots")
+
+typedef struct
+{
+  guint begin;
+  guint end;
+} Range;
+
+typedef struct
+{
+  const gchar *name;
+  GArray      *ranges;
+} ContextClass;
+
+struct _IdeHighlightSnapshot
+{
+  volatile gint   ref_count;
+
+  gchar          *text;
+  gsize           len;
+
+  guint           begin_offset;
+  guint           end_offset;
+
+  /* Array of ContextClass, there are only ever a few of these */
+  GArray         *classes;
+
+  gpointer        data;
+  GDestroyNotify  data_destroy;
+};
+
+static void
+context_class_clear (gpointer data)
+{
+  ContextClass *klass = data;
+
+  g_clear_pointer (&klass->ranges, g_array_unref);
+}
+
+/**
+ * ide_highlight_snapshot_new:
+ * @begin: the beginning of the region
+ * @end: the end of the region
+ *
+ * Copies the text between @begin and @end so it can be processed off of
+ * the main thread.
+ *
+ * Returns: (transfer full): A new #IdeHighlightSnapshot.
+ */
+IdeHighlightSnapshot *
+ide_highlight_snapshot_new (const GtkTextIter *begin,
+                            const GtkTextIter *end)
+{
+  IdeHighlightSnapshot *self;
+
+  g_return_val_if_fail (begin != NULL, NULL);
+  g_return_val_if_fail (end != NULL, NULL);
+  g_return_val_if_fail (gtk_text_iter_compare (begin, end) <= 0, NULL);
+
+  self = g_slice_new0 (IdeHighlightSnapshot);
+  self->ref_count = 1;
+  self->text = gtk_text_iter_get_slice (begin, end);
+  self->len = strlen (self->text);
+  self->begin_offset = gtk_text_iter_get_offset (begin);
+  self->end_offset = gtk_text_iter_get_offset (end);
+  self->classes = g_array_new (FALSE, FALSE, sizeof (ContextClass));
+  g_array_set_clear_func (self->classes, context_class_clear);
+
+  DZL_COUNTER_INC (instances);
+
+  return self;
+}
+
+IdeHighlightSnapshot *
+ide_highlight_snapshot_ref (IdeHighlightSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+ide_highlight_snapshot_unref (IdeHighlightSnapshot *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      if (self->data_destroy != NULL)
+        self->data_destroy (self->data);
+
+      g_clear_pointer (&self->classes, g_array_unref);
+      g_clear_pointer (&self->text, g_free);
+      g_slice_free (IdeHighlightSnapshot, self);
+
+      DZL_COUNTER_DEC (instances);
+    }
+}
+
+/**
+ * ide_highlight_snapshot_get_text:
+ * @self: An #IdeHighlightSnapshot
+ * @len: (out) (optional): the length of the text in bytes
+ *
+ * Gets the text of the region, including any embedded pixbuf or child
+ * anchor placeholders so that character offsets match the buffer.
+ *
+ * Returns: The text of the snapshot.
+ */
+const gchar *
+ide_highlight_snapshot_get_text (IdeHighlightSnapshot *self,
+                                 gsize                *len)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  if (len != NULL)
+    *len = self->len;
+
+  return self->text;
+}
+
+/**
+ * ide_highlight_snapshot_get_begin_offset:
+ * @self: An #IdeHighlightSnapshot
+ *
+ * Gets the character offset within the buffer of the first character
+ * in the snapshot.
+ */
+guint
+ide_highlight_snapshot_get_begin_offset (IdeHighlightSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->begin_offset;
+}
+
+guint
+ide_highlight_snapshot_get_end_offset (IdeHighlightSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->end_offset;
+}
+
+/**
+ * ide_highlight_snapshot_add_context_class:
+ * @self: An #IdeHighlightSnapshot
+ * @buffer: the #GtkSourceBuffer the snapshot was created from
+ * @context_class: the context class such as "comment" or "string"
+ *
+ * Records the ranges of the snapshot that are covered by @context_class
+ * so that ide_highlight_snapshot_has_context_class() can be used from
+ * a worker thread.
+ *
+ * This must be called from the main thread before the snapshot is
+ * shared with a worker.
+ */
+void
+ide_highlight_snapshot_add_context_class (IdeHighlightSnapshot *self,
+                                          GtkSourceBuffer      *buffer,
+                                          const gchar          *context_class)
+{
+  ContextClass klass;
+  GtkTextIter iter;
+  GtkTextIter limit;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (GTK_SOURCE_IS_BUFFER (buffer));
+  g_return_if_fail (context_class != NULL);
+
+  klass.name = g_intern_string (context_class);
+  klass.ranges = g_array_new (FALSE, FALSE, sizeof (Range));
+
+  gtk_text_buffer_get_iter_at_offset (GTK_TEXT_BUFFER (buffer), &iter, self->begin_offset);
+  gtk_text_buffer_get_iter_at_offset (GTK_TEXT_BUFFER (buffer), &limit, self->end_offset);
+
+  /*
+   * Walk the context class toggles rather than checking each character,
+   * which lets the tag b-tree do the heavy lifting for us.
+   */
+  while (gtk_text_iter_compare (&iter, &limit) < 0)
+    {
+      Range range;
+
+      if (!gtk_source_buffer_iter_has_context_class (buffer, &iter, context_class) &&
+          !gtk_source_buffer_iter_forward_to_context_class_toggle (buffer, &iter, context_class))
+        break;
+
+      if (gtk_text_iter_compare (&iter, &limit) >= 0)
+        break;
+
+      range.begin = gtk_text_iter_get_offset (&iter);
+
+      if (!gtk_source_buffer_iter_forward_to_context_class_toggle (buffer, &iter, context_class) ||
+          gtk_text_iter_compare (&iter, &limit) > 0)
+        iter = limit;
+
+      range.end = gtk_text_iter_get_offset (&iter);
+
+      g_array_append_val (klass.ranges, range);
+    }
+
+  g_array_append_val (self->classes, klass);
+}
+
+/**
+ * ide_highlight_snapshot_has_context_class:
+ * @self: An #IdeHighlightSnapshot
+ * @offset: a character offset within the buffer
+ * @context_class: the context class to check
+ *
+ * Checks if the character at @offset is within @context_class. The
+ * context class must have been added with
+ * ide_highlight_snapshot_add_context_class().
+ *
+ * This is safe to call from any thread.
+ *
+ * Returns: %TRUE if the character is within @context_class.
+ */
+gboolean
+ide_highlight_snapshot_has_context_class (IdeHighlightSnapshot *self,
+                                          guint                 offset,
+                                          const gchar          *context_class)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (context_class != NULL, FALSE);
+
+  for (guint i = 0; i < self->classes->len; i++)
+    {
+      const ContextClass *klass = &g_array_index (self->classes, ContextClass, i);
+      guint lo = 0;
+      guint hi = klass->ranges->len;
+
+      if (!g_str_equal (klass->name, context_class))
+        continue;
+
+      while (lo < hi)
+        {
+          guint mid = lo + (hi - lo) / 2;
+          const Range *range = &g_array_index (klass->ranges, Range, mid);
+
+          if (offset < range->begin)
+            hi = mid;
+          else if (offset >= range->end)
+            lo = mid + 1;
+          else
+            return TRUE;
+        }
+
+      return FALSE;
+    }
+
+  g_warning ("Context class \"%s\" was not added to the snapshot", context_class);
+
+  return FALSE;
+}
+
+/**
+ * ide_highlight_snapshot_set_data:
+ * @self: An #IdeHighlightSnapshot
+ * @data: (nullable): highlighter specific data
+ * @data_destroy: (nullable): destroy notify for @data
+ *
+ * Attaches data to the snapshot for use by the highlighter worker, such
+ * as a reference to a symbol index. @data must be safe to use from a
+ * worker thread. This must be called from the main thread.
+ */
+void
+ide_highlight_snapshot_set_data (IdeHighlightSnapshot *self,
+                                 gpointer              data,
+                                 GDestroyNotify        data_destroy)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->data_destroy != NULL)
+    self->data_destroy (self->data);
+
+  self->data = data;
+  self->data_destroy = data_destroy;
+}
+
+/**
+ * ide_highlight_snapshot_get_data:
+ * @self: An #IdeHighlightSnapshot
+ *
+ * Returns: (transfer none) (nullable): the data set with
+ *   ide_highlight_snapshot_set_data().
+ */
+gpointer
+ide_highlight_snapshot_get_data (IdeHighlightSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->data;
+}
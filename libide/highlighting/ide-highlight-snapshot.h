@@ -0,0 +1,70 @@
+/* ide-highlight-snapshot.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_HIGHLIGHT_SNAPSHOT_H
+#define IDE_HIGHLIGHT_SNAPSHOT_H
+
+#include <gtksourceview/gtksource.h>
+
+G_BEGIN_DECLS
+
+#define IDE_TYPE_HIGHLIGHT_SNAPSHOT (ide_highlight_snapshot_get_type())
+
+typedef struct _IdeHighlightSnapshot IdeHighlightSnapshot;
+
+/**
+ * IdeHighlightRun:
+ * @offset: the character offset of the run within the buffer
+ * @length: the length of the run in characters
+ * @style_name: the style to apply, which must outlive the run
+ *   (a static or interned string)
+ *
+ * A run of text to be styled, as produced by threaded highlighters.
+ */
+typedef struct
+{
+  guint        offset;
+  guint        length;
+  const gchar *style_name;
+} IdeHighlightRun;
+
+GType                 ide_highlight_snapshot_get_type           (void);
+IdeHighlightSnapshot *ide_highlight_snapshot_new                (const GtkTextIter    *begin,
+                                                                 const GtkTextIter    *end);
+IdeHighlightSnapshot *ide_highlight_snapshot_ref                (IdeHighlightSnapshot *self);
+void                  ide_highlight_snapshot_unref              (IdeHighlightSnapshot *self);
+const gchar          *ide_highlight_snapshot_get_text           (IdeHighlightSnapshot *self,
+                                                                 gsize                *len);
+guint                 ide_highlight_snapshot_get_begin_offset   (IdeHighlightSnapshot *self);
+guint                 ide_highlight_snapshot_get_end_offset     (IdeHighlightSnapshot *self);
+void                  ide_highlight_snapshot_add_context_class  (IdeHighlightSnapshot *self,
+                                                                 GtkSourceBuffer      *buffer,
+                                                                 const gchar          *context_class);
+gboolean              ide_highlight_snapshot_has_context_class  (IdeHighlightSnapshot *self,
+                                                                 guint                 offset,
+                                                                 const gchar          *context_class);
+void                  ide_highlight_snapshot_set_data           (IdeHighlightSnapshot *self,
+                                                                 gpointer              data,
+                                                                 GDestroyNotify        data_destroy);
+gpointer              ide_highlight_snapshot_get_data           (IdeHighlightSnapshot *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeHighlightSnapshot, ide_highlight_snapshot_unref)
+
+G_END_DECLS
+
+#endif /* IDE_HIGHLIGHT_SNAPSHOT_H */
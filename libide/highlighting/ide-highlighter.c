@@ -92,3 +92,73 @@ ide_highlighter_load (IdeHighlighter *self)
   if (IDE_HIGHLIGHTER_GET_IFACE (self)->load)
     IDE_HIGHLIGHTER_GET_IFACE (self)->load (self);
 }
+
+/**
+ * ide_highlighter_get_is_threaded:
+ * @self: An #IdeHighlighter.
+ *
+ * Checks if @self can compute highlight runs from a worker thread using
+ * ide_highlighter_compute_runs().
+ *
+ * Returns: %TRUE if the highlighter implements threaded highlighting.
+ */
+gboolean
+ide_highlighter_get_is_threaded (IdeHighlighter *self)
+{
+  g_return_val_if_fail (IDE_IS_HIGHLIGHTER (self), FALSE);
+
+  return IDE_HIGHLIGHTER_GET_IFACE (self)->compute_runs != NULL;
+}
+
+/**
+ * ide_highlighter_prepare_snapshot:
+ * @self: An #IdeHighlighter.
+ * @snapshot: An #IdeHighlightSnapshot.
+ *
+ * Prepares @snapshot for use by ide_highlighter_compute_runs(). This
+ * must be called from the main thread.
+ *
+ * Returns: %TRUE if @snapshot can be processed from a worker thread.
+ */
+gboolean
+ide_highlighter_prepare_snapshot (IdeHighlighter       *self,
+                                  IdeHighlightSnapshot *snapshot)
+{
+  g_return_val_if_fail (IDE_IS_HIGHLIGHTER (self), FALSE);
+  g_return_val_if_fail (snapshot != NULL, FALSE);
+
+  if (IDE_HIGHLIGHTER_GET_IFACE (self)->compute_runs == NULL)
+    return FALSE;
+
+  if (IDE_HIGHLIGHTER_GET_IFACE (self)->prepare_snapshot)
+    return IDE_HIGHLIGHTER_GET_IFACE (self)->prepare_snapshot (self, snapshot);
+
+  return TRUE;
+}
+
+/**
+ * ide_highlighter_compute_runs:
+ * @self: An #IdeHighlighter.
+ * @snapshot: An #IdeHighlightSnapshot.
+ * @cancellable: (nullable): A #GCancellable or %NULL.
+ *
+ * Computes the styled runs for @snapshot. This is meant to be called
+ * from a worker thread.
+ *
+ * Returns: (transfer full) (element-type Ide.HighlightRun) (nullable): A
+ *   #GArray of #IdeHighlightRun sorted by offset.
+ */
+GArray *
+ide_highlighter_compute_runs (IdeHighlighter       *self,
+                              IdeHighlightSnapshot *snapshot,
+                              GCancellable         *cancellable)
+{
+  g_return_val_if_fail (IDE_IS_HIGHLIGHTER (self), NULL);
+  g_return_val_if_fail (snapshot != NULL, NULL);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), NULL);
+
+  if (IDE_HIGHLIGHTER_GET_IFACE (self)->compute_runs)
+    return IDE_HIGHLIGHTER_GET_IFACE (self)->compute_runs (self, snapshot, cancellable);
+
+  return NULL;
+}
@@ -25,6 +25,7 @@
 #include "ide-types.h"
 
 #include "buffers/ide-buffer.h"
+#include "highlighting/ide-highlight-snapshot.h"
 #include "sourceview/ide-source-view.h"
 
 G_BEGIN_DECLS
@@ -70,14 +71,48 @@ struct _IdeHighlighterInterface
                       IdeHighlightEngine   *engine);
 
   void (*load)       (IdeHighlighter       *self);
+
+  /**
+   * IdeHighlighter::prepare_snapshot:
+   *
+   * Called on the main thread before @compute_runs is dispatched to a
+   * worker thread. The highlighter should record any context classes it
+   * needs and attach thread-safe state to @snapshot.
+   *
+   * Return %FALSE to have the engine fall back to @update for this pass,
+   * such as when the required state is not yet available.
+   */
+  gboolean (*prepare_snapshot) (IdeHighlighter       *self,
+                                IdeHighlightSnapshot *snapshot);
+
+  /**
+   * IdeHighlighter::compute_runs:
+   *
+   * Called from a worker thread to compute the styled runs within
+   * @snapshot. This must only use the contents of @snapshot and must not
+   * touch the buffer or other main thread state.
+   *
+   * The resulting array of #IdeHighlightRun must be sorted by offset and
+   * the runs must not overlap. The engine applies them in batches on the
+   * main thread.
+   */
+  GArray  *(*compute_runs)     (IdeHighlighter       *self,
+                                IdeHighlightSnapshot *snapshot,
+                                GCancellable         *cancellable);
 };
 
-void ide_highlighter_load   (IdeHighlighter       *self);
-void ide_highlighter_update (IdeHighlighter       *self,
-                             IdeHighlightCallback  callback,
-                             const GtkTextIter    *range_begin,
-                             const GtkTextIter    *range_end,
-                             GtkTextIter          *location);
+void      ide_highlighter_load             (IdeHighlighter       *self);
+void      ide_highlighter_update           (IdeHighlighter       *self,
+                                            IdeHighlightCallback  callback,
+                                            const GtkTextIter    *range_begin,
+                                            const GtkTextIter    *range_end,
+                                            GtkTextIter          *location);
+gboolean  ide_highlighter_get_is_threaded  (IdeHighlighter       *self);
+gboolean  ide_highlighter_prepare_snapshot (IdeHighlighter       *self,
+                                            IdeHighlightSnapshot *snapshot);
+GArray   *ide_highlighter_compute_runs     (IdeHighlighter       *self,
+                                            IdeHighlightSnapshot *snapshot,
+                                            GCancellable         *cancellable);
 
 G_END_DECLS
 
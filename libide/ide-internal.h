@@ -23,6 +23,8 @@
 
 #include "ide-types.h"
 
+#include "buffers/ide-rope.h"
+
 #include "highlighting/ide-highlight-engine.h"
 #include "history/ide-back-forward-item.h"
 #include "history/ide-back-forward-list.h"
@@ -37,6 +39,7 @@ void                _ide_battery_monitor_init               (void);
 void                _ide_battery_monitor_shutdown           (void);
 void                _ide_buffer_set_changed_on_volume       (IdeBuffer             *self,
                                                              gboolean               changed_on_volume);
+IdeHighlightEngine *_ide_buffer_get_highlight_engine        (IdeBuffer             *self);
 gboolean            _ide_buffer_get_loading                 (IdeBuffer             *self);
 void                _ide_buffer_set_loading                 (IdeBuffer             *self,
                                                              gboolean               loading);
@@ -86,8 +89,23 @@ IdeUnsavedFile     *_ide_unsaved_file_new                   (GFile
                                                              GBytes                *content,
                                                              const gchar           *temp_path,
                                                              gint64                 sequence);
+IdeUnsavedFile     *_ide_unsaved_file_new_for_rope          (GFile                 *file,
+                                                             IdeRope               *rope,
+                                                             gboolean               trailing_newline,
+                                                             const gchar           *temp_path,
+                                                             gint64                 sequence);
+void                _ide_unsaved_files_update_rope          (IdeUnsavedFiles       *self,
+                                                             GFile                 *file,
+                                                             IdeRope               *rope,
+                                                             gboolean               trailing_newline);
 void                _ide_highlighter_set_highlighter_engine (IdeHighlighter        *highlighter,
                                                              IdeHighlightEngine    *highlight_engine);
+void                _ide_highlight_engine_set_visible_range (IdeHighlightEngine    *self,
+                                                             gconstpointer          view,
+                                                             const GtkTextIter     *begin,
+                                                             const GtkTextIter     *end);
+void                _ide_highlight_engine_clear_visible_range (IdeHighlightEngine  *self,
+                                                               gconstpointer        view);
 const gchar        *_ide_source_view_get_mode_name          (IdeSourceView         *self);
 
 G_END_DECLS
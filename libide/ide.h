@@ -33,6 +33,7 @@ G_BEGIN_DECLS
 #include "buffers/ide-buffer-change-monitor.h"
 #include "buffers/ide-buffer-manager.h"
 #include "buffers/ide-buffer.h"
+#include "buffers/ide-rope.h"
 #include "buffers/ide-unsaved-file.h"
 #include "buffers/ide-unsaved-files.h"
 #include "buildconfig/ide-buildconfig-configuration.h"
@@ -47,6 +48,7 @@ G_BEGIN_DECLS
 #include "buildsystem/ide-build-system.h"
 #include "buildsystem/ide-build-system-discovery.h"
 #include "buildsystem/ide-build-target.h"
+#include "buildsystem/ide-compile-commands.h"
 #include "buildsystem/ide-configuration-manager.h"
 #include "buildsystem/ide-configuration.h"
 #include "buildsystem/ide-configuration-provider.h"
@@ -71,6 +73,7 @@ G_BEGIN_DECLS
 #include "genesis/ide-genesis-addin.h"
 #include "highlighting/ide-highlight-engine.h"
 #include "highlighting/ide-highlight-index.h"
+#include "highlighting/ide-highlight-snapshot.h"
 #include "highlighting/ide-highlighter.h"
 #include "history/ide-back-forward-item.h"
 #include "history/ide-back-forward-list.h"
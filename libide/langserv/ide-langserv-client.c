@@ -18,9 +18,11 @@
 
 #define G_LOG_DOMAIN "ide-langserv-client"
 
-#include <dazzle.h>
+#include "config.h"
+
 #include <dazzle.h>
 #include <jsonrpc-glib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "ide-context.h"
@@ -44,8 +46,50 @@ typedef struct
   GIOStream      *io_stream;
   GHashTable     *diagnostics_by_file;
   GPtrArray      *languages;
+  GHashTable     *pending_changes;
+  GPtrArray      *calls;
+  GHashTable     *calls_by_key;
+  guint           flush_source;
 } IdeLangservClientPrivate;
 
+typedef struct
+{
+  gint     begin_line;
+  gint     begin_column;
+  gint     end_line;
+  gint     end_column;
+  gint     length;
+  GString *text;
+} TextChange;
+
+typedef struct
+{
+  IdeBuffer *buffer;
+  GArray    *changes;
+} PendingChanges;
+
+typedef struct
+{
+  GTask  *task;
+  gulong  cancelled_handler;
+  guint   returned : 1;
+} CallWaiter;
+
+typedef struct
+{
+  volatile gint      ref_count;
+  IdeLangservClient *self;
+  gchar             *method;
+  gchar             *key;
+  GVariant          *params;
+  GVariant          *id;
+  IdeBuffer         *buffer;
+  guint              version;
+  GCancellable      *cancellable;
+  GArray            *waiters;
+  guint              finished : 1;
+} LangservCall;
+
 G_DEFINE_TYPE_WITH_PRIVATE (IdeLangservClient, ide_langserv_client, IDE_TYPE_OBJECT)
 
 enum {
@@ -74,9 +118,50 @@ enum {
   N_SIGNALS
 };
 
+/*
+ * Edits are batched for this long before textDocument/didChange is sent, so
+ * that typing a word results in a single notification.
+ */
+#define FLUSH_DELAY_MSEC 50
+
+/* Rough size of the JSON describing the range of a change */
+#define CHANGE_OVERHEAD  128
+
+static void ide_langserv_client_flush_changes (IdeLangservClient *self);
+
 static GParamSpec *properties [N_PROPS];
 static guint signals [N_SIGNALS];
 
+/*
+ * Requests for these methods are superseded by a newer request for the same
+ * document, and their replies are useless once the document has changed.
+ */
+static const gchar *superseded_methods[] = {
+  "textDocument/completion",
+  "textDocument/documentHighlight",
+  "textDocument/hover",
+  "textDocument/signatureHelp",
+};
+
+static void
+text_change_clear (gpointer data)
+{
+  TextChange *change = data;
+
+  if (change->text != NULL)
+    g_string_free (change->text, TRUE);
+}
+
+static void
+pending_changes_free (gpointer data)
+{
+  PendingChanges *pending = data;
+
+  g_clear_object (&pending->buffer);
+  g_clear_pointer (&pending->changes, g_array_unref);
+  g_slice_free (PendingChanges, pending);
+}
+
 static gboolean
 ide_langserv_client_supports_buffer (IdeLangservClient *self,
                                      IdeBuffer         *buffer)
@@ -134,6 +219,8 @@ ide_langserv_client_buffer_saved (IdeLangservClient *self,
   if (!ide_langserv_client_supports_buffer (self, buffer))
     IDE_EXIT;
 
+  ide_langserv_client_flush_changes (self);
+
   uri = ide_buffer_get_uri (buffer);
 
   params = JSONRPC_MESSAGE_NEW (
@@ -149,10 +236,206 @@ ide_langserv_client_buffer_saved (IdeLangservClient *self,
   IDE_EXIT;
 }
 
+static void
+ide_langserv_client_send_changes (IdeLangservClient *self,
+                                  PendingChanges    *pending)
+{
+  g_autoptr(GVariant) text_document = NULL;
+  g_autoptr(GVariant) params = NULL;
+  g_autofree gchar *uri = NULL;
+  GVariantBuilder changes;
+  GVariantDict dict;
+  gsize n_bytes = 0;
+  gint version;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_LANGSERV_CLIENT (self));
+  g_assert (pending != NULL);
+  g_assert (IDE_IS_BUFFER (pending->buffer));
+
+  if (pending->changes->len == 0)
+    IDE_EXIT;
+
+  uri = ide_buffer_get_uri (pending->buffer);
+  version = (gint)ide_buffer_get_change_count (pending->buffer);
+
+  for (guint i = 0; i < pending->changes->len; i++)
+    {
+      const TextChange *change = &g_array_index (pending->changes, TextChange, i);
+
+      n_bytes += CHANGE_OVERHEAD + change->text->len;
+    }
+
+  g_variant_builder_init (&changes, G_VARIANT_TYPE ("av"));
+
+  /*
+   * If describing the edits would take more than sending the document
+   * (such as after replacing most of the buffer), just send the new
+   * contents of the document instead.
+   */
+  if (n_bytes > (gsize)gtk_text_buffer_get_char_count (GTK_TEXT_BUFFER (pending->buffer)))
+    {
+      g_autoptr(GVariant) change = NULL;
+      g_autofree gchar *text = NULL;
+      GtkTextIter begin;
+      GtkTextIter end;
+
+      IDE_TRACE_MSG ("Sending full document for %u changes", pending->changes->len);
+
+      gtk_text_buffer_get_bounds (GTK_TEXT_BUFFER (pending->buffer), &begin, &end);
+      text = gtk_text_buffer_get_text (GTK_TEXT_BUFFER (pending->buffer), &begin, &end, TRUE);
+
+      change = g_variant_take_ref (JSONRPC_MESSAGE_NEW (
+        "text", JSONRPC_MESSAGE_PUT_STRING (text)
+      ));
+
+      g_variant_builder_add (&changes, "v", change);
+    }
+  else
+    {
+      for (guint i = 0; i < pending->changes->len; i++)
+        {
+          const TextChange *tc = &g_array_index (pending->changes, TextChange, i);
+          g_autoptr(GVariant) change = NULL;
+
+          change = g_variant_take_ref (JSONRPC_MESSAGE_NEW (
+            "range", "{",
+              "start", "{",
+                "line", JSONRPC_MESSAGE_PUT_INT64 (tc->begin_line),
+                "character", JSONRPC_MESSAGE_PUT_INT64 (tc->begin_column),
+              "}",
+              "end", "{",
+                "line", JSONRPC_MESSAGE_PUT_INT64 (tc->end_line),
+                "character", JSONRPC_MESSAGE_PUT_INT64 (tc->end_column),
+              "}",
+            "}",
+            "rangeLength", JSONRPC_MESSAGE_PUT_INT64 (tc->length),
+            "text", JSONRPC_MESSAGE_PUT_STRING (tc->text->str)
+          ));
+
+          g_variant_builder_add (&changes, "v", change);
+        }
+    }
+
+  text_document = g_variant_take_ref (JSONRPC_MESSAGE_NEW (
+    "uri", JSONRPC_MESSAGE_PUT_STRING (uri),
+    "version", JSONRPC_MESSAGE_PUT_INT64 (version)
+  ));
+
+  g_variant_dict_init (&dict, NULL);
+  g_variant_dict_insert_value (&dict, "textDocument", text_document);
+  g_variant_dict_insert_value (&dict, "contentChanges", g_variant_builder_end (&changes));
+  params = g_variant_take_ref (g_variant_dict_end (&dict));
+
+  g_array_set_size (pending->changes, 0);
+
+  ide_langserv_client_send_notification_async (self, "textDocument/didChange",
+                                               g_steal_pointer (&params),
+                                               NULL, NULL, NULL);
+
+  IDE_EXIT;
+}
+
 /*
- * TODO: This should all be delayed and buffered so we coalesce multiple
- *       events into a single dispatch.
+ * Sends all of the edits that have been batched up. This must be called
+ * before anything that relies on the peer having an up to date view of
+ * the documents, such as requests or other notifications.
  */
+static void
+ide_langserv_client_flush_changes (IdeLangservClient *self)
+{
+  IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (self);
+  g_autoptr(GHashTable) pending_changes = NULL;
+  GHashTableIter iter;
+  PendingChanges *pending;
+
+  g_assert (IDE_IS_LANGSERV_CLIENT (self));
+
+  ide_clear_source (&priv->flush_source);
+
+  if (g_hash_table_size (priv->pending_changes) == 0)
+    return;
+
+  /* Sending will re-enter, so swap out the pending changes first */
+  pending_changes = g_steal_pointer (&priv->pending_changes);
+  priv->pending_changes = g_hash_table_new_full (NULL, NULL, NULL, pending_changes_free);
+
+  g_hash_table_iter_init (&iter, pending_changes);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&pending))
+    ide_langserv_client_send_changes (self, pending);
+}
+
+static gboolean
+ide_langserv_client_flush_timeout (gpointer data)
+{
+  IdeLangservClient *self = data;
+  IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (self);
+
+  g_assert (IDE_IS_LANGSERV_CLIENT (self));
+
+  priv->flush_source = 0;
+
+  ide_langserv_client_flush_changes (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static GArray *
+ide_langserv_client_get_pending (IdeLangservClient *self,
+                                 IdeBuffer         *buffer)
+{
+  IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (self);
+  PendingChanges *pending;
+
+  g_assert (IDE_IS_LANGSERV_CLIENT (self));
+  g_assert (IDE_IS_BUFFER (buffer));
+
+  if (NULL == (pending = g_hash_table_lookup (priv->pending_changes, buffer)))
+    {
+      pending = g_slice_new0 (PendingChanges);
+      pending->buffer = g_object_ref (buffer);
+      pending->changes = g_array_new (FALSE, FALSE, sizeof (TextChange));
+      g_array_set_clear_func (pending->changes, text_change_clear);
+      g_hash_table_insert (priv->pending_changes, buffer, pending);
+    }
+
+  if (priv->flush_source == 0)
+    priv->flush_source = g_timeout_add (FLUSH_DELAY_MSEC,
+                                        ide_langserv_client_flush_timeout,
+                                        self);
+
+  return pending->changes;
+}
+
+static void
+text_change_get_insert_end (const TextChange *change,
+                            gint             *line,
+                            gint             *column)
+{
+  const gchar *last_line;
+
+  g_assert (change != NULL);
+  g_assert (line != NULL);
+  g_assert (column != NULL);
+
+  *line = change->begin_line;
+  *column = change->begin_column;
+
+  if (NULL == (last_line = strrchr (change->text->str, '\n')))
+    {
+      *column += g_utf8_strlen (change->text->str, change->text->len);
+      return;
+    }
+
+  for (const gchar *iter = change->text->str; iter <= last_line; iter++)
+    {
+      if (*iter == '\n')
+        (*line)++;
+    }
+
+  *column = g_utf8_strlen (last_line + 1, -1);
+}
 
 static void
 ide_langserv_client_buffer_insert_text (IdeLangservClient *self,
@@ -161,12 +444,10 @@ ide_langserv_client_buffer_insert_text (IdeLangservClient *self,
                                         gint               len,
                                         IdeBuffer         *buffer)
 {
-  g_autoptr(GVariant) params = NULL;
-  g_autofree gchar *uri = NULL;
-  g_autofree gchar *copy = NULL;
+  TextChange change = { 0 };
+  GArray *changes;
   gint line;
   gint column;
-  gint version;
 
   IDE_ENTRY;
 
@@ -174,39 +455,36 @@ ide_langserv_client_buffer_insert_text (IdeLangservClient *self,
   g_assert (location != NULL);
   g_assert (IDE_IS_BUFFER (buffer));
 
-  copy = g_strndup (new_text, len);
-
-  uri = ide_buffer_get_uri (buffer);
-  version = (gint)ide_buffer_get_change_count (buffer);
-
   line = gtk_text_iter_get_line (location);
   column = gtk_text_iter_get_line_offset (location);
 
-  params = JSONRPC_MESSAGE_NEW (
-    "textDocument", "{",
-      "uri", JSONRPC_MESSAGE_PUT_STRING (uri),
-      "version", JSONRPC_MESSAGE_PUT_INT64 (version),
-    "}",
-    "contentChanges", "[",
-      "{",
-        "range", "{",
-          "start", "{",
-            "line", JSONRPC_MESSAGE_PUT_INT64 (line),
-            "character", JSONRPC_MESSAGE_PUT_INT64 (column),
-          "}",
-          "end", "{",
-            "line", JSONRPC_MESSAGE_PUT_INT64 (line),
-            "character", JSONRPC_MESSAGE_PUT_INT64 (column),
-          "}",
-        "}",
-        "rangeLength", JSONRPC_MESSAGE_PUT_INT64 (0),
-        "text", JSONRPC_MESSAGE_PUT_STRING (copy),
-      "}",
-    "]");
+  changes = ide_langserv_client_get_pending (self, buffer);
 
-  ide_langserv_client_send_notification_async (self, "textDocument/didChange",
-                                               g_steal_pointer (&params),
-                                               NULL, NULL, NULL);
+  /* Extend the previous insertion if we are typing at the end of it */
+  if (changes->len > 0)
+    {
+      TextChange *last = &g_array_index (changes, TextChange, changes->len - 1);
+      gint last_line;
+      gint last_column;
+
+      if (last->length == 0 && last->text->len > 0)
+        {
+          text_change_get_insert_end (last, &last_line, &last_column);
+
+          if (last_line == line && last_column == column)
+            {
+              g_string_append_len (last->text, new_text, len);
+              IDE_EXIT;
+            }
+        }
+    }
+
+  change.begin_line = change.end_line = line;
+  change.begin_column = change.end_column = column;
+  change.length = 0;
+  change.text = g_string_new_len (new_text, len);
+
+  g_array_append_val (changes, change);
 
   IDE_EXIT;
 }
@@ -217,15 +495,8 @@ ide_langserv_client_buffer_delete_range (IdeLangservClient *self,
                                          GtkTextIter       *end_iter,
                                          IdeBuffer         *buffer)
 {
-
-  g_autoptr(GVariant) params = NULL;
-  g_autofree gchar *uri = NULL;
-  struct {
-    gint line;
-    gint column;
-  } begin, end;
-  gint version;
-  gint length;
+  TextChange change = { 0 };
+  GArray *changes;
 
   IDE_ENTRY;
 
@@ -234,42 +505,52 @@ ide_langserv_client_buffer_delete_range (IdeLangservClient *self,
   g_assert (end_iter != NULL);
   g_assert (IDE_IS_BUFFER (buffer));
 
-  uri = ide_buffer_get_uri (buffer);
-  version = (gint)ide_buffer_get_change_count (buffer);
+  change.begin_line = gtk_text_iter_get_line (begin_iter);
+  change.begin_column = gtk_text_iter_get_line_offset (begin_iter);
+  change.end_line = gtk_text_iter_get_line (end_iter);
+  change.end_column = gtk_text_iter_get_line_offset (end_iter);
+  change.length = gtk_text_iter_get_offset (end_iter) - gtk_text_iter_get_offset (begin_iter);
 
-  begin.line = gtk_text_iter_get_line (begin_iter);
-  begin.column = gtk_text_iter_get_line_offset (begin_iter);
+  changes = ide_langserv_client_get_pending (self, buffer);
 
-  end.line = gtk_text_iter_get_line (end_iter);
-  end.column = gtk_text_iter_get_line_offset (end_iter);
+  if (changes->len > 0)
+    {
+      TextChange *last = &g_array_index (changes, TextChange, changes->len - 1);
 
-  length = gtk_text_iter_get_offset (end_iter) - gtk_text_iter_get_offset (begin_iter);
+      /* Backspacing over a previous deletion, grow it towards the start */
+      if (last->text->len == 0 &&
+          last->begin_line == change.end_line &&
+          last->begin_column == change.end_column)
+        {
+          last->begin_line = change.begin_line;
+          last->begin_column = change.begin_column;
+          last->length += change.length;
+          IDE_EXIT;
+        }
 
-  params = JSONRPC_MESSAGE_NEW (
-    "textDocument", "{",
-      "uri", JSONRPC_MESSAGE_PUT_STRING (uri),
-      "version", JSONRPC_MESSAGE_PUT_INT64 (version),
-    "}",
-    "contentChanges", "[",
-      "{",
-        "range", "{",
-          "start", "{",
-            "line", JSONRPC_MESSAGE_PUT_INT64 (begin.line),
-            "character", JSONRPC_MESSAGE_PUT_INT64 (begin.column),
-          "}",
-          "end", "{",
-            "line", JSONRPC_MESSAGE_PUT_INT64 (end.line),
-            "character", JSONRPC_MESSAGE_PUT_INT64 (end.column),
-          "}",
-        "}",
-        "rangeLength", JSONRPC_MESSAGE_PUT_INT64 (length),
-        "text", "",
-      "}",
-    "]");
+      /* Backspacing over text we have not sent yet, just trim it */
+      if (last->length == 0 &&
+          change.begin_line == change.end_line &&
+          last->begin_line == change.begin_line &&
+          last->begin_column <= change.begin_column &&
+          strchr (last->text->str, '\n') == NULL &&
+          last->begin_column + (gint)g_utf8_strlen (last->text->str, last->text->len) == change.end_column)
+        {
+          const gchar *trim;
 
-  ide_langserv_client_send_notification_async (self, "textDocument/didChange",
-                                               g_steal_pointer (&params),
-                                               NULL, NULL, NULL);
+          trim = g_utf8_offset_to_pointer (last->text->str, change.begin_column - last->begin_column);
+          g_string_truncate (last->text, trim - last->text->str);
+
+          if (last->text->len == 0)
+            g_array_set_size (changes, changes->len - 1);
+
+          IDE_EXIT;
+        }
+    }
+
+  change.text = g_string_new (NULL);
+
+  g_array_append_val (changes, change);
 
   IDE_EXIT;
 }
@@ -352,6 +633,8 @@ ide_langserv_client_buffer_unloaded (IdeLangservClient *self,
   if (!ide_langserv_client_supports_buffer (self, buffer))
     IDE_EXIT;
 
+  ide_langserv_client_flush_changes (self);
+
   uri = ide_buffer_get_uri (buffer);
 
   params = JSONRPC_MESSAGE_NEW (
@@ -666,7 +949,12 @@ ide_langserv_client_finalize (GObject *object)
   IdeLangservClient *self = (IdeLangservClient *)object;
   IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (self);
 
+  ide_clear_source (&priv->flush_source);
+
   g_clear_pointer (&priv->diagnostics_by_file, g_hash_table_unref);
+  g_clear_pointer (&priv->pending_changes, g_hash_table_unref);
+  g_clear_pointer (&priv->calls, g_ptr_array_unref);
+  g_clear_pointer (&priv->calls_by_key, g_hash_table_unref);
   g_clear_pointer (&priv->languages, g_ptr_array_unref);
   g_clear_object (&priv->rpc_client);
   g_clear_object (&priv->buffer_manager_signals);
@@ -798,6 +1086,11 @@ ide_langserv_client_init (IdeLangservClient *self)
 
   priv->languages = g_ptr_array_new_with_free_func (g_free);
 
+  priv->pending_changes = g_hash_table_new_full (NULL, NULL, NULL, pending_changes_free);
+
+  priv->calls = g_ptr_array_new ();
+  priv->calls_by_key = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
   priv->diagnostics_by_file = g_hash_table_new_full ((GHashFunc)g_file_hash,
                                                      (GEqualFunc)g_file_equal,
                                                      g_object_unref,
@@ -1008,6 +1301,8 @@ ide_langserv_client_stop (IdeLangservClient *self)
 
   g_return_if_fail (IDE_IS_LANGSERV_CLIENT (self));
 
+  ide_langserv_client_flush_changes (self);
+
   if (priv->rpc_client != NULL)
     {
       jsonrpc_client_call_async (priv->rpc_client,
@@ -1022,6 +1317,257 @@ ide_langserv_client_stop (IdeLangservClient *self)
   IDE_EXIT;
 }
 
+static void
+call_waiter_clear (gpointer data)
+{
+  CallWaiter *waiter = data;
+
+  g_assert (waiter->cancelled_handler == 0);
+
+  g_clear_object (&waiter->task);
+}
+
+static LangservCall *
+langserv_call_ref (LangservCall *call)
+{
+  g_assert (call != NULL);
+  g_assert (call->ref_count > 0);
+
+  g_atomic_int_inc (&call->ref_count);
+
+  return call;
+}
+
+static void
+langserv_call_unref (LangservCall *call)
+{
+  g_assert (call != NULL);
+  g_assert (call->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&call->ref_count))
+    {
+      g_clear_object (&call->self);
+      g_clear_object (&call->buffer);
+      g_clear_object (&call->cancellable);
+      g_clear_pointer (&call->method, g_free);
+      g_clear_pointer (&call->key, g_free);
+      g_clear_pointer (&call->params, g_variant_unref);
+      g_clear_pointer (&call->id, g_variant_unref);
+      g_clear_pointer (&call->waiters, g_array_unref);
+      g_slice_free (LangservCall, call);
+    }
+}
+
+static gchar *
+get_params_uri (GVariant *params)
+{
+  g_autoptr(GVariant) text_document = NULL;
+  const gchar *uri = NULL;
+
+  if (params != NULL &&
+      g_variant_is_of_type (params, G_VARIANT_TYPE_VARDICT) &&
+      NULL != (text_document = g_variant_lookup_value (params, "textDocument", G_VARIANT_TYPE_VARDICT)) &&
+      g_variant_lookup (text_document, "uri", "&s", &uri))
+    return g_strdup (uri);
+
+  return NULL;
+}
+
+static gboolean
+is_superseded_method (const gchar *method)
+{
+  for (guint i = 0; i < G_N_ELEMENTS (superseded_methods); i++)
+    {
+      if (g_str_equal (method, superseded_methods[i]))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/*
+ * Completes a single caller waiting on @call. The reply is shared by all
+ * of the callers that made an identical request.
+ */
+static void
+langserv_call_return (LangservCall *call,
+                      guint         index,
+                      GVariant     *reply,
+                      const GError *error)
+{
+  CallWaiter *waiter;
+
+  g_assert (call != NULL);
+  g_assert (index < call->waiters->len);
+
+  waiter = &g_array_index (call->waiters, CallWaiter, index);
+
+  if (waiter->returned)
+    return;
+
+  waiter->returned = TRUE;
+
+  if (waiter->cancelled_handler != 0)
+    {
+      g_cancellable_disconnect (g_task_get_cancellable (waiter->task), waiter->cancelled_handler);
+      waiter->cancelled_handler = 0;
+    }
+
+  if (error != NULL)
+    g_task_return_error (waiter->task, g_error_copy (error));
+  else
+    g_task_return_pointer (waiter->task,
+                           reply ? g_variant_ref (reply) : NULL,
+                           (GDestroyNotify)g_variant_unref);
+}
+
+static void
+langserv_call_return_all (LangservCall *call,
+                          GVariant     *reply,
+                          const GError *error)
+{
+  g_assert (call != NULL);
+
+  for (guint i = 0; i < call->waiters->len; i++)
+    langserv_call_return (call, i, reply, error);
+}
+
+static void
+langserv_call_finish (LangservCall *call)
+{
+  IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (call->self);
+
+  g_assert (call != NULL);
+  g_assert (!call->finished);
+
+  call->finished = TRUE;
+
+  if (call->key != NULL && g_hash_table_lookup (priv->calls_by_key, call->key) == call)
+    g_hash_table_remove (priv->calls_by_key, call->key);
+
+  g_ptr_array_remove (priv->calls, call);
+}
+
+/*
+ * Stops waiting for the reply to @call and asks the peer to stop working on
+ * it. Anyone still waiting on the reply is told it was cancelled.
+ */
+static void
+langserv_call_cancel (LangservCall *call,
+                      const gchar  *reason)
+{
+  IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (call->self);
+  g_autoptr(GError) error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (call != NULL);
+  g_assert (reason != NULL);
+
+  if (call->finished)
+    IDE_EXIT;
+
+  IDE_TRACE_MSG ("Cancelling %s: %s", call->method, reason);
+
+  langserv_call_finish (call);
+
+  g_cancellable_cancel (call->cancellable);
+
+  if (call->id != NULL && priv->rpc_client != NULL)
+    {
+      g_autoptr(GVariant) params = NULL;
+
+      params = JSONRPC_MESSAGE_NEW (
+        "id", JSONRPC_MESSAGE_PUT_VARIANT (call->id)
+      );
+
+      ide_langserv_client_send_notification_async (call->self, "$/cancelRequest",
+                                                   g_steal_pointer (&params),
+                                                   NULL, NULL, NULL);
+    }
+
+  error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED, reason);
+  langserv_call_return_all (call, NULL, error);
+
+  IDE_EXIT;
+}
+
+static gboolean
+langserv_call_check_cancelled (gpointer data)
+{
+  LangservCall *call = data;
+  gboolean has_waiters = FALSE;
+
+  g_assert (call != NULL);
+
+  for (guint i = 0; i < call->waiters->len; i++)
+    {
+      CallWaiter *waiter = &g_array_index (call->waiters, CallWaiter, i);
+
+      if (waiter->returned)
+        continue;
+
+      if (g_cancellable_is_cancelled (g_task_get_cancellable (waiter->task)))
+        {
+          g_autoptr(GError) error = NULL;
+
+          error = g_error_new_literal (G_IO_ERROR,
+                                       G_IO_ERROR_CANCELLED,
+                                       "The operation was cancelled");
+          langserv_call_return (call, i, NULL, error);
+          continue;
+        }
+
+      has_waiters = TRUE;
+    }
+
+  /* Nobody is interested in the reply anymore */
+  if (!has_waiters)
+    langserv_call_cancel (call, "The operation was cancelled");
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+langserv_call_cancelled_cb (GCancellable *cancellable,
+                            LangservCall *call)
+{
+  g_assert (G_IS_CANCELLABLE (cancellable));
+  g_assert (call != NULL);
+
+  /*
+   * We might be called from any thread, and we cannot disconnect from the
+   * cancellable while inside this callback, so defer to the main loop.
+   */
+  g_idle_add_full (G_PRIORITY_HIGH,
+                   langserv_call_check_cancelled,
+                   langserv_call_ref (call),
+                   (GDestroyNotify)langserv_call_unref);
+}
+
+static void
+langserv_call_add_waiter (LangservCall *call,
+                          GTask        *task)
+{
+  CallWaiter waiter = { 0 };
+  GCancellable *cancellable;
+  CallWaiter *added;
+
+  g_assert (call != NULL);
+  g_assert (G_IS_TASK (task));
+
+  waiter.task = g_object_ref (task);
+  g_array_append_val (call->waiters, waiter);
+  added = &g_array_index (call->waiters, CallWaiter, call->waiters->len - 1);
+
+  if (NULL != (cancellable = g_task_get_cancellable (task)))
+    added->cancelled_handler =
+      g_cancellable_connect (cancellable,
+                             G_CALLBACK (langserv_call_cancelled_cb),
+                             langserv_call_ref (call),
+                             (GDestroyNotify)langserv_call_unref);
+}
+
 static void
 ide_langserv_client_call_cb (GObject      *object,
                              GAsyncResult *result,
@@ -1030,21 +1576,44 @@ ide_langserv_client_call_cb (GObject      *object,
   JsonrpcClient *client = (JsonrpcClient *)object;
   g_autoptr(GVariant) return_value = NULL;
   g_autoptr(GError) error = NULL;
-  g_autoptr(GTask) task = user_data;
+  LangservCall *call = user_data;
 
   IDE_ENTRY;
 
   g_assert (JSONRPC_IS_CLIENT (client));
   g_assert (G_IS_ASYNC_RESULT (result));
-  g_assert (G_IS_TASK (task));
+  g_assert (call != NULL);
 
   if (!jsonrpc_client_call_finish (client, result, &return_value, &error))
+    g_assert (error != NULL);
+
+  /* The call was superseded or cancelled, drop the reply on the floor */
+  if (call->finished)
     {
-      g_task_return_error (task, g_steal_pointer (&error));
-      return;
+      IDE_TRACE_MSG ("Dropping reply for abandoned %s", call->method);
+      langserv_call_unref (call);
+      IDE_EXIT;
     }
 
-  g_task_return_pointer (task, g_steal_pointer (&return_value), (GDestroyNotify)g_variant_unref);
+  langserv_call_finish (call);
+
+  /*
+   * Don't hand consumers a reply that was computed against an older
+   * version of the document, a newer request will follow.
+   */
+  if (error == NULL &&
+      call->key != NULL &&
+      call->buffer != NULL &&
+      ide_buffer_get_change_count (call->buffer) != call->version)
+    {
+      IDE_TRACE_MSG ("Dropping reply for %s, document changed", call->method);
+      error = g_error_new_literal (G_IO_ERROR,
+                                   G_IO_ERROR_CANCELLED,
+                                   "The document changed before the reply was received");
+    }
+
+  langserv_call_return_all (call, return_value, error);
+  langserv_call_unref (call);
 
   IDE_EXIT;
 }
@@ -1070,6 +1639,8 @@ ide_langserv_client_call_async (IdeLangservClient   *self,
 {
   IdeLangservClientPrivate *priv = ide_langserv_client_get_instance_private (self);
   g_autoptr(GTask) task = NULL;
+  g_autofree gchar *uri = NULL;
+  LangservCall *call;
 
   IDE_ENTRY;
 
@@ -1090,12 +1661,94 @@ ide_langserv_client_call_async (IdeLangservClient   *self,
       IDE_EXIT;
     }
 
+  /* Make sure the peer has seen all edits before answering a request */
+  ide_langserv_client_flush_changes (self);
+
+  if (params != NULL)
+    params = g_variant_take_ref (params);
+
+  /*
+   * Share the reply if an identical query is already in flight. Only the
+   * queries in superseded_methods are shared, since other requests may
+   * have side effects on the peer. A query sent against an older version
+   * of the document is superseded below rather than joined, since its
+   * reply will be dropped.
+   */
+  for (guint i = 0; is_superseded_method (method) && i < priv->calls->len; i++)
+    {
+      call = g_ptr_array_index (priv->calls, i);
+
+      if (call->buffer != NULL &&
+          call->version != ide_buffer_get_change_count (call->buffer))
+        continue;
+
+      if (g_str_equal (call->method, method) &&
+          ((params == NULL && call->params == NULL) ||
+           (params != NULL && call->params != NULL && g_variant_equal (params, call->params))))
+        {
+          IDE_TRACE_MSG ("Joining in-flight %s request", method);
+          langserv_call_add_waiter (call, task);
+          g_clear_pointer (&params, g_variant_unref);
+          IDE_EXIT;
+        }
+    }
+
+  call = g_slice_new0 (LangservCall);
+  call->ref_count = 1;
+  call->self = g_object_ref (self);
+  call->method = g_strdup (method);
+  call->params = params;
+  call->cancellable = g_cancellable_new ();
+  call->waiters = g_array_new (FALSE, FALSE, sizeof (CallWaiter));
+  g_array_set_clear_func (call->waiters, call_waiter_clear);
+
+  if (is_superseded_method (method) && NULL != (uri = get_params_uri (params)))
+    {
+      g_autoptr(GFile) file = g_file_new_for_uri (uri);
+      IdeContext *context = ide_object_get_context (IDE_OBJECT (self));
+      IdeBufferManager *buffer_manager = ide_context_get_buffer_manager (context);
+      IdeBuffer *buffer = ide_buffer_manager_find_buffer (buffer_manager, file);
+      LangservCall *previous;
+
+      call->key = g_strdup_printf ("%s %s", method, uri);
+
+      if (buffer != NULL)
+        {
+          call->buffer = g_object_ref (buffer);
+          call->version = ide_buffer_get_change_count (buffer);
+        }
+
+      if (NULL != (previous = g_hash_table_lookup (priv->calls_by_key, call->key)))
+        langserv_call_cancel (previous, "Superseded by a newer request");
+
+      g_hash_table_insert (priv->calls_by_key, g_strdup (call->key), call);
+    }
+
+  g_ptr_array_add (priv->calls, call);
+
+  langserv_call_add_waiter (call, task);
+
+#ifdef HAVE_JSONRPC_CALL_WITH_ID
+  /* Keep the id jsonrpc-glib used so that we can cancel the request */
+  jsonrpc_client_call_with_id_async (priv->rpc_client,
+                                     method,
+                                     call->params ? g_variant_ref (call->params) : NULL,
+                                     &call->id,
+                                     call->cancellable,
+                                     ide_langserv_client_call_cb,
+                                     call);
+#else
+  /*
+   * Older jsonrpc-glib does not tell us the id of the request, so we cannot
+   * send $/cancelRequest for it and the peer still computes the reply.
+   */
   jsonrpc_client_call_async (priv->rpc_client,
                              method,
-                             params,
-                             cancellable,
+                             call->params ? g_variant_ref (call->params) : NULL,
+                             call->cancellable,
                              ide_langserv_client_call_cb,
-                             g_steal_pointer (&task));
+                             call);
+#endif
 
   IDE_EXIT;
 }
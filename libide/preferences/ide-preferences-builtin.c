@@ -389,6 +389,8 @@ ide_preferences_builtin_register_build (IdePreferences *preferences)
   g_signal_connect (widget, "input", G_CALLBACK (workers_input), NULL);
   g_signal_connect (widget, "output", G_CALLBACK (workers_output), NULL);
 
+  ide_preferences_add_spin_button (preferences, "build", "basic", "org.gnome.builder.build", "log-retention-lines", "/org/gnome/builder/build/", _("Build Log Retention"), _("Number of lines of build output to keep"), NULL, 10);
+
   ide_preferences_add_list_group (preferences, "build", "network", _("Network"), GTK_SELECTION_NONE, 100);
   ide_preferences_add_switch (preferences, "build", "network", "org.gnome.builder.build", "allow-network-when-metered", NULL, NULL, _("Allow downloads over metered connections"), _("Allow the use of metered network connections when automatically downloading dependencies"), NULL, 10);
 }
@@ -118,6 +118,7 @@ typedef struct
 
   DzlBindingGroup             *file_setting_bindings;
   DzlSignalGroup              *buffer_signals;
+  DzlSignalGroup              *vadj_signals;
 
   guint                        change_sequence;
 
@@ -1630,6 +1631,49 @@ ide_source_view__buffer__notify_can_undo (IdeSourceView *self,
   dzl_widget_action_group_set_action_enabled (DZL_WIDGET_ACTION_GROUP (group), "undo", can_undo);
 }
 
+/*
+ * Lets the highlighter know what we are showing so that it can work on
+ * that first. This is called as the view is scrolled or resized rather
+ * than while drawing, as it moves marks and may queue highlighting work.
+ */
+static void
+ide_source_view_update_visible_range (IdeSourceView *self)
+{
+  GtkTextView *text_view = (GtkTextView *)self;
+  IdeHighlightEngine *engine;
+  GtkTextBuffer *buffer;
+  GdkRectangle area;
+  GtkTextIter begin;
+  GtkTextIter end;
+
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+
+  buffer = gtk_text_view_get_buffer (text_view);
+
+  if (!IDE_IS_BUFFER (buffer) ||
+      !(engine = _ide_buffer_get_highlight_engine (IDE_BUFFER (buffer))))
+    return;
+
+  gtk_text_view_get_visible_rect (text_view, &area);
+  gtk_text_view_get_line_at_y (text_view, &begin, area.y, NULL);
+  gtk_text_view_get_line_at_y (text_view, &end, area.y + area.height, NULL);
+
+  if (!gtk_text_iter_ends_line (&end))
+    gtk_text_iter_forward_to_line_end (&end);
+
+  _ide_highlight_engine_set_visible_range (engine, self, &begin, &end);
+}
+
+static void
+ide_source_view__vadj_changed_cb (IdeSourceView *self,
+                                  GtkAdjustment *adj)
+{
+  g_assert (IDE_IS_SOURCE_VIEW (self));
+  g_assert (GTK_IS_ADJUSTMENT (adj));
+
+  ide_source_view_update_visible_range (self);
+}
+
 static void
 ide_source_view_bind_buffer (IdeSourceView  *self,
                              IdeBuffer      *buffer,
@@ -1737,6 +1781,8 @@ ide_source_view_bind_buffer (IdeSourceView  *self,
   insert = gtk_text_buffer_get_insert (GTK_TEXT_BUFFER (buffer));
   ide_source_view_scroll_mark_onscreen (self, insert, TRUE, 0.5, 0.5);
 
+  ide_source_view_update_visible_range (self);
+
   IDE_EXIT;
 }
 
@@ -1745,6 +1791,7 @@ ide_source_view_unbind_buffer (IdeSourceView  *self,
                                DzlSignalGroup *group)
 {
   IdeSourceViewPrivate *priv = ide_source_view_get_instance_private (self);
+  IdeHighlightEngine *engine;
 
   IDE_ENTRY;
 
@@ -1783,6 +1830,9 @@ ide_source_view_unbind_buffer (IdeSourceView  *self,
   g_clear_object (&priv->definition_highlight_start_mark);
   g_clear_object (&priv->definition_highlight_end_mark);
 
+  if ((engine = _ide_buffer_get_highlight_engine (priv->buffer)))
+    _ide_highlight_engine_clear_visible_range (engine, self);
+
   ide_buffer_release (priv->buffer);
 
   IDE_EXIT;
@@ -5628,6 +5678,8 @@ ide_source_view_do_size_allocate_hack_cb (gpointer data)
 
   GTK_WIDGET_CLASS (ide_source_view_parent_class)->size_allocate (GTK_WIDGET (self), &alloc);
 
+  ide_source_view_update_visible_range (self);
+
   return G_SOURCE_REMOVE;
 }
 
@@ -5701,6 +5753,7 @@ ide_source_view_size_allocate (GtkWidget     *widget,
     GTK_WIDGET_CLASS (ide_source_view_parent_class)->size_allocate (GTK_WIDGET (self), allocation);
 
   ide_source_view_set_overscroll_num_lines (self, priv->overscroll_num_lines);
+  ide_source_view_update_visible_range (self);
 }
 
 static gboolean
@@ -6302,6 +6355,7 @@ ide_source_view_dispose (GObject *object)
   g_clear_object (&priv->css_provider);
   g_clear_object (&priv->mode);
   g_clear_object (&priv->buffer_signals);
+  g_clear_object (&priv->vadj_signals);
   g_clear_object (&priv->file_setting_bindings);
 
   if (priv->command_str != NULL)
@@ -7489,6 +7543,22 @@ ide_source_view_init (IdeSourceView *self)
   priv->command_str = g_string_sized_new (32);
   priv->overscroll_num_lines = DEFAULT_OVERSCROLL_NUM_LINES;
 
+  priv->vadj_signals = dzl_signal_group_new (GTK_TYPE_ADJUSTMENT);
+
+  dzl_signal_group_connect_object (priv->vadj_signals,
+                                   "value-changed",
+                                   G_CALLBACK (ide_source_view__vadj_changed_cb),
+                                   self,
+                                   G_CONNECT_SWAPPED);
+
+  dzl_signal_group_connect_object (priv->vadj_signals,
+                                   "changed",
+                                   G_CALLBACK (ide_source_view__vadj_changed_cb),
+                                   self,
+                                   G_CONNECT_SWAPPED);
+
+  g_object_bind_property (self, "vadjustment", priv->vadj_signals, "target", G_BINDING_SYNC_CREATE);
+
   priv->completion_providers_signals = dzl_signal_group_new (IDE_TYPE_EXTENSION_SET_ADAPTER);
 
   dzl_signal_group_connect_object (priv->completion_providers_signals,
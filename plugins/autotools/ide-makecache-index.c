@@ -0,0 +1,403 @@
+/* ide-makecache-index.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-makecache-index"
+
+#include <string.h>
+#include <ide.h>
+
+#include "ide-makecache-index.h"
+#include "ide-makecache-target.h"
+
+static gboolean
+is_target_interesting (const gchar *target)
+{
+  return ((target [0] != '#') &&
+          (target [0] != '.') &&
+          (g_str_has_suffix (target, ".lo") ||
+           g_str_has_suffix (target, ".o")));
+}
+
+static GHashTable *
+ide_makecache_index_new (void)
+{
+  return g_hash_table_new_full (g_str_hash,
+                                g_str_equal,
+                                g_free,
+                                (GDestroyNotify)g_ptr_array_unref);
+}
+
+static void
+ide_makecache_index_add (GHashTable  *index,
+                         const gchar *name,
+                         gsize        name_len,
+                         const gchar *subdir,
+                         const gchar *target)
+{
+  g_autofree gchar *key = g_strndup (name, name_len);
+  g_autoptr(IdeMakecacheTarget) item = NULL;
+  GPtrArray *targets;
+
+  g_assert (index != NULL);
+  g_assert (target != NULL);
+
+  if (NULL == (targets = g_hash_table_lookup (index, key)))
+    {
+      targets = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_makecache_target_unref);
+      g_hash_table_insert (index, g_steal_pointer (&key), targets);
+    }
+
+  item = ide_makecache_target_new (subdir, target);
+
+  for (guint i = 0; i < targets->len; i++)
+    {
+      if (ide_makecache_target_equal (g_ptr_array_index (targets, i), item))
+        return;
+    }
+
+  g_ptr_array_add (targets, g_steal_pointer (&item));
+}
+
+/**
+ * ide_makecache_index_build:
+ * @content: the contents of the make database
+ * @len: the length of @content
+ *
+ * Scans the make database once and builds an inverted index from the
+ * basename of each prerequisite to the interesting targets (along with the
+ * subdir they belong to) that depend on it. Looking up the targets for a
+ * file is then a hash table lookup rather than a regex scan of the whole
+ * database.
+ *
+ * Returns: (transfer full): A #GHashTable of basename to #GPtrArray of
+ *   #IdeMakecacheTarget.
+ */
+GHashTable *
+ide_makecache_index_build (const gchar *content,
+                           gsize        len)
+{
+  g_autofree gchar *subdir = NULL;
+  GHashTable *index;
+  const gchar *line;
+  IdeLineReader rl;
+  gsize line_len;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (content != NULL, NULL);
+
+  index = ide_makecache_index_new ();
+
+  ide_line_reader_init (&rl, (gchar *)content, len);
+
+  while ((line = ide_line_reader_next (&rl, &line_len)))
+    {
+      g_autofree gchar *target = NULL;
+      const gchar *end = line + line_len;
+      const gchar *iter;
+
+      /*
+       * Keep track of "subdir = <dir>" changes so we know what directory
+       * to launch make from.
+       */
+      if ((line_len > 9) && (memcmp (line, "subdir = ", 9) == 0))
+        {
+          g_free (subdir);
+          subdir = g_strndup (line + 9, line_len - 9);
+          continue;
+        }
+
+      /* We only care about rules, "target: prerequisites" */
+      for (iter = line; iter < end && *iter != ':' && *iter != ' '; iter++) { }
+
+      if (iter == line || iter == end || *iter != ':')
+        continue;
+
+      target = g_strndup (line, iter - line);
+
+      if (!is_target_interesting (target))
+        continue;
+
+      /* Index each prerequisite by its basename */
+      while (iter < end)
+        {
+          const gchar *word;
+          const gchar *name;
+
+          while (iter < end && (*iter == ':' || g_ascii_isspace (*iter)))
+            iter++;
+
+          for (word = name = iter; iter < end && !g_ascii_isspace (*iter); iter++)
+            {
+              if (*iter == G_DIR_SEPARATOR)
+                name = iter + 1;
+            }
+
+          if (iter > word && iter > name)
+            ide_makecache_index_add (index, name, iter - name, subdir, target);
+        }
+    }
+
+  IDE_TRACE_MSG ("Indexed %u prerequisites", g_hash_table_size (index));
+
+  IDE_RETURN (index);
+}
+
+/**
+ * ide_makecache_index_load:
+ * @index_path: the path of the saved index
+ * @checksum: the checksum of the current make database
+ *
+ * The index is stored next to the cache file along with the checksum of
+ * the cache file it was built from, so we can tell when it is stale. The
+ * cache file is rewritten by every build, so its modification time cannot
+ * be used for this.
+ *
+ * Returns: (transfer full) (nullable): The saved index, or %NULL if it is
+ *   missing or was built from a different make database.
+ */
+GHashTable *
+ide_makecache_index_load (const gchar *index_path,
+                          const gchar *checksum)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariantIter) entries = NULL;
+  GHashTable *index;
+  GVariantIter *targets;
+  const gchar *name;
+  const gchar *saved_checksum;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (index_path != NULL, NULL);
+  g_return_val_if_fail (checksum != NULL, NULL);
+
+  if (!(mapped = g_mapped_file_new (index_path, FALSE, NULL)))
+    IDE_RETURN (NULL);
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(sa{sa(ss)})"), bytes, FALSE));
+
+  g_variant_get (variant, "(&sa{sa(ss)})", &saved_checksum, &entries);
+
+  if (!g_str_equal (saved_checksum, checksum))
+    IDE_RETURN (NULL);
+
+  index = ide_makecache_index_new ();
+
+  while (g_variant_iter_next (entries, "{&sa(ss)}", &name, &targets))
+    {
+      const gchar *subdir;
+      const gchar *target;
+
+      while (g_variant_iter_next (targets, "(&s&s)", &subdir, &target))
+        ide_makecache_index_add (index, name, strlen (name), *subdir ? subdir : NULL, target);
+
+      g_variant_iter_free (targets);
+    }
+
+  IDE_RETURN (index);
+}
+
+gboolean
+ide_makecache_index_save (const gchar  *index_path,
+                          const gchar  *checksum,
+                          GHashTable   *index,
+                          GError      **error)
+{
+  g_autoptr(GVariant) variant = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const gchar *name;
+  GPtrArray *targets;
+  gboolean ret;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (index_path != NULL, FALSE);
+  g_return_val_if_fail (checksum != NULL, FALSE);
+  g_return_val_if_fail (index != NULL, FALSE);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sa(ss)}"));
+
+  g_hash_table_iter_init (&iter, index);
+
+  while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&targets))
+    {
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("{sa(ss)}"));
+      g_variant_builder_add (&builder, "s", name);
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(ss)"));
+
+      for (guint i = 0; i < targets->len; i++)
+        {
+          IdeMakecacheTarget *target = g_ptr_array_index (targets, i);
+
+          g_variant_builder_add (&builder, "(ss)",
+                                 ide_makecache_target_get_subdir (target) ?: "",
+                                 ide_makecache_target_get_target (target));
+        }
+
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
+    }
+
+  variant = g_variant_ref_sink (g_variant_new ("(s@a{sa(ss)})",
+                                               checksum,
+                                               g_variant_builder_end (&builder)));
+
+  ret = g_file_set_contents (index_path,
+                             g_variant_get_data (variant),
+                             g_variant_get_size (variant),
+                             error);
+
+  IDE_RETURN (ret);
+}
+
+/**
+ * ide_makecache_index_lookup:
+ *
+ * Returns: (transfer container) (nullable): A #GPtrArray of #IdeMakecacheTarget.
+ */
+GPtrArray *
+ide_makecache_index_lookup (GHashTable  *index,
+                            const gchar *path)
+{
+  g_autofree gchar *name = NULL;
+  GPtrArray *found;
+  GPtrArray *targets;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  /*
+   * TODO:
+   *
+   * We can end up with the same filename in multiple subdirectories. We should be careful about
+   * that later when we extract flags to choose the best match first.
+   */
+  name = g_path_get_basename (path);
+
+  if (!(found = g_hash_table_lookup (index, name)) || found->len == 0)
+    IDE_RETURN (NULL);
+
+  /* Copy the targets, since our caller may rename them */
+  targets = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_makecache_target_unref);
+
+  for (guint i = 0; i < found->len; i++)
+    {
+      IdeMakecacheTarget *target = g_ptr_array_index (found, i);
+
+      g_ptr_array_add (targets,
+                       ide_makecache_target_new (ide_makecache_target_get_subdir (target),
+                                                 ide_makecache_target_get_target (target)));
+    }
+
+#ifdef IDE_ENABLE_TRACE
+  {
+    GString *str;
+    gsize i;
+
+    str = g_string_new (NULL);
+
+    for (i = 0; i < targets->len; i++)
+      {
+        const gchar *target_subdir;
+        const gchar *target;
+        IdeMakecacheTarget *cur;
+
+        cur = g_ptr_array_index (targets, i);
+
+        target_subdir = ide_makecache_target_get_subdir (cur);
+        target = ide_makecache_target_get_target (cur);
+
+        if (target_subdir != NULL)
+          g_string_append_printf (str, " (%s of subdir %s)", target, target_subdir);
+        else
+          g_string_append_printf (str, " %s", target);
+      }
+
+    IDE_TRACE_MSG ("File \"%s\" found in targets: %s", path, str->str);
+    g_string_free (str, TRUE);
+  }
+#endif
+
+  IDE_RETURN (targets);
+}
+
+/*
+ * Checks if @line references @name, either bare or as the trailing
+ * components of a path.
+ */
+static gboolean
+line_mentions_file (const gchar *line,
+                    const gchar *name)
+{
+  gsize len;
+
+  g_assert (line != NULL);
+  g_assert (name != NULL);
+
+  len = strlen (name);
+
+  for (const gchar *iter = line; NULL != (iter = strstr (iter, name)); iter++)
+    {
+      gchar before = iter == line ? ' ' : iter[-1];
+      gchar after = iter[len];
+
+      if ((before == ' ' || before == G_DIR_SEPARATOR || before == '\'' || before == '"' || before == '`') &&
+          (after == ' ' || after == '\'' || after == '"' || after == '\0'))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+/**
+ * ide_makecache_find_compile_line:
+ * @lines: the output of a batched dry-run of make
+ * @relpath: the path of the file relative to the directory make ran in
+ *
+ * Locates the compiler invocation for @relpath, so that files sharing a
+ * basename do not take each other's line.
+ *
+ * Returns: the index of the line within @lines, or -1.
+ */
+gint
+ide_makecache_find_compile_line (const gchar * const *lines,
+                                 const gchar         *relpath)
+{
+  g_return_val_if_fail (lines != NULL, -1);
+  g_return_val_if_fail (relpath != NULL, -1);
+
+  for (guint i = 0; lines [i]; i++)
+    {
+      if (!strstr (lines [i], FAKE_CC) &&
+          !strstr (lines [i], FAKE_CXX) &&
+          !strstr (lines [i], FAKE_VALAC))
+        continue;
+
+      if (line_mentions_file (lines [i], relpath))
+        return i;
+    }
+
+  return -1;
+}
@@ -0,0 +1,45 @@
+/* ide-makecache-index.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_MAKECACHE_INDEX_H
+#define IDE_MAKECACHE_INDEX_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define FAKE_CC      "__LIBIDE_FAKE_CC__"
+#define FAKE_CXX     "__LIBIDE_FAKE_CXX__"
+#define FAKE_VALAC   "__LIBIDE_FAKE_VALAC__"
+
+GHashTable *ide_makecache_index_build       (const gchar         *content,
+                                             gsize                len);
+GHashTable *ide_makecache_index_load        (const gchar         *index_path,
+                                             const gchar         *checksum);
+gboolean    ide_makecache_index_save        (const gchar         *index_path,
+                                             const gchar         *checksum,
+                                             GHashTable          *index,
+                                             GError             **error);
+GPtrArray  *ide_makecache_index_lookup      (GHashTable          *index,
+                                             const gchar         *path);
+gint        ide_makecache_find_compile_line (const gchar * const *lines,
+                                             const gchar         *relpath);
+
+G_END_DECLS
+
+#endif /* IDE_MAKECACHE_INDEX_H */
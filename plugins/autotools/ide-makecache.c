@@ -34,21 +34,28 @@
 
 #include "ide-autotools-build-target.h"
 #include "ide-makecache.h"
+#include "ide-makecache-index.h"
 #include "ide-makecache-target.h"
 
-#define FAKE_CC      "__LIBIDE_FAKE_CC__"
-#define FAKE_CXX     "__LIBIDE_FAKE_CXX__"
-#define FAKE_VALAC   "__LIBIDE_FAKE_VALAC__"
 #define PRINT_VARS   "include Makefile\nprint-%: ; @echo $* = $($*)\n"
 
+#define SAVE_FLAGS_DELAY_SECONDS 1
+
 struct _IdeMakecache
 {
   IdeObject     parent_instance;
 
   GFile        *parent;
-  GMappedFile  *mapped;
+  gchar        *cache_path;
+  gchar        *cache_checksum;
+  GHashTable   *index;
+  GMutex        flags_mutex;
+  GHashTable   *flags_table;
+  GSource      *save_flags_source;
   DzlTaskCache *file_targets_cache;
   DzlTaskCache *file_flags_cache;
+  GPtrArray    *pending_flags;
+  guint         pending_flags_source;
   GPtrArray    *build_targets;
   IdeRuntime   *runtime;
   const gchar  *make_name;
@@ -64,10 +71,25 @@ typedef struct
 
 typedef struct
 {
-  GMappedFile *mapped;
-  gchar       *path;
+  GHashTable *index;
+  gchar      *path;
 } FileTargetsLookup;
 
+typedef struct
+{
+  IdeMakecache *self;
+  GPtrArray    *files;
+  GPtrArray    *relative_paths;
+  GHashTable   *results;
+} FilesFlagsLookup;
+
+typedef struct
+{
+  gchar     *subdir;
+  GPtrArray *targets;
+  GPtrArray *members;
+} FilesFlagsGroup;
+
 G_DEFINE_TYPE (IdeMakecache, ide_makecache, IDE_TYPE_OBJECT)
 
 DZL_DEFINE_COUNTER (instances, "IdeMakecache", "Instances", "The number of IdeMakecache")
@@ -90,10 +112,33 @@ file_targets_lookup_free (gpointer data)
   FileTargetsLookup *lookup = data;
 
   g_clear_pointer (&lookup->path, g_free);
-  g_clear_pointer (&lookup->mapped, g_mapped_file_unref);
+  g_clear_pointer (&lookup->index, g_hash_table_unref);
   g_slice_free (FileTargetsLookup, lookup);
 }
 
+static void
+files_flags_lookup_free (gpointer data)
+{
+  FilesFlagsLookup *lookup = data;
+
+  g_clear_object (&lookup->self);
+  g_clear_pointer (&lookup->files, g_ptr_array_unref);
+  g_clear_pointer (&lookup->relative_paths, g_ptr_array_unref);
+  g_clear_pointer (&lookup->results, g_hash_table_unref);
+  g_slice_free (FilesFlagsLookup, lookup);
+}
+
+static void
+files_flags_group_free (gpointer data)
+{
+  FilesFlagsGroup *group = data;
+
+  g_clear_pointer (&group->subdir, g_free);
+  g_clear_pointer (&group->targets, g_ptr_array_unref);
+  g_clear_pointer (&group->members, g_ptr_array_unref);
+  g_slice_free (FilesFlagsGroup, group);
+}
+
 static gboolean
 file_is_clangable (GFile *file)
 {
@@ -130,159 +175,6 @@ ide_makecache_get_relative_path (IdeMakecache *self,
 }
 
 
-static gboolean
-is_target_interesting (const gchar *target)
-{
-  return ((target [0] != '#') &&
-          (target [0] != '.') &&
-          (g_str_has_suffix (target, ".lo") ||
-           g_str_has_suffix (target, ".o")));
-}
-
-/**
- * ide_makecache_get_file_targets_searched:
- *
- * Returns: (transfer container): A #GPtrArray of #IdeMakecacheTarget.
- */
-static GPtrArray *
-ide_makecache_get_file_targets_searched (GMappedFile *mapped,
-                                         const gchar *path)
-{
-  g_autofree gchar *escaped = NULL;
-  g_autofree gchar *name = NULL;
-  g_autofree gchar *regexstr = NULL;
-  g_autofree gchar *subdir = NULL;
-  g_autoptr(GHashTable) found = NULL;
-  g_autoptr(GPtrArray) targets = NULL;
-  g_autoptr(GRegex) regex = NULL;
-  const gchar *content;
-  const gchar *line;
-  IdeLineReader rl;
-  gsize len;
-  gsize line_len;
-
-  IDE_ENTRY;
-
-  g_assert (path);
-
-  /*
-   * TODO:
-   *
-   * We can end up with the same filename in multiple subdirectories. We should be careful about
-   * that later when we extract flags to choose the best match first.
-   */
-  name = g_path_get_basename (path);
-  escaped = g_regex_escape_string (name, -1);
-  regexstr = g_strdup_printf ("^([^:\n ]+):.*\\b(%s)\\b", escaped);
-
-  regex = g_regex_new (regexstr, 0, 0, NULL);
-  if (!regex)
-    IDE_RETURN (NULL);
-
-  content = g_mapped_file_get_contents (mapped);
-  len = g_mapped_file_get_length (mapped);
-
-  targets = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_makecache_target_unref);
-  found = g_hash_table_new (ide_makecache_target_hash, ide_makecache_target_equal);
-
-#ifdef IDE_ENABLE_TRACE
-  {
-    gchar *fmtsize;
-
-    fmtsize = g_format_size (len);
-    IDE_TRACE_MSG ("Beginning regex lookup across %s of UTF-8 text", fmtsize);
-    g_free (fmtsize);
-  }
-#endif
-
-  if (len > G_MAXSSIZE)
-    IDE_RETURN (NULL);
-
-  ide_line_reader_init (&rl, (gchar *)content, len);
-
-  while ((line = ide_line_reader_next (&rl, &line_len)))
-    {
-      g_autoptr(GMatchInfo) match_info = NULL;
-
-      /*
-       * Keep track of "subdir = <dir>" changes so we know what directory
-       * to launch make from.
-       */
-      if ((line_len > 9) && (memcmp (line, "subdir = ", 9) == 0))
-        {
-          g_free (subdir);
-          subdir = g_strndup (line + 9, line_len - 9);
-          continue;
-        }
-
-      if (g_regex_match_full (regex, line, line_len, 0, 0, &match_info, NULL))
-        {
-          while (g_match_info_matches (match_info))
-            {
-              g_autofree gchar *targetstr = NULL;
-
-              targetstr = g_match_info_fetch (match_info, 1);
-
-              if (is_target_interesting (targetstr))
-                {
-                  g_autoptr(IdeMakecacheTarget) target = NULL;
-
-                  target = ide_makecache_target_new (subdir, targetstr);
-
-                  if (!g_hash_table_contains (found, target))
-                    {
-                      g_hash_table_insert (found, target, NULL);
-                      g_ptr_array_add (targets, g_steal_pointer (&target));
-                    }
-                }
-
-              g_match_info_next (match_info, NULL);
-            }
-        }
-    }
-
-  IDE_TRACE_MSG ("Regex scan complete");
-
-  if (targets->len > 0)
-    {
-#ifdef IDE_ENABLE_TRACE
-      {
-        GString *str;
-        gsize i;
-
-        str = g_string_new (NULL);
-
-        for (i = 0; i < targets->len; i++)
-          {
-            const gchar *target_subdir;
-            const gchar *target;
-            IdeMakecacheTarget *cur;
-
-            cur = g_ptr_array_index (targets, i);
-
-            target_subdir = ide_makecache_target_get_subdir (cur);
-            target = ide_makecache_target_get_target (cur);
-
-            if (target_subdir != NULL)
-              g_string_append_printf (str, " (%s of subdir %s)", target, target_subdir);
-            else
-              g_string_append_printf (str, " %s", target);
-          }
-
-
-        IDE_TRACE_MSG ("File \"%s\" found in targets: %s", path, str->str);
-        g_string_free (str, TRUE);
-      }
-#endif
-
-      g_ptr_array_ref (targets);
-
-      IDE_RETURN (targets);
-    }
-
-  IDE_RETURN (NULL);
-}
-
 static gboolean
 ide_makecache_validate_mapped_file (GMappedFile  *mapped,
                                     GError      **error)
@@ -603,6 +495,310 @@ ide_makecache_parse_line (IdeMakecache *self,
   IDE_RETURN (NULL);
 }
 
+static const gchar *
+get_subdir_relative_path (const gchar *relative_path,
+                          const gchar *subdir)
+{
+  const gchar *relpath;
+
+  g_assert (relative_path != NULL);
+
+  if ((subdir != NULL) && g_str_has_prefix (relative_path, subdir))
+    relpath = relative_path + strlen (subdir);
+  else
+    relpath = relative_path;
+
+  while (*relpath == G_DIR_SEPARATOR)
+    relpath++;
+
+  return relpath;
+}
+
+/*
+ * Runs make in dry-run mode from @subdir, pretending that each of @relpaths
+ * has changed so that the compile lines for @targets are printed. The
+ * compiler is replaced with our fake compilers so that we can locate the
+ * compile lines in the output.
+ *
+ * Returns: (transfer full): the lines of output with escaped newlines
+ *   joined, or %NULL and @error is set.
+ */
+static gchar **
+ide_makecache_dry_run (IdeMakecache        *self,
+                       const gchar         *subdir,
+                       const gchar * const *relpaths,
+                       const gchar * const *targets,
+                       GCancellable        *cancellable,
+                       GError             **error)
+{
+  g_autoptr(IdeSubprocessLauncher) launcher = NULL;
+  g_autoptr(IdeSubprocess) subprocess = NULL;
+  g_autoptr(GPtrArray) argv = NULL;
+  g_autofree gchar *stdoutstr = NULL;
+  g_autofree gchar *cwd = NULL;
+  gchar **lines;
+  gchar *tmp;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (relpaths != NULL);
+  g_assert (targets != NULL);
+  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  cwd = g_file_get_path (self->parent);
+
+  argv = g_ptr_array_new ();
+  g_ptr_array_add (argv, (gchar *)self->make_name);
+  g_ptr_array_add (argv, "-C");
+  g_ptr_array_add (argv, (gchar *)(subdir ?: "."));
+  g_ptr_array_add (argv, "-s");
+  g_ptr_array_add (argv, "-i");
+  g_ptr_array_add (argv, "-n");
+  for (guint i = 0; relpaths [i]; i++)
+    {
+      g_ptr_array_add (argv, "-W");
+      g_ptr_array_add (argv, (gchar *)relpaths [i]);
+    }
+  for (guint i = 0; targets [i]; i++)
+    g_ptr_array_add (argv, (gchar *)targets [i]);
+  g_ptr_array_add (argv, "V=1");
+  g_ptr_array_add (argv, "CC="FAKE_CC);
+  g_ptr_array_add (argv, "CXX="FAKE_CXX);
+  g_ptr_array_add (argv, "VALAC="FAKE_VALAC);
+  g_ptr_array_add (argv, NULL);
+
+#ifdef IDE_ENABLE_TRACE
+  {
+    gchar *cmdline;
+
+    cmdline = g_strjoinv (" ", (gchar **)argv->pdata);
+    IDE_TRACE_MSG ("subdir=%s %s", subdir ?: ".", cmdline);
+    g_free (cmdline);
+  }
+#endif
+
+  if (!(launcher = ide_runtime_create_launcher (self->runtime, error)))
+    IDE_RETURN (NULL);
+
+  ide_subprocess_launcher_set_flags (launcher, (G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+                                                G_SUBPROCESS_FLAGS_STDERR_SILENCE));
+  ide_subprocess_launcher_set_cwd (launcher, cwd);
+  ide_subprocess_launcher_push_args (launcher, (const gchar * const *)argv->pdata);
+
+  if (!(subprocess = ide_subprocess_launcher_spawn (launcher, cancellable, error)))
+    IDE_RETURN (NULL);
+
+  /* Don't let ourselves be cancelled from this operation */
+  if (!ide_subprocess_communicate_utf8 (subprocess, NULL, NULL, &stdoutstr, NULL, error))
+    IDE_RETURN (NULL);
+
+  /*
+   * Replace escaped newlines with " " to simplify command parsing
+   */
+  tmp = stdoutstr;
+  while (NULL != (tmp = strstr (tmp, "\\\n")))
+    {
+      tmp[0] = ' ';
+      tmp[1] = ' ';
+    }
+
+  lines = g_strsplit (stdoutstr, "\n", 0);
+
+  for (guint i = 0; lines [i]; i++)
+    {
+      gchar *line = lines [i];
+      gsize linelen = strlen (line);
+
+      if (linelen > 0 && line [linelen - 1] == '\\')
+        line [linelen - 1] = '\0';
+    }
+
+  IDE_RETURN (lines);
+}
+
+static gboolean ide_makecache_save_flags_cb (gpointer user_data);
+
+/*
+ * Records the flags discovered for @relative_path so that they can be
+ * reused without spawning make, even in a later session.
+ *
+ * The table is written out shortly after, so that discovering the flags
+ * for many files writes it once rather than once per file.
+ */
+static void
+ide_makecache_remember_flags (IdeMakecache        *self,
+                              const gchar         *relative_path,
+                              const gchar * const *flags)
+{
+  g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (relative_path != NULL);
+  g_assert (flags != NULL);
+
+  g_mutex_lock (&self->flags_mutex);
+
+  g_hash_table_insert (self->flags_table,
+                       g_strdup (relative_path),
+                       g_strdupv ((gchar **)flags));
+
+  /* The source keeps us alive until the table has been saved */
+  if (self->save_flags_source == NULL)
+    {
+      self->save_flags_source = g_timeout_source_new_seconds (SAVE_FLAGS_DELAY_SECONDS);
+      g_source_set_name (self->save_flags_source, "[ide] ide_makecache_save_flags_cb");
+      g_source_set_callback (self->save_flags_source,
+                             ide_makecache_save_flags_cb,
+                             g_object_ref (self),
+                             g_object_unref);
+      g_source_attach (self->save_flags_source, NULL);
+    }
+
+  g_mutex_unlock (&self->flags_mutex);
+}
+
+static gchar **
+ide_makecache_lookup_flags (IdeMakecache *self,
+                            const gchar  *relative_path)
+{
+  gchar **ret = NULL;
+  const gchar * const *flags;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (relative_path != NULL);
+
+  g_mutex_lock (&self->flags_mutex);
+  if (self->flags_table != NULL &&
+      NULL != (flags = g_hash_table_lookup (self->flags_table, relative_path)))
+    ret = g_strdupv ((gchar **)flags);
+  g_mutex_unlock (&self->flags_mutex);
+
+  return ret;
+}
+
+/*
+ * The flags table is stored next to the cache file, along with the
+ * checksum of the cache file so that we discard it when the makefiles
+ * change.
+ */
+static GHashTable *
+ide_makecache_load_flags (const gchar *flags_path,
+                          const gchar *checksum)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariantIter) entries = NULL;
+  GHashTable *flags_table;
+  const gchar *relative_path;
+  const gchar *saved_checksum;
+  gchar **flags;
+
+  IDE_ENTRY;
+
+  g_assert (flags_path != NULL);
+  g_assert (checksum != NULL);
+
+  flags_table = g_hash_table_new_full (g_str_hash,
+                                       g_str_equal,
+                                       g_free,
+                                       (GDestroyNotify)g_strfreev);
+
+  if (!(mapped = g_mapped_file_new (flags_path, FALSE, NULL)))
+    IDE_RETURN (flags_table);
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(sa{sas})"), bytes, FALSE));
+
+  g_variant_get (variant, "(&sa{sas})", &saved_checksum, &entries);
+
+  if (!g_str_equal (saved_checksum, checksum))
+    IDE_RETURN (flags_table);
+
+  while (g_variant_iter_next (entries, "{s^as}", &relative_path, &flags))
+    g_hash_table_insert (flags_table, (gchar *)relative_path, flags);
+
+  IDE_TRACE_MSG ("Loaded flags for %u files", g_hash_table_size (flags_table));
+
+  IDE_RETURN (flags_table);
+}
+
+static void
+ide_makecache_save_flags (IdeMakecache *self)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *flags_path = NULL;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const gchar *relative_path;
+  const gchar * const *flags;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (self->cache_path != NULL);
+
+  flags_path = g_strdup_printf ("%s.flags", self->cache_path);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sas}"));
+
+  g_mutex_lock (&self->flags_mutex);
+
+  g_hash_table_iter_init (&iter, self->flags_table);
+  while (g_hash_table_iter_next (&iter, (gpointer *)&relative_path, (gpointer *)&flags))
+    g_variant_builder_add (&builder, "{s^as}", relative_path, flags);
+
+  variant = g_variant_ref_sink (g_variant_new ("(s@a{sas})",
+                                               self->cache_checksum,
+                                               g_variant_builder_end (&builder)));
+
+  g_mutex_unlock (&self->flags_mutex);
+
+  /* Lookups must not wait on the disk, so write outside of the lock */
+  if (!g_file_set_contents (flags_path,
+                            g_variant_get_data (variant),
+                            g_variant_get_size (variant),
+                            &error))
+    g_warning ("Failed to save makecache flags: %s", error->message);
+
+  IDE_EXIT;
+}
+
+static void
+ide_makecache_save_flags_worker (GTask        *task,
+                                 gpointer      source_object,
+                                 gpointer      task_data,
+                                 GCancellable *cancellable)
+{
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_MAKECACHE (source_object));
+
+  ide_makecache_save_flags (source_object);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+ide_makecache_save_flags_cb (gpointer user_data)
+{
+  IdeMakecache *self = user_data;
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+
+  /* Flags remembered from now on schedule another save */
+  g_mutex_lock (&self->flags_mutex);
+  g_clear_pointer (&self->save_flags_source, g_source_unref);
+  g_mutex_unlock (&self->flags_mutex);
+
+  task = g_task_new (self, NULL, NULL, NULL);
+  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
+                             task,
+                             ide_makecache_save_flags_worker);
+
+  return G_SOURCE_REMOVE;
+}
+
 static void
 ide_makecache_get_file_flags_worker (GTask        *task,
                                      gpointer      source_object,
@@ -627,18 +823,12 @@ ide_makecache_get_file_flags_worker (GTask        *task,
   for (j = 0; j < lookup->targets->len; j++)
     {
       IdeMakecacheTarget *target;
-      g_autoptr(IdeSubprocessLauncher) launcher = NULL;
-      g_autoptr(IdeSubprocess) subprocess = NULL;
-      g_autoptr(GPtrArray) argv = NULL;
-      g_autofree gchar *stdoutstr = NULL;
-      g_autofree gchar *cwd = NULL;
       const gchar *subdir;
-      const gchar *targetstr;
-      const gchar *relpath;
+      const gchar *relpaths[2] = { NULL };
+      const gchar *targets[2] = { NULL };
       GError *error = NULL;
       gchar **lines;
       gchar **ret = NULL;
-      gchar *tmp;
 
       if (g_cancellable_is_cancelled (cancellable))
         break;
@@ -646,101 +836,24 @@ ide_makecache_get_file_flags_worker (GTask        *task,
       target = g_ptr_array_index (lookup->targets, j);
 
       subdir = ide_makecache_target_get_subdir (target);
-      targetstr = ide_makecache_target_get_target (target);
-
-      cwd = g_file_get_path (lookup->self->parent);
-
-      if ((subdir != NULL) && g_str_has_prefix (lookup->relative_path, subdir))
-        relpath = lookup->relative_path + strlen (subdir);
-      else
-        relpath = lookup->relative_path;
-
-      while (*relpath == G_DIR_SEPARATOR)
-        relpath++;
-
-      argv = g_ptr_array_new ();
-      g_ptr_array_add (argv, (gchar *)lookup->self->make_name);
-      g_ptr_array_add (argv, "-C");
-      g_ptr_array_add (argv, (gchar *)(subdir ?: "."));
-      g_ptr_array_add (argv, "-s");
-      g_ptr_array_add (argv, "-i");
-      g_ptr_array_add (argv, "-n");
-      g_ptr_array_add (argv, "-W");
-      g_ptr_array_add (argv, (gchar *)relpath);
-      g_ptr_array_add (argv, (gchar *)targetstr);
-      g_ptr_array_add (argv, "V=1");
-      g_ptr_array_add (argv, "CC="FAKE_CC);
-      g_ptr_array_add (argv, "CXX="FAKE_CXX);
-      g_ptr_array_add (argv, "VALAC="FAKE_VALAC);
-      g_ptr_array_add (argv, NULL);
-
-#ifdef IDE_ENABLE_TRACE
-      {
-        gchar *cmdline;
-
-        cmdline = g_strjoinv (" ", (gchar **)argv->pdata);
-        IDE_TRACE_MSG ("subdir=%s %s", subdir ?: ".", cmdline);
-        g_free (cmdline);
-      }
-#endif
-
-      launcher = ide_runtime_create_launcher (lookup->self->runtime, &error);
-
-      if (launcher == NULL)
-        {
-          g_assert (error != NULL);
-          g_task_return_error (task, error);
-          IDE_EXIT;
-        }
+      relpaths [0] = get_subdir_relative_path (lookup->relative_path, subdir);
+      targets [0] = ide_makecache_target_get_target (target);
 
-      ide_subprocess_launcher_set_flags (launcher, (G_SUBPROCESS_FLAGS_STDOUT_PIPE |
-                                                    G_SUBPROCESS_FLAGS_STDERR_SILENCE));
-      ide_subprocess_launcher_set_cwd (launcher, cwd);
-      ide_subprocess_launcher_push_args (launcher, (const gchar * const *)argv->pdata);
-
-      subprocess = ide_subprocess_launcher_spawn (launcher, cancellable, &error);
-
-      if (subprocess == NULL)
-        {
-          g_assert (error != NULL);
-          g_task_return_error (task, error);
-          IDE_EXIT;
-        }
+      lines = ide_makecache_dry_run (lookup->self, subdir, relpaths, targets, cancellable, &error);
 
-      /* Don't let ourselves be cancelled from this operation */
-      if (!ide_subprocess_communicate_utf8 (subprocess, NULL, NULL, &stdoutstr, NULL, &error))
+      if (lines == NULL)
         {
           g_assert (error != NULL);
           g_task_return_error (task, error);
           IDE_EXIT;
         }
 
-      /*
-       * Replace escaped newlines with " " to simplify command parsing
-       */
-      tmp = stdoutstr;
-      while (NULL != (tmp = strstr (tmp, "\\\n")))
-        {
-          tmp[0] = ' ';
-          tmp[1] = ' ';
-        }
-
-      lines = g_strsplit (stdoutstr, "\n", 0);
-
       for (i = 0; lines [i]; i++)
         {
-          gchar *line = lines [i];
-          gsize linelen;
-
-          if (line [0] == '\0')
+          if (lines [i][0] == '\0')
             continue;
 
-          linelen = strlen (line);
-
-          if (line [linelen - 1] == '\\')
-            line [linelen - 1] = '\0';
-
-          if ((ret = ide_makecache_parse_line (lookup->self, line, relpath, subdir ?: ".")))
+          if ((ret = ide_makecache_parse_line (lookup->self, lines [i], relpaths [0], subdir ?: ".")))
             break;
         }
 
@@ -749,6 +862,10 @@ ide_makecache_get_file_flags_worker (GTask        *task,
       if (ret == NULL)
         continue;
 
+      ide_makecache_remember_flags (lookup->self,
+                                    lookup->relative_path,
+                                    (const gchar * const *)ret);
+
       g_task_return_pointer (task, ret, (GDestroyNotify)g_strfreev);
 
       IDE_EXIT;
@@ -790,27 +907,23 @@ replace_suffix (const gchar *str,
   return g_string_free (gs, FALSE);
 }
 
-static void
-ide_makecache_get_file_targets_worker (GTask        *task,
-                                       gpointer      source_object,
-                                       gpointer      task_data,
-                                       GCancellable *cancellable)
+/**
+ * ide_makecache_lookup_file_targets:
+ *
+ * Returns: (transfer container): A #GPtrArray of #IdeMakecacheTarget.
+ */
+static GPtrArray *
+ide_makecache_lookup_file_targets (GHashTable  *index,
+                                   const gchar *path)
 {
   g_autofree gchar *translated = NULL;
   g_autofree gchar *base = NULL;
-  FileTargetsLookup *lookup = task_data;
-  const gchar *path;
   GPtrArray *ret;
 
   IDE_ENTRY;
 
-  g_assert (DZL_IS_TASK_CACHE (source_object));
-  g_assert (G_IS_TASK (task));
-  g_assert (lookup != NULL);
-  g_assert (lookup->mapped != NULL);
-  g_assert (lookup->path != NULL);
-
-  path = lookup->path;
+  g_assert (index != NULL);
+  g_assert (path != NULL);
 
   /* Translate suffix to something we can find in a target */
   if (g_str_has_suffix (path, ".vala"))
@@ -819,7 +932,7 @@ ide_makecache_get_file_targets_worker (GTask        *task,
   base = g_path_get_basename (path);
 
   /* we use an empty GPtrArray to get negative cache hits. a bit heavy handed? sure. */
-  if (!(ret = ide_makecache_get_file_targets_searched (lookup->mapped, path)))
+  if (!(ret = ide_makecache_index_lookup (index, path)))
     ret = g_ptr_array_new ();
 
   /* If we had a vala file, we might need to translate the target */
@@ -870,6 +983,28 @@ ide_makecache_get_file_targets_worker (GTask        *task,
         }
     }
 
+  IDE_RETURN (ret);
+}
+
+static void
+ide_makecache_get_file_targets_worker (GTask        *task,
+                                       gpointer      source_object,
+                                       gpointer      task_data,
+                                       GCancellable *cancellable)
+{
+  FileTargetsLookup *lookup = task_data;
+  GPtrArray *ret;
+
+  IDE_ENTRY;
+
+  g_assert (DZL_IS_TASK_CACHE (source_object));
+  g_assert (G_IS_TASK (task));
+  g_assert (lookup != NULL);
+  g_assert (lookup->index != NULL);
+  g_assert (lookup->path != NULL);
+
+  ret = ide_makecache_lookup_file_targets (lookup->index, lookup->path);
+
   g_task_return_pointer (task, ret, (GDestroyNotify)g_ptr_array_unref);
 
   IDE_EXIT;
@@ -891,7 +1026,7 @@ ide_makecache_get_file_targets_dispatch (DzlTaskCache  *cache,
   g_assert (G_IS_TASK (task));
 
   lookup = g_slice_new0 (FileTargetsLookup);
-  lookup->mapped = g_mapped_file_ref (self->mapped);
+  lookup->index = g_hash_table_ref (self->index);
 
   if (!(lookup->path = ide_makecache_get_relative_path (self, file)) &&
       !(lookup->path = g_file_get_path (file)) &&
@@ -967,6 +1102,84 @@ ide_makecache_get_file_flags__get_targets_cb (GObject      *object,
   IDE_EXIT;
 }
 
+static void
+ide_makecache_flush_pending_flags_cb (GObject      *object,
+                                      GAsyncResult *result,
+                                      gpointer      user_data)
+{
+  IdeMakecache *self = (IdeMakecache *)object;
+  g_autoptr(GPtrArray) tasks = user_data;
+  g_autoptr(GHashTable) results = NULL;
+  g_autoptr(GError) error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (tasks != NULL);
+
+  if (!(results = ide_makecache_get_files_flags_finish (self, result, &error)))
+    g_warning ("Failed to resolve flags: %s", error->message);
+
+  for (guint i = 0; i < tasks->len; i++)
+    {
+      GTask *task = g_ptr_array_index (tasks, i);
+      FileFlagsLookup *lookup = g_task_get_task_data (task);
+      const gchar * const *flags = NULL;
+
+      if (results != NULL)
+        flags = g_hash_table_lookup (results, lookup->file);
+
+      if (flags != NULL)
+        {
+          g_task_return_pointer (task, g_strdupv ((gchar **)flags), (GDestroyNotify)g_strfreev);
+          continue;
+        }
+
+      /* Look at the targets of the file on its own, which also handles defaults */
+      ide_makecache_get_file_targets_async (self,
+                                            lookup->file,
+                                            g_task_get_cancellable (task),
+                                            ide_makecache_get_file_flags__get_targets_cb,
+                                            g_object_ref (task));
+    }
+
+  IDE_EXIT;
+}
+
+static gboolean
+ide_makecache_flush_pending_flags (gpointer user_data)
+{
+  IdeMakecache *self = user_data;
+  g_autoptr(GPtrArray) files = NULL;
+  GPtrArray *tasks;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_MAKECACHE (self));
+
+  self->pending_flags_source = 0;
+
+  tasks = g_steal_pointer (&self->pending_flags);
+  self->pending_flags = g_ptr_array_new_with_free_func (g_object_unref);
+
+  files = g_ptr_array_new ();
+
+  for (guint i = 0; i < tasks->len; i++)
+    {
+      FileFlagsLookup *lookup = g_task_get_task_data (g_ptr_array_index (tasks, i));
+
+      g_ptr_array_add (files, lookup->file);
+    }
+
+  ide_makecache_get_files_flags_async (self,
+                                       files,
+                                       NULL,
+                                       ide_makecache_flush_pending_flags_cb,
+                                       tasks);
+
+  IDE_RETURN (G_SOURCE_REMOVE);
+}
+
 static void
 ide_makecache_get_file_flags_dispatch (DzlTaskCache  *cache,
                                        gconstpointer  key,
@@ -976,6 +1189,7 @@ ide_makecache_get_file_flags_dispatch (DzlTaskCache  *cache,
   IdeMakecache *self = user_data;
   FileFlagsLookup *lookup;
   GFile *file = (GFile *)key;
+  gchar **flags;
 
   IDE_ENTRY;
 
@@ -999,13 +1213,28 @@ ide_makecache_get_file_flags_dispatch (DzlTaskCache  *cache,
       return;
     }
 
+  /* We might already know the flags from a previous dry-run */
+  if ((flags = ide_makecache_lookup_flags (self, lookup->relative_path)))
+    {
+      file_flags_lookup_free (lookup);
+      g_task_return_pointer (task, g_steal_pointer (&flags), (GDestroyNotify)g_strfreev);
+      IDE_EXIT;
+    }
+
   g_task_set_task_data (task, lookup, file_flags_lookup_free);
 
-  ide_makecache_get_file_targets_async (self,
-                                        file,
-                                        g_task_get_cancellable (task),
-                                        ide_makecache_get_file_flags__get_targets_cb,
-                                        g_object_ref (task));
+  /*
+   * Files are often requested together, such as when a project is opened
+   * with many buffers. Collect the requests made in this main loop
+   * iteration so they can share dry-runs of make.
+   */
+  g_ptr_array_add (self->pending_flags, g_object_ref (task));
+
+  if (self->pending_flags_source == 0)
+    self->pending_flags_source = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                                                  ide_makecache_flush_pending_flags,
+                                                  g_object_ref (self),
+                                                  g_object_unref);
 
   IDE_EXIT;
 }
@@ -1018,12 +1247,18 @@ ide_makecache_finalize (GObject *object)
 
   g_clear_object (&self->file_targets_cache);
   g_clear_object (&self->file_flags_cache);
+  g_clear_pointer (&self->pending_flags, g_ptr_array_unref);
   g_clear_object (&self->runtime);
   g_clear_object (&self->parent);
 
-  g_clear_pointer (&self->mapped, g_mapped_file_unref);
+  g_clear_pointer (&self->cache_path, g_free);
+  g_clear_pointer (&self->cache_checksum, g_free);
+  g_clear_pointer (&self->index, g_hash_table_unref);
+  g_clear_pointer (&self->flags_table, g_hash_table_unref);
   g_clear_pointer (&self->build_targets, g_ptr_array_unref);
 
+  g_mutex_clear (&self->flags_mutex);
+
   G_OBJECT_CLASS (ide_makecache_parent_class)->finalize (object);
 
   DZL_COUNTER_DEC (instances);
@@ -1044,6 +1279,10 @@ ide_makecache_init (IdeMakecache *self)
 
   self->make_name = "make";
 
+  g_mutex_init (&self->flags_mutex);
+
+  self->pending_flags = g_ptr_array_new_with_free_func (g_object_unref);
+
   self->file_targets_cache = dzl_task_cache_new ((GHashFunc)g_file_hash,
                                                  (GEqualFunc)g_file_equal,
                                                  g_object_ref,
@@ -1078,17 +1317,57 @@ ide_makecache_validate_worker (GTask        *task,
                                GCancellable *cancellable)
 {
   IdeMakecache *self = task_data;
+  g_autoptr(GMappedFile) mapped = NULL;
   g_autoptr(GError) error = NULL;
+  g_autofree gchar *index_path = NULL;
+  g_autofree gchar *flags_path = NULL;
 
   IDE_ENTRY;
 
   g_assert (IDE_IS_MAKECACHE (self));
+  g_assert (self->cache_path != NULL);
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
 
-  if (!ide_makecache_validate_mapped_file (self->mapped, &error))
-    g_task_return_error (task, g_steal_pointer (&error));
-  else
-    g_task_return_pointer (task, g_object_ref (self), g_object_unref);
+  if (!(mapped = g_mapped_file_new (self->cache_path, FALSE, &error)))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      IDE_EXIT;
+    }
+
+  /*
+   * The makecache stage regenerates the cache file on every build, even if
+   * the makefiles did not change, so the saved index and flags are keyed on
+   * its contents rather than its modification time.
+   */
+  self->cache_checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1,
+                                                      (const guchar *)g_mapped_file_get_contents (mapped),
+                                                      g_mapped_file_get_length (mapped));
+
+  flags_path = g_strdup_printf ("%s.flags", self->cache_path);
+  self->flags_table = ide_makecache_load_flags (flags_path, self->cache_checksum);
+
+  index_path = g_strdup_printf ("%s.index", self->cache_path);
+
+  /* Reuse the index from a previous session if the cache has not changed */
+  if ((self->index = ide_makecache_index_load (index_path, self->cache_checksum)))
+    {
+      g_task_return_pointer (task, g_object_ref (self), g_object_unref);
+      IDE_EXIT;
+    }
+
+  if (!ide_makecache_validate_mapped_file (mapped, &error))
+    {
+      g_task_return_error (task, g_steal_pointer (&error));
+      IDE_EXIT;
+    }
+
+  self->index = ide_makecache_index_build (g_mapped_file_get_contents (mapped),
+                                           g_mapped_file_get_length (mapped));
+
+  if (!ide_makecache_index_save (index_path, self->cache_checksum, self->index, &error))
+    g_warning ("Failed to save makecache index: %s", error->message);
+
+  g_task_return_pointer (task, g_object_ref (self), g_object_unref);
 
   IDE_EXIT;
 }
@@ -1103,8 +1382,6 @@ ide_makecache_new_for_cache_file_async (IdeRuntime          *runtime,
   g_autoptr(GTask) task = NULL;
   g_autoptr(IdeMakecache) self = NULL;
   g_autoptr(GFile) parent = NULL;
-  g_autoptr(GMappedFile) mapped = NULL;
-  g_autoptr(GError) error = NULL;
   g_autofree gchar *cache_path = NULL;
   IdeContext *context;
 
@@ -1154,16 +1431,8 @@ ide_makecache_new_for_cache_file_async (IdeRuntime          *runtime,
                        "context", context,
                        NULL);
 
-  mapped = g_mapped_file_new (cache_path, FALSE, &error);
-
-  if (mapped == NULL)
-    {
-      g_task_return_error (task, g_steal_pointer (&error));
-      IDE_EXIT;
-    }
-
   self->parent = g_steal_pointer (&parent);
-  self->mapped = g_steal_pointer (&mapped);
+  self->cache_path = g_steal_pointer (&cache_path);
   self->runtime = g_object_ref (runtime);
 
   if (ide_runtime_contains_program_in_path (runtime, "gmake", NULL))
@@ -1326,6 +1595,265 @@ ide_makecache_get_file_flags_finish (IdeMakecache  *self,
   IDE_RETURN (ret);
 }
 
+static void
+ide_makecache_get_files_flags_worker (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  FilesFlagsLookup *lookup = task_data;
+  g_autoptr(GHashTable) groups = NULL;
+  GHashTableIter iter;
+  FilesFlagsGroup *group;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_MAKECACHE (source_object));
+  g_assert (G_IS_TASK (task));
+  g_assert (lookup != NULL);
+  g_assert (IDE_IS_MAKECACHE (lookup->self));
+  g_assert (lookup->files != NULL);
+  g_assert (lookup->relative_paths != NULL);
+  g_assert (lookup->results != NULL);
+
+  /*
+   * Group the files by the subdir of their targets so that we only need a
+   * single dry-run of make per directory, rather than one per file.
+   */
+
+  groups = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, files_flags_group_free);
+
+  for (guint i = 0; i < lookup->files->len; i++)
+    {
+      const gchar *relative_path = g_ptr_array_index (lookup->relative_paths, i);
+      g_autoptr(GPtrArray) targets = NULL;
+
+      if (g_hash_table_contains (lookup->results, g_ptr_array_index (lookup->files, i)))
+        continue;
+
+      targets = ide_makecache_lookup_file_targets (lookup->self->index, relative_path);
+
+      for (guint j = 0; j < targets->len; j++)
+        {
+          IdeMakecacheTarget *target = g_ptr_array_index (targets, j);
+          const gchar *subdir = ide_makecache_target_get_subdir (target) ?: ".";
+          const gchar *targetstr = ide_makecache_target_get_target (target);
+          gboolean found = FALSE;
+
+          if (NULL == (group = g_hash_table_lookup (groups, subdir)))
+            {
+              group = g_slice_new0 (FilesFlagsGroup);
+              group->subdir = g_strdup (subdir);
+              group->targets = g_ptr_array_new_with_free_func (g_free);
+              group->members = g_ptr_array_new ();
+              g_hash_table_insert (groups, group->subdir, group);
+            }
+
+          for (guint k = 0; !found && k < group->targets->len; k++)
+            found = g_str_equal (targetstr, g_ptr_array_index (group->targets, k));
+
+          if (!found)
+            g_ptr_array_add (group->targets, g_strdup (targetstr));
+
+          if (group->members->len == 0 ||
+              GPOINTER_TO_UINT (g_ptr_array_index (group->members, group->members->len - 1)) != i)
+            g_ptr_array_add (group->members, GUINT_TO_POINTER (i));
+        }
+    }
+
+  g_hash_table_iter_init (&iter, groups);
+
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&group))
+    {
+      g_autoptr(GPtrArray) relpaths = NULL;
+      g_autoptr(GError) error = NULL;
+      g_auto(GStrv) lines = NULL;
+      const gchar *subdir = NULL;
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      if (!g_str_equal (group->subdir, "."))
+        subdir = group->subdir;
+
+      relpaths = g_ptr_array_new ();
+      for (guint i = 0; i < group->members->len; i++)
+        {
+          guint member = GPOINTER_TO_UINT (g_ptr_array_index (group->members, i));
+          const gchar *relative_path = g_ptr_array_index (lookup->relative_paths, member);
+
+          g_ptr_array_add (relpaths, (gchar *)get_subdir_relative_path (relative_path, subdir));
+        }
+      g_ptr_array_add (relpaths, NULL);
+      g_ptr_array_add (group->targets, NULL);
+
+      lines = ide_makecache_dry_run (lookup->self,
+                                     subdir,
+                                     (const gchar * const *)relpaths->pdata,
+                                     (const gchar * const *)group->targets->pdata,
+                                     cancellable,
+                                     &error);
+
+      if (lines == NULL)
+        {
+          g_warning ("Failed to extract flags in %s: %s", group->subdir, error->message);
+          continue;
+        }
+
+      /*
+       * Parse the compile line for each member on its own, since include
+       * paths are resolved relative to the file. A member without a line
+       * is left for the per-file fallback.
+       */
+      for (guint i = 0; i < group->members->len; i++)
+        {
+          guint member = GPOINTER_TO_UINT (g_ptr_array_index (group->members, i));
+          GFile *file = g_ptr_array_index (lookup->files, member);
+          const gchar *relative_path = g_ptr_array_index (lookup->relative_paths, member);
+          const gchar *relpath = g_ptr_array_index (relpaths, i);
+          g_auto(GStrv) flags = NULL;
+          gint line;
+
+          if (g_hash_table_contains (lookup->results, file))
+            continue;
+
+          line = ide_makecache_find_compile_line ((const gchar * const *)lines, relpath);
+
+          if (line < 0)
+            continue;
+
+          flags = ide_makecache_parse_line (lookup->self, lines [line], relpath, group->subdir);
+
+          if (flags == NULL)
+            continue;
+
+          ide_makecache_remember_flags (lookup->self, relative_path, (const gchar * const *)flags);
+          g_hash_table_insert (lookup->results, g_object_ref (file), g_strdupv (flags));
+        }
+    }
+
+  IDE_TRACE_MSG ("Resolved flags for %u of %u files using %u dry-runs",
+                 g_hash_table_size (lookup->results),
+                 lookup->files->len,
+                 g_hash_table_size (groups));
+
+  g_task_return_pointer (task,
+                         g_hash_table_ref (lookup->results),
+                         (GDestroyNotify)g_hash_table_unref);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_makecache_get_files_flags_async:
+ * @self: An #IdeMakecache
+ * @files: (element-type Gio.File): A #GPtrArray of #GFile
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: A callback to execute upon completion
+ * @user_data: user data for @callback
+ *
+ * Asynchronously resolves the build flags for a number of files at once.
+ *
+ * Rather than spawning make for each file, the files are grouped by the
+ * directory of their targets and a single dry-run is performed for each
+ * group. The results are remembered (and persisted next to the cache file)
+ * so that future requests for the same files do not spawn make at all.
+ */
+void
+ide_makecache_get_files_flags_async (IdeMakecache        *self,
+                                     GPtrArray           *files,
+                                     GCancellable        *cancellable,
+                                     GAsyncReadyCallback  callback,
+                                     gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  FilesFlagsLookup *lookup;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_MAKECACHE (self));
+  g_return_if_fail (files != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  for (guint i = 0; i < files->len; i++)
+    g_return_if_fail (G_IS_FILE (g_ptr_array_index (files, i)));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_makecache_get_files_flags_async);
+
+  lookup = g_slice_new0 (FilesFlagsLookup);
+  lookup->self = g_object_ref (self);
+  lookup->files = g_ptr_array_new_with_free_func (g_object_unref);
+  lookup->relative_paths = g_ptr_array_new_with_free_func (g_free);
+  lookup->results = g_hash_table_new_full ((GHashFunc)g_file_hash,
+                                           (GEqualFunc)g_file_equal,
+                                           g_object_unref,
+                                           (GDestroyNotify)g_strfreev);
+
+  g_task_set_task_data (task, lookup, files_flags_lookup_free);
+
+  for (guint i = 0; i < files->len; i++)
+    {
+      GFile *file = g_ptr_array_index (files, i);
+      gchar *relative_path;
+      gchar **flags;
+
+      if (!(relative_path = ide_makecache_get_relative_path (self, file)) &&
+          !(relative_path = g_file_get_path (file)) &&
+          !(relative_path = g_file_get_basename (file)))
+        continue;
+
+      g_ptr_array_add (lookup->files, g_object_ref (file));
+      g_ptr_array_add (lookup->relative_paths, relative_path);
+
+      if ((flags = ide_makecache_lookup_flags (self, relative_path)))
+        g_hash_table_insert (lookup->results, g_object_ref (file), flags);
+    }
+
+  if (g_hash_table_size (lookup->results) == lookup->files->len)
+    {
+      g_task_return_pointer (task,
+                             g_hash_table_ref (lookup->results),
+                             (GDestroyNotify)g_hash_table_unref);
+      IDE_EXIT;
+    }
+
+  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
+                             task,
+                             ide_makecache_get_files_flags_worker);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_makecache_get_files_flags_finish:
+ *
+ * Completes an asynchronous request to ide_makecache_get_files_flags_async().
+ *
+ * Files for which no flags could be determined are not included in the
+ * result.
+ *
+ * Returns: (transfer container) (element-type Gio.File GStrv): A #GHashTable
+ *   of #GFile to build flags.
+ */
+GHashTable *
+ide_makecache_get_files_flags_finish (IdeMakecache  *self,
+                                      GAsyncResult  *result,
+                                      GError       **error)
+{
+  GTask *task = (GTask *)result;
+  GHashTable *ret;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_MAKECACHE (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (task), NULL);
+
+  ret = g_task_propagate_pointer (task, error);
+
+  IDE_RETURN (ret);
+}
+
 static gboolean
 _find_make_directories (IdeMakecache  *self,
                         GFile         *dir,
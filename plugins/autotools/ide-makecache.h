@@ -44,6 +44,14 @@ void                 ide_makecache_get_file_flags_async      (IdeMakecache
 gchar              **ide_makecache_get_file_flags_finish     (IdeMakecache         *self,
                                                               GAsyncResult         *result,
                                                               GError              **error);
+void                 ide_makecache_get_files_flags_async     (IdeMakecache         *self,
+                                                              GPtrArray            *files,
+                                                              GCancellable         *cancellable,
+                                                              GAsyncReadyCallback   callback,
+                                                              gpointer              user_data);
+GHashTable          *ide_makecache_get_files_flags_finish    (IdeMakecache         *self,
+                                                              GAsyncResult         *result,
+                                                              GError              **error);
 void                 ide_makecache_get_file_targets_async    (IdeMakecache         *self,
                                                               GFile                *file,
                                                               GCancellable         *cancellable,
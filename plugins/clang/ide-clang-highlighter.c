@@ -176,6 +176,115 @@ completed:
   *location = *range_end;
 }
 
+static gboolean
+ide_clang_highlighter_real_prepare_snapshot (IdeHighlighter       *highlighter,
+                                             IdeHighlightSnapshot *snapshot)
+{
+  IdeClangHighlighter *self = (IdeClangHighlighter *)highlighter;
+  g_autoptr(IdeClangTranslationUnit) unit = NULL;
+  IdeClangService *service = NULL;
+  IdeHighlightIndex *index;
+  IdeContext *context;
+  IdeBuffer *buffer;
+  IdeFile *file;
+
+  g_assert (IDE_IS_CLANG_HIGHLIGHTER (highlighter));
+  g_assert (snapshot != NULL);
+
+  if (self->engine == NULL ||
+      !(buffer = ide_highlight_engine_get_buffer (self->engine)) ||
+      !(file = ide_buffer_get_file (buffer)) ||
+      !(context = ide_object_get_context (IDE_OBJECT (highlighter))) ||
+      !(service = ide_context_get_service_typed (context, IDE_TYPE_CLANG_SERVICE)))
+    return FALSE;
+
+  /*
+   * Without a translation unit, let the synchronous path request one for
+   * us and try again once it has been parsed.
+   */
+  if (!(unit = ide_clang_service_get_cached_translation_unit (service, file)) ||
+      !(index = ide_clang_translation_unit_get_index (unit)))
+    return FALSE;
+
+  ide_highlight_snapshot_set_data (snapshot,
+                                   ide_highlight_index_ref (index),
+                                   (GDestroyNotify)ide_highlight_index_unref);
+
+  ide_highlight_snapshot_add_context_class (snapshot, GTK_SOURCE_BUFFER (buffer), "string");
+  ide_highlight_snapshot_add_context_class (snapshot, GTK_SOURCE_BUFFER (buffer), "path");
+  ide_highlight_snapshot_add_context_class (snapshot, GTK_SOURCE_BUFFER (buffer), "comment");
+
+  return TRUE;
+}
+
+static GArray *
+ide_clang_highlighter_real_compute_runs (IdeHighlighter       *highlighter,
+                                         IdeHighlightSnapshot *snapshot,
+                                         GCancellable         *cancellable)
+{
+  g_autoptr(GString) word = NULL;
+  IdeHighlightIndex *index;
+  const gchar *text;
+  const gchar *iter;
+  GArray *runs;
+  guint offset;
+  gsize len;
+
+  g_assert (IDE_IS_CLANG_HIGHLIGHTER (highlighter));
+  g_assert (snapshot != NULL);
+
+  index = ide_highlight_snapshot_get_data (snapshot);
+  text = ide_highlight_snapshot_get_text (snapshot, &len);
+  offset = ide_highlight_snapshot_get_begin_offset (snapshot);
+  runs = g_array_new (FALSE, FALSE, sizeof (IdeHighlightRun));
+  word = g_string_new (NULL);
+
+  g_assert (index != NULL);
+  g_assert (text != NULL);
+
+  for (iter = text; *iter; )
+    {
+      const gchar *tag;
+      guint begin;
+
+      if (!accepts_char (g_utf8_get_char (iter)))
+        {
+          iter = g_utf8_next_char (iter);
+          offset++;
+          continue;
+        }
+
+      begin = offset;
+      g_string_truncate (word, 0);
+
+      while (*iter && accepts_char (g_utf8_get_char (iter)))
+        {
+          const gchar *next = g_utf8_next_char (iter);
+
+          g_string_append_len (word, iter, next - iter);
+          iter = next;
+          offset++;
+        }
+
+      if (ide_highlight_snapshot_has_context_class (snapshot, begin, "string") ||
+          ide_highlight_snapshot_has_context_class (snapshot, begin, "path") ||
+          ide_highlight_snapshot_has_context_class (snapshot, begin, "comment"))
+        continue;
+
+      if ((tag = ide_highlight_index_lookup (index, word->str)))
+        {
+          IdeHighlightRun run = { begin, offset - begin, tag };
+
+          g_array_append_val (runs, run);
+        }
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+    }
+
+  return runs;
+}
+
 static void
 ide_clang_highlighter_real_set_engine (IdeHighlighter     *highlighter,
                                        IdeHighlightEngine *engine)
@@ -213,4 +322,6 @@ highlighter_iface_init (IdeHighlighterInterface *iface)
 {
   iface->update = ide_clang_highlighter_real_update;
   iface->set_engine = ide_clang_highlighter_real_set_engine;
+  iface->prepare_snapshot = ide_clang_highlighter_real_prepare_snapshot;
+  iface->compute_runs = ide_clang_highlighter_real_compute_runs;
 }
@@ -24,22 +24,39 @@
 
 #include "ide-clang-service.h"
 #include "ide-clang-symbol-node.h"
+#include "ide-clang-symbol-tree.h"
 #include "ide-clang-translation-unit.h"
 
 G_BEGIN_DECLS
 
-IdeClangTranslationUnit *_ide_clang_translation_unit_new     (IdeContext         *context,
-                                                              CXTranslationUnit   tu,
-                                                              GFile              *file,
-                                                              IdeHighlightIndex  *index,
-                                                              gint64              serial);
-void                     _ide_clang_dispose_string           (CXString           *str);
-IdeSymbolNode           *_ide_clang_symbol_node_new          (IdeContext         *context,
-                                                              CXCursor            cursor);
-CXCursor                 _ide_clang_symbol_node_get_cursor   (IdeClangSymbolNode *self);
-GArray                  *_ide_clang_symbol_node_get_children (IdeClangSymbolNode *self);
-void                     _ide_clang_symbol_node_set_children (IdeClangSymbolNode *self,
-                                                              GArray             *children);
+IdeClangTranslationUnit *_ide_clang_translation_unit_new                   (IdeContext               *context,
+                                                                            CXTranslationUnit         tu,
+                                                                            const gchar * const      *command_line_args,
+                                                                            GHashTable               *inclusions,
+                                                                            GFile                    *file,
+                                                                            IdeHighlightIndex        *index,
+                                                                            gint64                    serial);
+CXTranslationUnit        _ide_clang_translation_unit_begin_reparse         (IdeClangTranslationUnit  *self);
+void                     _ide_clang_translation_unit_end_reparse           (IdeClangTranslationUnit  *self,
+                                                                            gboolean                  success);
+void                     _ide_clang_translation_unit_reparsed              (IdeClangTranslationUnit  *self,
+                                                                            GHashTable               *inclusions,
+                                                                            IdeHighlightIndex        *index,
+                                                                            gint64                    serial);
+const gchar * const     *_ide_clang_translation_unit_get_command_line_args (IdeClangTranslationUnit  *self);
+GHashTable              *_ide_clang_translation_unit_get_inclusions        (IdeClangTranslationUnit  *self);
+gsize                    _ide_clang_translation_unit_get_memory_usage      (IdeClangTranslationUnit  *self);
+void                     _ide_clang_dispose_string                         (CXString                 *str);
+IdeClangSymbolNode      *_ide_clang_symbol_node_new                        (IdeContext               *context,
+                                                                            CXCursor                  cursor);
+guint                    _ide_clang_symbol_node_get_n_children             (IdeClangSymbolNode       *self);
+IdeSymbolNode           *_ide_clang_symbol_node_get_nth_child              (IdeClangSymbolNode       *self,
+                                                                            guint                     nth);
+void                     _ide_clang_symbol_node_take_child                 (IdeClangSymbolNode       *self,
+                                                                            IdeClangSymbolNode       *child);
+IdeClangSymbolTree      *_ide_clang_symbol_tree_new                        (IdeContext               *context,
+                                                                            CXTranslationUnit         tu,
+                                                                            GFile                    *file);
 
 G_DEFINE_AUTO_CLEANUP_CLEAR_FUNC (CXString, _ide_clang_dispose_string)
 
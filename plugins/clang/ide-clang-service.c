@@ -22,6 +22,7 @@
 #include <dazzle.h>
 #include <glib/gi18n.h>
 #include <ide.h>
+#include <stdlib.h>
 
 #include "ide-clang-highlighter.h"
 #include "ide-clang-private.h"
@@ -36,17 +37,40 @@ struct _IdeClangService
   CXIndex       index;
   GCancellable *cancellable;
   DzlTaskCache *units_cache;
+  GSettings    *settings;
+
+  /*
+   * Cached units ordered by last access, most recent first. Once the
+   * units use more than memory_budget bytes, the least recently used
+   * are evicted from units_cache.
+   */
+  GQueue        lru;
+  GHashTable   *lru_links;
+  guint64       memory_budget;
+  guint64       memory_usage;
 };
 
 typedef struct
 {
-  IdeFile    *file;
-  CXIndex     index;
-  gchar      *source_filename;
-  gchar     **command_line_args;
-  GPtrArray  *unsaved_files;
-  gint64      sequence;
-  guint       options;
+  IdeFile *file;
+  gsize    memory_usage;
+} LruEntry;
+
+typedef struct
+{
+  IdeFile                  *file;
+  IdeClangTranslationUnit  *previous;
+  CXIndex                   index;
+  gchar                    *source_filename;
+  gchar                   **command_line_args;
+  GPtrArray                *unsaved_files;
+  gint64                    sequence;
+  guint                     options;
+
+  /* Set when @previous was reparsed in place rather than replaced */
+  GHashTable               *inclusions;
+  IdeHighlightIndex        *highlight_index;
+  guint                     reparsed : 1;
 } ParseRequest;
 
 typedef struct
@@ -65,6 +89,239 @@ DZL_DEFINE_COUNTER (ParseAttempts,
                     "Clang",
                     "Total Parse Attempts",
                     "Total number of attempts to create a translation unit.")
+DZL_DEFINE_COUNTER (FullParses,
+                    "Clang",
+                    "Full Parses",
+                    "Number of translation units parsed from scratch.")
+DZL_DEFINE_COUNTER (Reparses,
+                    "Clang",
+                    "Reparses",
+                    "Number of translation units reparsed using their precompiled preamble.")
+DZL_DEFINE_COUNTER (CachedUnits,
+                    "Clang",
+                    "Cached Units",
+                    "Number of translation units tracked by the memory budget.")
+DZL_DEFINE_COUNTER (CachedBytes,
+                    "Clang",
+                    "Cached Bytes",
+                    "Memory used by cached translation units, as reported by clang.")
+DZL_DEFINE_COUNTER (BudgetEvictions,
+                    "Clang",
+                    "Budget Evictions",
+                    "Number of translation units evicted to stay within the memory budget.")
+
+static void
+lru_entry_free (gpointer data)
+{
+  LruEntry *entry = data;
+
+  DZL_COUNTER_DEC (CachedUnits);
+  DZL_COUNTER_SUB (CachedBytes, (gint64)entry->memory_usage);
+
+  g_clear_object (&entry->file);
+  g_slice_free (LruEntry, entry);
+}
+
+static void
+ide_clang_service_lru_remove (IdeClangService *self,
+                              GList           *link)
+{
+  LruEntry *entry;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (link != NULL);
+
+  entry = link->data;
+  self->memory_usage -= entry->memory_usage;
+  g_hash_table_remove (self->lru_links, entry->file);
+  g_queue_delete_link (&self->lru, link);
+  lru_entry_free (entry);
+}
+
+static void
+ide_clang_service_lru_clear (IdeClangService *self)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  while (self->lru.head != NULL)
+    ide_clang_service_lru_remove (self, self->lru.head);
+}
+
+static void
+collect_visible_files_cb (GtkWidget *view,
+                          gpointer   user_data)
+{
+  GHashTable *visible = user_data;
+  GtkWidget *stack;
+  IdeBuffer *buffer;
+
+  g_assert (GTK_IS_WIDGET (view));
+  g_assert (visible != NULL);
+
+  if (!IDE_IS_EDITOR_VIEW (view))
+    return;
+
+  /* Only the active view of a stack is on screen */
+  stack = gtk_widget_get_ancestor (view, IDE_TYPE_LAYOUT_STACK);
+  if (stack == NULL || ide_layout_stack_get_active_view (IDE_LAYOUT_STACK (stack)) != view)
+    return;
+
+  if (NULL != (buffer = ide_editor_view_get_document (IDE_EDITOR_VIEW (view))))
+    g_hash_table_add (visible, ide_buffer_get_file (buffer));
+}
+
+/*
+ * Gets the files of every buffer that is visible in a view stack of one of
+ * our workbenches, as well as the focused buffer. The units for those are
+ * never evicted, since the user is looking at them.
+ */
+static GHashTable *
+ide_clang_service_get_visible_files (IdeClangService *self)
+{
+  IdeBufferManager *buffer_manager;
+  GApplication *app;
+  IdeContext *context;
+  IdeBuffer *buffer;
+  GHashTable *visible;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+
+  visible = g_hash_table_new ((GHashFunc)ide_file_hash, (GEqualFunc)ide_file_equal);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  buffer_manager = ide_context_get_buffer_manager (context);
+
+  if (NULL != (buffer = ide_buffer_manager_get_focus_buffer (buffer_manager)))
+    g_hash_table_add (visible, ide_buffer_get_file (buffer));
+
+  app = g_application_get_default ();
+
+  if (GTK_IS_APPLICATION (app))
+    {
+      GList *windows = gtk_application_get_windows (GTK_APPLICATION (app));
+
+      for (; windows != NULL; windows = windows->next)
+        {
+          if (IDE_IS_WORKBENCH (windows->data) &&
+              ide_workbench_get_context (windows->data) == context)
+            ide_workbench_views_foreach (windows->data, collect_visible_files_cb, visible);
+        }
+    }
+
+  return visible;
+}
+
+/*
+ * Evicts the least recently used units until we are within the memory
+ * budget. The unit for @keep, which is usually the one that was just
+ * parsed, and the units for visible buffers are never evicted.
+ */
+static void
+ide_clang_service_enforce_budget (IdeClangService *self,
+                                  IdeFile         *keep)
+{
+  g_autoptr(GHashTable) visible = NULL;
+  GList *iter;
+  GList *prev;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (!keep || IDE_IS_FILE (keep));
+
+  if (self->units_cache == NULL)
+    return;
+
+  for (iter = self->lru.tail; iter != NULL; iter = prev)
+    {
+      LruEntry *entry = iter->data;
+
+      prev = iter->prev;
+
+      /* The unit for @keep may not have been inserted in the cache yet */
+      if (keep != NULL && ide_file_equal (entry->file, keep))
+        continue;
+
+      /* Drop entries that the cache expired on its own */
+      if (dzl_task_cache_peek (self->units_cache, entry->file) == NULL)
+        {
+          ide_clang_service_lru_remove (self, iter);
+          continue;
+        }
+
+      if (self->memory_usage <= self->memory_budget)
+        continue;
+
+      if (visible == NULL)
+        visible = ide_clang_service_get_visible_files (self);
+
+      if (g_hash_table_contains (visible, entry->file))
+        continue;
+
+      IDE_TRACE_MSG ("Evicting translation unit using %"G_GSIZE_FORMAT" bytes",
+                     entry->memory_usage);
+
+      DZL_COUNTER_INC (BudgetEvictions);
+      dzl_task_cache_evict (self->units_cache, entry->file);
+      ide_clang_service_lru_remove (self, iter);
+    }
+}
+
+/*
+ * Marks @unit as the most recently used unit and updates the memory it
+ * is charged for. This does not evict anything, see
+ * ide_clang_service_enforce_budget().
+ */
+static void
+ide_clang_service_touch (IdeClangService         *self,
+                         IdeFile                 *file,
+                         IdeClangTranslationUnit *unit)
+{
+  LruEntry *entry;
+  GList *link;
+  gsize memory_usage;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (IDE_IS_FILE (file));
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (unit));
+
+  memory_usage = _ide_clang_translation_unit_get_memory_usage (unit);
+
+  if (NULL != (link = g_hash_table_lookup (self->lru_links, file)))
+    {
+      entry = link->data;
+      g_queue_unlink (&self->lru, link);
+    }
+  else
+    {
+      entry = g_slice_new0 (LruEntry);
+      entry->file = g_object_ref (file);
+      link = g_list_alloc ();
+      link->data = entry;
+      g_hash_table_insert (self->lru_links, entry->file, link);
+      DZL_COUNTER_INC (CachedUnits);
+    }
+
+  DZL_COUNTER_SUB (CachedBytes, (gint64)entry->memory_usage);
+  DZL_COUNTER_ADD (CachedBytes, (gint64)memory_usage);
+
+  self->memory_usage -= entry->memory_usage;
+  self->memory_usage += memory_usage;
+  entry->memory_usage = memory_usage;
+
+  g_queue_push_head_link (&self->lru, link);
+}
+
+static void
+ide_clang_service_memory_budget_changed (IdeClangService *self,
+                                         const gchar     *key,
+                                         GSettings       *settings)
+{
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (G_IS_SETTINGS (settings));
+
+  self->memory_budget = (guint64)g_settings_get_uint (settings, "clang-memory-budget") * 1024 * 1024;
+
+  ide_clang_service_enforce_budget (self, NULL);
+}
 
 static void
 parse_request_free (gpointer data)
@@ -74,6 +331,9 @@ parse_request_free (gpointer data)
   g_free (request->source_filename);
   g_strfreev (request->command_line_args);
   g_ptr_array_unref (request->unsaved_files);
+  g_clear_pointer (&request->inclusions, g_hash_table_unref);
+  g_clear_pointer (&request->highlight_index, ide_highlight_index_unref);
+  g_clear_object (&request->previous);
   g_clear_object (&request->file);
   g_slice_free (ParseRequest, request);
 }
@@ -243,6 +503,200 @@ discover_llvm_flags (void)
   IDE_RETURN (llvm_flags);
 }
 
+/*
+ * Resolves symlinks in @path so that a file reached through a symlinked
+ * include directory matches the path of its buffer. Paths that do not
+ * exist on disk are only canonicalized lexically.
+ */
+static gchar *
+canonicalize_path (const gchar *path)
+{
+  g_autoptr(GFile) file = NULL;
+  gchar *real;
+  gchar *ret;
+
+  g_assert (path != NULL);
+
+  if (NULL != (real = realpath (path, NULL)))
+    {
+      ret = g_strdup (real);
+      free (real);
+      return ret;
+    }
+
+  /* GFile canonicalizes things like "/usr/include/../lib" for us */
+  file = g_file_new_for_path (path);
+
+  return g_file_get_path (file);
+}
+
+static gboolean
+inclusions_contain (GHashTable *inclusions,
+                    GFile      *file)
+{
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *canonical = NULL;
+
+  g_assert (inclusions != NULL);
+  g_assert (G_IS_FILE (file));
+
+  if (!(path = g_file_get_path (file)))
+    return FALSE;
+
+  canonical = canonicalize_path (path);
+
+  return g_hash_table_contains (inclusions, canonical);
+}
+
+static void
+ide_clang_service_collect_inclusions_cb (CXFile             included_file,
+                                         CXSourceLocation  *inclusion_stack,
+                                         unsigned           include_len,
+                                         CXClientData       user_data)
+{
+  GHashTable *inclusions = user_data;
+  g_auto(CXString) cxstr = { 0 };
+  const gchar *path;
+
+  g_assert (inclusions != NULL);
+
+  cxstr = clang_getFileName (included_file);
+  path = clang_getCString (cxstr);
+
+  if (path != NULL)
+    g_hash_table_add (inclusions, canonicalize_path (path));
+}
+
+/*
+ * Collects the set of files that were read while parsing @tu so that the
+ * next parse of the same file only needs the unsaved buffers that can
+ * actually affect it.
+ */
+static GHashTable *
+ide_clang_service_collect_inclusions (CXTranslationUnit tu)
+{
+  GHashTable *inclusions;
+
+  g_assert (tu != NULL);
+
+  inclusions = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  clang_getInclusions (tu, ide_clang_service_collect_inclusions_cb, inclusions);
+
+  return inclusions;
+}
+
+/*
+ * Checks whether @tu has a fatal error, such as an #include that could not
+ * be found. The inclusions of such a unit are incomplete, so they cannot
+ * be used to decide which unsaved files matter.
+ */
+static gboolean
+ide_clang_service_has_fatal_errors (CXTranslationUnit tu)
+{
+  guint count;
+
+  g_assert (tu != NULL);
+
+  count = clang_getNumDiagnostics (tu);
+
+  for (guint i = 0; i < count; i++)
+    {
+      CXDiagnostic cxdiag = clang_getDiagnostic (tu, i);
+      enum CXDiagnosticSeverity severity = clang_getDiagnosticSeverity (cxdiag);
+
+      clang_disposeDiagnostic (cxdiag);
+
+      if (severity >= CXDiagnostic_Fatal)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+add_unsaved_file (GArray         *ar,
+                  IdeUnsavedFile *iuf)
+{
+  struct CXUnsavedFile uf;
+  GBytes *content;
+  GFile *file;
+
+  g_assert (ar != NULL);
+  g_assert (iuf != NULL);
+
+  file = ide_unsaved_file_get_file (iuf);
+  content = ide_unsaved_file_get_content (iuf);
+
+  uf.Filename = g_file_get_path (file);
+  uf.Contents = g_bytes_get_data (content, NULL);
+  uf.Length = g_bytes_get_size (content);
+
+  g_array_append_val (ar, uf);
+}
+
+static gboolean
+command_line_args_equal (const gchar * const *a,
+                         const gchar * const *b)
+{
+  if (a == NULL || b == NULL)
+    return a == b;
+
+  for (; *a != NULL && *b != NULL; a++, b++)
+    {
+      if (!g_str_equal (*a, *b))
+        return FALSE;
+    }
+
+  return *a == NULL && *b == NULL;
+}
+
+/*
+ * If the unit we are replacing was parsed with the same arguments, we
+ * reparse its native unit in place with the new unsaved files. That lets
+ * clang reuse the precompiled preamble (the headers at the top of the file)
+ * rather than parsing them again.
+ *
+ * On success, the native unit of @request->previous is returned with its
+ * lock held, see _ide_clang_translation_unit_begin_reparse().
+ */
+static CXTranslationUnit
+ide_clang_service_try_reparse (IdeClangService *self,
+                               ParseRequest    *request,
+                               GArray          *unsaved_files)
+{
+  const gchar * const *previous_args;
+  CXTranslationUnit tu;
+
+  g_assert (IDE_IS_CLANG_SERVICE (self));
+  g_assert (request != NULL);
+  g_assert (unsaved_files != NULL);
+
+  if (request->previous == NULL)
+    return NULL;
+
+  previous_args = _ide_clang_translation_unit_get_command_line_args (request->previous);
+
+  if (!command_line_args_equal (previous_args, (const gchar * const *)request->command_line_args))
+    return NULL;
+
+  if (NULL == (tu = _ide_clang_translation_unit_begin_reparse (request->previous)))
+    return NULL;
+
+  if (0 != clang_reparseTranslationUnit (tu,
+                                         unsaved_files->len,
+                                         (struct CXUnsavedFile *)(gpointer)unsaved_files->data,
+                                         clang_defaultReparseOptions (tu)))
+    {
+      /* The unit is no longer usable once a reparse has failed */
+      _ide_clang_translation_unit_end_reparse (request->previous, FALSE);
+      return NULL;
+    }
+
+  DZL_COUNTER_INC (Reparses);
+
+  return tu;
+}
+
 static void
 ide_clang_service_parse_worker (GTask        *task,
                                 gpointer      source_object,
@@ -252,11 +706,14 @@ ide_clang_service_parse_worker (GTask        *task,
   g_autoptr(IdeClangTranslationUnit) ret = NULL;
   g_autoptr(IdeHighlightIndex) index = NULL;
   g_autoptr(IdeFile) file_copy = NULL;
+  g_autoptr(GHashTable) inclusions = NULL;
+  g_autoptr(GPtrArray) skipped = NULL;
   IdeClangService *self = source_object;
   CXTranslationUnit tu = NULL;
   ParseRequest *request = task_data;
   IdeContext *context;
   g_autoptr(GPtrArray) built_argv = NULL;
+  GHashTable *previous_inclusions = NULL;
   GFile *gfile;
   const gchar *detail_error = NULL;
   const gchar *llvm_flags;
@@ -270,25 +727,37 @@ ide_clang_service_parse_worker (GTask        *task,
   g_assert (IDE_IS_FILE (request->file));
 
   file_copy = g_object_ref (request->file);
+  gfile = ide_file_get_file (request->file);
 
   ar = g_array_new (FALSE, FALSE, sizeof (struct CXUnsavedFile));
   g_array_set_clear_func (ar, clear_unsaved_file);
 
+  /*
+   * If we know which files the previous parse of this unit read, only pass
+   * along the unsaved buffers for those. Every other modified buffer in the
+   * session cannot affect the result unless an #include was added, which we
+   * check for once the parse has completed. A unit whose previous parse had
+   * fatal errors has no inclusions, so it gets every unsaved buffer.
+   */
+  if (request->previous != NULL)
+    previous_inclusions = _ide_clang_translation_unit_get_inclusions (request->previous);
+
+  skipped = g_ptr_array_new ();
+
   for (i = 0; i < request->unsaved_files->len; i++)
     {
       IdeUnsavedFile *iuf = g_ptr_array_index (request->unsaved_files, i);
-      struct CXUnsavedFile uf;
-      GBytes *content;
-      GFile *file;
+      GFile *file = ide_unsaved_file_get_file (iuf);
 
-      file = ide_unsaved_file_get_file (iuf);
-      content = ide_unsaved_file_get_content (iuf);
+      if (previous_inclusions != NULL &&
+          !g_file_equal (file, gfile) &&
+          !inclusions_contain (previous_inclusions, file))
+        {
+          g_ptr_array_add (skipped, iuf);
+          continue;
+        }
 
-      uf.Filename = g_file_get_path (file);
-      uf.Contents = g_bytes_get_data (content, NULL);
-      uf.Length = g_bytes_get_size (content);
-
-      g_array_append_val (ar, uf);
+      add_unsaved_file (ar, iuf);
     }
 
   /*
@@ -303,14 +772,80 @@ ide_clang_service_parse_worker (GTask        *task,
   g_ptr_array_add (built_argv, NULL);
 
   DZL_COUNTER_INC (ParseAttempts);
-  code = clang_parseTranslationUnit2 (request->index,
-                                      request->source_filename,
-                                      (const gchar * const *)built_argv->pdata,
-                                      built_argv->len - 1,
-                                      (struct CXUnsavedFile *)(gpointer)ar->data,
-                                      ar->len,
-                                      request->options,
-                                      &tu);
+
+  if (NULL != (tu = ide_clang_service_try_reparse (self, request, ar)))
+    {
+      request->reparsed = TRUE;
+      code = CXError_Success;
+    }
+  else
+    {
+      DZL_COUNTER_INC (FullParses);
+      code = clang_parseTranslationUnit2 (request->index,
+                                          request->source_filename,
+                                          (const gchar * const *)built_argv->pdata,
+                                          built_argv->len - 1,
+                                          (struct CXUnsavedFile *)(gpointer)ar->data,
+                                          ar->len,
+                                          request->options,
+                                          &tu);
+    }
+
+  if (code == CXError_Success)
+    {
+      gboolean retry = FALSE;
+
+      inclusions = ide_clang_service_collect_inclusions (tu);
+
+      /*
+       * If the unit now includes a file whose unsaved buffer we skipped, we
+       * have to reparse with the complete set of unsaved files. The same goes
+       * for a fatal error, since a newly included header may only exist as an
+       * unsaved buffer, in which case clang could not find it at all.
+       */
+      if (skipped->len > 0)
+        {
+          retry = ide_clang_service_has_fatal_errors (tu);
+
+          for (i = 0; !retry && i < skipped->len; i++)
+            {
+              IdeUnsavedFile *iuf = g_ptr_array_index (skipped, i);
+
+              retry = inclusions_contain (inclusions, ide_unsaved_file_get_file (iuf));
+            }
+        }
+
+      if (retry)
+        {
+          for (i = 0; i < skipped->len; i++)
+            add_unsaved_file (ar, g_ptr_array_index (skipped, i));
+
+          if (0 != clang_reparseTranslationUnit (tu,
+                                                 ar->len,
+                                                 (struct CXUnsavedFile *)(gpointer)ar->data,
+                                                 clang_defaultReparseOptions (tu)))
+            {
+              if (request->reparsed)
+                _ide_clang_translation_unit_end_reparse (request->previous, FALSE);
+              else
+                clang_disposeTranslationUnit (tu);
+
+              request->reparsed = FALSE;
+              tu = NULL;
+              g_clear_pointer (&inclusions, g_hash_table_unref);
+              code = CXError_Failure;
+            }
+          else
+            {
+              g_hash_table_unref (inclusions);
+              inclusions = ide_clang_service_collect_inclusions (tu);
+            }
+        }
+
+      /* Make the next parse of this file pass every unsaved buffer */
+      if (tu != NULL && ide_clang_service_has_fatal_errors (tu))
+        g_clear_pointer (&inclusions, g_hash_table_unref);
+    }
 
   switch (code)
     {
@@ -351,9 +886,27 @@ ide_clang_service_parse_worker (GTask        *task,
       goto cleanup;
     }
 
+  /*
+   * The index and inclusions of a unit reparsed in place are replaced from
+   * the main thread, since they are used there without locking.
+   */
+  if (request->reparsed)
+    {
+      _ide_clang_translation_unit_end_reparse (request->previous, TRUE);
+      request->inclusions = g_steal_pointer (&inclusions);
+      request->highlight_index = g_steal_pointer (&index);
+      g_task_return_pointer (task, g_object_ref (request->previous), g_object_unref);
+      goto cleanup;
+    }
+
   context = ide_object_get_context (source_object);
-  gfile = ide_file_get_file (request->file);
-  ret = _ide_clang_translation_unit_new (context, tu, gfile, index, request->sequence);
+  ret = _ide_clang_translation_unit_new (context,
+                                         tu,
+                                         (const gchar * const *)request->command_line_args,
+                                         inclusions,
+                                         gfile,
+                                         index,
+                                         request->sequence);
 
   g_task_return_pointer (task, g_object_ref (ret), g_object_unref);
 
@@ -432,18 +985,35 @@ ide_clang_service_unit_completed_cb (GObject      *object,
                                      GAsyncResult *result,
                                      gpointer      user_data)
 {
+  IdeClangService *self = (IdeClangService *)object;
   g_autoptr(GTask) task = user_data;
-  gpointer ret;
+  IdeClangTranslationUnit *ret;
+  ParseRequest *request;
   GError *error = NULL;
 
-  g_assert (IDE_IS_CLANG_SERVICE (object));
+  g_assert (IDE_IS_CLANG_SERVICE (self));
   g_assert (G_IS_TASK (result));
   g_assert (G_IS_TASK (task));
 
+  request = g_task_get_task_data (G_TASK (result));
+
   if (!(ret = g_task_propagate_pointer (G_TASK (result), &error)))
-    g_task_return_error (task, error);
-  else
-    g_task_return_pointer (task, ret, g_object_unref);
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  if (request->reparsed)
+    _ide_clang_translation_unit_reparsed (ret,
+                                          request->inclusions,
+                                          request->highlight_index,
+                                          request->sequence);
+
+  /* Only a new or reparsed unit can take us over the memory budget */
+  ide_clang_service_touch (self, request->file, ret);
+  ide_clang_service_enforce_budget (self, request->file);
+
+  g_task_return_pointer (task, ret, g_object_unref);
 }
 
 static void
@@ -455,6 +1025,7 @@ ide_clang_service_get_translation_unit_worker (DzlTaskCache  *cache,
   g_autoptr(GTask) real_task = NULL;
   g_autofree gchar *path = NULL;
   IdeClangService *self = user_data;
+  IdeClangTranslationUnit *previous;
   IdeUnsavedFiles *unsaved_files;
   IdeBuildSystem *build_system;
   ParseRequest *request;
@@ -489,8 +1060,13 @@ ide_clang_service_get_translation_unit_worker (DzlTaskCache  *cache,
   request->index = self->index;
   request->source_filename = g_steal_pointer (&path);
   request->command_line_args = NULL;
-  request->unsaved_files = ide_unsaved_files_to_array (unsaved_files);
-  request->sequence = ide_unsaved_files_get_sequence (unsaved_files);
+  request->unsaved_files = ide_unsaved_files_get_snapshot (unsaved_files, &request->sequence);
+  /*
+   * Keep the unit we are replacing (if any) so that the worker can use the
+   * files it included and reparse it in place.
+   */
+  if (NULL != (previous = dzl_task_cache_peek (self->units_cache, file)))
+    request->previous = g_object_ref (previous);
   /*
    * NOTE:
    *
@@ -527,14 +1103,23 @@ ide_clang_service_get_translation_unit_cb (GObject      *object,
   DzlTaskCache *cache = (DzlTaskCache *)object;
   g_autoptr(IdeClangTranslationUnit) ret = NULL;
   g_autoptr(GTask) task = user_data;
+  IdeClangService *self;
   GError *error = NULL;
 
   g_assert (DZL_IS_TASK_CACHE (cache));
 
+  self = g_task_get_source_object (task);
+
   if (!(ret = dzl_task_cache_get_finish (cache, result, &error)))
-    g_task_return_error (task, error);
-  else
-    g_task_return_pointer (task, g_steal_pointer (&ret), g_object_unref);
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  if (cache == self->units_cache)
+    ide_clang_service_touch (self, g_task_get_task_data (task), ret);
+
+  g_task_return_pointer (task, g_steal_pointer (&ret), g_object_unref);
 }
 
 /**
@@ -565,6 +1150,7 @@ ide_clang_service_get_translation_unit_async (IdeClangService     *self,
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
 
   /*
    * Clang likes to crash on our temporary files.
@@ -594,6 +1180,7 @@ ide_clang_service_get_translation_unit_async (IdeClangService     *self,
   if ((cached = dzl_task_cache_peek (self->units_cache, file)) &&
       (ide_clang_translation_unit_get_serial (cached) >= min_serial))
     {
+      ide_clang_service_touch (self, file, cached);
       g_task_return_pointer (task, g_object_ref (cached), g_object_unref);
       return;
     }
@@ -649,6 +1236,14 @@ ide_clang_service_start (IdeService *service)
 
   dzl_task_cache_set_name (self->units_cache, "clang translation-unit cache");
 
+  self->settings = g_settings_new ("org.gnome.builder.code-insight");
+  g_signal_connect_object (self->settings,
+                           "changed::clang-memory-budget",
+                           G_CALLBACK (ide_clang_service_memory_budget_changed),
+                           self,
+                           G_CONNECT_SWAPPED);
+  ide_clang_service_memory_budget_changed (self, "clang-memory-budget", self->settings);
+
   self->index = clang_createIndex (0, 0);
   clang_CXIndex_setGlobalOptions (self->index,
                                   CXGlobalOpt_ThreadBackgroundPriorityForAll);
@@ -663,7 +1258,9 @@ ide_clang_service_stop (IdeService *service)
   g_return_if_fail (self->index != NULL);
 
   g_cancellable_cancel (self->cancellable);
+  ide_clang_service_lru_clear (self);
   g_clear_object (&self->units_cache);
+  g_clear_object (&self->settings);
 }
 
 static void
@@ -673,8 +1270,11 @@ ide_clang_service_dispose (GObject *object)
 
   IDE_ENTRY;
 
+  ide_clang_service_lru_clear (self);
   g_clear_object (&self->units_cache);
+  g_clear_object (&self->settings);
   g_clear_object (&self->cancellable);
+
   g_clear_pointer (&self->index, clang_disposeIndex);
 
   G_OBJECT_CLASS (ide_clang_service_parent_class)->dispose (object);
@@ -685,8 +1285,12 @@ ide_clang_service_dispose (GObject *object)
 static void
 ide_clang_service_finalize (GObject *object)
 {
+  IdeClangService *self = (IdeClangService *)object;
+
   IDE_ENTRY;
 
+  g_clear_pointer (&self->lru_links, g_hash_table_unref);
+
   G_OBJECT_CLASS (ide_clang_service_parent_class)->finalize (object);
 
   IDE_EXIT;
@@ -711,6 +1315,9 @@ service_iface_init (IdeServiceInterface *iface)
 static void
 ide_clang_service_init (IdeClangService *self)
 {
+  g_queue_init (&self->lru);
+  self->lru_links = g_hash_table_new ((GHashFunc)ide_file_hash,
+                                      (GEqualFunc)ide_file_equal);
 }
 
 /**
@@ -732,7 +1339,12 @@ ide_clang_service_get_cached_translation_unit (IdeClangService *self,
 
   cached = dzl_task_cache_peek (self->units_cache, file);
 
-  return cached ? g_object_ref (cached) : NULL;
+  if (cached == NULL)
+    return NULL;
+
+  ide_clang_service_touch (self, file, cached);
+
+  return g_object_ref (cached);
 }
 
 void
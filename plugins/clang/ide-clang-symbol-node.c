@@ -22,14 +22,22 @@
 #include <glib/gi18n.h>
 #include <gio/gio.h>
 
+#include "ide-clang-private.h"
 #include "ide-clang-symbol-node.h"
 
+/*
+ * Nodes do not keep a cursor into the translation unit. Everything that is
+ * needed later is copied out when the node is created, so that the unit
+ * can be reparsed while the symbol tree is still displayed.
+ */
 struct _IdeClangSymbolNode
 {
-  IdeSymbolNode parent_instance;
+  IdeSymbolNode  parent_instance;
 
-  CXCursor  cursor;
-  GArray   *children;
+  gchar         *path;
+  guint          line;
+  guint          line_offset;
+  GPtrArray     *children;
 };
 
 G_DEFINE_TYPE (IdeClangSymbolNode, ide_clang_symbol_node, IDE_TYPE_SYMBOL_NODE)
@@ -135,7 +143,10 @@ _ide_clang_symbol_node_new (IdeContext *context,
   IdeClangSymbolNode *self;
   IdeSymbolFlags flags = 0;
   IdeSymbolKind kind;
+  CXSourceLocation cxloc;
+  CXString cxfilename;
   CXString cxname;
+  CXFile file;
   const gchar *name;
 
   kind = get_symbol_kind (cursor, &flags);
@@ -149,21 +160,17 @@ _ide_clang_symbol_node_new (IdeContext *context,
                        "name", ide_str_empty0 (name) ? _("anonymous") : name,
                        NULL);
 
-  self->cursor = cursor;
+  cxloc = clang_getCursorLocation (cursor);
+  clang_getFileLocation (cxloc, &file, &self->line, &self->line_offset, NULL);
+  cxfilename = clang_getFileName (file);
+  self->path = g_strdup (clang_getCString (cxfilename));
 
+  clang_disposeString (cxfilename);
   clang_disposeString (cxname);
 
   return self;
 }
 
-CXCursor
-_ide_clang_symbol_node_get_cursor (IdeClangSymbolNode *self)
-{
-  g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_NODE (self), clang_getNullCursor ());;
-
-  return self->cursor;
-}
-
 static void
 ide_clang_symbol_node_get_location_async (IdeSymbolNode       *symbol_node,
                                           GCancellable        *cancellable,
@@ -173,14 +180,8 @@ ide_clang_symbol_node_get_location_async (IdeSymbolNode       *symbol_node,
   IdeClangSymbolNode *self = (IdeClangSymbolNode *)symbol_node;
   IdeSourceLocation *ret;
   IdeContext *context;
-  const gchar *filename;
-  CXString cxfilename;
-  CXSourceLocation cxloc;
-  CXFile file;
   GFile *gfile;
   IdeFile *ifile;
-  guint line = 0;
-  guint line_offset = 0;
   g_autoptr(GTask) task = NULL;
 
   g_return_if_fail (IDE_IS_CLANG_SYMBOL_NODE (self));
@@ -188,27 +189,30 @@ ide_clang_symbol_node_get_location_async (IdeSymbolNode       *symbol_node,
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, ide_clang_symbol_node_get_location_async);
 
-  cxloc = clang_getCursorLocation (self->cursor);
-  clang_getFileLocation (cxloc, &file, &line, &line_offset, NULL);
-  cxfilename = clang_getFileName (file);
-  filename = clang_getCString (cxfilename);
+  if (self->path == NULL)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_NOT_FOUND,
+                               "The symbol has no location");
+      return;
+    }
 
   /*
    * TODO: Remove IdeFile from all this junk.
    */
 
   context = ide_object_get_context (IDE_OBJECT (self));
-  gfile = g_file_new_for_path (filename);
+  gfile = g_file_new_for_path (self->path);
   ifile = g_object_new (IDE_TYPE_FILE,
                         "file", gfile,
                         "context", context,
                         NULL);
 
-  ret = ide_source_location_new (ifile, line-1, line_offset-1, 0);
+  ret = ide_source_location_new (ifile, self->line-1, self->line_offset-1, 0);
 
   g_clear_object (&ifile);
   g_clear_object (&gfile);
-  clang_disposeString (cxfilename);
 
   g_task_return_pointer (task, ret, (GDestroyNotify)ide_source_location_unref);
 }
@@ -224,11 +228,25 @@ ide_clang_symbol_node_get_location_finish (IdeSymbolNode  *symbol_node,
   return g_task_propagate_pointer (G_TASK (result), error);
 }
 
+static void
+ide_clang_symbol_node_finalize (GObject *object)
+{
+  IdeClangSymbolNode *self = (IdeClangSymbolNode *)object;
+
+  g_clear_pointer (&self->path, g_free);
+  g_clear_pointer (&self->children, g_ptr_array_unref);
+
+  G_OBJECT_CLASS (ide_clang_symbol_node_parent_class)->finalize (object);
+}
+
 static void
 ide_clang_symbol_node_class_init (IdeClangSymbolNodeClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
   IdeSymbolNodeClass *node_class = IDE_SYMBOL_NODE_CLASS (klass);
 
+  object_class->finalize = ide_clang_symbol_node_finalize;
+
   node_class->get_location_async = ide_clang_symbol_node_get_location_async;
   node_class->get_location_finish = ide_clang_symbol_node_get_location_finish;
 }
@@ -238,21 +256,34 @@ ide_clang_symbol_node_init (IdeClangSymbolNode *self)
 {
 }
 
-GArray *
-_ide_clang_symbol_node_get_children (IdeClangSymbolNode *self)
+guint
+_ide_clang_symbol_node_get_n_children (IdeClangSymbolNode *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_NODE (self), 0);
+
+  return self->children != NULL ? self->children->len : 0;
+}
+
+IdeSymbolNode *
+_ide_clang_symbol_node_get_nth_child (IdeClangSymbolNode *self,
+                                      guint               nth)
 {
   g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_NODE (self), NULL);
 
-  return self->children;
+  if (self->children != NULL && nth < self->children->len)
+    return g_object_ref (g_ptr_array_index (self->children, nth));
+
+  return NULL;
 }
 
 void
-_ide_clang_symbol_node_set_children (IdeClangSymbolNode *self,
-                                     GArray             *children)
+_ide_clang_symbol_node_take_child (IdeClangSymbolNode *self,
+                                   IdeClangSymbolNode *child)
 {
   g_return_if_fail (IDE_IS_CLANG_SYMBOL_NODE (self));
-  g_return_if_fail (self->children == NULL);
-  g_return_if_fail (children != NULL);
+  g_return_if_fail (IDE_IS_CLANG_SYMBOL_NODE (child));
 
-  self->children = g_array_ref (children);
+  if (self->children == NULL)
+    self->children = g_ptr_array_new_with_free_func (g_object_unref);
+  g_ptr_array_add (self->children, child);
 }
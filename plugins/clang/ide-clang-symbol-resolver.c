@@ -32,6 +32,25 @@ G_DEFINE_TYPE_EXTENDED (IdeClangSymbolResolver, ide_clang_symbol_resolver, IDE_T
                         G_IMPLEMENT_INTERFACE (IDE_TYPE_SYMBOL_RESOLVER,
                                                symbol_resolver_iface_init))
 
+static void
+ide_clang_symbol_resolver_lookup_symbol_cb2 (GObject      *object,
+                                             GAsyncResult *result,
+                                             gpointer      user_data)
+{
+  IdeClangTranslationUnit *unit = (IdeClangTranslationUnit *)object;
+  g_autoptr(GTask) task = user_data;
+  IdeSymbol *symbol;
+  GError *error = NULL;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (unit));
+  g_assert (G_IS_TASK (task));
+
+  if (!(symbol = ide_clang_translation_unit_lookup_symbol_finish (unit, result, &error)))
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, symbol, (GDestroyNotify)ide_symbol_unref);
+}
+
 static void
 ide_clang_symbol_resolver_lookup_symbol_cb (GObject      *object,
                                             GAsyncResult *result,
@@ -40,7 +59,6 @@ ide_clang_symbol_resolver_lookup_symbol_cb (GObject      *object,
   IdeClangService *service = (IdeClangService *)object;
   g_autoptr(IdeClangTranslationUnit) unit = NULL;
   g_autoptr(GTask) task = user_data;
-  g_autoptr(IdeSymbol) symbol = NULL;
   IdeSourceLocation *location;
   GError *error = NULL;
 
@@ -57,15 +75,11 @@ ide_clang_symbol_resolver_lookup_symbol_cb (GObject      *object,
       return;
     }
 
-  symbol = ide_clang_translation_unit_lookup_symbol (unit, location, &error);
-
-  if (symbol == NULL)
-    {
-      g_task_return_error (task, error);
-      return;
-    }
-
-  g_task_return_pointer (task, ide_symbol_ref (symbol), (GDestroyNotify)ide_symbol_unref);
+  ide_clang_translation_unit_lookup_symbol_async (unit,
+                                                  location,
+                                                  g_task_get_cancellable (task),
+                                                  ide_clang_symbol_resolver_lookup_symbol_cb2,
+                                                  g_object_ref (task));
 }
 
 static void
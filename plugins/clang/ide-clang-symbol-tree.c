@@ -29,16 +29,17 @@ struct _IdeClangSymbolTree
 {
   GObject    parent_instance;
 
-  IdeRefPtr *native;
   GFile     *file;
   gchar     *path;
-  GArray    *children;
+  GPtrArray *children;
 };
 
 typedef struct
 {
-  const gchar   *path;
-  GArray        *children;
+  IdeContext         *context;
+  const gchar        *path;
+  IdeClangSymbolNode *parent;
+  GPtrArray          *children;
 } TraversalState;
 
 static void symbol_tree_iface_init (IdeSymbolTreeInterface *iface);
@@ -49,7 +50,6 @@ G_DEFINE_TYPE_WITH_CODE (IdeClangSymbolTree, ide_clang_symbol_tree, IDE_TYPE_OBJ
 enum {
   PROP_0,
   PROP_FILE,
-  PROP_NATIVE,
   LAST_PROP
 };
 
@@ -126,70 +126,80 @@ cursor_is_recognized (TraversalState *state,
 }
 
 static enum CXChildVisitResult
-count_recognizable_children (CXCursor     cursor,
-                             CXCursor     parent,
-                             CXClientData user_data)
+collect_recognizable_children (CXCursor     cursor,
+                               CXCursor     parent,
+                               CXClientData user_data)
 {
   TraversalState *state = user_data;
+  TraversalState child_state = { 0 };
+  IdeClangSymbolNode *node;
 
-  if (cursor_is_recognized (state, cursor))
-    g_array_append_val (state->children, cursor);
+  if (!cursor_is_recognized (state, cursor))
+    return CXChildVisit_Continue;
+
+  node = _ide_clang_symbol_node_new (state->context, cursor);
+
+  child_state.context = state->context;
+  child_state.path = state->path;
+  child_state.parent = node;
+
+  clang_visitChildren (cursor, collect_recognizable_children, &child_state);
+
+  if (state->parent != NULL)
+    _ide_clang_symbol_node_take_child (state->parent, node);
+  else
+    g_ptr_array_add (state->children, node);
 
   return CXChildVisit_Continue;
 }
 
-static guint
-ide_clang_symbol_tree_get_n_children (IdeSymbolTree *symbol_tree,
-                                      IdeSymbolNode *parent)
+/*
+ * Creates a symbol tree for @file from the cursors of @tu. The whole tree
+ * is built up front, so that it does not keep a reference to @tu. That
+ * means it must be called with the native unit locked, from a compiler
+ * thread.
+ */
+IdeClangSymbolTree *
+_ide_clang_symbol_tree_new (IdeContext        *context,
+                            CXTranslationUnit  tu,
+                            GFile             *file)
 {
-  IdeClangSymbolTree *self = (IdeClangSymbolTree *)symbol_tree;
-  CXTranslationUnit tu;
-  CXCursor cursor;
+  IdeClangSymbolTree *self;
   TraversalState state = { 0 };
-  GArray *children = NULL;
-  guint count;
+  CXCursor cursor;
 
-  g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_TREE (self), 0);
-  g_return_val_if_fail (!parent || IDE_IS_CLANG_SYMBOL_NODE (parent), 0);
-  g_return_val_if_fail (self->native != NULL, 0);
+  g_return_val_if_fail (IDE_IS_CONTEXT (context), NULL);
+  g_return_val_if_fail (tu != NULL, NULL);
+  g_return_val_if_fail (G_IS_FILE (file), NULL);
 
-  if (parent == NULL)
-    children = self->children;
-  else
-    children = _ide_clang_symbol_node_get_children (IDE_CLANG_SYMBOL_NODE (parent));
+  self = g_object_new (IDE_TYPE_CLANG_SYMBOL_TREE,
+                       "context", context,
+                       "file", file,
+                       NULL);
 
-  if (children != NULL)
-    return children->len;
+  state.context = context;
+  state.path = self->path;
+  state.children = self->children;
 
-  if (parent == NULL)
-    {
-      tu = ide_ref_ptr_get (self->native);
-      cursor = clang_getTranslationUnitCursor (tu);
-    }
-  else
-    {
-      cursor = _ide_clang_symbol_node_get_cursor (IDE_CLANG_SYMBOL_NODE (parent));
-    }
+  cursor = clang_getTranslationUnitCursor (tu);
+  clang_visitChildren (cursor, collect_recognizable_children, &state);
 
-  children = g_array_new (FALSE, FALSE, sizeof (CXCursor));
+  return self;
+}
 
-  state.path = self->path;
-  state.children = children;
+static guint
+ide_clang_symbol_tree_get_n_children (IdeSymbolTree *symbol_tree,
+                                      IdeSymbolNode *parent)
+{
+  IdeClangSymbolTree *self = (IdeClangSymbolTree *)symbol_tree;
 
-  clang_visitChildren (cursor,
-                       count_recognizable_children,
-                       &state);
+  g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_TREE (self), 0);
+  g_return_val_if_fail (!parent || IDE_IS_CLANG_SYMBOL_NODE (parent), 0);
 
   if (parent == NULL)
-    self->children = g_array_ref (children);
-  else
-    _ide_clang_symbol_node_set_children (IDE_CLANG_SYMBOL_NODE (parent), children);
+    return self->children->len;
 
-  count = children->len;
-
-  g_array_unref (children);
-
-  return count;
+  return _ide_clang_symbol_node_get_n_children (IDE_CLANG_SYMBOL_NODE (parent));
 }
 
 static IdeSymbolNode *
@@ -198,28 +208,15 @@ ide_clang_symbol_tree_get_nth_child (IdeSymbolTree *symbol_tree,
                                      guint          nth)
 {
   IdeClangSymbolTree *self = (IdeClangSymbolTree *)symbol_tree;
-  IdeContext *context;
-  GArray *children;
 
   g_return_val_if_fail (IDE_IS_CLANG_SYMBOL_TREE (self), NULL);
-  g_return_val_if_fail (!parent || IDE_IS_SYMBOL_NODE (parent), NULL);
+  g_return_val_if_fail (!parent || IDE_IS_CLANG_SYMBOL_NODE (parent), NULL);
 
-  context = ide_object_get_context (IDE_OBJECT (self));
+  if (parent != NULL)
+    return _ide_clang_symbol_node_get_nth_child (IDE_CLANG_SYMBOL_NODE (parent), nth);
 
-  if (parent == NULL)
-    children = self->children;
-  else
-    children = _ide_clang_symbol_node_get_children (IDE_CLANG_SYMBOL_NODE (parent));
-
-  g_assert (children != NULL);
-
-  if (nth < children->len)
-    {
-      CXCursor cursor;
-
-      cursor = g_array_index (children, CXCursor, nth);
-      return _ide_clang_symbol_node_new (context, cursor);
-    }
+  if (nth < self->children->len)
+    return g_object_ref (g_ptr_array_index (self->children, nth));
 
   g_warning ("nth child %u is out of bounds", nth);
 
@@ -231,9 +228,9 @@ ide_clang_symbol_tree_finalize (GObject *object)
 {
   IdeClangSymbolTree *self = (IdeClangSymbolTree *)object;
 
-  g_clear_pointer (&self->native, ide_ref_ptr_unref);
-  g_clear_pointer (&self->children, g_array_unref);
+  g_clear_pointer (&self->children, g_ptr_array_unref);
   g_clear_pointer (&self->path, g_free);
+  g_clear_object (&self->file);
 
   G_OBJECT_CLASS (ide_clang_symbol_tree_parent_class)->finalize (object);
 }
@@ -252,10 +249,6 @@ ide_clang_symbol_tree_get_property (GObject    *object,
       g_value_set_object (value, ide_clang_symbol_tree_get_file (self));
       break;
 
-    case PROP_NATIVE:
-      g_value_set_boxed (value, self->native);
-      break;
-
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -275,10 +268,6 @@ ide_clang_symbol_tree_set_property (GObject      *object,
       ide_clang_symbol_tree_set_file (self, g_value_get_object (value));
       break;
 
-    case PROP_NATIVE:
-      self->native = g_value_dup_boxed (value);
-      break;
-
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -300,19 +289,13 @@ ide_clang_symbol_tree_class_init (IdeClangSymbolTreeClass *klass)
                          G_TYPE_FILE,
                          (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
-  properties [PROP_NATIVE] =
-    g_param_spec_boxed ("native",
-                        "Native",
-                        "Native",
-                        IDE_TYPE_REF_PTR,
-                        (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
-
   g_object_class_install_properties (object_class, LAST_PROP, properties);
 }
 
 static void
 ide_clang_symbol_tree_init (IdeClangSymbolTree *self)
 {
+  self->children = g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 static void
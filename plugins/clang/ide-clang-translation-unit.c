@@ -34,11 +34,27 @@ struct _IdeClangTranslationUnit
 {
   IdeObject          parent_instance;
 
-  IdeRefPtr         *native;
+  /*
+   * Every use of the native unit holds native_lock, since the service
+   * reparses it in place when the file changes. The lock is only taken
+   * from compiler threads. The main thread uses the results collected
+   * after the last parse instead.
+   */
+  GMutex             native_lock;
+  CXTranslationUnit  native;
+  gchar            **command_line_args;
+  GHashTable        *inclusions;
+  gsize              memory_usage;
+
   gint64             serial;
   GFile             *file;
   IdeHighlightIndex *index;
+  GHashTable        *native_diagnostics;
   GHashTable        *diagnostics;
+
+  /* Results of an in-place reparse, installed from the main thread */
+  GHashTable        *pending_diagnostics;
+  gsize              pending_memory_usage;
 };
 
 typedef struct
@@ -70,6 +86,9 @@ enum {
 
 static GParamSpec *properties [LAST_PROP];
 
+static GHashTable *collect_diagnostics (IdeClangTranslationUnit *self,
+                                        CXTranslationUnit        tu);
+
 static void
 code_complete_state_free (gpointer data)
 {
@@ -128,12 +147,31 @@ ide_clang_translation_unit_set_file (IdeClangTranslationUnit *self,
     g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_FILE]);
 }
 
+static gsize
+measure_native (CXTranslationUnit tu)
+{
+  CXTUResourceUsage usage;
+  gsize total = 0;
+
+  if (tu == NULL)
+    return 0;
+
+  usage = clang_getCXTUResourceUsage (tu);
+  for (guint i = 0; i < usage.numEntries; i++)
+    total += usage.entries[i].amount;
+  clang_disposeCXTUResourceUsage (usage);
+
+  return total;
+}
+
 IdeClangTranslationUnit *
-_ide_clang_translation_unit_new (IdeContext        *context,
-                                 CXTranslationUnit  tu,
-                                 GFile             *file,
-                                 IdeHighlightIndex *index,
-                                 gint64             serial)
+_ide_clang_translation_unit_new (IdeContext          *context,
+                                 CXTranslationUnit    tu,
+                                 const gchar * const *command_line_args,
+                                 GHashTable          *inclusions,
+                                 GFile               *file,
+                                 IdeHighlightIndex   *index,
+                                 gint64               serial)
 {
   IdeClangTranslationUnit *ret;
 
@@ -149,9 +187,132 @@ _ide_clang_translation_unit_new (IdeContext        *context,
                       "serial", serial,
                       NULL);
 
+  ret->command_line_args = g_strdupv ((gchar **)command_line_args);
+  ret->inclusions = inclusions ? g_hash_table_ref (inclusions) : NULL;
+  ret->memory_usage = measure_native (tu);
+  ret->native_diagnostics = collect_diagnostics (ret, tu);
+
   return ret;
 }
 
+/*
+ * Locks the native unit of @self so that the service may reparse it in
+ * place. Returns %NULL without holding the lock if the unit cannot be
+ * reparsed, because a previous reparse failed. Otherwise,
+ * _ide_clang_translation_unit_end_reparse() must be called once done.
+ *
+ * This is meant to be called from the parse thread.
+ */
+CXTranslationUnit
+_ide_clang_translation_unit_begin_reparse (IdeClangTranslationUnit *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+
+  g_mutex_lock (&self->native_lock);
+
+  if (self->native == NULL)
+    {
+      g_mutex_unlock (&self->native_lock);
+      return NULL;
+    }
+
+  return self->native;
+}
+
+/*
+ * Releases the lock taken by _ide_clang_translation_unit_begin_reparse().
+ * On success, the diagnostics and memory usage of the reparsed unit are
+ * collected for _ide_clang_translation_unit_reparsed(). If the reparse
+ * failed, the native unit is no longer usable and is disposed, leaving
+ * @self with the results of its last successful parse.
+ */
+void
+_ide_clang_translation_unit_end_reparse (IdeClangTranslationUnit *self,
+                                         gboolean                 success)
+{
+  g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+
+  g_clear_pointer (&self->pending_diagnostics, g_hash_table_unref);
+
+  if (success)
+    {
+      self->pending_diagnostics = collect_diagnostics (self, self->native);
+      self->pending_memory_usage = measure_native (self->native);
+    }
+  else
+    g_clear_pointer (&self->native, clang_disposeTranslationUnit);
+
+  g_mutex_unlock (&self->native_lock);
+}
+
+/*
+ * Updates @self after its native unit was reparsed. This must be called
+ * from the main thread, since the index and diagnostics are used from it
+ * without locking.
+ */
+void
+_ide_clang_translation_unit_reparsed (IdeClangTranslationUnit *self,
+                                      GHashTable              *inclusions,
+                                      IdeHighlightIndex       *index,
+                                      gint64                   serial)
+{
+  g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_return_if_fail (IDE_IS_MAIN_THREAD ());
+
+  g_clear_pointer (&self->inclusions, g_hash_table_unref);
+  self->inclusions = inclusions ? g_hash_table_ref (inclusions) : NULL;
+
+  g_clear_pointer (&self->index, ide_highlight_index_unref);
+  self->index = index ? ide_highlight_index_ref (index) : NULL;
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_INDEX]);
+
+  self->serial = serial;
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_SERIAL]);
+
+  if (self->pending_diagnostics != NULL)
+    {
+      g_clear_pointer (&self->native_diagnostics, g_hash_table_unref);
+      self->native_diagnostics = g_steal_pointer (&self->pending_diagnostics);
+      self->memory_usage = self->pending_memory_usage;
+    }
+
+  g_hash_table_remove_all (self->diagnostics);
+}
+
+const gchar * const *
+_ide_clang_translation_unit_get_command_line_args (IdeClangTranslationUnit *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+
+  return (const gchar * const *)self->command_line_args;
+}
+
+/*
+ * Gets the set of canonical paths of the files that were read while
+ * parsing the unit, or %NULL if that is unknown. The set is only replaced
+ * from the main thread once a reparse has completed, so the parse thread
+ * may read it while it parses the same file.
+ */
+GHashTable *
+_ide_clang_translation_unit_get_inclusions (IdeClangTranslationUnit *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+
+  return self->inclusions;
+}
+
+/*
+ * Gets the number of bytes clang reported as used by the native unit when
+ * it was last parsed.
+ */
+gsize
+_ide_clang_translation_unit_get_memory_usage (IdeClangTranslationUnit *self)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), 0);
+
+  return self->memory_usage;
+}
+
 static IdeDiagnosticSeverity
 translate_severity (enum CXDiagnosticSeverity severity)
 {
@@ -273,40 +434,18 @@ create_range (IdeClangTranslationUnit *self,
   return range;
 }
 
-static gboolean
-cxfile_equal (CXFile  cxfile,
-              GFile  *file)
-{
-  CXString cxstr;
-  gchar *path;
-  gboolean ret;
-
-  cxstr = clang_getFileName (cxfile);
-  path = g_file_get_path (file);
-
-  ret = (0 == g_strcmp0 (clang_getCString (cxstr), path));
-
-  clang_disposeString (cxstr);
-  g_free (path);
-
-  return ret;
-}
-
 static IdeDiagnostic *
 create_diagnostic (IdeClangTranslationUnit *self,
                    IdeProject              *project,
                    const gchar             *workpath,
-                   GFile                   *target,
                    CXDiagnostic            *cxdiag)
 {
-  enum CXDiagnosticSeverity cxseverity;
   IdeDiagnosticSeverity severity;
   IdeDiagnostic *diag;
   IdeSourceLocation *loc;
   g_autofree gchar *spelling = NULL;
   CXString cxstr;
   CXSourceLocation cxloc;
-  CXFile cxfile = NULL;
   guint num_ranges;
   guint i;
 
@@ -314,18 +453,13 @@ create_diagnostic (IdeClangTranslationUnit *self,
   g_return_val_if_fail (cxdiag, NULL);
 
   cxloc = clang_getDiagnosticLocation (cxdiag);
-  clang_getExpansionLocation (cxloc, &cxfile, NULL, NULL, NULL);
-
-  if (cxfile && !cxfile_equal (cxfile, target))
-    return NULL;
-
-  cxseverity = clang_getDiagnosticSeverity (cxdiag);
-  severity = translate_severity (cxseverity);
 
   cxstr = clang_getDiagnosticSpelling (cxdiag);
   spelling = g_strdup (clang_getCString (cxstr));
   clang_disposeString (cxstr);
 
+  severity = translate_severity (clang_getDiagnosticSeverity (cxdiag));
+
   /*
    * I thought we could use an approach like the following to get deprecation
    * status. However, it has so far proven ineffective.
@@ -358,87 +492,145 @@ create_diagnostic (IdeClangTranslationUnit *self,
   return diag;
 }
 
-/**
- * ide_clang_translation_unit_get_diagnostics_for_file:
- *
- * Retrieves the diagnostics for the translation unit for a specific file.
- *
- * Returns: (transfer none) (nullable): An #IdeDiagnostics or %NULL.
+/*
+ * Converts the diagnostics of @tu, grouping them by the path of the file
+ * they were reported in. Diagnostics without a file, such as those about
+ * the command line, are stored under "". This must be called with the
+ * native unit locked.
  */
-IdeDiagnostics *
-ide_clang_translation_unit_get_diagnostics_for_file (IdeClangTranslationUnit *self,
-                                                     GFile                   *file)
+static GHashTable *
+collect_diagnostics (IdeClangTranslationUnit *self,
+                     CXTranslationUnit        tu)
 {
-  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+  g_autofree gchar *workpath = NULL;
+  IdeContext *context;
+  IdeProject *project;
+  GHashTable *ret;
+  IdeVcs *vcs;
+  GFile *workdir;
+  guint count;
+  guint i;
 
-  if (!g_hash_table_contains (self->diagnostics, file))
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (tu != NULL);
+
+  ret = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)g_ptr_array_unref);
+
+  /*
+   * Acquire the reader lock for the project since we will need to do
+   * a bunch of project tree lookups when creating diagnostics. By doing
+   * this outside of the loops, we avoid creating lots of contention on
+   * the reader lock, but potentially hold on to the entire lock for a bit
+   * longer at a time.
+   */
+  context = ide_object_get_context (IDE_OBJECT (self));
+  project = ide_context_get_project (context);
+  vcs = ide_context_get_vcs (context);
+  workdir = ide_vcs_get_working_directory (vcs);
+  workpath = g_file_get_path (workdir);
+
+  ide_project_reader_lock (project);
+
+  count = clang_getNumDiagnostics (tu);
+  for (i = 0; i < count; i++)
     {
-      CXTranslationUnit tu = ide_ref_ptr_get (self->native);
-      IdeContext *context;
-      IdeProject *project;
-      IdeVcs *vcs;
-      g_autofree gchar *workpath = NULL;
-      GFile *workdir;
+      g_auto(CXString) cxpath = { 0 };
+      CXSourceLocation cxloc;
+      CXDiagnostic cxdiag;
+      IdeDiagnostic *diag;
+      CXFile cxfile = NULL;
+      const gchar *path;
       GPtrArray *diags;
-      guint count;
-      guint i;
+      guint num_fixits;
+      gsize j;
 
-      diags = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+      cxdiag = clang_getDiagnostic (tu, i);
 
-      /*
-       * Acquire the reader lock for the project since we will need to do
-       * a bunch of project tree lookups when creating diagnostics. By doing
-       * this outside of the loops, we avoid creating lots of contention on
-       * the reader lock, but potentially hold on to the entire lock for a bit
-       * longer at a time.
-       */
-      context = ide_object_get_context (IDE_OBJECT (self));
-      project = ide_context_get_project (context);
-      vcs = ide_context_get_vcs (context);
-      workdir = ide_vcs_get_working_directory (vcs);
-      workpath = g_file_get_path (workdir);
+      if (NULL == (diag = create_diagnostic (self, project, workpath, cxdiag)))
+        {
+          clang_disposeDiagnostic (cxdiag);
+          continue;
+        }
 
-      ide_project_reader_lock (project);
+      num_fixits = clang_getDiagnosticNumFixIts (cxdiag);
 
-      count = clang_getNumDiagnostics (tu);
-      for (i = 0; i < count; i++)
+      for (j = 0; j < num_fixits; j++)
         {
-          CXDiagnostic cxdiag;
-          IdeDiagnostic *diag;
+          IdeFixit *fixit = NULL;
+          IdeSourceRange *range;
+          CXSourceRange cxrange;
+          CXString cxstr;
+
+          cxstr = clang_getDiagnosticFixIt (cxdiag, j, &cxrange);
+          range = create_range (self, project, workpath, cxrange);
+          fixit = _ide_fixit_new (range, clang_getCString (cxstr));
+          clang_disposeString (cxstr);
+
+          if (fixit != NULL)
+            ide_diagnostic_take_fixit (diag, fixit);
+        }
 
-          cxdiag = clang_getDiagnostic (tu, i);
-          diag = create_diagnostic (self, project, workpath, file, cxdiag);
+      /* Diagnostics in macro expansions belong to the file they expand in */
+      cxloc = clang_getDiagnosticLocation (cxdiag);
+      clang_getExpansionLocation (cxloc, &cxfile, NULL, NULL, NULL);
+      cxpath = clang_getFileName (cxfile);
 
-          if (diag != NULL)
-            {
-              guint num_fixits;
-              gsize j;
+      if (cxfile == NULL || NULL == (path = clang_getCString (cxpath)))
+        path = "";
 
-              num_fixits = clang_getDiagnosticNumFixIts (cxdiag);
+      if (NULL == (diags = g_hash_table_lookup (ret, path)))
+        {
+          diags = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+          g_hash_table_insert (ret, g_strdup (path), diags);
+        }
 
-              for (j = 0; j < num_fixits; j++)
-                {
-                  IdeFixit *fixit = NULL;
-                  IdeSourceRange *range;
-                  CXSourceRange cxrange;
-                  CXString cxstr;
+      g_ptr_array_add (diags, diag);
 
-                  cxstr = clang_getDiagnosticFixIt (cxdiag, j, &cxrange);
-                  range = create_range (self, project, workpath, cxrange);
-                  fixit = _ide_fixit_new (range, clang_getCString (cxstr));
-                  clang_disposeString (cxstr);
+      clang_disposeDiagnostic (cxdiag);
+    }
 
-                  if (fixit != NULL)
-                    ide_diagnostic_take_fixit (diag, fixit);
-                }
+  ide_project_reader_unlock (project);
 
-              g_ptr_array_add (diags, diag);
-            }
+  return ret;
+}
 
-          clang_disposeDiagnostic (cxdiag);
-        }
+static void
+append_diagnostics (GPtrArray *ar,
+                    GPtrArray *diags)
+{
+  g_assert (ar != NULL);
 
-      ide_project_reader_unlock (project);
+  if (diags == NULL)
+    return;
+
+  for (guint i = 0; i < diags->len; i++)
+    g_ptr_array_add (ar, ide_diagnostic_ref (g_ptr_array_index (diags, i)));
+}
+
+/**
+ * ide_clang_translation_unit_get_diagnostics_for_file:
+ *
+ * Retrieves the diagnostics for the translation unit for a specific file.
+ *
+ * Returns: (transfer none) (nullable): An #IdeDiagnostics or %NULL.
+ */
+IdeDiagnostics *
+ide_clang_translation_unit_get_diagnostics_for_file (IdeClangTranslationUnit *self,
+                                                     GFile                   *file)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+
+  if (!g_hash_table_contains (self->diagnostics, file))
+    {
+      g_autofree gchar *path = g_file_get_path (file);
+      GPtrArray *diags;
+
+      diags = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_diagnostic_unref);
+
+      if (path != NULL)
+        append_diagnostics (diags, g_hash_table_lookup (self->native_diagnostics, path));
+      append_diagnostics (diags, g_hash_table_lookup (self->native_diagnostics, ""));
 
       g_hash_table_insert (self->diagnostics, g_object_ref (file), ide_diagnostics_new (diags));
     }
@@ -473,8 +665,7 @@ ide_clang_translation_unit_set_native (IdeClangTranslationUnit *self,
 {
   g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
 
-  if (native != NULL)
-    self->native = ide_ref_ptr_new (native, (GDestroyNotify)clang_disposeTranslationUnit);
+  self->native = native;
 }
 
 static void
@@ -484,9 +675,15 @@ ide_clang_translation_unit_finalize (GObject *object)
 
   IDE_ENTRY;
 
-  g_clear_pointer (&self->native, ide_ref_ptr_unref);
+  g_clear_pointer (&self->native, clang_disposeTranslationUnit);
+
+  g_mutex_clear (&self->native_lock);
+  g_clear_pointer (&self->command_line_args, g_strfreev);
+  g_clear_pointer (&self->inclusions, g_hash_table_unref);
   g_clear_object (&self->file);
   g_clear_pointer (&self->index, ide_highlight_index_unref);
+  g_clear_pointer (&self->native_diagnostics, g_hash_table_unref);
+  g_clear_pointer (&self->pending_diagnostics, g_hash_table_unref);
   g_clear_pointer (&self->diagnostics, g_hash_table_unref);
 
   G_OBJECT_CLASS (ide_clang_translation_unit_parent_class)->finalize (object);
@@ -600,6 +797,8 @@ ide_clang_translation_unit_init (IdeClangTranslationUnit *self)
 {
   DZL_COUNTER_INC (instances);
 
+  g_mutex_init (&self->native_lock);
+
   self->diagnostics = g_hash_table_new_full ((GHashFunc)g_file_hash,
                                              (GEqualFunc)g_file_equal,
                                              g_object_unref,
@@ -616,6 +815,7 @@ ide_clang_translation_unit_code_complete_worker (GTask        *task,
   CodeCompleteState *state = task_data;
   CXCodeCompleteResults *results;
   CXTranslationUnit tu;
+  g_autoptr(GMutexLocker) locker = NULL;
   g_autoptr(IdeRefPtr) refptr = NULL;
   struct CXUnsavedFile *ufs;
   GPtrArray *ar;
@@ -626,12 +826,21 @@ ide_clang_translation_unit_code_complete_worker (GTask        *task,
   g_assert (state);
   g_assert (state->unsaved_files);
 
-  tu = ide_ref_ptr_get (self->native);
-
   /*
-   * FIXME: Not thread safe! We should probably add a "Pending" flag or something that is
-   *        similar to g_input_stream_set_pending().
+   * Hold the native lock for the duration of the completion so that the
+   * service cannot reparse the unit from under us.
    */
+  locker = g_mutex_locker_new (&self->native_lock);
+  tu = self->native;
+
+  if (tu == NULL)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_CANCELLED,
+                               "The translation unit failed to reparse");
+      return;
+    }
 
   if (!state->path)
     {
@@ -732,7 +941,7 @@ ide_clang_translation_unit_code_complete_async (IdeClangTranslationUnit *self,
   state->path = g_file_get_path (file);
   state->line = gtk_text_iter_get_line (location);
   state->line_offset = gtk_text_iter_get_line_offset (location);
-  state->unsaved_files = ide_unsaved_files_to_array (unsaved_files);
+  state->unsaved_files = ide_unsaved_files_get_snapshot (unsaved_files, NULL);
 
   /*
    * TODO: Technically it is not safe for us to go run this in a thread. We need to ensure
@@ -871,10 +1080,14 @@ get_symbol_kind (CXCursor        cursor,
   return kind;
 }
 
-IdeSymbol *
-ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
-                                          IdeSourceLocation        *location,
-                                          GError                  **error)
+/*
+ * Looks up the symbol at @location in @tu, which must be the locked native
+ * unit of @self.
+ */
+static IdeSymbol *
+lookup_symbol (IdeClangTranslationUnit *self,
+               CXTranslationUnit        tu,
+               IdeSourceLocation       *location)
 {
   g_autofree gchar *filename = NULL;
   g_autofree gchar *workpath = NULL;
@@ -882,7 +1095,6 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
   g_autoptr(IdeSourceLocation) declaration = NULL;
   g_autoptr(IdeSourceLocation) definition = NULL;
   g_autoptr(IdeSourceLocation) canonical = NULL;
-  CXTranslationUnit tu;
   IdeSymbolKind symkind = 0;
   IdeSymbolFlags symflags = 0;
   IdeProject *project;
@@ -901,10 +1113,9 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
 
   IDE_ENTRY;
 
-  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
-  g_return_val_if_fail (location != NULL, NULL);
-
-  tu = ide_ref_ptr_get (self->native);
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (tu != NULL);
+  g_assert (location != NULL);
 
   context = ide_object_get_context (IDE_OBJECT (self));
   project = ide_context_get_project (context);
@@ -978,6 +1189,76 @@ ide_clang_translation_unit_lookup_symbol (IdeClangTranslationUnit  *self,
   IDE_RETURN (ret);
 }
 
+static void
+ide_clang_translation_unit_lookup_symbol_worker (GTask        *task,
+                                                 gpointer      source_object,
+                                                 gpointer      task_data,
+                                                 GCancellable *cancellable)
+{
+  IdeClangTranslationUnit *self = source_object;
+  IdeSourceLocation *location = task_data;
+  g_autoptr(GMutexLocker) locker = NULL;
+  IdeSymbol *ret = NULL;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (location != NULL);
+
+  locker = g_mutex_locker_new (&self->native_lock);
+
+  if (self->native != NULL)
+    ret = lookup_symbol (self, self->native, location);
+
+  if (ret == NULL)
+    g_task_return_new_error (task,
+                             G_IO_ERROR,
+                             G_IO_ERROR_NOT_FOUND,
+                             "Failed to locate symbol");
+  else
+    g_task_return_pointer (task, ret, (GDestroyNotify)ide_symbol_unref);
+}
+
+void
+ide_clang_translation_unit_lookup_symbol_async (IdeClangTranslationUnit *self,
+                                                IdeSourceLocation       *location,
+                                                GCancellable            *cancellable,
+                                                GAsyncReadyCallback      callback,
+                                                gpointer                 user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_return_if_fail (location != NULL);
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_clang_translation_unit_lookup_symbol_async);
+  g_task_set_task_data (task,
+                        ide_source_location_ref (location),
+                        (GDestroyNotify)ide_source_location_unref);
+
+  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
+                             task,
+                             ide_clang_translation_unit_lookup_symbol_worker);
+}
+
+/**
+ * ide_clang_translation_unit_lookup_symbol_finish:
+ *
+ * Completes a call to ide_clang_translation_unit_lookup_symbol_async().
+ *
+ * Returns: (transfer full): An #IdeSymbol or %NULL up on failure.
+ */
+IdeSymbol *
+ide_clang_translation_unit_lookup_symbol_finish (IdeClangTranslationUnit  *self,
+                                                 GAsyncResult             *result,
+                                                 GError                  **error)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 static IdeSymbol *
 create_symbol (CXCursor         cursor,
                GetSymbolsState *state)
@@ -1056,35 +1337,114 @@ sort_symbols_by_name (gconstpointer a,
                     ide_symbol_get_name (*bsym));
 }
 
-/**
- * ide_clang_translation_unit_get_symbols:
- *
- * Returns: (transfer container) (element-type IdeSymbol*): An array of #IdeSymbol.
- */
-GPtrArray *
-ide_clang_translation_unit_get_symbols (IdeClangTranslationUnit *self,
-                                        IdeFile                 *file)
+static void
+ide_clang_translation_unit_get_symbols_worker (GTask        *task,
+                                               gpointer      source_object,
+                                               gpointer      task_data,
+                                               GCancellable *cancellable)
 {
+  IdeClangTranslationUnit *self = source_object;
+  g_autoptr(GMutexLocker) locker = NULL;
   GetSymbolsState state = { 0 };
+  IdeFile *file = task_data;
   CXCursor cursor;
 
-  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
-  g_return_val_if_fail (IDE_IS_FILE (file), NULL);
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (IDE_IS_FILE (file));
 
   state.ar = g_ptr_array_new_with_free_func ((GDestroyNotify)ide_symbol_unref);
   state.file = file;
   state.path = g_file_get_path (ide_file_get_file (file));
 
-  cursor = clang_getTranslationUnitCursor (ide_ref_ptr_get (self->native));
-  clang_visitChildren (cursor,
-                       ide_clang_translation_unit_get_symbols__visitor_cb,
-                       &state);
+  locker = g_mutex_locker_new (&self->native_lock);
+
+  if (self->native != NULL)
+    {
+      cursor = clang_getTranslationUnitCursor (self->native);
+      clang_visitChildren (cursor,
+                           ide_clang_translation_unit_get_symbols__visitor_cb,
+                           &state);
+    }
+
+  g_clear_pointer (&locker, g_mutex_locker_free);
 
   g_ptr_array_sort (state.ar, sort_symbols_by_name);
 
   g_free (state.path);
 
-  return state.ar;
+  g_task_return_pointer (task, state.ar, (GDestroyNotify)g_ptr_array_unref);
+}
+
+void
+ide_clang_translation_unit_get_symbols_async (IdeClangTranslationUnit *self,
+                                              IdeFile                 *file,
+                                              GCancellable            *cancellable,
+                                              GAsyncReadyCallback      callback,
+                                              gpointer                 user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_return_if_fail (IDE_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_clang_translation_unit_get_symbols_async);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
+
+  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
+                             task,
+                             ide_clang_translation_unit_get_symbols_worker);
+}
+
+/**
+ * ide_clang_translation_unit_get_symbols_finish:
+ *
+ * Completes a call to ide_clang_translation_unit_get_symbols_async().
+ *
+ * Returns: (transfer container) (element-type IdeSymbol*): An array of #IdeSymbol.
+ */
+GPtrArray *
+ide_clang_translation_unit_get_symbols_finish (IdeClangTranslationUnit  *self,
+                                               GAsyncResult             *result,
+                                               GError                  **error)
+{
+  g_return_val_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+ide_clang_translation_unit_get_symbol_tree_worker (GTask        *task,
+                                                   gpointer      source_object,
+                                                   gpointer      task_data,
+                                                   GCancellable *cancellable)
+{
+  IdeClangTranslationUnit *self = source_object;
+  g_autoptr(GMutexLocker) locker = NULL;
+  IdeClangSymbolTree *symbol_tree;
+  IdeContext *context;
+  GFile *file = task_data;
+
+  g_assert (IDE_IS_CLANG_TRANSLATION_UNIT (self));
+  g_assert (G_IS_FILE (file));
+
+  locker = g_mutex_locker_new (&self->native_lock);
+
+  if (self->native == NULL)
+    {
+      g_task_return_new_error (task,
+                               G_IO_ERROR,
+                               G_IO_ERROR_CANCELLED,
+                               "The translation unit failed to reparse");
+      return;
+    }
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  symbol_tree = _ide_clang_symbol_tree_new (context, self->native, file);
+
+  g_task_return_pointer (task, symbol_tree, g_object_unref);
 }
 
 void
@@ -1095,22 +1455,18 @@ ide_clang_translation_unit_get_symbol_tree_async (IdeClangTranslationUnit *self,
                                                   gpointer                 user_data)
 {
   g_autoptr(GTask) task = NULL;
-  IdeSymbolTree *symbol_tree;
-  IdeContext *context;
 
   g_return_if_fail (IDE_IS_CLANG_TRANSLATION_UNIT (self));
   g_return_if_fail (G_IS_FILE (file));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_clang_translation_unit_get_symbol_tree_async);
+  g_task_set_task_data (task, g_object_ref (file), g_object_unref);
 
-  context = ide_object_get_context (IDE_OBJECT (self));
-  symbol_tree = g_object_new (IDE_TYPE_CLANG_SYMBOL_TREE,
-                              "context", context,
-                              "native", self->native,
-                              "file", file,
-                              NULL);
-  g_task_return_pointer (task, symbol_tree, g_object_unref);
+  ide_thread_pool_push_task (IDE_THREAD_POOL_COMPILER,
+                             task,
+                             ide_clang_translation_unit_get_symbol_tree_worker);
 }
 
 IdeSymbolTree *
@@ -50,11 +50,22 @@ IdeSymbolTree     *ide_clang_translation_unit_get_symbol_tree_finish   (IdeClang
                                                                         GAsyncResult             *result,
                                                                         GError                  **error);
 IdeHighlightIndex *ide_clang_translation_unit_get_index                (IdeClangTranslationUnit  *self);
-IdeSymbol         *ide_clang_translation_unit_lookup_symbol            (IdeClangTranslationUnit  *self,
+void               ide_clang_translation_unit_lookup_symbol_async      (IdeClangTranslationUnit  *self,
                                                                         IdeSourceLocation        *location,
+                                                                        GCancellable             *cancellable,
+                                                                        GAsyncReadyCallback       callback,
+                                                                        gpointer                  user_data);
+IdeSymbol         *ide_clang_translation_unit_lookup_symbol_finish     (IdeClangTranslationUnit  *self,
+                                                                        GAsyncResult             *result,
+                                                                        GError                  **error);
+void               ide_clang_translation_unit_get_symbols_async        (IdeClangTranslationUnit  *self,
+                                                                        IdeFile                  *file,
+                                                                        GCancellable             *cancellable,
+                                                                        GAsyncReadyCallback       callback,
+                                                                        gpointer                  user_data);
+GPtrArray         *ide_clang_translation_unit_get_symbols_finish       (IdeClangTranslationUnit  *self,
+                                                                        GAsyncResult             *result,
                                                                         GError                  **error);
-GPtrArray         *ide_clang_translation_unit_get_symbols              (IdeClangTranslationUnit  *self,
-                                                                        IdeFile                  *file);
 
 G_END_DECLS
 
@@ -29,6 +29,7 @@ typedef struct
 {
   GFile *directory;
   GFile *destination;
+  GFile *file;
   gchar *ctags;
   guint  recursive : 1;
 } BuildTaskData;
@@ -47,6 +48,7 @@ build_task_data_free (gpointer data)
 
   g_clear_object (&task_data->directory);
   g_clear_object (&task_data->destination);
+  g_clear_object (&task_data->file);
   g_clear_pointer (&task_data->ctags, g_free);
 
   g_slice_free (BuildTaskData, task_data);
@@ -86,6 +88,40 @@ ide_ctags_builder_new (IdeContext *context)
                        NULL);
 }
 
+static void
+push_ctags_argv (IdeSubprocessLauncher *launcher,
+                 const gchar           *ctags)
+{
+  g_autofree gchar *options_path = NULL;
+
+  g_assert (IDE_IS_SUBPROCESS_LAUNCHER (launcher));
+  g_assert (ctags != NULL);
+
+  options_path = g_build_filename (g_get_user_config_dir (),
+                                   ide_get_program_name (),
+                                   "ctags.conf",
+                                   NULL);
+
+  ide_subprocess_launcher_push_argv (launcher, ctags);
+  ide_subprocess_launcher_push_argv (launcher, "-f");
+  ide_subprocess_launcher_push_argv (launcher, "-");
+  ide_subprocess_launcher_push_argv (launcher, "--tag-relative=no");
+  ide_subprocess_launcher_push_argv (launcher, "--exclude=.git");
+  ide_subprocess_launcher_push_argv (launcher, "--exclude=.bzr");
+  ide_subprocess_launcher_push_argv (launcher, "--exclude=.svn");
+  ide_subprocess_launcher_push_argv (launcher, "--exclude=.flatpak-builder");
+  ide_subprocess_launcher_push_argv (launcher, "--sort=yes");
+  ide_subprocess_launcher_push_argv (launcher, "--languages=all");
+  ide_subprocess_launcher_push_argv (launcher, "--file-scope=yes");
+  ide_subprocess_launcher_push_argv (launcher, "--c-kinds=+defgpstx");
+
+  if (g_file_test (options_path, G_FILE_TEST_IS_REGULAR))
+    {
+      ide_subprocess_launcher_push_argv (launcher, "--options");
+      ide_subprocess_launcher_push_argv (launcher, options_path);
+    }
+}
+
 static gboolean
 ide_ctags_builder_build (IdeCtagsBuilder *self,
                          const gchar     *ctags,
@@ -103,7 +139,6 @@ ide_ctags_builder_build (IdeCtagsBuilder *self,
   g_autoptr(GError) error = NULL;
   g_autofree gchar *cwd = NULL;
   g_autofree gchar *dest_dir = NULL;
-  g_autofree gchar *options_path = NULL;
   g_autofree gchar *tags_path = NULL;
   g_autoptr(GString) filenames = NULL;
   GOutputStream *stdin_stream;
@@ -120,10 +155,6 @@ ide_ctags_builder_build (IdeCtagsBuilder *self,
   tags_file = g_file_get_child (destination, "tags");
   tags_path = g_file_get_path (tags_file);
   cwd = g_file_get_path (directory);
-  options_path = g_build_filename (g_get_user_config_dir (),
-                                   ide_get_program_name (),
-                                   "ctags.conf",
-                                   NULL);
   directories = g_ptr_array_new_with_free_func (g_object_unref);
   dest_directories = g_ptr_array_new_with_free_func (g_object_unref);
   filenames = g_string_new (NULL);
@@ -135,24 +166,7 @@ ide_ctags_builder_build (IdeCtagsBuilder *self,
   ide_subprocess_launcher_setenv (launcher, "TMPDIR", cwd, TRUE);
   ide_subprocess_launcher_set_stdout_file_path (launcher, tags_path);
 
-  ide_subprocess_launcher_push_argv (launcher, ctags);
-  ide_subprocess_launcher_push_argv (launcher, "-f");
-  ide_subprocess_launcher_push_argv (launcher, "-");
-  ide_subprocess_launcher_push_argv (launcher, "--tag-relative=no");
-  ide_subprocess_launcher_push_argv (launcher, "--exclude=.git");
-  ide_subprocess_launcher_push_argv (launcher, "--exclude=.bzr");
-  ide_subprocess_launcher_push_argv (launcher, "--exclude=.svn");
-  ide_subprocess_launcher_push_argv (launcher, "--exclude=.flatpak-builder");
-  ide_subprocess_launcher_push_argv (launcher, "--sort=yes");
-  ide_subprocess_launcher_push_argv (launcher, "--languages=all");
-  ide_subprocess_launcher_push_argv (launcher, "--file-scope=yes");
-  ide_subprocess_launcher_push_argv (launcher, "--c-kinds=+defgpstx");
-
-  if (g_file_test (options_path, G_FILE_TEST_IS_REGULAR))
-    {
-      ide_subprocess_launcher_push_argv (launcher, "--options");
-      ide_subprocess_launcher_push_argv (launcher, options_path);
-    }
+  push_ctags_argv (launcher, ctags);
 
   /* Read filenames from stdin, which we will provided below */
   ide_subprocess_launcher_push_argv (launcher, "-L");
@@ -274,6 +288,33 @@ ide_ctags_builder_build_worker (GTask        *task,
   IDE_EXIT;
 }
 
+static GFile *
+get_destination (IdeCtagsBuilder *self,
+                 GFile           *directory)
+{
+  g_autofree gchar *destination_path = NULL;
+  g_autofree gchar *relative_path = NULL;
+  IdeContext *context;
+  const gchar *project_id;
+  GFile *workdir;
+
+  g_assert (IDE_IS_CTAGS_BUILDER (self));
+  g_assert (G_IS_FILE (directory));
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  project_id = ide_project_get_id (ide_context_get_project (context));
+  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
+  relative_path = g_file_get_relative_path (workdir, directory);
+  destination_path = g_build_filename (g_get_user_cache_dir (),
+                                       ide_get_program_name (),
+                                       "tags",
+                                       project_id,
+                                       relative_path,
+                                       NULL);
+
+  return g_file_new_for_path (destination_path);
+}
+
 static void
 ide_ctags_builder_build_async (IdeTagsBuilder      *builder,
                                GFile               *directory_or_file,
@@ -285,12 +326,7 @@ ide_ctags_builder_build_async (IdeTagsBuilder      *builder,
   IdeCtagsBuilder *self = (IdeCtagsBuilder *)builder;
   g_autoptr(GTask) task = NULL;
   g_autoptr(GSettings) settings = NULL;
-  g_autofree gchar *destination_path = NULL;
-  g_autofree gchar *relative_path = NULL;
   BuildTaskData *task_data;
-  IdeContext *context;
-  const gchar *project_id;
-  GFile *workdir;
 
   IDE_ENTRY;
 
@@ -311,17 +347,7 @@ ide_ctags_builder_build_async (IdeTagsBuilder      *builder,
    * even between configuration changes. Primarily, we want to avoid
    * putting things in the source tree.
    */
-  context = ide_object_get_context (IDE_OBJECT (self));
-  project_id = ide_project_get_id (ide_context_get_project (context));
-  workdir = ide_vcs_get_working_directory (ide_context_get_vcs (context));
-  relative_path = g_file_get_relative_path (workdir, directory_or_file);
-  destination_path = g_build_filename (g_get_user_cache_dir (),
-                                       ide_get_program_name (),
-                                       "tags",
-                                       project_id,
-                                       relative_path,
-                                       NULL);
-  task_data->destination = g_file_new_for_path (destination_path);
+  task_data->destination = get_destination (self, directory_or_file);
 
   task = g_task_new (self, cancellable, callback, user_data);
   g_task_set_source_tag (task, ide_ctags_builder_build_async);
@@ -354,3 +380,149 @@ tags_builder_iface_init (IdeTagsBuilderInterface *iface)
   iface->build_async = ide_ctags_builder_build_async;
   iface->build_finish = ide_ctags_builder_build_finish;
 }
+
+/**
+ * ide_ctags_builder_get_tags_file:
+ * @self: An #IdeCtagsBuilder
+ * @directory: a directory within the project
+ *
+ * Gets the tags file that ide_tags_builder_build_async() generates
+ * for @directory.
+ *
+ * Returns: (transfer full): A #GFile
+ */
+GFile *
+ide_ctags_builder_get_tags_file (IdeCtagsBuilder *self,
+                                 GFile           *directory)
+{
+  g_autoptr(GFile) destination = NULL;
+
+  g_return_val_if_fail (IDE_IS_CTAGS_BUILDER (self), NULL);
+  g_return_val_if_fail (G_IS_FILE (directory), NULL);
+
+  destination = get_destination (self, directory);
+
+  return g_file_get_child (destination, "tags");
+}
+
+static void
+ide_ctags_builder_build_file_worker (GTask        *task,
+                                     gpointer      source_object,
+                                     gpointer      task_data_ptr,
+                                     GCancellable *cancellable)
+{
+  g_autoptr(IdeSubprocessLauncher) launcher = NULL;
+  g_autoptr(IdeSubprocess) subprocess = NULL;
+  g_autoptr(GBytes) stdout_buf = NULL;
+  g_autofree gchar *program = NULL;
+  g_autofree gchar *cwd = NULL;
+  g_autofree gchar *name = NULL;
+  BuildTaskData *task_data = task_data_ptr;
+  const gchar *ctags;
+  GError *error = NULL;
+
+  IDE_ENTRY;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (IDE_IS_CTAGS_BUILDER (source_object));
+  g_assert (G_IS_FILE (task_data->file));
+  g_assert (G_IS_FILE (task_data->directory));
+
+  ctags = task_data->ctags;
+  program = g_find_program_in_path (ctags);
+  if (!program)
+    ctags = "ctags";
+
+  cwd = g_file_get_path (task_data->directory);
+  name = g_file_get_basename (task_data->file);
+
+  launcher = ide_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+                                          G_SUBPROCESS_FLAGS_STDERR_SILENCE);
+
+  ide_subprocess_launcher_set_cwd (launcher, cwd);
+  ide_subprocess_launcher_setenv (launcher, "TMPDIR", cwd, TRUE);
+
+  /* Use the same relative naming as the directory build so entries line up */
+  push_ctags_argv (launcher, ctags);
+  ide_subprocess_launcher_push_argv (launcher, name);
+
+  if (!(subprocess = ide_subprocess_launcher_spawn (launcher, cancellable, &error)) ||
+      !ide_subprocess_communicate (subprocess, NULL, cancellable, &stdout_buf, NULL, &error))
+    {
+      g_task_return_error (task, error);
+      IDE_EXIT;
+    }
+
+  if (stdout_buf == NULL)
+    stdout_buf = g_bytes_new (NULL, 0);
+
+  g_task_return_pointer (task, g_steal_pointer (&stdout_buf), (GDestroyNotify)g_bytes_unref);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_ctags_builder_build_file_async:
+ * @self: An #IdeCtagsBuilder
+ * @file: the file to generate tags for
+ * @cancellable: (nullable): A #GCancellable or %NULL
+ * @callback: A callback to execute upon completion
+ * @user_data: user data for @callback
+ *
+ * Runs ctags on just @file, rather than the whole directory. The
+ * resulting tags can be spliced into an existing index for the
+ * directory with ide_ctags_index_splice().
+ */
+void
+ide_ctags_builder_build_file_async (IdeCtagsBuilder     *self,
+                                    GFile               *file,
+                                    GCancellable        *cancellable,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GSettings) settings = NULL;
+  BuildTaskData *task_data;
+
+  IDE_ENTRY;
+
+  g_return_if_fail (IDE_IS_CTAGS_BUILDER (self));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
+
+  settings = g_settings_new ("org.gnome.builder.code-insight");
+
+  task_data = g_slice_new0 (BuildTaskData);
+  task_data->ctags = g_settings_get_string (settings, "ctags-path");
+  task_data->file = g_object_ref (file);
+  task_data->directory = g_file_get_parent (file);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, ide_ctags_builder_build_file_async);
+  g_task_set_task_data (task, task_data, build_task_data_free);
+  ide_thread_pool_push_task (IDE_THREAD_POOL_INDEXER, task, ide_ctags_builder_build_file_worker);
+
+  IDE_EXIT;
+}
+
+/**
+ * ide_ctags_builder_build_file_finish:
+ *
+ * Returns: (transfer full): the contents of the generated tags file.
+ */
+GBytes *
+ide_ctags_builder_build_file_finish (IdeCtagsBuilder  *self,
+                                     GAsyncResult     *result,
+                                     GError          **error)
+{
+  GBytes *ret;
+
+  IDE_ENTRY;
+
+  g_return_val_if_fail (IDE_IS_CTAGS_BUILDER (self), NULL);
+  g_return_val_if_fail (G_IS_TASK (result), NULL);
+
+  ret = g_task_propagate_pointer (G_TASK (result), error);
+
+  IDE_RETURN (ret);
+}
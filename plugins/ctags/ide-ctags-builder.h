@@ -27,7 +27,17 @@ G_BEGIN_DECLS
 
 G_DECLARE_FINAL_TYPE (IdeCtagsBuilder, ide_ctags_builder, IDE, CTAGS_BUILDER, IdeObject)
 
-IdeTagsBuilder *ide_ctags_builder_new (IdeContext *context);
+IdeTagsBuilder *ide_ctags_builder_new               (IdeContext           *context);
+GFile          *ide_ctags_builder_get_tags_file     (IdeCtagsBuilder      *self,
+                                                     GFile                *directory);
+void            ide_ctags_builder_build_file_async  (IdeCtagsBuilder      *self,
+                                                     GFile                *file,
+                                                     GCancellable         *cancellable,
+                                                     GAsyncReadyCallback   callback,
+                                                     gpointer              user_data);
+GBytes         *ide_ctags_builder_build_file_finish (IdeCtagsBuilder      *self,
+                                                     GAsyncResult         *result,
+                                                     GError              **error);
 
 G_END_DECLS
 
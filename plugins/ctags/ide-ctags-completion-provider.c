@@ -165,11 +165,12 @@ ide_ctags_completion_provider_populate (GtkSourceCompletionProvider *provider,
 {
   IdeCtagsCompletionProvider *self = (IdeCtagsCompletionProvider *)provider;
   const gchar * const *allowed;
+  const gchar *last_name = NULL;
   g_autofree gchar *casefold = NULL;
+  g_autoptr(GArray) matches = NULL;
   gint word_len;
   guint i;
   guint j;
-  g_autoptr(GHashTable) completions = NULL;
 
   IDE_ENTRY;
 
@@ -199,15 +200,11 @@ ide_ctags_completion_provider_populate (GtkSourceCompletionProvider *provider,
 
   self->results = ide_completion_results_new (self->current_word);
 
-  completions = g_hash_table_new (g_str_hash, g_str_equal);
+  matches = g_array_new (FALSE, FALSE, sizeof (IdeCtagsIndexMatch));
 
   for (i = 0; i < self->indexes->len; i++)
     {
-      g_autofree gchar *copy = g_strdup (self->current_word);
       IdeCtagsIndex *index = g_ptr_array_index (self->indexes, i);
-      const IdeCtagsIndexEntry *entries = NULL;
-      guint tmp_len = word_len;
-      gsize n_entries = 0;
       gchar gdata_key[64];
 
       /*
@@ -218,38 +215,48 @@ ide_ctags_completion_provider_populate (GtkSourceCompletionProvider *provider,
       g_object_set_data_full (G_OBJECT (self->results), gdata_key,
                               g_object_ref (index), g_object_unref);
 
-      while (entries == NULL && *copy)
-        {
-          if (!(entries = ide_ctags_index_lookup_prefix (index, copy, &n_entries)))
-            copy [--tmp_len] = '\0';
-        }
+      ide_ctags_index_lookup_fuzzy (index, self->current_word, casefold, matches);
+    }
 
-      if ((entries == NULL) || (n_entries == 0))
+  /*
+   * Each index gives us unique names, so once sorted we only need to
+   * compare against the previously added name to dedup across indexes.
+   */
+  g_array_sort (matches, ide_ctags_index_match_compare);
+
+  for (i = 0; i < matches->len; i++)
+    {
+      const IdeCtagsIndexMatch *match = &g_array_index (matches, IdeCtagsIndexMatch, i);
+      const IdeCtagsIndexEntry *entry = NULL;
+      IdeCtagsCompletionItem *item;
+
+      if (last_name != NULL && g_str_equal (last_name, match->entries->name))
         continue;
 
-      for (j = 0; j < n_entries; j++)
+      for (j = 0; j < match->n_entries; j++)
         {
-          const IdeCtagsIndexEntry *entry = &entries [j];
-          IdeCtagsCompletionItem *item;
-
-          if (g_hash_table_contains (completions, entry->name))
-            continue;
+          if (ide_ctags_is_allowed (&match->entries [j], allowed))
+            {
+              entry = &match->entries [j];
+              break;
+            }
+        }
 
-          g_hash_table_add (completions, (gchar *)entry->name);
+      if (entry == NULL)
+        continue;
 
-          if (!ide_ctags_is_allowed (entry, allowed))
-            continue;
+      item = ide_ctags_completion_item_new (self, entry);
 
-          item = ide_ctags_completion_item_new (self, entry);
+      /* This also calculates the priority for the item */
+      if (!ide_completion_item_match (IDE_COMPLETION_ITEM (item), self->current_word, casefold))
+        {
+          g_object_unref (item);
+          continue;
+        }
 
-          if (!ide_completion_item_match (IDE_COMPLETION_ITEM (item), self->current_word, casefold))
-            {
-              g_object_unref (item);
-              continue;
-            }
+      last_name = entry->name;
 
-          ide_completion_results_take_proposal (self->results, IDE_COMPLETION_ITEM (item));
-        }
+      ide_completion_results_take_proposal (self->results, IDE_COMPLETION_ITEM (item));
     }
 
   ide_completion_results_present (self->results, provider, context);
@@ -25,17 +25,20 @@
 #include <string.h>
 
 #include "ide-ctags-index.h"
+#include "ide-ctags-trie.h"
 
 struct _IdeCtagsIndex
 {
   IdeObject  parent_instance;
 
-  GArray    *index;
-  GBytes    *buffer;
-  GFile     *file;
-  gchar     *path_root;
+  GArray       *index;
+  IdeCtagsTrie *trie;
+  GBytes       *buffer;
+  GPtrArray    *shared_buffers;
+  GFile        *file;
+  gchar        *path_root;
 
-  guint64    mtime;
+  guint64       mtime;
 };
 
 enum {
@@ -55,6 +58,53 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED (IdeCtagsIndex, ide_ctags_index, IDE_TYPE_OBJECT,
 DZL_DEFINE_COUNTER (instances, "IdeCtagsIndex", "Instances", "Number of IdeCtagsIndex instances.")
 DZL_DEFINE_COUNTER (index_entries, "IdeCtagsIndex", "N Entries", "Number of entries in indexes.")
 DZL_DEFINE_COUNTER (heap_size, "IdeCtagsIndex", "Heap Size", "Size of index string heaps.")
+DZL_DEFINE_COUNTER (mapped, "IdeCtagsIndex", "Mapped", "Number of indexes loaded from a mapped binary index.")
+
+/*
+ * The binary index is written to the user cache directory, named after a
+ * checksum of the path of the tags file, so that subsequent loads can simply
+ * mmap() the file instead of parsing and sorting the text format again.
+ * Regenerating the index replaces the previous file rather than adding a
+ * new one. We never write into the source tree or next to system tags files.
+ * The layout is:
+ *
+ *   IdeCtagsIndexHeader
+ *   IdeCtagsIndexRecord[n_records] (sorted by ide_ctags_index_entry_compare)
+ *   string heap (\0 terminated, de-duplicated strings)
+ *
+ * Records refer to strings by offset into the heap. The header contains
+ * the mtime and size of the tags file it was generated from so that we
+ * can detect when it is stale.
+ */
+#define INDEX_MAGIC        "IDECTAGS"
+#define INDEX_VERSION      1
+#define INDEX_NULL_STRING  G_MAXUINT32
+
+typedef struct
+{
+  gchar   magic[8];
+  guint32 version;
+  guint32 byte_order;
+  guint64 source_mtime;
+  guint64 source_size;
+  guint32 n_records;
+  guint32 heap_offset;
+  guint32 heap_length;
+  guint32 padding;
+} IdeCtagsIndexHeader;
+
+typedef struct
+{
+  guint32 name;
+  guint32 path;
+  guint32 pattern;
+  guint32 keyval;
+  guint8  kind;
+  guint8  padding[3];
+} IdeCtagsIndexRecord;
+
+G_STATIC_ASSERT (sizeof (IdeCtagsIndexHeader) == 48);
+G_STATIC_ASSERT (sizeof (IdeCtagsIndexRecord) == 20);
 
 static GParamSpec *properties [LAST_PROP];
 
@@ -123,6 +173,31 @@ forward_to_nontab_and_zero (gchar *iter)
   return *iter ? iter : NULL;
 }
 
+static inline gboolean
+ide_ctags_index_entry_kind_is_valid (gint kind)
+{
+  switch (kind)
+    {
+    case IDE_CTAGS_INDEX_ENTRY_ANCHOR:
+    case IDE_CTAGS_INDEX_ENTRY_CLASS_NAME:
+    case IDE_CTAGS_INDEX_ENTRY_DEFINE:
+    case IDE_CTAGS_INDEX_ENTRY_ENUMERATOR:
+    case IDE_CTAGS_INDEX_ENTRY_FUNCTION:
+    case IDE_CTAGS_INDEX_ENTRY_FILE_NAME:
+    case IDE_CTAGS_INDEX_ENTRY_ENUMERATION_NAME:
+    case IDE_CTAGS_INDEX_ENTRY_MEMBER:
+    case IDE_CTAGS_INDEX_ENTRY_PROTOTYPE:
+    case IDE_CTAGS_INDEX_ENTRY_STRUCTURE:
+    case IDE_CTAGS_INDEX_ENTRY_TYPEDEF:
+    case IDE_CTAGS_INDEX_ENTRY_UNION:
+    case IDE_CTAGS_INDEX_ENTRY_VARIABLE:
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
 static gboolean
 ide_ctags_index_parse_line (gchar              *line,
                             IdeCtagsIndexEntry *entry)
@@ -152,27 +227,8 @@ ide_ctags_index_parse_line (gchar              *line,
   if (!(iter = forward_to_nontab_and_zero (iter)))
     return FALSE;
 
-  switch (*iter)
-    {
-    case IDE_CTAGS_INDEX_ENTRY_ANCHOR:
-    case IDE_CTAGS_INDEX_ENTRY_CLASS_NAME:
-    case IDE_CTAGS_INDEX_ENTRY_DEFINE:
-    case IDE_CTAGS_INDEX_ENTRY_ENUMERATOR:
-    case IDE_CTAGS_INDEX_ENTRY_FUNCTION:
-    case IDE_CTAGS_INDEX_ENTRY_FILE_NAME:
-    case IDE_CTAGS_INDEX_ENTRY_ENUMERATION_NAME:
-    case IDE_CTAGS_INDEX_ENTRY_MEMBER:
-    case IDE_CTAGS_INDEX_ENTRY_PROTOTYPE:
-    case IDE_CTAGS_INDEX_ENTRY_STRUCTURE:
-    case IDE_CTAGS_INDEX_ENTRY_TYPEDEF:
-    case IDE_CTAGS_INDEX_ENTRY_UNION:
-    case IDE_CTAGS_INDEX_ENTRY_VARIABLE:
-      entry->kind = (IdeCtagsIndexEntryKind)*iter;
-      break;
-
-    default:
-      break;
-    }
+  if (ide_ctags_index_entry_kind_is_valid (*iter))
+    entry->kind = (IdeCtagsIndexEntryKind)*iter;
 
   /* Store a pointer to the beginning of the key/val pairs */
   if (NULL != (iter = forward_to_tab (iter)))
@@ -183,6 +239,242 @@ ide_ctags_index_parse_line (gchar              *line,
   return TRUE;
 }
 
+static gchar *
+ide_ctags_index_get_index_path (IdeCtagsIndex *self)
+{
+  g_autoptr(GChecksum) checksum = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *name = NULL;
+
+  g_assert (IDE_IS_CTAGS_INDEX (self));
+
+  if (!(path = g_file_get_path (self->file)))
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *)path, strlen (path));
+
+  name = g_strdup_printf ("%s.idx", g_checksum_get_string (checksum));
+
+  return g_build_filename (g_get_user_cache_dir (),
+                           ide_get_program_name (),
+                           "ctags",
+                           name,
+                           NULL);
+}
+
+static inline const gchar *
+heap_string (const gchar *heap,
+             guint32      heap_length,
+             guint32      offset,
+             gboolean    *valid)
+{
+  if (offset == INDEX_NULL_STRING)
+    return NULL;
+
+  if (offset >= heap_length)
+    {
+      *valid = FALSE;
+      return NULL;
+    }
+
+  return &heap [offset];
+}
+
+/*
+ * Tries to load the index from a previously written binary index. The
+ * string heap is used directly from the mapping, so the only work we do
+ * is a linear pass to resolve string offsets into entry pointers.
+ */
+static gboolean
+ide_ctags_index_load_mapped (IdeCtagsIndex *self,
+                             guint64        source_mtime,
+                             guint64        source_size)
+{
+  g_autoptr(GMappedFile) mapped_file = NULL;
+  g_autofree gchar *index_path = NULL;
+  const IdeCtagsIndexHeader *header;
+  const IdeCtagsIndexRecord *records;
+  const gchar *contents;
+  const gchar *heap;
+  GArray *index;
+  gboolean valid = TRUE;
+  gsize length;
+
+  g_assert (IDE_IS_CTAGS_INDEX (self));
+
+  if (!(index_path = ide_ctags_index_get_index_path (self)))
+    return FALSE;
+
+  if (!(mapped_file = g_mapped_file_new (index_path, FALSE, NULL)))
+    return FALSE;
+
+  contents = g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
+
+  if (contents == NULL || length < sizeof *header)
+    return FALSE;
+
+  header = (const IdeCtagsIndexHeader *)(gconstpointer)contents;
+
+  if (memcmp (header->magic, INDEX_MAGIC, sizeof header->magic) != 0 ||
+      header->version != INDEX_VERSION ||
+      header->byte_order != G_BYTE_ORDER ||
+      header->source_mtime != source_mtime ||
+      header->source_size != source_size)
+    return FALSE;
+
+  if (header->n_records > (length - sizeof *header) / sizeof *records ||
+      header->heap_offset < sizeof *header + (gsize)header->n_records * sizeof *records ||
+      (gsize)header->heap_offset + header->heap_length > length ||
+      header->heap_length == 0)
+    return FALSE;
+
+  records = (const IdeCtagsIndexRecord *)(gconstpointer)(contents + sizeof *header);
+  heap = contents + header->heap_offset;
+
+  /* Ensure strings cannot run off the end of the mapping */
+  if (heap [header->heap_length - 1] != '\0')
+    return FALSE;
+
+  index = g_array_sized_new (FALSE, FALSE, sizeof (IdeCtagsIndexEntry), header->n_records);
+  g_array_set_size (index, header->n_records);
+
+  for (guint i = 0; valid && i < header->n_records; i++)
+    {
+      const IdeCtagsIndexRecord *record = &records [i];
+      IdeCtagsIndexEntry *entry = &g_array_index (index, IdeCtagsIndexEntry, i);
+
+      memset (entry, 0, sizeof *entry);
+
+      entry->name = heap_string (heap, header->heap_length, record->name, &valid);
+      entry->path = heap_string (heap, header->heap_length, record->path, &valid);
+      entry->pattern = heap_string (heap, header->heap_length, record->pattern, &valid);
+      entry->keyval = heap_string (heap, header->heap_length, record->keyval, &valid);
+      entry->kind = (IdeCtagsIndexEntryKind)record->kind;
+
+      /* The parser stores 0 for kinds it does not know about */
+      if (record->kind != 0 && !ide_ctags_index_entry_kind_is_valid (record->kind))
+        valid = FALSE;
+
+      if (entry->name == NULL || entry->path == NULL || entry->pattern == NULL)
+        valid = FALSE;
+    }
+
+  if (!valid)
+    {
+      g_array_unref (index);
+      return FALSE;
+    }
+
+  self->index = index;
+  self->buffer = g_mapped_file_get_bytes (mapped_file);
+
+  DZL_COUNTER_INC (mapped);
+
+  return TRUE;
+}
+
+static guint32
+heap_intern (GByteArray  *heap,
+             GHashTable  *offsets,
+             const gchar *str)
+{
+  gpointer value;
+  guint32 offset;
+
+  if (str == NULL)
+    return INDEX_NULL_STRING;
+
+  if (g_hash_table_lookup_extended (offsets, str, NULL, &value))
+    return GPOINTER_TO_UINT (value);
+
+  offset = heap->len;
+  g_byte_array_append (heap, (const guint8 *)str, strlen (str) + 1);
+  g_hash_table_insert (offsets, (gpointer)str, GUINT_TO_POINTER (offset));
+
+  return offset;
+}
+
+/*
+ * Writes the sorted index to disk so that the next load of this tags
+ * file can skip parsing entirely. Failure is not fatal, we simply parse
+ * the tags file again next time.
+ */
+static void
+ide_ctags_index_write_mapped (IdeCtagsIndex *self,
+                              GArray        *index,
+                              guint64        source_mtime,
+                              guint64        source_size)
+{
+  g_autoptr(GByteArray) heap = NULL;
+  g_autoptr(GByteArray) data = NULL;
+  g_autoptr(GHashTable) offsets = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *index_path = NULL;
+  g_autofree gchar *index_dir = NULL;
+  IdeCtagsIndexHeader header = { { 0 } };
+  gsize heap_offset;
+
+  g_assert (IDE_IS_CTAGS_INDEX (self));
+  g_assert (index != NULL);
+
+  if (index->len == 0 || !(index_path = ide_ctags_index_get_index_path (self)))
+    return;
+
+  heap_offset = sizeof header + (gsize)index->len * sizeof (IdeCtagsIndexRecord);
+  if (heap_offset >= G_MAXUINT32)
+    return;
+
+  offsets = g_hash_table_new (g_str_hash, g_str_equal);
+  heap = g_byte_array_new ();
+  data = g_byte_array_sized_new (heap_offset);
+
+  memcpy (header.magic, INDEX_MAGIC, sizeof header.magic);
+  header.version = INDEX_VERSION;
+  header.byte_order = G_BYTE_ORDER;
+  header.source_mtime = source_mtime;
+  header.source_size = source_size;
+  header.n_records = index->len;
+  header.heap_offset = heap_offset;
+
+  g_byte_array_append (data, (const guint8 *)&header, sizeof header);
+
+  for (guint i = 0; i < index->len; i++)
+    {
+      const IdeCtagsIndexEntry *entry = &g_array_index (index, IdeCtagsIndexEntry, i);
+      IdeCtagsIndexRecord record = { 0 };
+
+      record.name = heap_intern (heap, offsets, entry->name);
+      record.path = heap_intern (heap, offsets, entry->path);
+      record.pattern = heap_intern (heap, offsets, entry->pattern);
+      record.keyval = heap_intern (heap, offsets, entry->keyval);
+      record.kind = (guint8)entry->kind;
+
+      g_byte_array_append (data, (const guint8 *)&record, sizeof record);
+    }
+
+  if (heap->len == 0 || heap->len > G_MAXUINT32 - heap_offset)
+    return;
+
+  /* Now that the heap is complete, patch its length into the header */
+  header.heap_length = heap->len;
+  memcpy (data->data, &header, sizeof header);
+
+  g_byte_array_append (data, heap->data, heap->len);
+
+  index_dir = g_path_get_dirname (index_path);
+
+  if (g_mkdir_with_parents (index_dir, 0750) != 0)
+    {
+      g_debug ("Failed to create ctags index directory %s", index_dir);
+      return;
+    }
+
+  if (!g_file_set_contents (index_path, (const gchar *)data->data, data->len, &error))
+    g_debug ("Failed to write ctags index %s: %s", index_path, error->message);
+}
+
 static void
 ide_ctags_index_build_index (GTask        *task,
                              gpointer      source_object,
@@ -190,11 +482,14 @@ ide_ctags_index_build_index (GTask        *task,
                              GCancellable *cancellable)
 {
   IdeCtagsIndex *self = source_object;
+  g_autoptr(GFileInfo) info = NULL;
   IdeLineReader reader;
   GError *error = NULL;
   GArray *index = NULL;
   gchar *contents = NULL;
   gchar *line;
+  guint64 source_mtime = 0;
+  guint64 source_size = 0;
   gsize length = 0;
   gsize line_length;
 
@@ -204,6 +499,32 @@ ide_ctags_index_build_index (GTask        *task,
   g_assert (IDE_IS_CTAGS_INDEX (self));
   g_assert (G_IS_FILE (self->file));
 
+  info = g_file_query_info (self->file,
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED","
+                            G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC","
+                            G_FILE_ATTRIBUTE_STANDARD_SIZE,
+                            G_FILE_QUERY_INFO_NONE,
+                            cancellable,
+                            NULL);
+
+  if (info != NULL)
+    {
+      /* Include usec so that rewrites within the same second are noticed */
+      source_mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+                   + g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+      source_size = g_file_info_get_size (info);
+
+      if (ide_ctags_index_load_mapped (self, source_mtime, source_size))
+        {
+          self->trie = ide_ctags_trie_new ((const IdeCtagsIndexEntry *)(gpointer)self->index->data,
+                                           self->index->len);
+          DZL_COUNTER_ADD (index_entries, (gint64)self->index->len);
+          DZL_COUNTER_ADD (heap_size, (gint64)g_bytes_get_size (self->buffer));
+          g_task_return_boolean (task, TRUE);
+          IDE_EXIT;
+        }
+    }
+
   if (!g_file_load_contents (self->file, cancellable, &contents, &length, NULL, &error))
     IDE_GOTO (failure);
 
@@ -239,7 +560,11 @@ ide_ctags_index_build_index (GTask        *task,
 
   g_array_sort (index, ide_ctags_index_entry_compare);
 
+  if (info != NULL)
+    ide_ctags_index_write_mapped (self, index, source_mtime, source_size);
+
   self->index = index;
+  self->trie = ide_ctags_trie_new ((const IdeCtagsIndexEntry *)(gpointer)index->data, index->len);
   self->buffer = g_bytes_new_take (contents, length);
 
   DZL_COUNTER_ADD (index_entries, (gint64)index->len);
@@ -366,8 +691,10 @@ ide_ctags_index_finalize (GObject *object)
     }
 
   g_clear_object (&self->file);
+  g_clear_pointer (&self->trie, ide_ctags_trie_free);
   g_clear_pointer (&self->index, g_array_unref);
   g_clear_pointer (&self->buffer, g_bytes_unref);
+  g_clear_pointer (&self->shared_buffers, g_ptr_array_unref);
   g_clear_pointer (&self->path_root, g_free);
 
   G_OBJECT_CLASS (ide_ctags_index_parent_class)->finalize (object);
@@ -625,6 +952,173 @@ ide_ctags_index_lookup_prefix (IdeCtagsIndex *self,
                                       ide_ctags_index_entry_compare_prefix);
 }
 
+/**
+ * ide_ctags_index_splice:
+ * @self: An #IdeCtagsIndex
+ * @relative_path: the path of the file, as found in the tags file
+ * @tags: the ctags output for just @relative_path
+ *
+ * Creates a new index containing the contents of @self with all of the
+ * entries for @relative_path replaced by those found in @tags. This allows
+ * updating the index after a file is saved without regenerating and
+ * reloading the tags for the whole directory.
+ *
+ * The new index shares the string heaps of @self, so this is a linear
+ * merge of two sorted arrays rather than a reparse. The directory should
+ * be regenerated eventually so that the shared heaps can be released.
+ *
+ * Returns: (transfer full): A new, already initialized #IdeCtagsIndex.
+ */
+IdeCtagsIndex *
+ide_ctags_index_splice (IdeCtagsIndex *self,
+                        const gchar   *relative_path,
+                        GBytes        *tags)
+{
+  IdeCtagsIndex *ret;
+  IdeLineReader reader;
+  GArray *delta;
+  GArray *merged;
+  const gchar *data;
+  gchar *contents;
+  gchar *line;
+  gsize length = 0;
+  gsize line_length;
+  guint i = 0;
+  guint j = 0;
+
+  g_return_val_if_fail (IDE_IS_CTAGS_INDEX (self), NULL);
+  g_return_val_if_fail (relative_path != NULL, NULL);
+  g_return_val_if_fail (tags != NULL, NULL);
+
+  /* Extra byte so the last line can always be \0 terminated in place */
+  data = g_bytes_get_data (tags, &length);
+  contents = g_malloc (length + 1);
+  memcpy (contents, data, length);
+  contents [length] = '\0';
+
+  delta = g_array_new (FALSE, FALSE, sizeof (IdeCtagsIndexEntry));
+
+  ide_line_reader_init (&reader, contents, length);
+
+  while ((line = ide_line_reader_next (&reader, &line_length)))
+    {
+      IdeCtagsIndexEntry entry;
+
+      if (line [0] == '!')
+        continue;
+
+      line [line_length] = '\0';
+
+      if (ide_ctags_index_parse_line (line, &entry))
+        g_array_append_val (delta, entry);
+    }
+
+  g_array_sort (delta, ide_ctags_index_entry_compare);
+
+  merged = g_array_sized_new (FALSE, FALSE, sizeof (IdeCtagsIndexEntry),
+                              ide_ctags_index_get_size (self) + delta->len);
+
+  if (self->index != NULL)
+    {
+      while (i < self->index->len || j < delta->len)
+        {
+          const IdeCtagsIndexEntry *base = NULL;
+          const IdeCtagsIndexEntry *replace = NULL;
+
+          if (i < self->index->len)
+            {
+              base = &g_array_index (self->index, IdeCtagsIndexEntry, i);
+
+              /* Drop the stale entries for the file */
+              if (g_str_equal (base->path, relative_path))
+                {
+                  i++;
+                  continue;
+                }
+            }
+
+          if (j < delta->len)
+            replace = &g_array_index (delta, IdeCtagsIndexEntry, j);
+
+          if (replace == NULL ||
+              (base != NULL && ide_ctags_index_entry_compare (base, replace) <= 0))
+            {
+              g_array_append_vals (merged, base, 1);
+              i++;
+            }
+          else
+            {
+              g_array_append_vals (merged, replace, 1);
+              j++;
+            }
+        }
+    }
+  else
+    {
+      g_array_append_vals (merged, delta->data, delta->len);
+    }
+
+  g_array_unref (delta);
+
+  ret = ide_ctags_index_new (self->file, self->path_root, self->mtime);
+  ret->index = merged;
+  ret->trie = ide_ctags_trie_new ((const IdeCtagsIndexEntry *)(gpointer)merged->data, merged->len);
+  ret->buffer = g_bytes_new_take (contents, length + 1);
+
+  /* Keep the heaps of the previous index alive, we point into them */
+  ret->shared_buffers = g_ptr_array_new_with_free_func ((GDestroyNotify)g_bytes_unref);
+  if (self->shared_buffers != NULL)
+    {
+      for (guint k = 0; k < self->shared_buffers->len; k++)
+        g_ptr_array_add (ret->shared_buffers,
+                         g_bytes_ref (g_ptr_array_index (self->shared_buffers, k)));
+    }
+  if (self->buffer != NULL)
+    g_ptr_array_add (ret->shared_buffers, g_bytes_ref (self->buffer));
+
+  DZL_COUNTER_ADD (index_entries, (gint64)merged->len);
+  DZL_COUNTER_ADD (heap_size, (gint64)length + 1);
+
+  return ret;
+}
+
+/**
+ * ide_ctags_index_lookup_fuzzy:
+ * @self: An #IdeCtagsIndex
+ * @word: the word to complete
+ * @casefold: g_utf8_casefold() of @word
+ * @matches: (element-type IdeCtagsIndexMatch): an array to append to
+ *
+ * Appends an #IdeCtagsIndexMatch to @matches for every unique name which
+ * shares the longest available prefix with @word and fuzzy matches
+ * @casefold. Matches are appended in sorted order, so results from
+ * multiple indexes can be merged with ide_ctags_index_match_compare().
+ */
+void
+ide_ctags_index_lookup_fuzzy (IdeCtagsIndex *self,
+                              const gchar   *word,
+                              const gchar   *casefold,
+                              GArray        *matches)
+{
+  g_return_if_fail (IDE_IS_CTAGS_INDEX (self));
+  g_return_if_fail (word != NULL);
+  g_return_if_fail (casefold != NULL);
+  g_return_if_fail (matches != NULL);
+
+  if (self->trie != NULL)
+    ide_ctags_trie_lookup_fuzzy (self->trie, word, casefold, matches);
+}
+
+gint
+ide_ctags_index_match_compare (gconstpointer a,
+                               gconstpointer b)
+{
+  const IdeCtagsIndexMatch *matcha = a;
+  const IdeCtagsIndexMatch *matchb = b;
+
+  return g_strcmp0 (matcha->entries->name, matchb->entries->name);
+}
+
 void
 _ide_ctags_index_register_type (GTypeModule *module)
 {
@@ -639,6 +1133,21 @@ ide_ctags_index_get_mtime (IdeCtagsIndex *self)
   return self->mtime;
 }
 
+/**
+ * ide_ctags_index_get_n_splices:
+ * @self: An #IdeCtagsIndex
+ *
+ * Gets the number of splices since the index was last loaded from a tags
+ * file, which is also the number of previous heaps @self keeps alive.
+ */
+guint
+ide_ctags_index_get_n_splices (IdeCtagsIndex *self)
+{
+  g_return_val_if_fail (IDE_IS_CTAGS_INDEX (self), 0);
+
+  return self->shared_buffers != NULL ? self->shared_buffers->len : 0;
+}
+
 /**
  * ide_ctags_index_find_with_path:
  * @self: A #IdeCtagsIndex
@@ -55,6 +55,13 @@ typedef struct
   guint8                  padding[3];
 } IdeCtagsIndexEntry;
 
+typedef struct
+{
+  /* All entries sharing a single name, contiguous in the index */
+  const IdeCtagsIndexEntry *entries;
+  guint                     n_entries;
+} IdeCtagsIndexMatch;
+
 IdeCtagsIndex            *ide_ctags_index_new           (GFile                    *file,
                                                          const gchar              *path_root,
                                                          guint64                   mtime);
@@ -80,11 +87,21 @@ const IdeCtagsIndexEntry *ide_ctags_index_lookup        (IdeCtagsIndex
 const IdeCtagsIndexEntry *ide_ctags_index_lookup_prefix (IdeCtagsIndex            *self,
                                                          const gchar              *keyword,
                                                          gsize                    *length);
+void                      ide_ctags_index_lookup_fuzzy  (IdeCtagsIndex            *self,
+                                                         const gchar              *word,
+                                                         const gchar              *casefold,
+                                                         GArray                   *matches);
 guint64                   ide_ctags_index_get_mtime     (IdeCtagsIndex            *self);
+guint                     ide_ctags_index_get_n_splices (IdeCtagsIndex            *self);
+IdeCtagsIndex            *ide_ctags_index_splice        (IdeCtagsIndex            *self,
+                                                         const gchar              *relative_path,
+                                                         GBytes                   *tags);
 gint                      ide_ctags_index_entry_compare (gconstpointer             a,
                                                          gconstpointer             b);
 IdeCtagsIndexEntry       *ide_ctags_index_entry_copy    (const IdeCtagsIndexEntry *entry);
 void                      ide_ctags_index_entry_free    (IdeCtagsIndexEntry       *entry);
+gint                      ide_ctags_index_match_compare (gconstpointer             a,
+                                                         gconstpointer             b);
 
 static inline IdeSymbolKind
 ide_ctags_index_entry_kind_to_symbol_kind (IdeCtagsIndexEntryKind kind)
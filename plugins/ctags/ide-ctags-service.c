@@ -49,6 +49,17 @@ typedef struct
   guint  recursive;
 } MineInfo;
 
+/*
+ * After a save we splice the tags for just that file into the index, and
+ * then regenerate the whole directory COMPACT_DELAY_SECONDS after the last
+ * splice so that the on-disk tags catch up and the spliced index can be
+ * released. Each splice keeps the previous heaps alive, so once MAX_SPLICES
+ * is reached we stop splicing and regenerate the directory right away.
+ */
+#define BUILD_DELAY_SECONDS   5
+#define COMPACT_DELAY_SECONDS 60
+#define MAX_SPLICES           16
+
 static void service_iface_init (IdeServiceInterface *iface);
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED (IdeCtagsService, ide_ctags_service, IDE_TYPE_OBJECT, 0,
@@ -168,6 +179,26 @@ ide_ctags_service_build_index_cb (DzlTaskCache  *cache,
   IDE_EXIT;
 }
 
+static void
+ide_ctags_service_publish_index (IdeCtagsService *self,
+                                 IdeCtagsIndex   *index)
+{
+  g_assert (IDE_IS_CTAGS_SERVICE (self));
+  g_assert (IDE_IS_CTAGS_INDEX (index));
+
+  for (guint i = 0; i < self->highlighters->len; i++)
+    {
+      IdeCtagsHighlighter *highlighter = g_ptr_array_index (self->highlighters, i);
+      ide_ctags_highlighter_add_index (highlighter, index);
+    }
+
+  for (guint i = 0; i < self->completions->len; i++)
+    {
+      IdeCtagsCompletionProvider *provider = g_ptr_array_index (self->completions, i);
+      ide_ctags_completion_provider_add_index (provider, index);
+    }
+}
+
 static void
 ide_ctags_service_tags_loaded_cb (GObject      *object,
                                   GAsyncResult *result,
@@ -177,7 +208,6 @@ ide_ctags_service_tags_loaded_cb (GObject      *object,
   g_autoptr(IdeCtagsService) self = user_data;
   g_autoptr(IdeCtagsIndex) index = NULL;
   GError *error = NULL;
-  gsize i;
 
   IDE_ENTRY;
 
@@ -197,17 +227,7 @@ ide_ctags_service_tags_loaded_cb (GObject      *object,
 
   g_assert (IDE_IS_CTAGS_INDEX (index));
 
-  for (i = 0; i < self->highlighters->len; i++)
-    {
-      IdeCtagsHighlighter *highlighter = g_ptr_array_index (self->highlighters, i);
-      ide_ctags_highlighter_add_index (highlighter, index);
-    }
-
-  for (i = 0; i < self->completions->len; i++)
-    {
-      IdeCtagsCompletionProvider *provider = g_ptr_array_index (self->completions, i);
-      ide_ctags_completion_provider_add_index (provider, index);
-    }
+  ide_ctags_service_publish_index (self, index);
 
   IDE_EXIT;
 }
@@ -458,12 +478,22 @@ build_system_tags_cb (GObject      *object,
   ide_ctags_service_queue_mine (self);
 }
 
+static void
+restart_miner_data_free (gpointer user_data)
+{
+  gpointer *data = user_data;
+
+  g_object_unref (data[0]);
+  g_object_unref (data[1]);
+  g_free (data);
+}
+
 static gboolean
 restart_miner (gpointer user_data)
 {
-  g_autofree gpointer *data = user_data;
-  g_autoptr(IdeCtagsService) self = data[0];
-  g_autoptr(GFile) directory = data[1];
+  gpointer *data = user_data;
+  IdeCtagsService *self = data[0];
+  GFile *directory = data[1];
   g_autoptr(IdeTagsBuilder) tags_builder = NULL;
   IdeBuildSystem *build_system;
   IdeContext *context;
@@ -496,26 +526,89 @@ restart_miner (gpointer user_data)
 
 static void
 ide_ctags_service_queue_build_for_directory (IdeCtagsService *self,
-                                             GFile           *directory)
+                                             GFile           *directory,
+                                             guint            delay_seconds)
 {
+  gpointer *data;
+  guint source_id;
+
   g_assert (IDE_IS_CTAGS_SERVICE (self));
   g_assert (G_IS_FILE (directory));
 
-  if (!g_hash_table_lookup (self->build_timeout_by_dir, directory))
-    {
-      gpointer *data;
-      guint source_id;
+  /* Push back any pending build, so the delay counts from the last request */
+  if ((source_id = GPOINTER_TO_UINT (g_hash_table_lookup (self->build_timeout_by_dir, directory))))
+    g_source_remove (source_id);
+
+  data = g_new0 (gpointer, 2);
+  data[0] = g_object_ref (self);
+  data[1] = g_object_ref (directory);
+
+  source_id = g_timeout_add_seconds_full (G_PRIORITY_DEFAULT,
+                                          delay_seconds,
+                                          restart_miner,
+                                          data,
+                                          restart_miner_data_free);
+
+  g_hash_table_insert (self->build_timeout_by_dir,
+                       g_object_ref (directory),
+                       GUINT_TO_POINTER (source_id));
+}
+
+static void
+ide_ctags_service_build_file_cb (GObject      *object,
+                                 GAsyncResult *result,
+                                 gpointer      user_data)
+{
+  IdeCtagsBuilder *builder = (IdeCtagsBuilder *)object;
+  g_autofree gpointer *data = user_data;
+  g_autoptr(IdeCtagsService) self = data[0];
+  g_autoptr(GFile) file = data[1];
+  g_autoptr(IdeCtagsIndex) spliced = NULL;
+  g_autoptr(GBytes) tags = NULL;
+  g_autoptr(GFile) parent = NULL;
+  g_autoptr(GFile) tags_file = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *name = NULL;
+  IdeCtagsIndex *index;
+
+  IDE_ENTRY;
+
+  g_assert (IDE_IS_CTAGS_BUILDER (builder));
+  g_assert (IDE_IS_CTAGS_SERVICE (self));
+  g_assert (G_IS_FILE (file));
 
-      data = g_new0 (gpointer, 2);
-      data[0] = g_object_ref (self);
-      data[1] = g_object_ref (directory);
+  parent = g_file_get_parent (file);
+  tags_file = ide_ctags_builder_get_tags_file (builder, parent);
 
-      source_id = g_timeout_add_seconds (5, restart_miner, data);
+  /*
+   * If we failed, or have not loaded tags for this directory yet, there
+   * is nothing to splice into. Fallback to rebuilding the directory.
+   */
+  if (!(tags = ide_ctags_builder_build_file_finish (builder, result, &error)) ||
+      !(index = dzl_task_cache_peek (self->indexes, tags_file)))
+    {
+      if (error != NULL)
+        g_debug ("%s", error->message);
+      ide_ctags_service_queue_build_for_directory (self, parent, BUILD_DELAY_SECONDS);
+      IDE_EXIT;
+    }
 
-      g_hash_table_insert (self->build_timeout_by_dir,
-                           g_object_ref (directory),
-                           GUINT_TO_POINTER (source_id));
+  /* Don't let the chain of shared heaps grow without bound */
+  if (ide_ctags_index_get_n_splices (index) >= MAX_SPLICES)
+    {
+      ide_ctags_service_queue_build_for_directory (self, parent, BUILD_DELAY_SECONDS);
+      IDE_EXIT;
     }
+
+  name = g_file_get_basename (file);
+  spliced = ide_ctags_index_splice (index, name, tags);
+
+  dzl_task_cache_insert (self->indexes, tags_file, spliced);
+  ide_ctags_service_publish_index (self, spliced);
+
+  ide_ctags_service_queue_build_for_directory (self, parent, COMPACT_DELAY_SECONDS);
+
+  IDE_EXIT;
 }
 
 static void
@@ -524,6 +617,11 @@ ide_ctags_service_buffer_saved (IdeCtagsService  *self,
                                 IdeBufferManager *buffer_manager)
 {
   g_autoptr(GFile) parent = NULL;
+  g_autoptr(IdeTagsBuilder) tags_builder = NULL;
+  IdeBuildSystem *build_system;
+  IdeContext *context;
+  GFile *file;
+  gpointer *data;
 
   IDE_ENTRY;
 
@@ -531,8 +629,31 @@ ide_ctags_service_buffer_saved (IdeCtagsService  *self,
   g_assert (IDE_IS_BUFFER (buffer));
   g_assert (IDE_IS_BUFFER_MANAGER (buffer_manager));
 
-  parent = g_file_get_parent (ide_file_get_file (ide_buffer_get_file (buffer)));
-  ide_ctags_service_queue_build_for_directory (self, parent);
+  context = ide_object_get_context (IDE_OBJECT (self));
+  build_system = ide_context_get_build_system (context);
+  file = ide_file_get_file (ide_buffer_get_file (buffer));
+
+  /*
+   * We only know how to splice tags generated by our own builder. If the
+   * build system generates tags itself, rebuild the whole directory.
+   */
+  if (IDE_IS_TAGS_BUILDER (build_system))
+    {
+      parent = g_file_get_parent (file);
+      ide_ctags_service_queue_build_for_directory (self, parent, BUILD_DELAY_SECONDS);
+      IDE_EXIT;
+    }
+
+  data = g_new0 (gpointer, 2);
+  data[0] = g_object_ref (self);
+  data[1] = g_object_ref (file);
+
+  tags_builder = ide_ctags_builder_new (context);
+  ide_ctags_builder_build_file_async (IDE_CTAGS_BUILDER (tags_builder),
+                                      file,
+                                      self->cancellable,
+                                      ide_ctags_service_build_file_cb,
+                                      data);
 
   IDE_EXIT;
 }
@@ -564,7 +685,7 @@ ide_ctags_service_context_loaded (IdeService *service)
    * Then we do incrementals from there on out.
    */
   self->needs_recursive_mine = TRUE;
-  ide_ctags_service_queue_build_for_directory (self, workdir);
+  ide_ctags_service_queue_build_for_directory (self, workdir, BUILD_DELAY_SECONDS);
 
   IDE_EXIT;
 }
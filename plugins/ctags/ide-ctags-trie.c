@@ -0,0 +1,328 @@
+/* ide-ctags-trie.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-ctags-trie"
+
+#include <dazzle.h>
+#include <string.h>
+
+#include "ide-ctags-trie.h"
+
+/*
+ * IdeCtagsTrie is a compressed (radix) trie over the unique symbol names
+ * of an index. Since the index entries are already sorted by name, every
+ * node covers a contiguous range of unique names and the edge labels can
+ * simply point into the name of the first entry in that range. That keeps
+ * the structure to a couple of flat arrays of integers with no string
+ * copies at all.
+ *
+ * Fuzzy (subsequence) queries walk the trie so that shared prefixes are
+ * only examined once, and as soon as the needle has been consumed the
+ * whole subtree is emitted without looking at it.
+ */
+
+typedef struct
+{
+  /* Offset into the name where our edge label begins */
+  guint32 depth;
+  /* Length of the edge label */
+  guint32 length;
+  /* Range of unique names [first,last) below this node */
+  guint32 first;
+  guint32 last;
+  /* Children are stored contiguously, sorted by first byte */
+  guint32 first_child;
+  guint32 n_children;
+} IdeCtagsTrieNode;
+
+struct _IdeCtagsTrie
+{
+  const IdeCtagsIndexEntry *entries;
+  /* Index of the first entry for each unique name, plus a sentinel */
+  GArray                   *names;
+  GArray                   *nodes;
+};
+
+DZL_DEFINE_COUNTER (trie_nodes, "IdeCtagsTrie", "Nodes", "Number of nodes in ctags tries.")
+
+static inline const gchar *
+get_name (IdeCtagsTrie *self,
+          guint32       name)
+{
+  return self->entries [g_array_index (self->names, guint32, name)].name;
+}
+
+static inline const IdeCtagsTrieNode *
+get_node (IdeCtagsTrie *self,
+          guint32       node)
+{
+  return &g_array_index (self->nodes, IdeCtagsTrieNode, node);
+}
+
+static inline gboolean
+char_matches (gchar haystack,
+              gchar casefold_needle)
+{
+  /* Same approximation as ide_completion_item_fuzzy_match() */
+  return haystack == casefold_needle || haystack == g_ascii_toupper (casefold_needle);
+}
+
+static void
+ide_ctags_trie_build_node (IdeCtagsTrie *self,
+                           guint32       node_index,
+                           guint32       first,
+                           guint32       last,
+                           guint32       depth)
+{
+  IdeCtagsTrieNode *node;
+  const gchar *lo = get_name (self, first);
+  const gchar *hi = get_name (self, last - 1);
+  guint32 n_children = 0;
+  guint32 first_child;
+  guint32 child;
+  guint32 end;
+  guint32 i;
+
+  g_assert (first < last);
+
+  /*
+   * The edge label is the longest common prefix of the range. Since the
+   * names are sorted, that is the common prefix of the first and last.
+   */
+  for (end = depth; lo [end] != '\0' && lo [end] == hi [end]; end++)
+    { /* Do Nothing */ }
+
+  /* Only the first name can terminate here, as names are unique */
+  child = (lo [end] == '\0') ? first + 1 : first;
+
+  for (i = child; i < last; i++)
+    {
+      if (i == child || get_name (self, i)[end] != get_name (self, i - 1)[end])
+        n_children++;
+    }
+
+  first_child = self->nodes->len;
+  g_array_set_size (self->nodes, self->nodes->len + n_children);
+
+  node = &g_array_index (self->nodes, IdeCtagsTrieNode, node_index);
+  node->depth = depth;
+  node->length = end - depth;
+  node->first = first;
+  node->last = last;
+  node->first_child = first_child;
+  node->n_children = n_children;
+
+  /* Now recurse into each group of names sharing the next byte */
+  for (i = 0; i < n_children; i++)
+    {
+      guint32 group_end = child + 1;
+      gchar ch = get_name (self, child)[end];
+
+      while (group_end < last && get_name (self, group_end)[end] == ch)
+        group_end++;
+
+      ide_ctags_trie_build_node (self, first_child + i, child, group_end, end);
+
+      child = group_end;
+    }
+}
+
+/**
+ * ide_ctags_trie_new:
+ * @entries: (array length=n_entries): entries sorted by name
+ * @n_entries: the number of entries
+ *
+ * Creates a new trie over the unique names found in @entries. @entries
+ * must remain valid for the lifetime of the trie.
+ */
+IdeCtagsTrie *
+ide_ctags_trie_new (const IdeCtagsIndexEntry *entries,
+                    guint                     n_entries)
+{
+  IdeCtagsTrie *self;
+  guint32 sentinel = n_entries;
+
+  g_return_val_if_fail (entries != NULL || n_entries == 0, NULL);
+
+  self = g_slice_new0 (IdeCtagsTrie);
+  self->entries = entries;
+  self->names = g_array_new (FALSE, FALSE, sizeof (guint32));
+  self->nodes = g_array_new (FALSE, TRUE, sizeof (IdeCtagsTrieNode));
+
+  for (guint32 i = 0; i < n_entries; i++)
+    {
+      if (i == 0 || !g_str_equal (entries [i].name, entries [i - 1].name))
+        g_array_append_val (self->names, i);
+    }
+
+  if (self->names->len > 0)
+    {
+      guint32 n_names = self->names->len;
+
+      g_array_append_val (self->names, sentinel);
+      g_array_set_size (self->nodes, 1);
+      ide_ctags_trie_build_node (self, 0, 0, n_names, 0);
+    }
+
+  DZL_COUNTER_ADD (trie_nodes, self->nodes->len);
+
+  return self;
+}
+
+void
+ide_ctags_trie_free (IdeCtagsTrie *self)
+{
+  if (self != NULL)
+    {
+      DZL_COUNTER_SUB (trie_nodes, self->nodes->len);
+
+      g_clear_pointer (&self->names, g_array_unref);
+      g_clear_pointer (&self->nodes, g_array_unref);
+      g_slice_free (IdeCtagsTrie, self);
+    }
+}
+
+guint
+ide_ctags_trie_get_n_names (IdeCtagsTrie *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  /* Account for the sentinel */
+  return self->names->len ? self->names->len - 1 : 0;
+}
+
+static void
+ide_ctags_trie_emit (IdeCtagsTrie           *self,
+                     const IdeCtagsTrieNode *node,
+                     GArray                 *matches)
+{
+  for (guint32 i = node->first; i < node->last; i++)
+    {
+      guint32 begin = g_array_index (self->names, guint32, i);
+      guint32 end = g_array_index (self->names, guint32, i + 1);
+      IdeCtagsIndexMatch match;
+
+      match.entries = &self->entries [begin];
+      match.n_entries = end - begin;
+
+      g_array_append_val (matches, match);
+    }
+}
+
+static void
+ide_ctags_trie_visit_fuzzy (IdeCtagsTrie           *self,
+                            const IdeCtagsTrieNode *node,
+                            guint32                 offset,
+                            const gchar            *needle,
+                            GArray                 *matches)
+{
+  const gchar *label = get_name (self, node->first);
+  guint32 end = node->depth + node->length;
+
+  for (guint32 i = node->depth + offset; *needle && i < end; i++)
+    {
+      if (char_matches (label [i], *needle))
+        needle++;
+    }
+
+  if (*needle == '\0')
+    {
+      ide_ctags_trie_emit (self, node, matches);
+      return;
+    }
+
+  for (guint32 i = 0; i < node->n_children; i++)
+    ide_ctags_trie_visit_fuzzy (self, get_node (self, node->first_child + i), 0, needle, matches);
+}
+
+/**
+ * ide_ctags_trie_lookup_fuzzy:
+ * @self: an #IdeCtagsTrie
+ * @word: the word being completed
+ * @casefold: g_utf8_casefold() of @word
+ * @matches: (element-type IdeCtagsIndexMatch): an array to append to
+ *
+ * Locates the names sharing the longest possible literal prefix with
+ * @word and then appends each of those which contains @casefold as a
+ * subsequence to @matches, in sorted order.
+ */
+void
+ide_ctags_trie_lookup_fuzzy (IdeCtagsTrie *self,
+                             const gchar  *word,
+                             const gchar  *casefold,
+                             GArray       *matches)
+{
+  const IdeCtagsTrieNode *node;
+  const gchar *needle = casefold;
+  guint32 offset = 0;
+  guint32 p = 0;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (word != NULL);
+  g_return_if_fail (casefold != NULL);
+  g_return_if_fail (matches != NULL);
+
+  if (self->nodes->len == 0)
+    return;
+
+  node = get_node (self, 0);
+
+  /* Walk down the literal prefix as far as the trie allows */
+  for (;;)
+    {
+      const gchar *label = get_name (self, node->first);
+      const IdeCtagsTrieNode *next = NULL;
+
+      for (offset = 0;
+           offset < node->length && word [p] != '\0' && label [node->depth + offset] == word [p];
+           offset++, p++)
+        { /* Do Nothing */ }
+
+      if (offset < node->length || word [p] == '\0')
+        break;
+
+      for (guint32 i = 0; i < node->n_children; i++)
+        {
+          const IdeCtagsTrieNode *child = get_node (self, node->first_child + i);
+
+          if (get_name (self, child->first)[child->depth] == word [p])
+            {
+              next = child;
+              break;
+            }
+        }
+
+      if (next == NULL)
+        break;
+
+      node = next;
+    }
+
+  /* Nothing shares even the first character */
+  if (p == 0)
+    return;
+
+  /* The literal prefix is shared by everything below, consume it */
+  for (guint32 i = 0; i < p && *needle; i++)
+    {
+      if (char_matches (word [i], *needle))
+        needle++;
+    }
+
+  ide_ctags_trie_visit_fuzzy (self, node, offset, needle, matches);
+}
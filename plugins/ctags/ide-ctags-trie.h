@@ -0,0 +1,41 @@
+/* ide-ctags-trie.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_CTAGS_TRIE_H
+#define IDE_CTAGS_TRIE_H
+
+#include "ide-ctags-index.h"
+
+G_BEGIN_DECLS
+
+typedef struct _IdeCtagsTrie IdeCtagsTrie;
+
+IdeCtagsTrie *ide_ctags_trie_new          (const IdeCtagsIndexEntry *entries,
+                                           guint                     n_entries);
+void          ide_ctags_trie_free         (IdeCtagsTrie             *self);
+guint         ide_ctags_trie_get_n_names  (IdeCtagsTrie             *self);
+void          ide_ctags_trie_lookup_fuzzy (IdeCtagsTrie             *self,
+                                           const gchar              *word,
+                                           const gchar              *casefold,
+                                           GArray                   *matches);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeCtagsTrie, ide_ctags_trie_free)
+
+G_END_DECLS
+
+#endif /* IDE_CTAGS_TRIE_H */
@@ -18,11 +18,19 @@
 
 #define G_LOG_DOMAIN "gb-file-search-index"
 
+#include <errno.h>
 #include <glib/gi18n.h>
 #include <ide.h>
 
 #include "gb-file-search-index.h"
 #include "gb-file-search-result.h"
+#include "gb-file-search-walker.h"
+
+#define CACHE_VERSION      1
+#define CACHE_FORMAT       "(usa(stas))"
+#define MAX_MONITORS       4096
+#define MONITORS_PER_IDLE  64
+#define SAVE_DELAY_SECONDS 5
 
 struct _GbFileSearchIndex
 {
@@ -30,8 +38,53 @@ struct _GbFileSearchIndex
 
   GFile                *root_directory;
   DzlFuzzyMutableIndex *fuzzy;
+  IdeProgress          *progress;
+  GCancellable         *cancellable;
+
+  /*
+   * Maps the relative path of every indexed directory ("" for the root)
+   * to a DirectoryInfo. This is what gets persisted to the cache and
+   * what we diff against when validating a cache on the next load.
+   */
+  GHashTable           *directories;
+
+  /* Location of the on-disk cache and the VCS state it belongs to. */
+  gchar                *cache_path;
+  gchar                *vcs_stamp;
+
+  /* The cache we loaded from, kept until it has been validated. */
+  GVariant             *cache;
+
+  /* Relative paths of directories still waiting for a GFileMonitor. */
+  GQueue                monitor_queue;
+  guint                 n_monitors;
+
+  guint                 monitor_source;
+  guint                 save_source;
 };
 
+typedef struct
+{
+  gchar        *relpath;
+  GHashTable   *names;
+  GFileMonitor *monitor;
+  guint64       mtime;
+} DirectoryInfo;
+
+typedef struct
+{
+  gchar   *relpath;
+  guint64  mtime;
+} DirectoryStamp;
+
+typedef struct
+{
+  GPtrArray *added;
+  GPtrArray *removed;
+  GPtrArray *removed_dirs;
+  GArray    *dirs;
+} ChangeSet;
+
 G_DEFINE_TYPE (GbFileSearchIndex, gb_file_search_index, IDE_TYPE_OBJECT)
 
 enum {
@@ -42,6 +95,237 @@ enum {
 
 static GParamSpec *properties [LAST_PROP];
 
+static void     gb_file_search_index_queue_save  (GbFileSearchIndex  *self);
+static gboolean gb_file_search_index_write_cache (GbFileSearchIndex  *self,
+                                                  GError            **error);
+static void     gb_file_search_index_walk_async  (GbFileSearchIndex  *self,
+                                                  const gchar        *relative_path);
+
+static void
+directory_info_free (gpointer data)
+{
+  DirectoryInfo *info = data;
+
+  if (info->monitor != NULL)
+    {
+      g_file_monitor_cancel (info->monitor);
+      g_clear_object (&info->monitor);
+    }
+
+  g_clear_pointer (&info->names, g_hash_table_unref);
+  g_clear_pointer (&info->relpath, g_free);
+  g_slice_free (DirectoryInfo, info);
+}
+
+static void
+directory_stamp_clear (gpointer data)
+{
+  DirectoryStamp *stamp = data;
+
+  g_clear_pointer (&stamp->relpath, g_free);
+}
+
+static ChangeSet *
+change_set_new (void)
+{
+  ChangeSet *changes;
+
+  changes = g_slice_new0 (ChangeSet);
+  changes->added = g_ptr_array_new_with_free_func (g_free);
+  changes->removed = g_ptr_array_new_with_free_func (g_free);
+  changes->removed_dirs = g_ptr_array_new_with_free_func (g_free);
+  changes->dirs = g_array_new (FALSE, FALSE, sizeof (DirectoryStamp));
+  g_array_set_clear_func (changes->dirs, directory_stamp_clear);
+
+  return changes;
+}
+
+static void
+change_set_free (gpointer data)
+{
+  ChangeSet *changes = data;
+
+  g_clear_pointer (&changes->added, g_ptr_array_unref);
+  g_clear_pointer (&changes->removed, g_ptr_array_unref);
+  g_clear_pointer (&changes->removed_dirs, g_ptr_array_unref);
+  g_clear_pointer (&changes->dirs, g_array_unref);
+  g_slice_free (ChangeSet, changes);
+}
+
+static void
+change_set_add_directory (ChangeSet   *changes,
+                          const gchar *relative_path,
+                          guint64      mtime)
+{
+  DirectoryStamp stamp = { g_strdup (relative_path), mtime };
+
+  g_array_append_val (changes->dirs, stamp);
+}
+
+static void
+change_set_walk_directory (const gchar *relative_path,
+                           guint64      mtime,
+                           gpointer     user_data)
+{
+  change_set_add_directory (user_data, relative_path, mtime);
+}
+
+static void
+change_set_walk_batch (const gchar * const *paths,
+                       guint                n_paths,
+                       gpointer             user_data)
+{
+  ChangeSet *changes = user_data;
+
+  for (guint i = 0; i < n_paths; i++)
+    g_ptr_array_add (changes->added, g_strdup (paths [i]));
+}
+
+static gchar *
+build_relative_path (const gchar *directory,
+                     const gchar *name)
+{
+  if (directory == NULL || *directory == '\0')
+    return g_strdup (name);
+  return g_build_filename (directory, name, NULL);
+}
+
+static gchar *
+get_relative_dirname (const gchar *relative_path)
+{
+  gchar *dirname = g_path_get_dirname (relative_path);
+
+  if (g_str_equal (dirname, "."))
+    {
+      g_free (dirname);
+      return g_strdup ("");
+    }
+
+  return dirname;
+}
+
+static GFile *
+get_directory (GbFileSearchIndex *self,
+               const gchar       *relative_path)
+{
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  if (*relative_path == '\0')
+    return g_object_ref (self->root_directory);
+
+  return g_file_resolve_relative_path (self->root_directory, relative_path);
+}
+
+static DirectoryInfo *
+gb_file_search_index_ensure_directory (GbFileSearchIndex *self,
+                                       const gchar       *relative_path)
+{
+  DirectoryInfo *info;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  if (NULL == (info = g_hash_table_lookup (self->directories, relative_path)))
+    {
+      info = g_slice_new0 (DirectoryInfo);
+      info->relpath = g_strdup (relative_path);
+      info->names = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+      g_hash_table_insert (self->directories, info->relpath, info);
+    }
+
+  return info;
+}
+
+static void
+gb_file_search_index_add_path (GbFileSearchIndex *self,
+                               const gchar       *relative_path)
+{
+  g_autofree gchar *dirname = NULL;
+  DirectoryInfo *info;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  dirname = get_relative_dirname (relative_path);
+  info = gb_file_search_index_ensure_directory (self, dirname);
+  g_hash_table_add (info->names, g_path_get_basename (relative_path));
+
+  if (!dzl_fuzzy_mutable_index_contains (self->fuzzy, relative_path))
+    dzl_fuzzy_mutable_index_insert (self->fuzzy, relative_path, NULL);
+}
+
+static void
+gb_file_search_index_remove_path (GbFileSearchIndex *self,
+                                  const gchar       *relative_path)
+{
+  g_autofree gchar *dirname = NULL;
+  DirectoryInfo *info;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  dirname = get_relative_dirname (relative_path);
+
+  if (NULL != (info = g_hash_table_lookup (self->directories, dirname)))
+    {
+      g_autofree gchar *name = g_path_get_basename (relative_path);
+
+      g_hash_table_remove (info->names, name);
+    }
+
+  dzl_fuzzy_mutable_index_remove (self->fuzzy, relative_path);
+}
+
+static void
+gb_file_search_index_remove_directory (GbFileSearchIndex *self,
+                                       const gchar       *relative_path)
+{
+  g_autoptr(GPtrArray) doomed = NULL;
+  g_autofree gchar *prefix = NULL;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  doomed = g_ptr_array_new ();
+  prefix = g_strconcat (relative_path, G_DIR_SEPARATOR_S, NULL);
+
+  g_hash_table_iter_init (&iter, self->directories);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      DirectoryInfo *info = value;
+
+      if (*relative_path == '\0' ||
+          g_str_equal (info->relpath, relative_path) ||
+          g_str_has_prefix (info->relpath, prefix))
+        g_ptr_array_add (doomed, info);
+    }
+
+  for (guint i = 0; i < doomed->len; i++)
+    {
+      DirectoryInfo *info = g_ptr_array_index (doomed, i);
+      GHashTableIter name_iter;
+      gpointer key;
+
+      g_hash_table_iter_init (&name_iter, info->names);
+
+      while (g_hash_table_iter_next (&name_iter, &key, NULL))
+        {
+          g_autofree gchar *path = build_relative_path (info->relpath, key);
+
+          dzl_fuzzy_mutable_index_remove (self->fuzzy, path);
+        }
+
+      if (info->monitor != NULL)
+        self->n_monitors--;
+
+      g_hash_table_remove (self->directories, info->relpath);
+    }
+}
+
 static void
 gb_file_search_index_set_root_directory (GbFileSearchIndex *self,
                                          GFile             *root_directory)
@@ -57,6 +341,59 @@ gb_file_search_index_set_root_directory (GbFileSearchIndex *self,
     }
 }
 
+/*
+ * Once disposed, the index still answers queries but stops following the
+ * file-system. Any pending save is written out right away so that it is not
+ * lost, and no further saves are queued so that a stale index cannot
+ * overwrite the cache of the index replacing it.
+ */
+static void
+gb_file_search_index_dispose (GObject *object)
+{
+  GbFileSearchIndex *self = (GbFileSearchIndex *)object;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_cancellable_cancel (self->cancellable);
+
+  if (self->monitor_source != 0)
+    {
+      g_source_remove (self->monitor_source);
+      self->monitor_source = 0;
+    }
+
+  if (self->save_source != 0)
+    {
+      g_autoptr(GError) error = NULL;
+
+      g_source_remove (self->save_source);
+      self->save_source = 0;
+
+      if (self->fuzzy != NULL && !gb_file_search_index_write_cache (self, &error))
+        g_warning ("Failed to write file index cache: %s", error->message);
+    }
+
+  g_queue_foreach (&self->monitor_queue, (GFunc)g_free, NULL);
+  g_queue_clear (&self->monitor_queue);
+
+  g_hash_table_iter_init (&iter, self->directories);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      DirectoryInfo *info = value;
+
+      if (info->monitor != NULL)
+        {
+          g_file_monitor_cancel (info->monitor);
+          g_clear_object (&info->monitor);
+        }
+    }
+
+  self->n_monitors = 0;
+
+  G_OBJECT_CLASS (gb_file_search_index_parent_class)->dispose (object);
+}
+
 static void
 gb_file_search_index_finalize (GObject *object)
 {
@@ -64,6 +401,12 @@ gb_file_search_index_finalize (GObject *object)
 
   g_clear_object (&self->root_directory);
   g_clear_pointer (&self->fuzzy, dzl_fuzzy_mutable_index_unref);
+  g_clear_object (&self->progress);
+  g_clear_object (&self->cancellable);
+  g_clear_pointer (&self->directories, g_hash_table_unref);
+  g_clear_pointer (&self->cache, g_variant_unref);
+  g_clear_pointer (&self->cache_path, g_free);
+  g_clear_pointer (&self->vcs_stamp, g_free);
 
   G_OBJECT_CLASS (gb_file_search_index_parent_class)->finalize (object);
 }
@@ -111,6 +454,7 @@ gb_file_search_index_class_init (GbFileSearchIndexClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->dispose = gb_file_search_index_dispose;
   object_class->finalize = gb_file_search_index_finalize;
   object_class->get_property = gb_file_search_index_get_property;
   object_class->set_property = gb_file_search_index_set_property;
@@ -128,25 +472,483 @@ gb_file_search_index_class_init (GbFileSearchIndexClass *klass)
 static void
 gb_file_search_index_init (GbFileSearchIndex *self)
 {
+  self->progress = ide_progress_new ();
+  self->cancellable = g_cancellable_new ();
+  self->directories = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, directory_info_free);
+  g_queue_init (&self->monitor_queue);
+}
+
+
+static void
+gb_file_search_index_file_created (GbFileSearchIndex *self,
+                                   GFile             *file)
+{
+  g_autofree gchar *relative_path = NULL;
+  IdeContext *context;
+  IdeVcs *vcs;
+  GFileType file_type;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (G_IS_FILE (file));
+
+  if (NULL == (relative_path = g_file_get_relative_path (self->root_directory, file)))
+    return;
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  vcs = ide_context_get_vcs (context);
+
+  if (gb_file_search_vcs_is_ignored (vcs, file))
+    return;
+
+  file_type = g_file_query_file_type (file, G_FILE_QUERY_INFO_NONE, NULL);
+
+  if (file_type == G_FILE_TYPE_DIRECTORY)
+    {
+      if (!g_hash_table_contains (self->directories, relative_path))
+        gb_file_search_index_walk_async (self, relative_path);
+    }
+  else if (file_type != G_FILE_TYPE_UNKNOWN)
+    {
+      gb_file_search_index_add_path (self, relative_path);
+      gb_file_search_index_queue_save (self);
+    }
+}
+
+static void
+gb_file_search_index_file_deleted (GbFileSearchIndex *self,
+                                   GFile             *file)
+{
+  g_autofree gchar *relative_path = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (G_IS_FILE (file));
+
+  if (NULL == (relative_path = g_file_get_relative_path (self->root_directory, file)))
+    return;
+
+  if (g_hash_table_contains (self->directories, relative_path))
+    gb_file_search_index_remove_directory (self, relative_path);
+  else
+    gb_file_search_index_remove_path (self, relative_path);
+
+  gb_file_search_index_queue_save (self);
+}
+
+static void
+gb_file_search_index_monitor_changed (GbFileSearchIndex *self,
+                                      GFile             *file,
+                                      GFile             *other_file,
+                                      GFileMonitorEvent  event,
+                                      GFileMonitor      *monitor)
+{
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (G_IS_FILE (file));
+  g_assert (!other_file || G_IS_FILE (other_file));
+  g_assert (G_IS_FILE_MONITOR (monitor));
+
+  if (self->fuzzy == NULL)
+    return;
+
+  switch (event)
+    {
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+      gb_file_search_index_file_created (self, file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+      gb_file_search_index_file_deleted (self, file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      gb_file_search_index_file_deleted (self, file);
+      if (other_file != NULL)
+        gb_file_search_index_file_created (self, other_file);
+      break;
+
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_ATTRIBUTE_CHANGED:
+    case G_FILE_MONITOR_EVENT_PRE_UNMOUNT:
+    case G_FILE_MONITOR_EVENT_UNMOUNTED:
+    case G_FILE_MONITOR_EVENT_MOVED:
+    default:
+      break;
+    }
+}
+
+static gboolean
+gb_file_search_index_monitor_cb (gpointer user_data)
+{
+  GbFileSearchIndex *self = user_data;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  for (guint i = 0; i < MONITORS_PER_IDLE; i++)
+    {
+      g_autofree gchar *relative_path = NULL;
+      g_autoptr(GFile) directory = NULL;
+      DirectoryInfo *info;
+
+      if (NULL == (relative_path = g_queue_pop_head (&self->monitor_queue)))
+        break;
+
+      /*
+       * Each monitor costs an inotify watch, which is a limited per-user
+       * resource. Once we hit our budget the remaining (deeper)
+       * directories are only picked up when the cache is validated.
+       */
+      if (self->n_monitors >= MAX_MONITORS)
+        {
+          g_debug ("Monitor limit reached, %u directories left unwatched",
+                   self->monitor_queue.length + 1);
+          g_queue_foreach (&self->monitor_queue, (GFunc)g_free, NULL);
+          g_queue_clear (&self->monitor_queue);
+          break;
+        }
+
+      info = g_hash_table_lookup (self->directories, relative_path);
+      if (info == NULL || info->monitor != NULL)
+        continue;
+
+      directory = get_directory (self, relative_path);
+      info->monitor = g_file_monitor_directory (directory,
+                                                G_FILE_MONITOR_WATCH_MOVES,
+                                                NULL,
+                                                NULL);
+      if (info->monitor == NULL)
+        continue;
+
+      self->n_monitors++;
+
+      g_signal_connect_object (info->monitor,
+                               "changed",
+                               G_CALLBACK (gb_file_search_index_monitor_changed),
+                               self,
+                               G_CONNECT_SWAPPED);
+    }
+
+  if (g_queue_is_empty (&self->monitor_queue))
+    {
+      self->monitor_source = 0;
+      return G_SOURCE_REMOVE;
+    }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+gb_file_search_index_queue_monitor (GbFileSearchIndex *self,
+                                    const gchar       *relative_path)
+{
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  g_queue_push_tail (&self->monitor_queue, g_strdup (relative_path));
+
+  if (self->monitor_source == 0)
+    self->monitor_source = g_idle_add_full (G_PRIORITY_LOW,
+                                            gb_file_search_index_monitor_cb,
+                                            self,
+                                            NULL);
+}
+
+static guint
+get_depth (const gchar *relative_path)
+{
+  guint depth = 0;
+
+  if (*relative_path == '\0')
+    return 0;
+
+  for (const gchar *iter = relative_path; *iter; iter++)
+    depth += (*iter == G_DIR_SEPARATOR);
+
+  return depth + 1;
+}
+
+static gint
+compare_by_depth (gconstpointer a,
+                  gconstpointer b)
+{
+  const gchar * const *astr = a;
+  const gchar * const *bstr = b;
+
+  return (gint)get_depth (*astr) - (gint)get_depth (*bstr);
 }
 
 static void
-populate_from_dir (DzlFuzzyMutableIndex *fuzzy,
-                   IdeVcs               *vcs,
-                   const gchar          *relpath,
-                   GFile                *directory,
-                   GCancellable         *cancellable)
+gb_file_search_index_start_monitors (GbFileSearchIndex *self)
 {
-  GFileEnumerator *enumerator;
-  GPtrArray *children = NULL;
+  g_autoptr(GPtrArray) paths = NULL;
+  GHashTableIter iter;
+  gpointer key;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  paths = g_ptr_array_new ();
+
+  g_hash_table_iter_init (&iter, self->directories);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (paths, key);
+
+  /* Shallow directories first so the monitor budget covers the likely ones */
+  g_ptr_array_sort (paths, compare_by_depth);
+
+  for (guint i = 0; i < paths->len; i++)
+    gb_file_search_index_queue_monitor (self, g_ptr_array_index (paths, i));
+}
+
+static GVariant *
+gb_file_search_index_serialize (GbFileSearchIndex *self)
+{
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(stas)"));
+
+  g_hash_table_iter_init (&iter, self->directories);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      DirectoryInfo *info = value;
+      GVariantBuilder names;
+      GHashTableIter name_iter;
+      gpointer key;
+
+      g_variant_builder_init (&names, G_VARIANT_TYPE_STRING_ARRAY);
+
+      g_hash_table_iter_init (&name_iter, info->names);
+      while (g_hash_table_iter_next (&name_iter, &key, NULL))
+        g_variant_builder_add (&names, "s", key);
+
+      g_variant_builder_add (&builder, "(stas)", info->relpath, info->mtime, &names);
+    }
+
+  return g_variant_ref_sink (g_variant_new (CACHE_FORMAT,
+                                            CACHE_VERSION,
+                                            self->vcs_stamp ? self->vcs_stamp : "",
+                                            &builder));
+}
+
+static void
+gb_file_search_index_save_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  GFile *file = (GFile *)object;
+  g_autoptr(GError) error = NULL;
+
+  g_assert (G_IS_FILE (file));
+  g_assert (G_IS_ASYNC_RESULT (result));
+
+  if (!g_file_replace_contents_finish (file, result, NULL, &error))
+    g_debug ("Failed to save file index: %s", error->message);
+}
+
+static gboolean
+gb_file_search_index_save_timeout (gpointer user_data)
+{
+  GbFileSearchIndex *self = user_data;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *dirname = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  self->save_source = 0;
+
+  if (self->cache_path == NULL || self->fuzzy == NULL)
+    return G_SOURCE_REMOVE;
+
+  variant = gb_file_search_index_serialize (self);
+  bytes = g_variant_get_data_as_bytes (variant);
+
+  dirname = g_path_get_dirname (self->cache_path);
+  g_mkdir_with_parents (dirname, 0750);
+
+  file = g_file_new_for_path (self->cache_path);
+  g_file_replace_contents_bytes_async (file,
+                                       bytes,
+                                       NULL,
+                                       FALSE,
+                                       G_FILE_CREATE_REPLACE_DESTINATION,
+                                       NULL,
+                                       gb_file_search_index_save_cb,
+                                       NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_file_search_index_queue_save (GbFileSearchIndex *self)
+{
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  if (self->save_source == 0)
+    self->save_source = g_timeout_add_seconds (SAVE_DELAY_SECONDS,
+                                               gb_file_search_index_save_timeout,
+                                               self);
+}
+
+static void
+gb_file_search_index_apply (GbFileSearchIndex *self,
+                            ChangeSet         *changes)
+{
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (changes != NULL);
+
+  if (self->fuzzy == NULL)
+    return;
+
+  for (guint i = 0; i < changes->removed_dirs->len; i++)
+    gb_file_search_index_remove_directory (self, g_ptr_array_index (changes->removed_dirs, i));
+
+  for (guint i = 0; i < changes->removed->len; i++)
+    gb_file_search_index_remove_path (self, g_ptr_array_index (changes->removed, i));
+
+  for (guint i = 0; i < changes->dirs->len; i++)
+    {
+      const DirectoryStamp *stamp = &g_array_index (changes->dirs, DirectoryStamp, i);
+      DirectoryInfo *info;
+
+      info = gb_file_search_index_ensure_directory (self, stamp->relpath);
+      info->mtime = stamp->mtime;
+
+      if (info->monitor == NULL)
+        gb_file_search_index_queue_monitor (self, stamp->relpath);
+    }
+
+  for (guint i = 0; i < changes->added->len; i++)
+    gb_file_search_index_add_path (self, g_ptr_array_index (changes->added, i));
+
+  if (changes->removed_dirs->len ||
+      changes->removed->len ||
+      changes->dirs->len ||
+      changes->added->len)
+    gb_file_search_index_queue_save (self);
+}
+
+static void
+gb_file_search_index_walk_worker (GTask        *task,
+                                  gpointer      source_object,
+                                  gpointer      task_data,
+                                  GCancellable *cancellable)
+{
+  GbFileSearchIndex *self = source_object;
+  g_autoptr(GbFileSearchWalker) walker = NULL;
+  g_autoptr(GFile) directory = NULL;
+  const gchar *relative_path = task_data;
+  ChangeSet *changes;
+  IdeContext *context;
+  IdeVcs *vcs;
+  GError *error = NULL;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  vcs = ide_context_get_vcs (context);
+  directory = get_directory (self, relative_path);
+  changes = change_set_new ();
+
+  walker = gb_file_search_walker_new (directory, vcs);
+  gb_file_search_walker_set_prefix (walker, relative_path);
+  gb_file_search_walker_set_directory_func (walker, change_set_walk_directory);
+
+  if (!gb_file_search_walker_run (walker, change_set_walk_batch, changes, cancellable, &error))
+    {
+      change_set_free (changes);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  g_task_return_pointer (task, changes, change_set_free);
+}
+
+static void
+gb_file_search_index_walk_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  GbFileSearchIndex *self = (GbFileSearchIndex *)object;
+  g_autoptr(GError) error = NULL;
+  ChangeSet *changes;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (G_IS_TASK (result));
+
+  if (NULL == (changes = g_task_propagate_pointer (G_TASK (result), &error)))
+    {
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        g_debug ("Failed to index directory: %s", error->message);
+      return;
+    }
+
+  gb_file_search_index_apply (self, changes);
+  change_set_free (changes);
+}
+
+static void
+gb_file_search_index_walk_async (GbFileSearchIndex *self,
+                                 const gchar       *relative_path)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (relative_path != NULL);
+
+  task = g_task_new (self, self->cancellable, gb_file_search_index_walk_cb, NULL);
+  g_task_set_source_tag (task, gb_file_search_index_walk_async);
+  g_task_set_task_data (task, g_strdup (relative_path), g_free);
+  g_task_run_in_thread (task, gb_file_search_index_walk_worker);
+}
+
+static void
+gb_file_search_index_rescan_directory (GbFileSearchIndex *self,
+                                       ChangeSet         *changes,
+                                       IdeVcs            *vcs,
+                                       GFile             *directory,
+                                       const gchar       *relative_path,
+                                       GVariant          *names,
+                                       GHashTable        *known,
+                                       GCancellable      *cancellable)
+{
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  g_autoptr(GHashTable) previous = NULL;
+  GHashTableIter hiter;
+  GVariantIter iter;
+  const gchar *name;
   gpointer file_info_ptr;
+  gpointer key;
+  gpointer value;
 
-  g_assert (fuzzy != NULL);
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (changes != NULL);
+  g_assert (IDE_IS_VCS (vcs));
   g_assert (G_IS_FILE (directory));
-  g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
+  g_assert (relative_path != NULL);
+  g_assert (names != NULL);
+  g_assert (known != NULL);
 
-  if (ide_vcs_is_ignored (vcs, directory, NULL))
-    return;
+  /* Maps names from the cache to whether we still see them on disk */
+  previous = g_hash_table_new (g_str_hash, g_str_equal);
+
+  g_variant_iter_init (&iter, names);
+  while (g_variant_iter_next (&iter, "&s", &name))
+    g_hash_table_insert (previous, (gchar *)name, GINT_TO_POINTER (FALSE));
 
   enumerator = g_file_enumerate_children (directory,
                                           G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME","
@@ -161,53 +963,282 @@ populate_from_dir (DzlFuzzyMutableIndex *fuzzy,
   while ((file_info_ptr = g_file_enumerator_next_file (enumerator, cancellable, NULL)))
     {
       g_autoptr(GFileInfo) file_info = file_info_ptr;
-      g_autofree gchar *path = NULL;
       g_autoptr(GFile) file = NULL;
-      const gchar *name;
+      g_autofree gchar *path = NULL;
 
       name = g_file_info_get_display_name (file_info);
       file = g_file_get_child (directory, name);
+      path = build_relative_path (relative_path, name);
 
       if (g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY)
         {
-          if (children == NULL)
-            children = g_ptr_array_new_with_free_func (g_object_unref);
-          g_ptr_array_add (children, g_object_ref (file));
+          g_autoptr(GbFileSearchWalker) walker = NULL;
+
+          /* Known directories are validated on their own */
+          if (g_hash_table_contains (known, path))
+            continue;
+
+          walker = gb_file_search_walker_new (file, vcs);
+          gb_file_search_walker_set_prefix (walker, path);
+          gb_file_search_walker_set_directory_func (walker, change_set_walk_directory);
+          gb_file_search_walker_run (walker, change_set_walk_batch, changes, cancellable, NULL);
+
+          continue;
+        }
+
+      if (g_hash_table_contains (previous, name))
+        {
+          g_hash_table_insert (previous, (gchar *)name, GINT_TO_POINTER (TRUE));
           continue;
         }
 
-      if (ide_vcs_is_ignored (vcs, file, NULL))
+      if (!gb_file_search_vcs_is_ignored (vcs, file))
+        g_ptr_array_add (changes->added, g_steal_pointer (&path));
+    }
+
+  g_hash_table_iter_init (&hiter, previous);
+
+  while (g_hash_table_iter_next (&hiter, &key, &value))
+    {
+      if (!GPOINTER_TO_INT (value))
+        g_ptr_array_add (changes->removed, build_relative_path (relative_path, key));
+    }
+}
+
+static void
+gb_file_search_index_validate_worker (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  GbFileSearchIndex *self = source_object;
+  g_autoptr(GHashTable) known = NULL;
+  g_autoptr(GVariant) dirs = NULL;
+  g_autoptr(GTimer) timer = NULL;
+  GVariant *cache = task_data;
+  GVariantIter iter;
+  const gchar *relative_path;
+  IdeContext *context;
+  ChangeSet *changes;
+  GVariant *names;
+  IdeVcs *vcs;
+  guint64 mtime;
+
+  g_assert (G_IS_TASK (task));
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (cache != NULL);
+
+  context = ide_object_get_context (IDE_OBJECT (self));
+  vcs = ide_context_get_vcs (context);
+
+  timer = g_timer_new ();
+  changes = change_set_new ();
+  known = g_hash_table_new (g_str_hash, g_str_equal);
+  dirs = g_variant_get_child_value (cache, 2);
+
+  g_variant_iter_init (&iter, dirs);
+  while (g_variant_iter_next (&iter, "(&st@as)", &relative_path, NULL, NULL))
+    g_hash_table_add (known, (gchar *)relative_path);
+
+  /*
+   * Only directories whose mtime changed can have gained or lost entries,
+   * so everything else is a single stat() away from being validated.
+   */
+  g_variant_iter_init (&iter, dirs);
+
+  while (g_variant_iter_next (&iter, "(&st@as)", &relative_path, &mtime, &names))
+    {
+      g_autoptr(GVariant) names_ref = names;
+      g_autoptr(GFileInfo) info = NULL;
+      g_autoptr(GFile) directory = NULL;
+      guint64 current;
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      directory = get_directory (self, relative_path);
+      info = g_file_query_info (directory,
+                                G_FILE_ATTRIBUTE_STANDARD_TYPE","
+                                G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                G_FILE_QUERY_INFO_NONE,
+                                cancellable,
+                                NULL);
+
+      if (info == NULL || g_file_info_get_file_type (info) != G_FILE_TYPE_DIRECTORY)
+        {
+          g_ptr_array_add (changes->removed_dirs, g_strdup (relative_path));
+          continue;
+        }
+
+      current = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+      if (current == mtime)
         continue;
 
-      if (relpath != NULL)
-        name = path = g_build_filename (relpath, name, NULL);
+      change_set_add_directory (changes, relative_path, current);
+      gb_file_search_index_rescan_directory (self,
+                                             changes,
+                                             vcs,
+                                             directory,
+                                             relative_path,
+                                             names,
+                                             known,
+                                             cancellable);
+    }
+
+  g_debug ("File index validated in %lf seconds (%u added, %u removed, %u directories removed).",
+           g_timer_elapsed (timer, NULL),
+           changes->added->len,
+           changes->removed->len,
+           changes->removed_dirs->len);
 
-      dzl_fuzzy_mutable_index_insert (fuzzy, name, NULL);
+  g_task_return_pointer (task, changes, change_set_free);
+}
+
+static void
+gb_file_search_index_validate_async (GbFileSearchIndex *self,
+                                     GVariant          *cache)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (cache != NULL);
+
+  task = g_task_new (self, self->cancellable, gb_file_search_index_walk_cb, NULL);
+  g_task_set_source_tag (task, gb_file_search_index_validate_async);
+  g_task_set_task_data (task, g_variant_ref (cache), (GDestroyNotify)g_variant_unref);
+  g_task_run_in_thread (task, gb_file_search_index_validate_worker);
+}
+
+static gboolean
+gb_file_search_index_load_cache (GbFileSearchIndex    *self,
+                                 DzlFuzzyMutableIndex *fuzzy)
+{
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autoptr(GVariant) variant = NULL;
+  g_autoptr(GVariant) dirs = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  const gchar *stamp = NULL;
+  const gchar *relative_path;
+  GVariantIter iter;
+  GVariant *names;
+  guint32 version = 0;
+  guint64 mtime;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (fuzzy != NULL);
+
+  if (self->cache_path == NULL)
+    return FALSE;
+
+  if (NULL == (mapped = g_mapped_file_new (self->cache_path, FALSE, NULL)))
+    return FALSE;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  variant = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (CACHE_FORMAT), bytes, FALSE));
+
+  g_variant_get (variant, "(u&s@a(stas))", &version, &stamp, &dirs);
+
+  if (version != CACHE_VERSION || g_strcmp0 (stamp, self->vcs_stamp ? self->vcs_stamp : "") != 0)
+    {
+      g_debug ("Discarding stale file index cache %s", self->cache_path);
+      return FALSE;
     }
 
-  g_clear_object (&enumerator);
+  g_variant_iter_init (&iter, dirs);
 
-  if (children != NULL)
+  while (g_variant_iter_next (&iter, "(&st@as)", &relative_path, &mtime, &names))
     {
-      gsize i;
+      g_autoptr(GVariant) names_ref = names;
+      DirectoryInfo *info;
+      GVariantIter name_iter;
+      const gchar *name;
 
-      for (i = 0; i < children->len; i++)
-        {
-          g_autofree gchar *path = NULL;
-          g_autofree gchar *name = NULL;
-          GFile *child;
+      info = gb_file_search_index_ensure_directory (self, relative_path);
+      info->mtime = mtime;
 
-          child = g_ptr_array_index (children, i);
-          name = g_file_get_basename (child);
+      g_variant_iter_init (&name_iter, names);
 
-          if (relpath != NULL)
-            path = g_build_filename (relpath, name, NULL);
+      while (g_variant_iter_next (&name_iter, "&s", &name))
+        {
+          g_autofree gchar *path = build_relative_path (relative_path, name);
 
-          populate_from_dir (fuzzy, vcs, path ? path : name, child, cancellable);
+          g_hash_table_add (info->names, g_strdup (name));
+          dzl_fuzzy_mutable_index_insert (fuzzy, path, NULL);
         }
     }
 
-  g_clear_pointer (&children, g_ptr_array_unref);
+  self->cache = g_steal_pointer (&variant);
+
+  return TRUE;
+}
+
+static gboolean
+gb_file_search_index_write_cache (GbFileSearchIndex  *self,
+                                  GError            **error)
+{
+  g_autoptr(GVariant) variant = NULL;
+  g_autofree gchar *dirname = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  if (self->cache_path == NULL)
+    return TRUE;
+
+  dirname = g_path_get_dirname (self->cache_path);
+
+  if (g_mkdir_with_parents (dirname, 0750) != 0)
+    {
+      int errsv = errno;
+      g_set_error_literal (error,
+                           G_FILE_ERROR,
+                           g_file_error_from_errno (errsv),
+                           g_strerror (errsv));
+      return FALSE;
+    }
+
+  variant = gb_file_search_index_serialize (self);
+
+  return g_file_set_contents (self->cache_path,
+                              g_variant_get_data (variant),
+                              g_variant_get_size (variant),
+                              error);
+}
+
+static void
+walk_directory (const gchar *relative_path,
+                guint64      mtime,
+                gpointer     user_data)
+{
+  GbFileSearchIndex *self = user_data;
+  DirectoryInfo *info;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+
+  info = gb_file_search_index_ensure_directory (self, relative_path);
+  info->mtime = mtime;
+}
+
+static void
+walk_batch (const gchar * const *paths,
+            guint                n_paths,
+            gpointer             user_data)
+{
+  GbFileSearchIndex *self = user_data;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (self->fuzzy != NULL);
+
+  for (guint i = 0; i < n_paths; i++)
+    {
+      g_autofree gchar *dirname = get_relative_dirname (paths [i]);
+      DirectoryInfo *info;
+
+      info = gb_file_search_index_ensure_directory (self, dirname);
+      g_hash_table_add (info->names, g_path_get_basename (paths [i]));
+
+      dzl_fuzzy_mutable_index_insert (self->fuzzy, paths [i], NULL);
+    }
 }
 
 static void
@@ -217,11 +1248,14 @@ gb_file_search_index_builder (GTask        *task,
                               GCancellable *cancellable)
 {
   GbFileSearchIndex *self = source_object;
+  g_autoptr(GbFileSearchWalker) walker = NULL;
   g_autoptr(GTimer) timer = NULL;
+  g_autoptr(GError) write_error = NULL;
   GFile *directory = task_data;
   IdeContext *context;
   IdeVcs *vcs;
   DzlFuzzyMutableIndex *fuzzy;
+  GError *error = NULL;
   gdouble elapsed;
 
   g_assert (G_IS_TASK (task));
@@ -236,15 +1270,82 @@ gb_file_search_index_builder (GTask        *task,
 
   fuzzy = dzl_fuzzy_mutable_index_new (FALSE);
   dzl_fuzzy_mutable_index_begin_bulk_insert (fuzzy);
-  populate_from_dir (fuzzy, vcs, NULL, directory, cancellable);
-  dzl_fuzzy_mutable_index_end_bulk_insert (fuzzy);
 
+  /*
+   * If we have a cache for the current VCS state, use it right away and
+   * let validation catch up with what changed while we were not running.
+   */
+  if (gb_file_search_index_load_cache (self, fuzzy))
+    {
+      dzl_fuzzy_mutable_index_end_bulk_insert (fuzzy);
+      self->fuzzy = fuzzy;
+
+      g_message ("File index loaded from cache in %lf seconds (%u directories).",
+                 g_timer_elapsed (timer, NULL),
+                 g_hash_table_size (self->directories));
+
+      ide_progress_set_fraction (self->progress, 1.0);
+
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  /* Discard anything a partial cache load may have left behind */
+  g_hash_table_remove_all (self->directories);
+
+  walker = gb_file_search_walker_new (directory, vcs);
+  gb_file_search_walker_set_progress (walker, self->progress);
+  gb_file_search_walker_set_directory_func (walker, walk_directory);
+
+  /* Nothing else can see the index until this task completes */
   self->fuzzy = fuzzy;
 
+  if (!gb_file_search_walker_run (walker, walk_batch, self, cancellable, &error))
+    {
+      dzl_fuzzy_mutable_index_end_bulk_insert (fuzzy);
+      g_clear_pointer (&self->fuzzy, dzl_fuzzy_mutable_index_unref);
+      g_task_return_error (task, error);
+      return;
+    }
+
+  dzl_fuzzy_mutable_index_end_bulk_insert (fuzzy);
+
   g_timer_stop (timer);
   elapsed = g_timer_elapsed (timer, NULL);
 
-  g_message ("File index built in %lf seconds.", elapsed);
+  g_message ("File index built in %lf seconds (%u files).",
+             elapsed, gb_file_search_walker_get_n_files (walker));
+
+  if (!gb_file_search_index_write_cache (self, &write_error))
+    g_warning ("Failed to write file index cache: %s", write_error->message);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+gb_file_search_index_build_cb (GObject      *object,
+                               GAsyncResult *result,
+                               gpointer      user_data)
+{
+  GbFileSearchIndex *self = (GbFileSearchIndex *)object;
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(GVariant) cache = NULL;
+  GError *error = NULL;
+
+  g_assert (GB_IS_FILE_SEARCH_INDEX (self));
+  g_assert (G_IS_TASK (result));
+  g_assert (G_IS_TASK (task));
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  gb_file_search_index_start_monitors (self);
+
+  if (NULL != (cache = g_steal_pointer (&self->cache)))
+    gb_file_search_index_validate_async (self, cache);
 
   g_task_return_boolean (task, TRUE);
 }
@@ -256,6 +1357,13 @@ gb_file_search_index_build_async (GbFileSearchIndex   *self,
                                   gpointer             user_data)
 {
   g_autoptr(GTask) task = NULL;
+  g_autoptr(GTask) build_task = NULL;
+  g_autofree gchar *name = NULL;
+  g_autofree gchar *uri = NULL;
+  g_autofree gchar *checksum = NULL;
+  IdeContext *context;
+  IdeProject *project;
+  IdeVcs *vcs;
 
   g_return_if_fail (GB_IS_FILE_SEARCH_INDEX (self));
   g_return_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable));
@@ -271,8 +1379,32 @@ gb_file_search_index_build_async (GbFileSearchIndex   *self,
       return;
     }
 
-  g_task_set_task_data (task, g_object_ref (self->root_directory), g_object_unref);
-  g_task_run_in_thread (task, gb_file_search_index_builder);
+  context = ide_object_get_context (IDE_OBJECT (self));
+  project = ide_context_get_project (context);
+  vcs = ide_context_get_vcs (context);
+
+  /*
+   * IdeVcs does not expose the HEAD commit, so the branch name is the
+   * closest stamp we have. Directory mtimes catch everything else.
+   */
+  g_clear_pointer (&self->vcs_stamp, g_free);
+  self->vcs_stamp = ide_vcs_get_branch_name (vcs);
+
+  /* Checkouts of the same project in different places get their own cache */
+  uri = g_file_get_uri (self->root_directory);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, uri, -1);
+  name = g_strdup_printf ("%s-%s.index", ide_project_get_id (project), checksum);
+  g_clear_pointer (&self->cache_path, g_free);
+  self->cache_path = g_build_filename (g_get_user_cache_dir (),
+                                       ide_get_program_name (),
+                                       "file-search",
+                                       name,
+                                       NULL);
+
+  build_task = g_task_new (self, cancellable, gb_file_search_index_build_cb, g_steal_pointer (&task));
+  g_task_set_source_tag (build_task, gb_file_search_index_build_async);
+  g_task_set_task_data (build_task, g_object_ref (self->root_directory), g_object_unref);
+  g_task_run_in_thread (build_task, gb_file_search_index_builder);
 }
 
 gboolean
@@ -370,7 +1502,8 @@ gb_file_search_index_insert (GbFileSearchIndex *self,
   g_return_if_fail (relative_path != NULL);
   g_return_if_fail (self->fuzzy != NULL);
 
-  dzl_fuzzy_mutable_index_insert (self->fuzzy, relative_path, NULL);
+  gb_file_search_index_add_path (self, relative_path);
+  gb_file_search_index_queue_save (self);
 }
 
 void
@@ -381,5 +1514,21 @@ gb_file_search_index_remove (GbFileSearchIndex *self,
   g_return_if_fail (relative_path != NULL);
   g_return_if_fail (self->fuzzy != NULL);
 
-  dzl_fuzzy_mutable_index_remove (self->fuzzy, relative_path);
+  gb_file_search_index_remove_path (self, relative_path);
+  gb_file_search_index_queue_save (self);
+}
+
+/**
+ * gb_file_search_index_get_progress:
+ *
+ * Gets the #IdeProgress that is updated while the index is built.
+ *
+ * Returns: (transfer none): An #IdeProgress
+ */
+IdeProgress *
+gb_file_search_index_get_progress (GbFileSearchIndex *self)
+{
+  g_return_val_if_fail (GB_IS_FILE_SEARCH_INDEX (self), NULL);
+
+  return self->progress;
 }
@@ -22,11 +22,18 @@
 
 #include "gb-file-search-provider.h"
 #include "gb-file-search-index.h"
+#include "gb-file-search-result.h"
+#include "gb-file-search-walker.h"
+
+#define REBUILD_DELAY_SECONDS 2
 
 struct _GbFileSearchProvider
 {
   IdeObject          parent_instance;
   GbFileSearchIndex *index;
+  IdeProgress       *progress;
+  GCancellable      *rebuild_cancellable;
+  guint              rebuild_source;
 };
 
 static void search_provider_iface_init (IdeSearchProviderInterface *iface);
@@ -59,7 +66,21 @@ gb_file_search_provider_populate (IdeSearchProvider *provider,
   g_assert (!cancellable || G_IS_CANCELLABLE (cancellable));
 
   if (self->index != NULL)
-    gb_file_search_index_populate (self->index, context, provider, search_terms);
+    {
+      gb_file_search_index_populate (self->index, context, provider, search_terms);
+    }
+  else if (self->progress != NULL)
+    {
+      g_autoptr(IdeSearchResult) result = NULL;
+      g_autofree gchar *subtitle = NULL;
+      guint percent;
+
+      /* Let the user know why there are no files yet instead of showing nothing */
+      percent = ide_progress_get_fraction (self->progress) * 100;
+      subtitle = g_strdup_printf (_("%u%% complete"), percent);
+      result = ide_search_result_new (provider, _("Indexing project files…"), subtitle, 0.0);
+      ide_search_context_add_result (context, provider, result);
+    }
 
   ide_search_context_provider_completed (context, provider);
 }
@@ -89,7 +110,7 @@ on_buffer_loaded (GbFileSearchProvider *self,
   relative_path = g_file_get_relative_path (workdir, file);
 
   if ((relative_path != NULL) &&
-      !ide_vcs_is_ignored (vcs, file, NULL) &&
+      !gb_file_search_vcs_is_ignored (vcs, file) &&
       !gb_file_search_index_contains (self->index, relative_path))
     gb_file_search_index_insert (self->index, relative_path);
 }
@@ -160,11 +181,16 @@ gb_file_search_provider_build_cb (GObject      *object,
 
   if (!gb_file_search_index_build_finish (index, result, &error))
     {
-      g_warning ("%s", error->message);
+      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_warning ("%s", error->message);
+          g_clear_object (&self->progress);
+        }
       return;
     }
 
   g_set_object (&self->index, index);
+  g_clear_object (&self->progress);
 }
 
 static GtkWidget *
@@ -192,6 +218,10 @@ gb_file_search_provider_activate (IdeSearchProvider *provider,
   g_assert (GTK_IS_WIDGET (row));
   g_assert (IDE_IS_SEARCH_RESULT (result));
 
+  /* The indexing placeholder has nothing to open */
+  if (!GB_IS_FILE_SEARCH_RESULT (result))
+    return;
+
   toplevel = gtk_widget_get_toplevel (row);
 
   if (IDE_IS_WORKBENCH (toplevel))
@@ -226,30 +256,75 @@ gb_file_search_provider_get_priority (IdeSearchProvider *provider)
 }
 
 static void
-gb_file_search_provider_vcs_changed_cb (GbFileSearchProvider *self,
-                                        IdeVcs               *vcs)
+gb_file_search_provider_rebuild (GbFileSearchProvider *self)
 {
   g_autoptr(GbFileSearchIndex) index = NULL;
   IdeContext *context;
+  IdeVcs *vcs;
   GFile *workdir;
 
-  IDE_ENTRY;
-
-  g_return_if_fail (GB_IS_FILE_SEARCH_PROVIDER (self));
-  g_return_if_fail (IDE_IS_VCS (vcs));
+  g_assert (GB_IS_FILE_SEARCH_PROVIDER (self));
 
   context = ide_object_get_context (IDE_OBJECT (self));
+  vcs = ide_context_get_vcs (context);
   workdir = ide_vcs_get_working_directory (vcs);
 
+  /* Only the most recent build may replace the index */
+  g_cancellable_cancel (self->rebuild_cancellable);
+  g_clear_object (&self->rebuild_cancellable);
+  self->rebuild_cancellable = g_cancellable_new ();
+
+  /*
+   * The current index keeps answering queries until the new one is ready,
+   * but disposing it releases its file monitors and flushes its pending
+   * changes to the cache the new index is about to load.
+   */
+  if (self->index != NULL)
+    g_object_run_dispose (G_OBJECT (self->index));
+
   index = g_object_new (GB_TYPE_FILE_SEARCH_INDEX,
                         "context", context,
                         "root-directory", workdir,
                         NULL);
 
+  g_set_object (&self->progress, gb_file_search_index_get_progress (index));
+
   gb_file_search_index_build_async (index,
-                                    NULL,
+                                    self->rebuild_cancellable,
                                     gb_file_search_provider_build_cb,
                                     g_object_ref (self));
+}
+
+static gboolean
+gb_file_search_provider_rebuild_timeout (gpointer user_data)
+{
+  GbFileSearchProvider *self = user_data;
+
+  g_assert (GB_IS_FILE_SEARCH_PROVIDER (self));
+
+  self->rebuild_source = 0;
+
+  gb_file_search_provider_rebuild (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gb_file_search_provider_vcs_changed_cb (GbFileSearchProvider *self,
+                                        IdeVcs               *vcs)
+{
+  IDE_ENTRY;
+
+  g_return_if_fail (GB_IS_FILE_SEARCH_PROVIDER (self));
+  g_return_if_fail (IDE_IS_VCS (vcs));
+
+  /* A checkout or rebase emits a burst of changes, rebuild once it settles */
+  if (self->rebuild_source != 0)
+    g_source_remove (self->rebuild_source);
+
+  self->rebuild_source = g_timeout_add_seconds (REBUILD_DELAY_SECONDS,
+                                                gb_file_search_provider_rebuild_timeout,
+                                                self);
 
   IDE_EXIT;
 }
@@ -258,12 +333,10 @@ static void
 gb_file_search_provider_constructed (GObject *object)
 {
   GbFileSearchProvider *self = (GbFileSearchProvider *)object;
-  g_autoptr(GbFileSearchIndex) index = NULL;
   IdeBufferManager *bufmgr;
   IdeContext *context;
   IdeProject *project;
   IdeVcs *vcs;
-  GFile *workdir;
 
   context = ide_object_get_context (IDE_OBJECT (self));
 
@@ -271,8 +344,6 @@ gb_file_search_provider_constructed (GObject *object)
   project = ide_context_get_project (context);
   vcs = ide_context_get_vcs (context);
 
-  workdir = ide_vcs_get_working_directory (vcs);
-
   g_signal_connect_object (vcs,
                            "changed",
                            G_CALLBACK (gb_file_search_provider_vcs_changed_cb),
@@ -297,15 +368,7 @@ gb_file_search_provider_constructed (GObject *object)
                            self,
                            G_CONNECT_SWAPPED);
 
-  index = g_object_new (GB_TYPE_FILE_SEARCH_INDEX,
-                        "context", context,
-                        "root-directory", workdir,
-                        NULL);
-
-  gb_file_search_index_build_async (index,
-                                    NULL,
-                                    gb_file_search_provider_build_cb,
-                                    g_object_ref (self));
+  gb_file_search_provider_rebuild (self);
 
   G_OBJECT_CLASS (gb_file_search_provider_parent_class)->constructed (object);
 }
@@ -315,7 +378,16 @@ gb_file_search_provider_finalize (GObject *object)
 {
   GbFileSearchProvider *self = (GbFileSearchProvider *)object;
 
+  if (self->rebuild_source != 0)
+    {
+      g_source_remove (self->rebuild_source);
+      self->rebuild_source = 0;
+    }
+
+  g_cancellable_cancel (self->rebuild_cancellable);
+  g_clear_object (&self->rebuild_cancellable);
   g_clear_object (&self->index);
+  g_clear_object (&self->progress);
 
   G_OBJECT_CLASS (gb_file_search_provider_parent_class)->finalize (object);
 }
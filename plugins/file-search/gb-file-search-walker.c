@@ -0,0 +1,619 @@
+/* gb-file-search-walker.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "gb-file-search-walker"
+
+#include "gb-file-search-walker.h"
+
+/*
+ * GbFileSearchWalker walks a directory tree using a number of threads.
+ *
+ * Every worker has its own queue of directories. Subdirectories that are
+ * discovered are pushed onto the queue of the worker that found them and
+ * popped from the tail, so a worker tends to stay depth-first within the
+ * same part of the tree. When a worker runs out of work, it steals from
+ * the head of another worker's queue, which is where the shallowest (and
+ * therefore likely largest) directories are.
+ *
+ * Files are collected into per-worker batches so that the consumer (which
+ * must be serialized) is only entered once per BATCH_SIZE files.
+ *
+ * IdeVcs implementations are not required to be thread-safe, so ignore
+ * checks are serialized. To keep workers from contending on that for every
+ * file, a worker enumerates a whole directory first and then checks all of
+ * its children while holding the lock once. Ignored subdirectories are never
+ * queued, so nothing below them is checked at all.
+ */
+
+#define BATCH_SIZE        512
+#define MAX_WORKERS       8
+#define PROGRESS_INTERVAL 64
+
+typedef struct
+{
+  GFile   *directory;
+  gchar   *relpath;
+  guint64  mtime;
+} WalkItem;
+
+typedef struct
+{
+  GFile   *file;
+  gchar   *path;
+  guint64  mtime;
+  guint    is_dir : 1;
+  guint    ignored : 1;
+} WalkChild;
+
+typedef struct
+{
+  GMutex mutex;
+  GQueue queue;
+} WalkQueue;
+
+typedef struct
+{
+  GbFileSearchWalker *walker;
+  GPtrArray          *batch;
+  guint               id;
+} Worker;
+
+struct _GbFileSearchWalker
+{
+  GFile                           *root_directory;
+  IdeVcs                          *vcs;
+  IdeProgress                     *progress;
+  gchar                           *prefix;
+  GbFileSearchWalkerDirectoryFunc  directory_func;
+  guint                            n_workers;
+
+  /* The following are only valid during gb_file_search_walker_run() */
+  GbFileSearchWalkerFunc           func;
+  gpointer                         user_data;
+  GCancellable                    *cancellable;
+  WalkQueue                       *queues;
+
+  /* Serializes calls to func */
+  GMutex                           func_mutex;
+
+  /* Used to sleep idle workers until more work is available */
+  GMutex                           idle_mutex;
+  GCond                            idle_cond;
+
+  /* Directories queued or being processed */
+  volatile gint                    pending;
+  /* Directories queued and not yet taken by a worker */
+  volatile gint                    queued;
+  volatile gint                    n_files;
+  volatile gint                    n_dirs;
+  volatile gint                    n_dirs_done;
+};
+
+/* IdeVcs implementations are not required to be thread-safe */
+G_LOCK_DEFINE_STATIC (vcs_lock);
+
+static void
+walk_item_free (WalkItem *item)
+{
+  g_clear_object (&item->directory);
+  g_clear_pointer (&item->relpath, g_free);
+  g_slice_free (WalkItem, item);
+}
+
+static void
+walk_child_clear (gpointer data)
+{
+  WalkChild *child = data;
+
+  g_clear_object (&child->file);
+  g_clear_pointer (&child->path, g_free);
+}
+
+/**
+ * gb_file_search_walker_new:
+ * @root_directory: the directory to walk
+ * @vcs: (nullable): an #IdeVcs to check for ignored files, or %NULL
+ *
+ * Returns: (transfer full): A new #GbFileSearchWalker
+ */
+GbFileSearchWalker *
+gb_file_search_walker_new (GFile  *root_directory,
+                           IdeVcs *vcs)
+{
+  GbFileSearchWalker *self;
+
+  g_return_val_if_fail (G_IS_FILE (root_directory), NULL);
+  g_return_val_if_fail (!vcs || IDE_IS_VCS (vcs), NULL);
+
+  self = g_slice_new0 (GbFileSearchWalker);
+  self->root_directory = g_object_ref (root_directory);
+  self->vcs = vcs ? g_object_ref (vcs) : NULL;
+  self->n_workers = CLAMP (g_get_num_processors (), 1, MAX_WORKERS);
+
+  g_mutex_init (&self->func_mutex);
+  g_mutex_init (&self->idle_mutex);
+  g_cond_init (&self->idle_cond);
+
+  return self;
+}
+
+void
+gb_file_search_walker_free (GbFileSearchWalker *self)
+{
+  if (self != NULL)
+    {
+      g_assert (self->queues == NULL);
+
+      g_clear_object (&self->root_directory);
+      g_clear_object (&self->vcs);
+      g_clear_object (&self->progress);
+      g_clear_pointer (&self->prefix, g_free);
+
+      g_mutex_clear (&self->func_mutex);
+      g_mutex_clear (&self->idle_mutex);
+      g_cond_clear (&self->idle_cond);
+
+      g_slice_free (GbFileSearchWalker, self);
+    }
+}
+
+void
+gb_file_search_walker_set_n_workers (GbFileSearchWalker *self,
+                                     guint               n_workers)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->queues == NULL);
+
+  self->n_workers = MAX (1, n_workers);
+}
+
+/**
+ * gb_file_search_walker_set_progress:
+ * @self: a #GbFileSearchWalker
+ * @progress: (nullable): an #IdeProgress to update while walking
+ *
+ * The total number of directories is not known up front, so the fraction
+ * is an estimate based on the directories discovered so far.
+ */
+void
+gb_file_search_walker_set_progress (GbFileSearchWalker *self,
+                                    IdeProgress        *progress)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->queues == NULL);
+  g_return_if_fail (!progress || IDE_IS_PROGRESS (progress));
+
+  g_set_object (&self->progress, progress);
+}
+
+/**
+ * gb_file_search_walker_set_prefix:
+ * @self: a #GbFileSearchWalker
+ * @prefix: (nullable): a relative path to prefix results with
+ *
+ * Sets the relative path of the root directory, so that a subtree can be
+ * walked while producing paths relative to an ancestor.
+ */
+void
+gb_file_search_walker_set_prefix (GbFileSearchWalker *self,
+                                  const gchar        *prefix)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->queues == NULL);
+
+  if (prefix != NULL && *prefix == '\0')
+    prefix = NULL;
+
+  g_free (self->prefix);
+  self->prefix = g_strdup (prefix);
+}
+
+/**
+ * gb_file_search_walker_set_directory_func:
+ * @self: a #GbFileSearchWalker
+ * @func: (nullable): a #GbFileSearchWalkerDirectoryFunc
+ *
+ * Sets a function to be called for every directory that is walked. It
+ * is called with the same user_data as provided to
+ * gb_file_search_walker_run().
+ */
+void
+gb_file_search_walker_set_directory_func (GbFileSearchWalker              *self,
+                                          GbFileSearchWalkerDirectoryFunc  func)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->queues == NULL);
+
+  self->directory_func = func;
+}
+
+guint
+gb_file_search_walker_get_n_files (GbFileSearchWalker *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return g_atomic_int_get (&self->n_files);
+}
+
+/**
+ * gb_file_search_vcs_is_ignored:
+ * @vcs: an #IdeVcs
+ * @file: a #GFile
+ *
+ * Like ide_vcs_is_ignored(), but safe to call from any thread as long as
+ * everything within the file search plugin uses this instead.
+ *
+ * Returns: %TRUE if @file is ignored.
+ */
+gboolean
+gb_file_search_vcs_is_ignored (IdeVcs *vcs,
+                               GFile  *file)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (IDE_IS_VCS (vcs), FALSE);
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+
+  G_LOCK (vcs_lock);
+  ret = ide_vcs_is_ignored (vcs, file, NULL);
+  G_UNLOCK (vcs_lock);
+
+  return ret;
+}
+
+static void
+gb_file_search_walker_check_ignored (GbFileSearchWalker *self,
+                                     GArray             *children)
+{
+  g_assert (self != NULL);
+  g_assert (children != NULL);
+
+  if (self->vcs == NULL || children->len == 0)
+    return;
+
+  G_LOCK (vcs_lock);
+
+  for (guint i = 0; i < children->len; i++)
+    {
+      WalkChild *child = &g_array_index (children, WalkChild, i);
+
+      child->ignored = ide_vcs_is_ignored (self->vcs, child->file, NULL);
+    }
+
+  G_UNLOCK (vcs_lock);
+}
+
+static void
+gb_file_search_walker_push (GbFileSearchWalker *self,
+                            guint               id,
+                            GFile              *directory,
+                            gchar              *relpath,
+                            guint64             mtime)
+{
+  WalkQueue *queue = &self->queues [id];
+  WalkItem *item;
+
+  item = g_slice_new0 (WalkItem);
+  item->directory = directory;
+  item->relpath = relpath;
+  item->mtime = mtime;
+
+  g_atomic_int_inc (&self->pending);
+  g_atomic_int_inc (&self->n_dirs);
+
+  g_mutex_lock (&queue->mutex);
+  g_queue_push_tail (&queue->queue, item);
+  g_mutex_unlock (&queue->mutex);
+
+  g_atomic_int_inc (&self->queued);
+
+  /*
+   * Wake up an idle worker so that it may steal this. Idle workers check
+   * queued while holding idle_mutex, so they either see the item or are
+   * already waiting when we signal.
+   */
+  g_mutex_lock (&self->idle_mutex);
+  g_cond_signal (&self->idle_cond);
+  g_mutex_unlock (&self->idle_mutex);
+}
+
+static WalkItem *
+gb_file_search_walker_pop (GbFileSearchWalker *self,
+                           guint               id)
+{
+  WalkItem *item;
+
+  g_mutex_lock (&self->queues [id].mutex);
+  item = g_queue_pop_tail (&self->queues [id].queue);
+  g_mutex_unlock (&self->queues [id].mutex);
+
+  for (guint i = 1; item == NULL && i < self->n_workers; i++)
+    {
+      WalkQueue *victim = &self->queues [(id + i) % self->n_workers];
+
+      g_mutex_lock (&victim->mutex);
+      item = g_queue_pop_head (&victim->queue);
+      g_mutex_unlock (&victim->mutex);
+    }
+
+  if (item != NULL)
+    g_atomic_int_add (&self->queued, -1);
+
+  return item;
+}
+
+static void
+worker_flush (Worker *worker)
+{
+  GbFileSearchWalker *self = worker->walker;
+
+  if (worker->batch->len == 0)
+    return;
+
+  g_mutex_lock (&self->func_mutex);
+  self->func ((const gchar * const *)worker->batch->pdata,
+              worker->batch->len,
+              self->user_data);
+  g_mutex_unlock (&self->func_mutex);
+
+  g_atomic_int_add (&self->n_files, worker->batch->len);
+
+  g_ptr_array_set_size (worker->batch, 0);
+}
+
+static void
+worker_update_progress (Worker *worker)
+{
+  GbFileSearchWalker *self = worker->walker;
+  guint n_dirs = g_atomic_int_get (&self->n_dirs);
+  guint n_dirs_done = g_atomic_int_get (&self->n_dirs_done);
+
+  if (n_dirs > 0 && n_dirs_done < n_dirs)
+    ide_progress_set_fraction (self->progress, (gdouble)n_dirs_done / (gdouble)n_dirs);
+}
+
+static void
+worker_process (Worker   *worker,
+                WalkItem *item)
+{
+  GbFileSearchWalker *self = worker->walker;
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  g_autoptr(GArray) children = NULL;
+  gpointer file_info_ptr;
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    return;
+
+  if (self->directory_func != NULL)
+    {
+      g_mutex_lock (&self->func_mutex);
+      self->directory_func (item->relpath ? item->relpath : "", item->mtime, self->user_data);
+      g_mutex_unlock (&self->func_mutex);
+    }
+
+  enumerator = g_file_enumerate_children (item->directory,
+                                          G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME","
+                                          G_FILE_ATTRIBUTE_STANDARD_TYPE","
+                                          G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                          G_FILE_QUERY_INFO_NONE,
+                                          self->cancellable,
+                                          NULL);
+
+  if (enumerator == NULL)
+    return;
+
+  children = g_array_new (FALSE, FALSE, sizeof (WalkChild));
+  g_array_set_clear_func (children, walk_child_clear);
+
+  while ((file_info_ptr = g_file_enumerator_next_file (enumerator, self->cancellable, NULL)))
+    {
+      g_autoptr(GFileInfo) file_info = file_info_ptr;
+      WalkChild child = { 0 };
+      const gchar *name;
+
+      name = g_file_info_get_display_name (file_info);
+
+      child.file = g_file_get_child (item->directory, name);
+      child.mtime = g_file_info_get_attribute_uint64 (file_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      child.is_dir = g_file_info_get_file_type (file_info) == G_FILE_TYPE_DIRECTORY;
+
+      if (item->relpath != NULL)
+        child.path = g_build_filename (item->relpath, name, NULL);
+      else
+        child.path = g_strdup (name);
+
+      g_array_append_val (children, child);
+    }
+
+  gb_file_search_walker_check_ignored (self, children);
+
+  for (guint i = 0; i < children->len; i++)
+    {
+      WalkChild *child = &g_array_index (children, WalkChild, i);
+
+      if (child->ignored)
+        continue;
+
+      if (child->is_dir)
+        {
+          gb_file_search_walker_push (self,
+                                      worker->id,
+                                      g_steal_pointer (&child->file),
+                                      g_steal_pointer (&child->path),
+                                      child->mtime);
+          continue;
+        }
+
+      g_ptr_array_add (worker->batch, g_steal_pointer (&child->path));
+
+      if (worker->batch->len >= BATCH_SIZE)
+        worker_flush (worker);
+    }
+}
+
+static gpointer
+worker_run (gpointer data)
+{
+  Worker *worker = data;
+  GbFileSearchWalker *self = worker->walker;
+
+  for (;;)
+    {
+      WalkItem *item;
+      guint n_dirs_done;
+
+      if (!(item = gb_file_search_walker_pop (self, worker->id)))
+        {
+          if (g_atomic_int_get (&self->pending) == 0)
+            break;
+
+          /*
+           * Someone is still processing a directory and may produce more
+           * work. Sleep until something is queued or everything is done.
+           */
+          g_mutex_lock (&self->idle_mutex);
+          while (g_atomic_int_get (&self->queued) == 0 &&
+                 g_atomic_int_get (&self->pending) != 0)
+            g_cond_wait (&self->idle_cond, &self->idle_mutex);
+          g_mutex_unlock (&self->idle_mutex);
+
+          continue;
+        }
+
+      worker_process (worker, item);
+      walk_item_free (item);
+
+      n_dirs_done = g_atomic_int_add (&self->n_dirs_done, 1) + 1;
+
+      if (self->progress != NULL && (n_dirs_done % PROGRESS_INTERVAL) == 0)
+        worker_update_progress (worker);
+
+      if (g_atomic_int_dec_and_test (&self->pending))
+        {
+          g_mutex_lock (&self->idle_mutex);
+          g_cond_broadcast (&self->idle_cond);
+          g_mutex_unlock (&self->idle_mutex);
+        }
+    }
+
+  worker_flush (worker);
+
+  return NULL;
+}
+
+/**
+ * gb_file_search_walker_run:
+ * @self: a #GbFileSearchWalker
+ * @func: (scope call): a function to call with batches of files
+ * @user_data: closure data for @func
+ * @cancellable: (nullable): a #GCancellable or %NULL
+ * @error: a location for a #GError or %NULL
+ *
+ * Walks the directory tree, blocking until the walk has completed. The
+ * calling thread is used as one of the workers, so this should be called
+ * from a thread pool rather than the main thread.
+ *
+ * Returns: %TRUE if the walk completed; otherwise %FALSE and @error is set.
+ */
+gboolean
+gb_file_search_walker_run (GbFileSearchWalker      *self,
+                           GbFileSearchWalkerFunc   func,
+                           gpointer                 user_data,
+                           GCancellable            *cancellable,
+                           GError                 **error)
+{
+  g_autoptr(GPtrArray) threads = NULL;
+  g_autoptr(GFileInfo) root_info = NULL;
+  g_autofree Worker *workers = NULL;
+  guint64 root_mtime = 0;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+  g_return_val_if_fail (!cancellable || G_IS_CANCELLABLE (cancellable), FALSE);
+  g_return_val_if_fail (self->queues == NULL, FALSE);
+
+  self->func = func;
+  self->user_data = user_data;
+  self->cancellable = cancellable;
+  self->pending = 0;
+  self->queued = 0;
+  self->n_files = 0;
+  self->n_dirs = 0;
+  self->n_dirs_done = 0;
+
+  self->queues = g_new0 (WalkQueue, self->n_workers);
+  workers = g_new0 (Worker, self->n_workers);
+
+  for (guint i = 0; i < self->n_workers; i++)
+    {
+      g_mutex_init (&self->queues [i].mutex);
+      g_queue_init (&self->queues [i].queue);
+
+      workers [i].walker = self;
+      workers [i].id = i;
+      workers [i].batch = g_ptr_array_new_with_free_func (g_free);
+    }
+
+  root_info = g_file_query_info (self->root_directory,
+                                 G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                                 G_FILE_QUERY_INFO_NONE,
+                                 cancellable,
+                                 NULL);
+  if (root_info != NULL)
+    root_mtime = g_file_info_get_attribute_uint64 (root_info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+
+  /* Children are checked by their parent, so only the root is checked here */
+  if (self->vcs == NULL || !gb_file_search_vcs_is_ignored (self->vcs, self->root_directory))
+    gb_file_search_walker_push (self,
+                                0,
+                                g_object_ref (self->root_directory),
+                                g_strdup (self->prefix),
+                                root_mtime);
+
+  threads = g_ptr_array_new ();
+
+  for (guint i = 1; i < self->n_workers; i++)
+    g_ptr_array_add (threads, g_thread_new ("gb-file-search-walker", worker_run, &workers [i]));
+
+  worker_run (&workers [0]);
+
+  for (guint i = 0; i < threads->len; i++)
+    g_thread_join (g_ptr_array_index (threads, i));
+
+  for (guint i = 0; i < self->n_workers; i++)
+    {
+      g_assert (g_queue_is_empty (&self->queues [i].queue));
+
+      g_mutex_clear (&self->queues [i].mutex);
+      g_ptr_array_unref (workers [i].batch);
+    }
+
+  g_clear_pointer (&self->queues, g_free);
+
+  self->func = NULL;
+  self->user_data = NULL;
+  self->cancellable = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  if (self->progress != NULL)
+    ide_progress_set_fraction (self->progress, 1.0);
+
+  return TRUE;
+}
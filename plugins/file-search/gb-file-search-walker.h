@@ -0,0 +1,79 @@
+/* gb-file-search-walker.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GB_FILE_SEARCH_WALKER_H
+#define GB_FILE_SEARCH_WALKER_H
+
+#include <ide.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GbFileSearchWalker GbFileSearchWalker;
+
+/**
+ * GbFileSearchWalkerFunc:
+ * @paths: (array length=n_paths): relative paths of the files found
+ * @n_paths: the number of paths
+ * @user_data: closure data
+ *
+ * Called with batches of files as they are discovered. This is called
+ * from the walker threads, but never concurrently.
+ */
+typedef void (*GbFileSearchWalkerFunc) (const gchar * const *paths,
+                                        guint                n_paths,
+                                        gpointer             user_data);
+
+/**
+ * GbFileSearchWalkerDirectoryFunc:
+ * @relative_path: the relative path of the directory, or "" for the root
+ * @mtime: the modification time of the directory
+ * @user_data: closure data
+ *
+ * Called for every directory that is walked. This is serialized with
+ * #GbFileSearchWalkerFunc.
+ */
+typedef void (*GbFileSearchWalkerDirectoryFunc) (const gchar *relative_path,
+                                                 guint64      mtime,
+                                                 gpointer     user_data);
+
+GbFileSearchWalker *gb_file_search_walker_new                (GFile                            *root_directory,
+                                                              IdeVcs                           *vcs);
+void                gb_file_search_walker_free               (GbFileSearchWalker               *self);
+void                gb_file_search_walker_set_n_workers      (GbFileSearchWalker               *self,
+                                                              guint                             n_workers);
+void                gb_file_search_walker_set_progress       (GbFileSearchWalker               *self,
+                                                              IdeProgress                      *progress);
+void                gb_file_search_walker_set_prefix         (GbFileSearchWalker               *self,
+                                                              const gchar                      *prefix);
+void                gb_file_search_walker_set_directory_func (GbFileSearchWalker               *self,
+                                                              GbFileSearchWalkerDirectoryFunc   func);
+guint               gb_file_search_walker_get_n_files        (GbFileSearchWalker               *self);
+gboolean            gb_file_search_walker_run                (GbFileSearchWalker               *self,
+                                                              GbFileSearchWalkerFunc            func,
+                                                              gpointer                          user_data,
+                                                              GCancellable                     *cancellable,
+                                                              GError                          **error);
+
+gboolean            gb_file_search_vcs_is_ignored            (IdeVcs                           *vcs,
+                                                              GFile                            *file);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GbFileSearchWalker, gb_file_search_walker_free)
+
+G_END_DECLS
+
+#endif /* GB_FILE_SEARCH_WALKER_H */
@@ -21,8 +21,10 @@
 #include <dazzle.h>
 #include <glib/gi18n.h>
 #include <libgit2-glib/ggit.h>
+#include <string.h>
 
 #include "ide-git-buffer-change-monitor.h"
+#include "ide-git-line-model.h"
 #include "ide-git-vcs.h"
 
 /**
@@ -40,9 +42,18 @@
  * Upon completion of the diff, the results will be passed back to the primary thread and the
  * state updated for use by line change renderer in the source view.
  *
+ * Along with the state of each line, we keep the line of the blob that each unchanged line
+ * matches. As the buffer is edited, both are shifted on the primary thread and the edited lines
+ * are tracked. The next pass then only needs to diff the edited region between the closest
+ * unchanged lines, against a line-hashed model of the blob that is kept alongside the blob. If
+ * that region turns out to be large, we fall back to diffing the whole buffer with libgit2.
+ *
  * TODO: Move the thread work into ide_thread_pool?
  */
 
+#define MAX_INCREMENTAL_LINES 2000
+#define MAX_INCREMENTAL_EDITS 256
+
 struct _IdeGitBufferChangeMonitor
 {
   IdeBufferChangeMonitor  parent_instance;
@@ -53,9 +64,19 @@ struct _IdeGitBufferChangeMonitor
   IdeBuffer              *buffer;
 
   GgitRepository         *repository;
-  GHashTable             *state;
+
+  /* An IdeBufferLineChange for each line of the buffer */
+  GArray                 *state;
+
+  /* The line of the blob matching each unchanged line of the buffer, or -1 */
+  GArray                 *base_lines;
 
   GgitBlob               *cached_blob;
+  IdeGitLineModel        *cached_base;
+
+  /* The lines edited since base_lines was last computed, end is exclusive */
+  guint                   dirty_begin;
+  guint                   dirty_end;
 
   guint                   changed_timeout;
 
@@ -67,14 +88,29 @@ struct _IdeGitBufferChangeMonitor
 
 typedef struct
 {
-  GgitRepository *repository;
-  GHashTable     *state;
-  GFile          *file;
-  GBytes         *content;
-  GgitBlob       *blob;
-  guint           is_child_of_workdir : 1;
+  GgitRepository  *repository;
+  GArray          *state;
+  GArray          *base_lines;
+  GFile           *file;
+  IdeRope         *rope;
+  GBytes          *content;
+  GgitBlob        *blob;
+  IdeGitLineModel *base;
+  gsize            change_count;
+  guint            dirty_begin;
+  guint            dirty_end;
+  guint            is_child_of_workdir : 1;
+  guint            trailing_newline : 1;
 } DiffTask;
 
+typedef struct
+{
+  gboolean *added;
+  guint     n_added;
+  gboolean *deleted;
+  guint     n_deleted;
+} DiffLines;
+
 G_DEFINE_TYPE (IdeGitBufferChangeMonitor,
                ide_git_buffer_change_monitor,
                IDE_TYPE_BUFFER_CHANGE_MONITOR)
@@ -102,12 +138,153 @@ diff_task_free (gpointer data)
       g_clear_object (&diff->file);
       g_clear_object (&diff->blob);
       g_clear_object (&diff->repository);
-      g_clear_pointer (&diff->state, g_hash_table_unref);
+      g_clear_pointer (&diff->state, g_array_unref);
+      g_clear_pointer (&diff->base_lines, g_array_unref);
+      g_clear_pointer (&diff->rope, ide_rope_unref);
       g_clear_pointer (&diff->content, g_bytes_unref);
+      g_clear_pointer (&diff->base, ide_git_line_model_unref);
+      g_slice_free (DiffTask, diff);
+    }
+}
+
+static GArray *
+copy_array (GArray *array)
+{
+  guint element_size = g_array_get_element_size (array);
+  GArray *copy;
+
+  copy = g_array_sized_new (FALSE, FALSE, element_size, array->len);
+  g_array_append_vals (copy, array->data, array->len);
+
+  return copy;
+}
+
+/* Inserts @n_items copies of @item at @position */
+static void
+insert_items (GArray        *array,
+              guint          position,
+              guint          n_items,
+              gconstpointer  item)
+{
+  guint element_size = g_array_get_element_size (array);
+  guint old_len = array->len;
+
+  g_assert (position <= old_len);
+
+  g_array_set_size (array, old_len + n_items);
+
+  memmove (array->data + (position + n_items) * element_size,
+           array->data + position * element_size,
+           (old_len - position) * element_size);
+
+  for (guint i = 0; i < n_items; i++)
+    memcpy (array->data + (position + i) * element_size, item, element_size);
+}
+
+static void
+ide_git_buffer_change_monitor_mark_dirty (IdeGitBufferChangeMonitor *self,
+                                          guint                      begin,
+                                          guint                      end)
+{
+  g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
+  g_assert (begin < end);
+
+  if (self->dirty_begin >= self->dirty_end)
+    {
+      self->dirty_begin = begin;
+      self->dirty_end = end;
+    }
+  else
+    {
+      self->dirty_begin = MIN (self->dirty_begin, begin);
+      self->dirty_end = MAX (self->dirty_end, end);
+    }
+}
+
+/*
+ * Called when @n_lines lines have been inserted after @line. The new lines are considered added
+ * until the next pass tells us otherwise.
+ */
+static void
+ide_git_buffer_change_monitor_insert_lines (IdeGitBufferChangeMonitor *self,
+                                            guint                      line,
+                                            guint                      n_lines)
+{
+  g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
+
+  if (n_lines > 0)
+    {
+      if (self->state != NULL)
+        {
+          guint8 added = IDE_BUFFER_LINE_CHANGE_ADDED;
+
+          insert_items (self->state, MIN (line + 1, self->state->len), n_lines, &added);
+        }
+
+      if (self->base_lines != NULL)
+        {
+          gint unknown = -1;
+
+          /* If we lost track of the lines, the next pass has to start over */
+          if (line < self->base_lines->len)
+            insert_items (self->base_lines, line + 1, n_lines, &unknown);
+          else
+            g_clear_pointer (&self->base_lines, g_array_unref);
+        }
+
+      if (self->dirty_begin < self->dirty_end)
+        {
+          if (self->dirty_begin > line)
+            self->dirty_begin += n_lines;
+          if (self->dirty_end > line)
+            self->dirty_end += n_lines;
+        }
     }
+
+  ide_git_buffer_change_monitor_mark_dirty (self, line, line + n_lines + 1);
 }
 
-static GHashTable *
+/*
+ * Called when the @n_lines lines after @line are about to be joined with @line.
+ */
+static void
+ide_git_buffer_change_monitor_delete_lines (IdeGitBufferChangeMonitor *self,
+                                            guint                      line,
+                                            guint                      n_lines)
+{
+  g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
+
+  if (n_lines > 0)
+    {
+      if (self->state != NULL && line + 1 < self->state->len)
+        g_array_remove_range (self->state, line + 1, MIN (n_lines, self->state->len - line - 1));
+
+      if (self->base_lines != NULL)
+        {
+          if (line + n_lines < self->base_lines->len)
+            g_array_remove_range (self->base_lines, line + 1, n_lines);
+          else
+            g_clear_pointer (&self->base_lines, g_array_unref);
+        }
+
+      if (self->dirty_begin < self->dirty_end)
+        {
+          if (self->dirty_begin > line + n_lines)
+            self->dirty_begin -= n_lines;
+          else if (self->dirty_begin > line)
+            self->dirty_begin = line;
+
+          if (self->dirty_end > line + n_lines + 1)
+            self->dirty_end -= n_lines;
+          else if (self->dirty_end > line + 1)
+            self->dirty_end = line + 1;
+        }
+    }
+
+  ide_git_buffer_change_monitor_mark_dirty (self, line, line + 1);
+}
+
+static gboolean
 ide_git_buffer_change_monitor_calculate_finish (IdeGitBufferChangeMonitor  *self,
                                                 GAsyncResult               *result,
                                                 GError                    **error)
@@ -120,14 +297,51 @@ ide_git_buffer_change_monitor_calculate_finish (IdeGitBufferChangeMonitor  *self
 
   diff = g_task_get_task_data (task);
 
-  /* Keep the blob around for future use */
+  /* Keep the blob and its lines around for future use */
   if (diff->blob != self->cached_blob)
     g_set_object (&self->cached_blob, diff->blob);
 
+  if (diff->base != self->cached_base)
+    {
+      g_clear_pointer (&self->cached_base, ide_git_line_model_unref);
+      if (diff->base != NULL)
+        self->cached_base = ide_git_line_model_ref (diff->base);
+    }
+
   /* If the file is a child of the working directory, we need to know */
   self->is_child_of_workdir = diff->is_child_of_workdir;
 
-  return g_task_propagate_pointer (task, error);
+  if (!g_task_propagate_boolean (task, error))
+    return FALSE;
+
+  if (self->buffer == NULL)
+    return TRUE;
+
+  if (diff->change_count == ide_buffer_get_change_count (self->buffer))
+    {
+      g_clear_pointer (&self->state, g_array_unref);
+      g_clear_pointer (&self->base_lines, g_array_unref);
+
+      self->state = g_steal_pointer (&diff->state);
+      self->base_lines = g_steal_pointer (&diff->base_lines);
+      self->dirty_begin = 0;
+      self->dirty_end = 0;
+    }
+  else if (self->state == NULL)
+    {
+      /*
+       * The buffer changed while we were working, so the lines no longer match. Show what we
+       * have for now, the next pass will have to diff the whole buffer.
+       */
+      self->state = g_steal_pointer (&diff->state);
+    }
+
+  /*
+   * Otherwise we keep the lines we have been shifting along with the edits, the next pass covers
+   * the lines we diffed here as they are still marked as dirty.
+   */
+
+  return TRUE;
 }
 
 static void
@@ -165,9 +379,23 @@ ide_git_buffer_change_monitor_calculate_async (IdeGitBufferChangeMonitor *self,
   diff = g_slice_new0 (DiffTask);
   diff->file = g_object_ref (gfile);
   diff->repository = g_object_ref (self->repository);
-  diff->state = g_hash_table_new (g_direct_hash, g_direct_equal);
-  diff->content = ide_buffer_get_content (self->buffer);
+  diff->rope = ide_buffer_get_rope (self->buffer);
+  diff->trailing_newline = gtk_source_buffer_get_implicit_trailing_newline (GTK_SOURCE_BUFFER (self->buffer));
   diff->blob = self->cached_blob ? g_object_ref (self->cached_blob) : NULL;
+  diff->change_count = ide_buffer_get_change_count (self->buffer);
+
+  /* The lines of the blob stay valid for as long as we keep the blob */
+  if (self->cached_blob != NULL && self->cached_base != NULL)
+    diff->base = ide_git_line_model_ref (self->cached_base);
+
+  /* The worker can only update the previous state if it is diffing against the same blob */
+  if (diff->base != NULL && self->state != NULL && self->base_lines != NULL)
+    {
+      diff->state = copy_array (self->state);
+      diff->base_lines = copy_array (self->base_lines);
+      diff->dirty_begin = self->dirty_begin;
+      diff->dirty_end = self->dirty_end;
+    }
 
   g_task_set_task_data (task, diff, diff_task_free);
 
@@ -181,8 +409,7 @@ ide_git_buffer_change_monitor_get_change (IdeBufferChangeMonitor *monitor,
                                           const GtkTextIter      *iter)
 {
   IdeGitBufferChangeMonitor *self = (IdeGitBufferChangeMonitor *)monitor;
-  gpointer key;
-  gpointer value;
+  guint line;
 
   g_return_val_if_fail (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self), IDE_BUFFER_LINE_CHANGE_NONE);
   g_return_val_if_fail (iter, IDE_BUFFER_LINE_CHANGE_NONE);
@@ -197,10 +424,12 @@ ide_git_buffer_change_monitor_get_change (IdeBufferChangeMonitor *monitor,
       return IDE_BUFFER_LINE_CHANGE_NONE;
     }
 
-  key = GINT_TO_POINTER (gtk_text_iter_get_line (iter) + 1);
-  value = g_hash_table_lookup (self->state, key);
+  line = gtk_text_iter_get_line (iter);
+
+  if (line < self->state->len)
+    return g_array_index (self->state, guint8, line);
 
-  return GPOINTER_TO_INT (value);
+  return IDE_BUFFER_LINE_CHANGE_NONE;
 }
 
 static void
@@ -219,25 +448,17 @@ ide_git_buffer_change_monitor__calculate_cb (GObject      *object,
                                              gpointer      user_data_unused)
 {
   IdeGitBufferChangeMonitor *self = (IdeGitBufferChangeMonitor *)object;
-  g_autoptr(GHashTable) ret = NULL;
   g_autoptr(GError) error = NULL;
 
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
 
   self->in_calculation = FALSE;
 
-  ret = ide_git_buffer_change_monitor_calculate_finish (self, result, &error);
-
-  if (!ret)
+  if (!ide_git_buffer_change_monitor_calculate_finish (self, result, &error))
     {
       if (!g_error_matches (error, GGIT_ERROR, GGIT_ERROR_NOTFOUND))
         g_message ("%s", error->message);
     }
-  else
-    {
-      g_clear_pointer (&self->state, g_hash_table_unref);
-      self->state = g_hash_table_ref (ret);
-    }
 
   ide_buffer_change_monitor_emit_changed (IDE_BUFFER_CHANGE_MONITOR (self));
 
@@ -304,6 +525,10 @@ ide_git_buffer_change_monitor__buffer_delete_range_cb (IdeGitBufferChangeMonitor
   g_assert (end);
   g_assert (IDE_IS_BUFFER (buffer));
 
+  ide_git_buffer_change_monitor_delete_lines (self,
+                                              gtk_text_iter_get_line (begin),
+                                              gtk_text_iter_get_line (end) - gtk_text_iter_get_line (begin));
+
   /*
    * We need to recalculate the diff when text is deleted if:
    *
@@ -342,6 +567,9 @@ ide_git_buffer_change_monitor__buffer_insert_text_after_cb (IdeGitBufferChangeMo
                                                             IdeBuffer                 *buffer)
 {
   IdeBufferLineChange change;
+  const gchar *pos = text;
+  const gchar *end = text + len;
+  guint n_lines = 0;
 
   IDE_ENTRY;
 
@@ -350,6 +578,17 @@ ide_git_buffer_change_monitor__buffer_insert_text_after_cb (IdeGitBufferChangeMo
   g_assert (text);
   g_assert (IDE_IS_BUFFER (buffer));
 
+  while ((pos = memchr (pos, '\n', end - pos)))
+    {
+      n_lines++;
+      pos++;
+    }
+
+  /* @location has been moved to the end of the inserted text */
+  ide_git_buffer_change_monitor_insert_lines (self,
+                                              gtk_text_iter_get_line (location) - n_lines,
+                                              n_lines);
+
   /*
    * We need to recalculate the diff when text is inserted if:
    *
@@ -361,7 +600,7 @@ ide_git_buffer_change_monitor__buffer_insert_text_after_cb (IdeGitBufferChangeMo
    * more conservative timeout, generated by ide_git_buffer_change_monitor__buffer_changed_cb().
    */
 
-  if (NULL != memmem (text, len, "\n", 1))
+  if (n_lines > 0)
     IDE_GOTO (recalculate);
 
   change = ide_git_buffer_change_monitor_get_change (IDE_BUFFER_CHANGE_MONITOR (self), location);
@@ -423,6 +662,11 @@ ide_git_buffer_change_monitor_reload (IdeBufferChangeMonitor *monitor)
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
 
   g_clear_object (&self->cached_blob);
+  g_clear_pointer (&self->cached_base, ide_git_line_model_unref);
+
+  /* The lines we matched belong to the old blob */
+  g_clear_pointer (&self->base_lines, g_array_unref);
+
   ide_git_buffer_change_monitor_recalculate (self);
 
   IDE_EXIT;
@@ -477,15 +721,14 @@ diff_line_cb (GgitDiffDelta *delta,
               gpointer       user_data)
 {
   GgitDiffLineType type;
-  GHashTable *hash = user_data;
+  DiffLines *lines = user_data;
   gint new_lineno;
   gint old_lineno;
-  gint adjust;
 
   g_return_val_if_fail (delta, GGIT_ERROR_GIT_ERROR);
   g_return_val_if_fail (hunk, GGIT_ERROR_GIT_ERROR);
   g_return_val_if_fail (line, GGIT_ERROR_GIT_ERROR);
-  g_return_val_if_fail (hash, GGIT_ERROR_GIT_ERROR);
+  g_return_val_if_fail (lines, GGIT_ERROR_GIT_ERROR);
 
   type = ggit_diff_line_get_origin (line);
 
@@ -498,27 +741,13 @@ diff_line_cb (GgitDiffDelta *delta,
   switch (type)
     {
     case GGIT_DIFF_LINE_ADDITION:
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (new_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (new_lineno),
-                              GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_CHANGED));
-      else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (new_lineno),
-                             GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_ADDED));
+      if (new_lineno > 0 && (guint)new_lineno <= lines->n_added)
+        lines->added [new_lineno - 1] = TRUE;
       break;
 
     case GGIT_DIFF_LINE_DELETION:
-      adjust = (ggit_diff_hunk_get_new_start (hunk) - ggit_diff_hunk_get_old_start (hunk));
-      old_lineno += adjust;
-      if (g_hash_table_lookup (hash, GINT_TO_POINTER (old_lineno)))
-        g_hash_table_replace (hash,
-                              GINT_TO_POINTER (old_lineno),
-                              GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_CHANGED));
-      else
-        g_hash_table_insert (hash,
-                             GINT_TO_POINTER (old_lineno),
-                             GINT_TO_POINTER (IDE_BUFFER_LINE_CHANGE_DELETED));
+      if (old_lineno > 0 && (guint)old_lineno <= lines->n_deleted)
+        lines->deleted [old_lineno - 1] = TRUE;
       break;
 
     case GGIT_DIFF_LINE_CONTEXT:
@@ -537,6 +766,221 @@ diff_line_cb (GgitDiffDelta *delta,
   return 0;
 }
 
+/*
+ * Updates the state of the buffer lines [new_begin, new_end) from the added and deleted lines
+ * when compared to the blob lines [old_begin, old_end).
+ *
+ * Within each run of edits, lines replacing deleted lines are changed and the rest are added.
+ * If more lines were deleted than added, the line following the run is marked as deleted.
+ */
+static void
+apply_changes (DiffTask       *diff,
+               guint           new_begin,
+               guint           new_end,
+               guint           old_begin,
+               guint           old_end,
+               const gboolean *added,
+               const gboolean *deleted)
+{
+  guint8 *state;
+  gint *base_lines;
+  guint n_added = new_end - new_begin;
+  guint n_deleted = old_end - old_begin;
+  guint i = 0;
+  guint j = 0;
+
+  g_assert (diff != NULL);
+  g_assert (diff->state != NULL);
+  g_assert (diff->base_lines != NULL);
+  g_assert (new_end <= diff->state->len);
+  g_assert (diff->state->len == diff->base_lines->len);
+
+  state = (guint8 *)diff->state->data;
+  base_lines = (gint *)(gpointer)diff->base_lines->data;
+
+  /* The line after the range may have been marked by a deletion within it */
+  memset (state + new_begin, IDE_BUFFER_LINE_CHANGE_NONE, n_added);
+  if (new_end < diff->state->len)
+    state [new_end] = IDE_BUFFER_LINE_CHANGE_NONE;
+
+  while (i < n_added || j < n_deleted)
+    {
+      guint run_i = i;
+      guint run_j = j;
+
+      if (i < n_added && j < n_deleted && !added [i] && !deleted [j])
+        {
+          base_lines [new_begin + i] = old_begin + j;
+          i++;
+          j++;
+          continue;
+        }
+
+      /* Once either side runs out, the rest of the other side is part of the run */
+      while ((i < n_added && (added [i] || j >= n_deleted)) ||
+             (j < n_deleted && (deleted [j] || i >= n_added)))
+        {
+          if (i < n_added && (added [i] || j >= n_deleted))
+            i++;
+          else
+            j++;
+        }
+
+      for (guint k = run_i; k < i; k++)
+        {
+          if (k - run_i < j - run_j)
+            state [new_begin + k] = IDE_BUFFER_LINE_CHANGE_CHANGED;
+          else
+            state [new_begin + k] = IDE_BUFFER_LINE_CHANGE_ADDED;
+          base_lines [new_begin + k] = -1;
+        }
+
+      if (j - run_j > i - run_i && new_begin + i < diff->state->len)
+        state [new_begin + i] = IDE_BUFFER_LINE_CHANGE_DELETED;
+    }
+}
+
+/*
+ * Diffs the lines edited since the previous pass, widened to the closest unchanged lines on
+ * either side, against the matching lines of the blob. Returns %FALSE if that is not possible
+ * or the edits are too large, in which case the whole buffer needs to be diffed.
+ */
+static gboolean
+ide_git_buffer_change_monitor_diff_incremental (DiffTask        *diff,
+                                                IdeGitLineModel *lines)
+{
+  g_autofree gboolean *added = NULL;
+  g_autofree gboolean *deleted = NULL;
+  const gint *base_lines;
+  guint n_lines;
+  guint new_begin;
+  guint new_end;
+  guint old_begin;
+  guint old_end;
+
+  g_assert (diff != NULL);
+  g_assert (lines != NULL);
+
+  n_lines = ide_git_line_model_get_n_lines (lines);
+
+  if (diff->base == NULL ||
+      diff->state == NULL ||
+      diff->base_lines == NULL ||
+      diff->state->len != n_lines ||
+      diff->base_lines->len != n_lines)
+    return FALSE;
+
+  if (diff->dirty_begin >= diff->dirty_end)
+    return TRUE;
+
+  base_lines = (const gint *)(gpointer)diff->base_lines->data;
+
+  new_begin = MIN (diff->dirty_begin, n_lines);
+  while (new_begin > 0 && base_lines [new_begin - 1] < 0)
+    new_begin--;
+
+  new_end = MIN (diff->dirty_end, n_lines);
+  while (new_end < n_lines && base_lines [new_end] < 0)
+    new_end++;
+
+  old_begin = new_begin > 0 ? base_lines [new_begin - 1] + 1 : 0;
+  old_end = new_end < n_lines ? (guint)base_lines [new_end] : ide_git_line_model_get_n_lines (diff->base);
+
+  if (old_begin > old_end ||
+      old_end > ide_git_line_model_get_n_lines (diff->base) ||
+      new_end - new_begin > MAX_INCREMENTAL_LINES ||
+      old_end - old_begin > MAX_INCREMENTAL_LINES)
+    return FALSE;
+
+  added = g_new0 (gboolean, new_end - new_begin);
+  deleted = g_new0 (gboolean, old_end - old_begin);
+
+  if (!ide_git_line_model_diff (diff->base, old_begin, old_end,
+                                lines, new_begin, new_end,
+                                MAX_INCREMENTAL_EDITS,
+                                deleted, added))
+    return FALSE;
+
+  apply_changes (diff, new_begin, new_end, old_begin, old_end, added, deleted);
+
+  return TRUE;
+}
+
+static gboolean
+ide_git_buffer_change_monitor_diff_full (DiffTask         *diff,
+                                         IdeGitLineModel  *lines,
+                                         const gchar      *relative_path,
+                                         GError          **error)
+{
+  g_autofree gboolean *added = NULL;
+  g_autofree gboolean *deleted = NULL;
+  DiffLines diff_lines;
+  const guint8 *data;
+  gsize data_len = 0;
+  guint n_lines;
+  guint n_base_lines;
+
+  g_assert (diff != NULL);
+  g_assert (diff->base != NULL);
+  g_assert (lines != NULL);
+
+  n_lines = ide_git_line_model_get_n_lines (lines);
+  n_base_lines = ide_git_line_model_get_n_lines (diff->base);
+
+  added = g_new0 (gboolean, n_lines);
+  deleted = g_new0 (gboolean, n_base_lines);
+
+  diff_lines.added = added;
+  diff_lines.n_added = n_lines;
+  diff_lines.deleted = deleted;
+  diff_lines.n_deleted = n_base_lines;
+
+  data = g_bytes_get_data (diff->content, &data_len);
+
+  ggit_diff_blob_to_buffer (diff->blob, relative_path, data, data_len, relative_path,
+                            NULL, NULL, NULL, NULL, diff_line_cb, &diff_lines, error);
+
+  if ((*error) != NULL)
+    return FALSE;
+
+  g_clear_pointer (&diff->state, g_array_unref);
+  g_clear_pointer (&diff->base_lines, g_array_unref);
+
+  diff->state = g_array_sized_new (FALSE, FALSE, sizeof (guint8), n_lines);
+  g_array_set_size (diff->state, n_lines);
+
+  diff->base_lines = g_array_sized_new (FALSE, FALSE, sizeof (gint), n_lines);
+  g_array_set_size (diff->base_lines, n_lines);
+
+  apply_changes (diff, 0, n_lines, 0, n_base_lines, added, deleted);
+
+  return TRUE;
+}
+
+/*
+ * Flattens the snapshot taken on the main thread. This is done here rather
+ * than with ide_buffer_get_content() so that the main thread only has to
+ * take a reference to the rope instead of copying the whole buffer.
+ */
+static GBytes *
+diff_task_get_content (DiffTask *diff)
+{
+  gchar *text;
+  gsize len;
+
+  g_assert (diff != NULL);
+  g_assert (diff->rope != NULL);
+
+  len = ide_rope_get_length (diff->rope);
+  text = g_malloc (len + 2);
+  ide_rope_flatten_into (diff->rope, text);
+  if (diff->trailing_newline)
+    text [len++] = '\n';
+  text [len] = '\0';
+
+  return g_bytes_new_take (text, len);
+}
+
 static gboolean
 ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *self,
                                                   DiffTask                   *diff,
@@ -544,15 +988,13 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
 {
   g_autofree gchar *relative_path = NULL;
   g_autoptr(GFile) workdir = NULL;
-  const guint8 *data;
-  gsize data_len = 0;
+  g_autoptr(IdeGitLineModel) lines = NULL;
 
   g_assert (IDE_IS_GIT_BUFFER_CHANGE_MONITOR (self));
   g_assert (diff);
   g_assert (G_IS_FILE (diff->file));
-  g_assert (diff->state);
   g_assert (GGIT_IS_REPOSITORY (diff->repository));
-  g_assert (diff->content);
+  g_assert (diff->rope);
   g_assert (!diff->blob || GGIT_IS_BLOB (diff->blob));
   g_assert (error);
   g_assert (!*error);
@@ -645,12 +1087,25 @@ ide_git_buffer_change_monitor_calculate_threaded (IdeGitBufferChangeMonitor  *se
       return FALSE;
     }
 
-  data = g_bytes_get_data (diff->content, &data_len);
+  /* The lines of the blob are cached by the main thread along with the blob */
+  if (!diff->base)
+    {
+      g_autoptr(GBytes) bytes = NULL;
+      const guchar *raw;
+      gsize raw_len = 0;
 
-  ggit_diff_blob_to_buffer (diff->blob, relative_path, data, data_len, relative_path,
-                            NULL, NULL, NULL, NULL, diff_line_cb, (gpointer)diff->state, error);
+      raw = ggit_blob_get_raw_content (diff->blob, &raw_len);
+      bytes = g_bytes_new (raw, raw_len);
+      diff->base = ide_git_line_model_new (bytes);
+    }
+
+  diff->content = diff_task_get_content (diff);
+  lines = ide_git_line_model_new (diff->content);
 
-  return ((*error) == NULL);
+  if (ide_git_buffer_change_monitor_diff_incremental (diff, lines))
+    return TRUE;
+
+  return ide_git_buffer_change_monitor_diff_full (diff, lines, relative_path, error);
 }
 
 static gpointer
@@ -673,8 +1128,7 @@ ide_git_buffer_change_monitor_worker (gpointer data)
       if (!ide_git_buffer_change_monitor_calculate_threaded (self, diff, &error))
         g_task_return_error (task, error);
       else
-        g_task_return_pointer (task, g_hash_table_ref (diff->state),
-                               (GDestroyNotify)g_hash_table_unref);
+        g_task_return_boolean (task, TRUE);
 
       g_object_unref (task);
     }
@@ -698,6 +1152,7 @@ ide_git_buffer_change_monitor_dispose (GObject *object)
   g_clear_object (&self->signal_group);
   g_clear_object (&self->vcs_signal_group);
   g_clear_object (&self->cached_blob);
+  g_clear_pointer (&self->cached_base, ide_git_line_model_unref);
   g_clear_object (&self->repository);
 
   G_OBJECT_CLASS (ide_git_buffer_change_monitor_parent_class)->dispose (object);
@@ -706,6 +1161,11 @@ ide_git_buffer_change_monitor_dispose (GObject *object)
 static void
 ide_git_buffer_change_monitor_finalize (GObject *object)
 {
+  IdeGitBufferChangeMonitor *self = (IdeGitBufferChangeMonitor *)object;
+
+  g_clear_pointer (&self->state, g_array_unref);
+  g_clear_pointer (&self->base_lines, g_array_unref);
+
   G_OBJECT_CLASS (ide_git_buffer_change_monitor_parent_class)->finalize (object);
 
   DZL_COUNTER_DEC (instances);
@@ -0,0 +1,276 @@
+/* ide-git-line-model.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define G_LOG_DOMAIN "ide-git-line-model"
+
+#include <string.h>
+
+#include "ide-git-line-model.h"
+
+/*
+ * A line model splits a document into lines the same way git does, and
+ * keeps a hash of each line so that lines can be compared without touching
+ * the text in the common case. The trailing newline is part of the line so
+ * that a missing newline at the end of the file is a change, like it is
+ * for git.
+ *
+ * Models are immutable once created, and may be shared between threads.
+ */
+
+typedef struct
+{
+  gsize  offset;
+  gsize  length;
+  guint  hash;
+} LineInfo;
+
+struct _IdeGitLineModel
+{
+  volatile gint  ref_count;
+  GBytes        *content;
+  GArray        *lines;
+};
+
+static guint
+hash_line (const guint8 *data,
+           gsize         length)
+{
+  guint hash = 5381;
+
+  for (gsize i = 0; i < length; i++)
+    hash = (hash << 5) + hash + data[i];
+
+  return hash;
+}
+
+/**
+ * ide_git_line_model_new:
+ * @content: the contents of the document
+ *
+ * Creates a new line model for @content.
+ *
+ * Returns: (transfer full): an #IdeGitLineModel
+ */
+IdeGitLineModel *
+ide_git_line_model_new (GBytes *content)
+{
+  IdeGitLineModel *self;
+  const guint8 *data;
+  gsize len = 0;
+  gsize pos = 0;
+
+  g_return_val_if_fail (content != NULL, NULL);
+
+  data = g_bytes_get_data (content, &len);
+
+  self = g_slice_new0 (IdeGitLineModel);
+  self->ref_count = 1;
+  self->content = g_bytes_ref (content);
+  self->lines = g_array_new (FALSE, FALSE, sizeof (LineInfo));
+
+  while (pos < len)
+    {
+      const guint8 *nl = memchr (data + pos, '\n', len - pos);
+      LineInfo info;
+
+      info.offset = pos;
+      info.length = nl != NULL ? (gsize)(nl - data) + 1 - pos : len - pos;
+      info.hash = hash_line (data + pos, info.length);
+
+      g_array_append_val (self->lines, info);
+
+      pos += info.length;
+    }
+
+  return self;
+}
+
+IdeGitLineModel *
+ide_git_line_model_ref (IdeGitLineModel *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->ref_count > 0, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+ide_git_line_model_unref (IdeGitLineModel *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->ref_count > 0);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    {
+      g_clear_pointer (&self->content, g_bytes_unref);
+      g_clear_pointer (&self->lines, g_array_unref);
+      g_slice_free (IdeGitLineModel, self);
+    }
+}
+
+guint
+ide_git_line_model_get_n_lines (IdeGitLineModel *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->lines->len;
+}
+
+static inline gboolean
+lines_equal (IdeGitLineModel *a,
+             guint            a_line,
+             IdeGitLineModel *b,
+             guint            b_line)
+{
+  const LineInfo *a_info = &g_array_index (a->lines, LineInfo, a_line);
+  const LineInfo *b_info = &g_array_index (b->lines, LineInfo, b_line);
+  const guint8 *a_data;
+  const guint8 *b_data;
+
+  if (a_info->hash != b_info->hash || a_info->length != b_info->length)
+    return FALSE;
+
+  a_data = g_bytes_get_data (a->content, NULL);
+  b_data = g_bytes_get_data (b->content, NULL);
+
+  return memcmp (a_data + a_info->offset, b_data + b_info->offset, a_info->length) == 0;
+}
+
+/**
+ * ide_git_line_model_diff:
+ * @old_model: the model to compare against
+ * @old_begin: the first line of @old_model to compare
+ * @old_end: the line after the last line of @old_model to compare
+ * @new_model: the model to compare
+ * @new_begin: the first line of @new_model to compare
+ * @new_end: the line after the last line of @new_model to compare
+ * @max_edits: the maximum number of added and deleted lines
+ * @deleted: (out caller-allocates): %TRUE for each deleted line of the range
+ *   of @old_model
+ * @added: (out caller-allocates): %TRUE for each added line of the range
+ *   of @new_model
+ *
+ * Computes a shortest edit script between two ranges of lines using the
+ * Myers algorithm. @deleted and @added must be zeroed by the caller and
+ * are indexed relative to @old_begin and @new_begin.
+ *
+ * This is O((N+M)D) in time and O(D²) in space, so the search is given up
+ * once more than @max_edits lines would need to change. The caller should
+ * fall back to something that copes better with large differences.
+ *
+ * Returns: %TRUE if the edit script was computed, %FALSE if it needed more
+ *   than @max_edits edits.
+ */
+gboolean
+ide_git_line_model_diff (IdeGitLineModel *old_model,
+                         guint            old_begin,
+                         guint            old_end,
+                         IdeGitLineModel *new_model,
+                         guint            new_begin,
+                         guint            new_end,
+                         guint            max_edits,
+                         gboolean        *deleted,
+                         gboolean        *added)
+{
+  g_autoptr(GArray) trace = NULL;
+  g_autofree gint *v = NULL;
+  gint n;
+  gint m;
+  gint max_d;
+  gint offset;
+
+  g_return_val_if_fail (old_model != NULL, FALSE);
+  g_return_val_if_fail (new_model != NULL, FALSE);
+  g_return_val_if_fail (old_begin <= old_end, FALSE);
+  g_return_val_if_fail (old_end <= old_model->lines->len, FALSE);
+  g_return_val_if_fail (new_begin <= new_end, FALSE);
+  g_return_val_if_fail (new_end <= new_model->lines->len, FALSE);
+  g_return_val_if_fail (old_begin == old_end || deleted != NULL, FALSE);
+  g_return_val_if_fail (new_begin == new_end || added != NULL, FALSE);
+
+  n = old_end - old_begin;
+  m = new_end - new_begin;
+  max_d = MIN ((gint64)max_edits, (gint64)n + m);
+  offset = max_d + 1;
+
+  /* v[offset + k] is the furthest x reached on diagonal k */
+  v = g_new0 (gint, 2 * max_d + 3);
+
+  /* Row d holds v[-d..d] as it was before step d, and starts at d² */
+  trace = g_array_new (FALSE, FALSE, sizeof (gint));
+
+  for (gint d = 0; d <= max_d; d++)
+    {
+      g_array_append_vals (trace, &v[offset - d], 2 * d + 1);
+
+      for (gint k = -d; k <= d; k += 2)
+        {
+          gint x;
+          gint y;
+
+          if (k == -d || (k != d && v[offset + k - 1] < v[offset + k + 1]))
+            x = v[offset + k + 1];
+          else
+            x = v[offset + k - 1] + 1;
+
+          y = x - k;
+
+          while (x < n && y < m && lines_equal (old_model, old_begin + x, new_model, new_begin + y))
+            x++, y++;
+
+          v[offset + k] = x;
+
+          if (x >= n && y >= m)
+            {
+              /* Walk the trace backwards to recover the edits */
+              for (; d > 0; d--)
+                {
+                  const gint *row = &g_array_index (trace, gint, d * d + d);
+                  gint prev_k;
+                  gint prev_x;
+                  gint prev_y;
+
+                  k = x - y;
+
+                  if (k == -d || (k != d && row[k - 1] < row[k + 1]))
+                    prev_k = k + 1;
+                  else
+                    prev_k = k - 1;
+
+                  prev_x = row[prev_k];
+                  prev_y = prev_x - prev_k;
+
+                  /* An insertion moves down before the snake, a deletion right */
+                  if (x - prev_x < y - prev_y)
+                    added[prev_y] = TRUE;
+                  else
+                    deleted[prev_x] = TRUE;
+
+                  x = prev_x;
+                  y = prev_y;
+                }
+
+              return TRUE;
+            }
+        }
+    }
+
+  return FALSE;
+}
@@ -0,0 +1,46 @@
+/* ide-git-line-model.h
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IDE_GIT_LINE_MODEL_H
+#define IDE_GIT_LINE_MODEL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IdeGitLineModel IdeGitLineModel;
+
+IdeGitLineModel *ide_git_line_model_new         (GBytes          *content);
+IdeGitLineModel *ide_git_line_model_ref         (IdeGitLineModel *self);
+void             ide_git_line_model_unref       (IdeGitLineModel *self);
+guint            ide_git_line_model_get_n_lines (IdeGitLineModel *self);
+gboolean         ide_git_line_model_diff        (IdeGitLineModel *old_model,
+                                                 guint            old_begin,
+                                                 guint            old_end,
+                                                 IdeGitLineModel *new_model,
+                                                 guint            new_begin,
+                                                 guint            new_end,
+                                                 guint            max_edits,
+                                                 gboolean        *deleted,
+                                                 gboolean        *added);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (IdeGitLineModel, ide_git_line_model_unref)
+
+G_END_DECLS
+
+#endif /* IDE_GIT_LINE_MODEL_H */
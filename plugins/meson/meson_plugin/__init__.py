@@ -44,8 +44,7 @@ def execInRuntime(runtime, *args, **kwargs):
     _, stdout, stderr = proc.communicate_utf8(None, None)
     return stdout
 
-def extract_flags(command: str, builddir: str):
-    flags = GLib.shell_parse_argv(command)[1] # Raises on failure
+def extract_flags(flags: list, builddir: str):
     wanted_flags = []
     for flag in flags:
         if flag.startswith('-I'):
@@ -59,6 +58,11 @@ def extract_flags(command: str, builddir: str):
 class MesonBuildSystem(Ide.Object, Ide.BuildSystem, Gio.AsyncInitable):
     project_file = GObject.Property(type=Gio.File)
 
+    def __init__(self, *args, **kwargs):
+        super().__init__(*args, **kwargs)
+        # Parsed once and only reloaded when compile_commands.json changes
+        self._compile_commands = Ide.CompileCommands.new()
+
     def do_get_id(self):
         return 'meson'
 
@@ -109,27 +113,24 @@ class MesonBuildSystem(Ide.Object, Ide.BuildSystem, Gio.AsyncInitable):
     def _get_build_flags_cb(self, build_manager, result, task):
         config = build_manager.get_pipeline().get_configuration()
         builddir = build_manager.get_pipeline().get_builddir()
-        commands_file = path.join(self.get_builddir(config), 'compile_commands.json')
+        commands_file = Gio.File.new_for_path(path.join(self.get_builddir(config), 'compile_commands.json'))
         runtime = config.get_runtime()
 
         def build_flags_thread():
             try:
-                with open(commands_file) as f:
-                    commands = json.loads(f.read(), encoding='utf-8')
-            except (json.JSONDecodeError, FileNotFoundError, UnicodeDecodeError) as e:
-                task.return_error(GLib.Error('Failed to decode meson json: {}'.format(e)))
+                self._compile_commands.load(commands_file, None)
+            except GLib.Error as e:
+                task.return_error(GLib.Error('Failed to decode meson json: {}'.format(e.message)))
                 return
 
             infile = task.ifile.get_path()
-            for c in commands:
-                filepath = path.normpath(path.join(c['directory'], c['file']))
-                if filepath == infile:
-                    try:
-                        task.build_flags = extract_flags(c['command'], builddir)
-                    except GLib.Error as e:
-                        task.return_error(e)
-                        return
-                    break
+            try:
+                argv, directory = self._compile_commands.lookup(task.ifile.get_file())
+                task.build_flags = extract_flags(argv, builddir)
+            except GLib.Error as e:
+                if not e.matches(Gio.io_error_quark(), Gio.IOErrorEnum.NOT_FOUND):
+                    task.return_error(e)
+                    return
 
             if infile.endswith('.vala'):
                 # We didn't find anything in the compile_commands.json, so now try to use
@@ -0,0 +1,233 @@
+/* bench-build-error-matcher.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buildsystem/ide-build-error-matcher-private.h"
+#include "buildsystem/ide-build-utils.h"
+
+/* The error formats registered by the gcc, vala and mono plugins */
+static const struct {
+  const gchar        *regex;
+  GRegexCompileFlags  flags;
+} formats[] = {
+  { "(?<filename>[a-zA-Z0-9\\-\\.\\/]+):"
+    "(?<line>\\d+):"
+    "(?<column>\\d+): "
+    "(?<level>[\\w\\s]+): "
+    "(?<message>.*)",
+    G_REGEX_CASELESS },
+  { "(?<filename>[a-zA-Z0-9\\-\\.\\/]+.vala):"
+    "(?<line>\\d+).(?<column>\\d+)-(?<line2>\\d+).(?<column2>\\d+): "
+    "(?<level>[\\w\\s]+): "
+    "(?<message>.*)",
+    G_REGEX_OPTIMIZE | G_REGEX_CASELESS },
+  { "(?<filename>[a-zA-Z0-9\\-\\.\\/]+.cs)"
+    "\\((?<line>\\d+),(?<column>\\d+)\\): "
+    "(?<level>[\\w\\s]+) "
+    "(?<code>CS[0-9]+): "
+    "(?<message>.*)",
+    G_REGEX_OPTIMIZE },
+};
+
+static gchar *log_path;
+static gint n_lines = 1000000;
+
+static const GOptionEntry entries[] = {
+  { "log", 'l', 0, G_OPTION_ARG_FILENAME, &log_path, "Replay a recorded build log", "PATH" },
+  { "lines", 'n', 0, G_OPTION_ARG_INT, &n_lines, "Number of lines to generate without --log" },
+  { NULL }
+};
+
+static void
+report (const gchar *what,
+        guint        count,
+        GTimer      *timer)
+{
+  gdouble elapsed = g_timer_elapsed (timer, NULL);
+
+  g_print ("%-32s %8u in %8.4lf seconds (%12.0lf/sec)\n",
+           what, count, elapsed, count / elapsed);
+}
+
+/*
+ * Generates something resembling the output of a large make build, with
+ * the occasional (sometimes colored) warning and its source context.
+ */
+static GPtrArray *
+generate_log (void)
+{
+  GPtrArray *lines = g_ptr_array_new_with_free_func (g_free);
+  GRand *rand = g_rand_new_with_seed (0);
+
+  for (gint i = 0; i < n_lines; i++)
+    {
+      gint n = g_rand_int_range (rand, 0, 1000);
+
+      if (n < 600)
+        g_ptr_array_add (lines, g_strdup_printf ("  CC       libfoo_la-file-%d.lo", i));
+      else if (n < 800)
+        g_ptr_array_add (lines, g_strdup_printf ("[%d/%d] Compiling C object 'libfoo@sha/src_file-%d.c.o'.", i, n_lines, i));
+      else if (n < 900)
+        g_ptr_array_add (lines, g_strdup_printf ("libtool: link: gcc -shared -fPIC -DPIC .libs/file-%d.o -o .libs/libfoo.so", i));
+      else if (n < 950)
+        g_ptr_array_add (lines, g_strdup_printf ("make[2]: Entering directory '/project/build/src/dir-%d'", i));
+      else if (n < 990)
+        g_ptr_array_add (lines, g_strdup ("    int unused = 0;"));
+      else if (n < 995)
+        g_ptr_array_add (lines, g_strdup_printf ("../src/file-%d.c:%d:%d: warning: unused variable 'unused' [-Wunused-variable]", i, n, 5));
+      else if (n < 998)
+        g_ptr_array_add (lines, g_strdup_printf ("\033[01m\033[K../src/file-%d.c:%d:%d:\033[m\033[K \033[01;35m\033[Kwarning: \033[m\033[Kunused variable", i, n, 5));
+      else
+        g_ptr_array_add (lines, g_strdup_printf ("src/file-%d.vala:%d.5-%d.9: error: The name `foo' does not exist", i, n, n));
+    }
+
+  g_rand_free (rand);
+
+  return lines;
+}
+
+static GPtrArray *
+load_log (const gchar  *path,
+          GError      **error)
+{
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) split = NULL;
+  GPtrArray *lines;
+
+  if (!g_file_get_contents (path, &contents, NULL, error))
+    return NULL;
+
+  split = g_strsplit (contents, "\n", -1);
+  lines = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = 0; split[i] != NULL; i++)
+    g_ptr_array_add (lines, g_steal_pointer (&split[i]));
+
+  return lines;
+}
+
+static gboolean
+count_match (GMatchInfo *match_info,
+             gpointer    user_data)
+{
+  guint *count = user_data;
+  g_autofree gchar *message = g_match_info_fetch_named (match_info, "message");
+
+  if (message == NULL)
+    return FALSE;
+
+  (*count)++;
+
+  return TRUE;
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GPtrArray) regexes = NULL;
+  g_autoptr(GPtrArray) lines = NULL;
+  g_autoptr(GTimer) timer = NULL;
+  g_autoptr(GError) error = NULL;
+  IdeBuildErrorMatcher *matcher;
+  guint sequential = 0;
+  guint matched = 0;
+
+  context = g_option_context_new ("- benchmark error format matching of build logs");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (log_path != NULL)
+    lines = load_log (log_path, &error);
+  else
+    lines = generate_log ();
+
+  if (lines == NULL)
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  regexes = g_ptr_array_new_with_free_func ((GDestroyNotify)g_regex_unref);
+  matcher = ide_build_error_matcher_new ();
+
+  for (guint i = 0; i < G_N_ELEMENTS (formats); i++)
+    {
+      GRegex *regex = g_regex_new (formats[i].regex, G_REGEX_OPTIMIZE | formats[i].flags, 0, &error);
+      guint id;
+
+      g_assert_no_error (error);
+      g_ptr_array_add (regexes, regex);
+
+      id = ide_build_error_matcher_add (matcher, formats[i].regex, formats[i].flags, &error);
+      g_assert_no_error (error);
+      g_assert_cmpint (id, >, 0);
+    }
+
+  timer = g_timer_new ();
+
+  /* How the pipeline used to process each line */
+  for (guint i = 0; i < lines->len; i++)
+    {
+      g_autofree gchar *filtered = ide_build_utils_color_codes_filtering (g_ptr_array_index (lines, i));
+
+      for (guint j = 0; j < regexes->len; j++)
+        {
+          g_autoptr(GMatchInfo) match_info = NULL;
+
+          if (g_regex_match (g_ptr_array_index (regexes, j), filtered, 0, &match_info) &&
+              count_match (match_info, &sequential))
+            break;
+        }
+    }
+
+  report ("sequential regexes", lines->len, timer);
+
+  g_timer_reset (timer);
+
+  for (guint i = 0; i < lines->len; i++)
+    {
+      const gchar *line = g_ptr_array_index (lines, i);
+      g_autofree gchar *filtered = NULL;
+
+      if (strchr (line, '\033') != NULL || strchr (line, '\\') != NULL)
+        line = filtered = ide_build_utils_color_codes_filtering (line);
+
+      ide_build_error_matcher_match (matcher, line, count_match, &matched);
+    }
+
+  report ("error matcher", lines->len, timer);
+
+  g_print ("%u diagnostics found\n", matched);
+
+  g_assert_cmpint (matched, ==, sequential);
+
+  ide_build_error_matcher_free (matcher);
+  g_free (log_path);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,248 @@
+/* bench-file-search-walker.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <ide.h>
+#include <stdlib.h>
+
+#include "application/ide-application-tests.h"
+
+#include "gb-file-search-walker.h"
+
+static gint depth = 6;
+static gint fanout = 4;
+static gint files_per_dir = 16;
+static gint iterations = 3;
+static gchar *tree_path;
+
+static const GOptionEntry entries[] = {
+  { "depth", 'd', 0, G_OPTION_ARG_INT, &depth, "Depth of the synthetic tree" },
+  { "fanout", 'f', 0, G_OPTION_ARG_INT, &fanout, "Subdirectories per directory" },
+  { "files", 'n', 0, G_OPTION_ARG_INT, &files_per_dir, "Files per directory" },
+  { "iterations", 'i', 0, G_OPTION_ARG_INT, &iterations, "Iterations per worker count" },
+  { NULL }
+};
+
+static void
+create_tree (const gchar *path,
+             gint         level)
+{
+  g_mkdir_with_parents (path, 0750);
+
+  for (gint i = 0; i < files_per_dir; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("file-%d.c", i);
+      g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+      g_file_set_contents (child, "", 0, NULL);
+
+      /* Every other file has an object file next to it for the VCS to ignore */
+      if (i % 2 == 0)
+        {
+          g_autofree gchar *object_name = g_strdup_printf ("file-%d.o", i);
+          g_autofree gchar *object_child = g_build_filename (path, object_name, NULL);
+
+          g_file_set_contents (object_child, "", 0, NULL);
+        }
+    }
+
+  if (level >= depth)
+    return;
+
+  for (gint i = 0; i < fanout; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("dir-%d", i);
+      g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+      create_tree (child, level + 1);
+    }
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  g_autoptr(GDir) dir = NULL;
+  const gchar *name;
+
+  if ((dir = g_dir_open (path, 0, NULL)))
+    {
+      while ((name = g_dir_read_name (dir)))
+        {
+          g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+          if (g_file_test (child, G_FILE_TEST_IS_DIR))
+            remove_tree (child);
+          else
+            g_unlink (child);
+        }
+    }
+
+  g_rmdir (path);
+}
+
+static void
+count_batch (const gchar * const *paths,
+             guint                n_paths,
+             gpointer             user_data)
+{
+  guint *count = user_data;
+
+  *count += n_paths;
+}
+
+static void
+init_repository (const gchar *path)
+{
+  g_autofree gchar *gitignore = g_build_filename (path, ".gitignore", NULL);
+  g_autoptr(GError) error = NULL;
+  const gchar *argv[] = { "git", "init", "-q", NULL };
+  gint exit_status = 0;
+
+  g_file_set_contents (gitignore, "*.o\n", -1, NULL);
+
+  if (!g_spawn_sync (path, (gchar **)argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                     NULL, NULL, &exit_status, &error) || exit_status != 0)
+    g_printerr ("Failed to initialize git repository, results will not use git\n");
+}
+
+static void
+run_walker (GFile  *root,
+            IdeVcs *vcs,
+            guint   n_workers)
+{
+  gdouble total = 0.0;
+  guint n_files = 0;
+
+  for (gint i = 0; i < iterations; i++)
+    {
+      g_autoptr(GbFileSearchWalker) walker = NULL;
+      g_autoptr(GTimer) timer = NULL;
+      g_autoptr(GError) error = NULL;
+      gboolean r;
+
+      n_files = 0;
+
+      walker = gb_file_search_walker_new (root, vcs);
+      gb_file_search_walker_set_n_workers (walker, n_workers);
+
+      timer = g_timer_new ();
+      r = gb_file_search_walker_run (walker, count_batch, &n_files, NULL, &error);
+      g_timer_stop (timer);
+
+      g_assert_no_error (error);
+      g_assert_true (r);
+      g_assert_cmpint (n_files, ==, gb_file_search_walker_get_n_files (walker));
+
+      total += g_timer_elapsed (timer, NULL);
+    }
+
+  g_print ("%-16s %2u workers: %8u files in %8.4lf seconds (%10.0lf files/sec)\n",
+           vcs ? G_OBJECT_TYPE_NAME (vcs) : "(no vcs)",
+           n_workers,
+           n_files,
+           total / iterations,
+           n_files / (total / iterations));
+}
+
+static void
+bench_context_cb (GObject      *object,
+                  GAsyncResult *result,
+                  gpointer      user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  g_autoptr(IdeContext) context = NULL;
+  g_autoptr(GFile) root = NULL;
+  g_autoptr(GError) error = NULL;
+  guint max_workers;
+
+  context = ide_context_new_finish (result, &error);
+  g_assert_no_error (error);
+  g_assert (context != NULL);
+
+  root = g_file_new_for_path (tree_path);
+  max_workers = g_get_num_processors ();
+
+  /* Without a VCS for reference, then with the one the context discovered */
+  for (guint n_workers = 1; n_workers <= max_workers; n_workers *= 2)
+    run_walker (root, NULL, n_workers);
+
+  for (guint n_workers = 1; n_workers <= max_workers; n_workers *= 2)
+    run_walker (root, ide_context_get_vcs (context), n_workers);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+bench_walker (GCancellable        *cancellable,
+              GAsyncReadyCallback  callback,
+              gpointer             user_data)
+{
+  g_autoptr(GFile) project_file = NULL;
+  GTask *task;
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  project_file = g_file_new_for_path (tree_path);
+
+  ide_context_new_async (project_file,
+                         cancellable,
+                         bench_context_cb,
+                         task);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(GError) error = NULL;
+  IdeApplication *app;
+  gint ret;
+
+  context = g_option_context_new ("- benchmark the file-search directory walker");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (!(tree_path = g_dir_make_tmp ("bench-file-search-XXXXXX", &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  create_tree (tree_path, 0);
+  init_repository (tree_path);
+
+  g_test_init (&argc, &argv, NULL);
+
+  /* IdeApplication only runs registered tests (and loads the VCS plugins) in test mode */
+  g_set_prgname ("test-file-search-walker");
+
+  app = ide_application_new ();
+  ide_application_add_test (app, "/Bench/FileSearchWalker", bench_walker, NULL);
+  ret = g_application_run (G_APPLICATION (app), argc, argv);
+  g_object_unref (app);
+
+  remove_tree (tree_path);
+  g_free (tree_path);
+
+  return ret;
+}
@@ -0,0 +1,190 @@
+/* bench-unsaved-files.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <ide.h>
+#include <stdlib.h>
+#include <string.h>
+
+static gint n_buffers = 200;
+static gint n_updates = 100000;
+static gint n_parses = 10000;
+
+static const GOptionEntry entries[] = {
+  { "buffers", 'b', 0, G_OPTION_ARG_INT, &n_buffers, "Number of open buffers" },
+  { "updates", 'u', 0, G_OPTION_ARG_INT, &n_updates, "Number of content updates" },
+  { "parses", 'p', 0, G_OPTION_ARG_INT, &n_parses, "Number of simulated parse requests" },
+  { NULL }
+};
+
+static void
+report (const gchar *what,
+        gint         count,
+        GTimer      *timer)
+{
+  gdouble elapsed = g_timer_elapsed (timer, NULL);
+
+  g_print ("%-32s %8d in %8.4lf seconds (%12.0lf/sec)\n",
+           what, count, elapsed, count / elapsed);
+}
+
+static void
+remove_tree (const gchar *path)
+{
+  g_autoptr(GDir) dir = NULL;
+  const gchar *name;
+
+  if ((dir = g_dir_open (path, 0, NULL)))
+    {
+      while ((name = g_dir_read_name (dir)))
+        {
+          g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+          if (g_file_test (child, G_FILE_TEST_IS_DIR))
+            remove_tree (child);
+          else
+            g_unlink (child);
+        }
+    }
+
+  g_rmdir (path);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autoptr(GOptionContext) context = NULL;
+  g_autoptr(IdeUnsavedFiles) unsaved_files = NULL;
+  g_autoptr(GPtrArray) files = NULL;
+  g_autoptr(GTimer) timer = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  GRand *rand;
+  gsize total = 0;
+
+  context = g_option_context_new ("- benchmark unsaved file tracking with many buffers");
+  g_option_context_add_main_entries (context, entries, NULL);
+
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  if (!(path = g_dir_make_tmp ("bench-unsaved-files-XXXXXX", &error)))
+    {
+      g_printerr ("%s\n", error->message);
+      return EXIT_FAILURE;
+    }
+
+  /* Keep the per-buffer temporary files out of the real cache directory */
+  g_setenv ("XDG_CACHE_HOME", path, TRUE);
+
+  unsaved_files = g_object_new (IDE_TYPE_UNSAVED_FILES, NULL);
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  rand = g_rand_new_with_seed (0);
+  timer = g_timer_new ();
+
+  for (gint i = 0; i < n_buffers; i++)
+    {
+      g_autofree gchar *name = g_strdup_printf ("/project/src/file-%d.c", i);
+      g_autoptr(GBytes) bytes = g_bytes_new_take (g_strdup (name), strlen (name));
+      GFile *file = g_file_new_for_path (name);
+
+      g_ptr_array_add (files, file);
+      ide_unsaved_files_update (unsaved_files, file, bytes);
+    }
+
+  g_timer_reset (timer);
+
+  /*
+   * Most updates go to the buffer the user is typing in, with the rest
+   * scattered across the other open buffers.
+   */
+  for (gint i = 0; i < n_updates; i++)
+    {
+      g_autoptr(GBytes) bytes = g_bytes_new ("int x;", 6);
+      guint index = 0;
+
+      if (g_rand_int_range (rand, 0, 10) == 0)
+        index = g_rand_int_range (rand, 0, files->len);
+
+      ide_unsaved_files_update (unsaved_files, g_ptr_array_index (files, index), bytes);
+    }
+
+  report ("updates", n_updates, timer);
+
+  g_timer_reset (timer);
+
+  for (gint i = 0; i < n_updates; i++)
+    {
+      GFile *file = g_ptr_array_index (files, g_rand_int_range (rand, 0, files->len));
+      g_autoptr(IdeUnsavedFile) uf = ide_unsaved_files_get_unsaved_file (unsaved_files, file);
+
+      g_assert (uf != NULL);
+    }
+
+  report ("lookups", n_updates, timer);
+
+  g_timer_reset (timer);
+
+  for (gint i = 0; i < n_parses; i++)
+    {
+      g_autoptr(GPtrArray) ar = ide_unsaved_files_to_array (unsaved_files);
+
+      total += ar->len;
+    }
+
+  report ("to_array (unchanged)", n_parses, timer);
+
+  g_timer_reset (timer);
+
+  for (gint i = 0; i < n_parses; i++)
+    {
+      g_autoptr(GPtrArray) ar = ide_unsaved_files_get_snapshot (unsaved_files, NULL);
+
+      total += ar->len;
+    }
+
+  report ("get_snapshot (unchanged)", n_parses, timer);
+
+  g_timer_reset (timer);
+
+  /* A keystroke between every parse, as happens while typing */
+  for (gint i = 0; i < n_parses; i++)
+    {
+      g_autoptr(GBytes) bytes = g_bytes_new ("int y;", 6);
+      g_autoptr(GPtrArray) ar = NULL;
+
+      ide_unsaved_files_update (unsaved_files, g_ptr_array_index (files, 0), bytes);
+      ar = ide_unsaved_files_get_snapshot (unsaved_files, NULL);
+
+      total += ar->len;
+    }
+
+  report ("get_snapshot (after update)", n_parses, timer);
+
+  g_assert_cmpint (total, ==, (gsize)n_parses * 3 * files->len);
+
+  g_rand_free (rand);
+  g_clear_object (&unsaved_files);
+  remove_tree (path);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+/* test-ide-build-log-store.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buildui/ide-build-log-store.h"
+
+typedef struct
+{
+  guint n_lines;
+  guint first;
+  guint next;
+} Checked;
+
+static gboolean
+check_line (IdeBuildLogStream  stream,
+            const gchar       *message,
+            gsize              message_len,
+            gpointer           user_data)
+{
+  Checked *checked = user_data;
+  guint n;
+
+  g_assert_cmpint (strlen (message), ==, message_len);
+  g_assert_true (g_str_has_prefix (message, "line-"));
+
+  n = atoi (message + strlen ("line-"));
+
+  if (checked->n_lines == 0)
+    checked->first = n;
+  else
+    g_assert_cmpint (n, ==, checked->next);
+
+  /* Every third line was logged to stderr */
+  g_assert_cmpint (stream, ==, (n % 3) == 0 ? IDE_BUILD_LOG_STDERR : IDE_BUILD_LOG_STDOUT);
+
+  checked->next = n + 1;
+  checked->n_lines++;
+
+  return TRUE;
+}
+
+static void
+append_lines (IdeBuildLogStore *store,
+              guint             begin,
+              guint             end)
+{
+  for (guint i = begin; i < end; i++)
+    {
+      g_autofree gchar *line = g_strdup_printf ("line-%u", i);
+
+      ide_build_log_store_append (store,
+                                  (i % 3) == 0 ? IDE_BUILD_LOG_STDERR : IDE_BUILD_LOG_STDOUT,
+                                  line,
+                                  strlen (line));
+    }
+}
+
+static void
+test_build_log_store_retention (void)
+{
+  IdeBuildLogStore *store = ide_build_log_store_new (20000);
+  g_autoptr(GError) error = NULL;
+  Checked checked = { 0 };
+  gboolean r;
+
+  /* Enough lines to spill segments to disk and drop them again */
+  append_lines (store, 0, 100000);
+
+  /* Whole segments of 4096 lines are dropped at a time */
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), <=, 20000);
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), >, 20000 - 4096);
+
+  r = ide_build_log_store_foreach (store, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, ide_build_log_store_get_n_lines (store));
+  g_assert_cmpint (checked.next, ==, 100000);
+
+  /* Shrinking the limit drops the oldest lines */
+  ide_build_log_store_set_max_lines (store, 10000);
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), <=, 10000);
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), >, 10000 - 4096);
+
+  memset (&checked, 0, sizeof checked);
+  r = ide_build_log_store_foreach (store, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, ide_build_log_store_get_n_lines (store));
+  g_assert_cmpint (checked.next, ==, 100000);
+
+  ide_build_log_store_free (store);
+}
+
+static void
+test_build_log_store_range (void)
+{
+  IdeBuildLogStore *store = ide_build_log_store_new (20000);
+  g_autoptr(GError) error = NULL;
+  Checked checked = { 0 };
+  guint first;
+  gboolean r;
+
+  append_lines (store, 0, 100000);
+
+  /* Indexes continue from the dropped lines */
+  first = ide_build_log_store_get_first_line (store);
+  g_assert_cmpint (first, >, 0);
+  g_assert_cmpint (first + ide_build_log_store_get_n_lines (store), ==, 100000);
+
+  /* Spans segments on disk and in memory */
+  r = ide_build_log_store_foreach_range (store, first + 100, 10000, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, 10000);
+  g_assert_cmpint (checked.first, ==, first + 100);
+  g_assert_cmpint (checked.next, ==, first + 10100);
+
+  /* Lines that were dropped are skipped */
+  memset (&checked, 0, sizeof checked);
+  r = ide_build_log_store_foreach_range (store, 0, first + 10, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, 10);
+  g_assert_cmpint (checked.first, ==, first);
+
+  /* Ranges past the end stop at the last line */
+  memset (&checked, 0, sizeof checked);
+  r = ide_build_log_store_foreach_range (store, 99995, 100, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, 5);
+  g_assert_cmpint (checked.next, ==, 100000);
+
+  ide_build_log_store_free (store);
+}
+
+static void
+test_build_log_store_clear (void)
+{
+  IdeBuildLogStore *store = ide_build_log_store_new (1000000);
+  g_autoptr(GError) error = NULL;
+  Checked checked = { 0 };
+  gboolean r;
+
+  append_lines (store, 0, 50000);
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), ==, 50000);
+
+  ide_build_log_store_clear (store);
+  g_assert_cmpint (ide_build_log_store_get_n_lines (store), ==, 0);
+  g_assert_cmpint (ide_build_log_store_get_first_line (store), ==, 50000);
+
+  /* The spill file is reused after clearing */
+  append_lines (store, 50000, 90000);
+
+  r = ide_build_log_store_foreach (store, check_line, &checked, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+  g_assert_cmpint (checked.n_lines, ==, 40000);
+  g_assert_cmpint (checked.first, ==, 50000);
+  g_assert_cmpint (checked.next, ==, 90000);
+
+  ide_build_log_store_free (store);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/BuildLogStore/retention", test_build_log_store_retention);
+  g_test_add_func ("/Ide/BuildLogStore/range", test_build_log_store_range);
+  g_test_add_func ("/Ide/BuildLogStore/clear", test_build_log_store_clear);
+
+  return g_test_run ();
+}
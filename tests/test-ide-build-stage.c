@@ -0,0 +1,114 @@
+/* test-ide-build-stage.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <string.h>
+
+#define N_LINES 5000
+
+typedef struct
+{
+  GMainLoop *main_loop;
+  GPtrArray *lines;
+} Observed;
+
+static void
+observe_line (IdeBuildLogStream  stream,
+              const gchar       *message,
+              gssize             message_len,
+              gpointer           user_data)
+{
+  Observed *observed = user_data;
+
+  g_assert_cmpint (stream, ==, IDE_BUILD_LOG_STDOUT);
+  g_assert_cmpint (strlen (message), ==, message_len);
+  g_assert_true (g_utf8_validate (message, message_len, NULL));
+
+  g_ptr_array_add (observed->lines, g_strndup (message, message_len));
+
+  if (g_str_equal (message, "last"))
+    g_main_loop_quit (observed->main_loop);
+}
+
+static void
+test_log_subprocess (void)
+{
+  g_autoptr(IdeSubprocessLauncher) launcher = NULL;
+  g_autoptr(IdeSubprocess) subprocess = NULL;
+  g_autoptr(IdeBuildStage) stage = NULL;
+  g_autoptr(GError) error = NULL;
+  Observed observed;
+  gboolean r;
+
+  observed.main_loop = g_main_loop_new (NULL, FALSE);
+  observed.lines = g_ptr_array_new_with_free_func (g_free);
+
+  /* Many lines spanning several reads, invalid UTF-8, and no trailing newline */
+  launcher = ide_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE);
+  ide_subprocess_launcher_push_argv (launcher, "sh");
+  ide_subprocess_launcher_push_argv (launcher, "-c");
+  ide_subprocess_launcher_push_argv (launcher,
+                                     "i=0; "
+                                     "while [ $i -lt " G_STRINGIFY (N_LINES) " ]; do "
+                                     "  echo line-$i; i=$((i+1)); "
+                                     "done; "
+                                     "printf 'bad-\\377-utf8\\n'; "
+                                     "printf last");
+
+  subprocess = ide_subprocess_launcher_spawn (launcher, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (subprocess);
+
+  stage = g_object_new (IDE_TYPE_BUILD_STAGE, NULL);
+  ide_build_stage_set_log_observer (stage, observe_line, &observed, NULL);
+  ide_build_stage_log_subprocess (stage, subprocess);
+
+  g_main_loop_run (observed.main_loop);
+
+  r = ide_subprocess_wait_check (subprocess, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  g_assert_cmpint (observed.lines->len, ==, N_LINES + 2);
+
+  for (guint i = 0; i < N_LINES; i++)
+    {
+      g_autofree gchar *expected = g_strdup_printf ("line-%u", i);
+
+      g_assert_cmpstr (g_ptr_array_index (observed.lines, i), ==, expected);
+    }
+
+  g_assert_cmpstr (g_ptr_array_index (observed.lines, N_LINES), ==, "bad-?-utf8");
+  g_assert_cmpstr (g_ptr_array_index (observed.lines, N_LINES + 1), ==, "last");
+
+  ide_build_stage_set_log_observer (stage, NULL, NULL, NULL);
+
+  g_ptr_array_unref (observed.lines);
+  g_main_loop_unref (observed.main_loop);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/BuildStage/log-subprocess", test_log_subprocess);
+
+  return g_test_run ();
+}
@@ -0,0 +1,195 @@
+/* test-ide-compile-commands.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <ide.h>
+
+static const gchar *basic_json =
+  "[\n"
+  "  {\n"
+  "    \"directory\": \"/project/build\",\n"
+  "    \"command\": \"cc -I../include -DNAME=\\\"a b\\\" -o foo.o -c ../src/foo.c\",\n"
+  "    \"file\": \"../src/foo.c\",\n"
+  "    \"extra\": { \"nested\": [1, 2.5e3, true, null, \"\\u00e9\"] }\n"
+  "  },\n"
+  "  {\n"
+  "    \"directory\": \"/project/build\",\n"
+  "    \"arguments\": [\"c++\", \"-std=c++11\", \"-c\", \"/project/src/bar.cpp\"],\n"
+  "    \"file\": \"/project/src/bar.cpp\"\n"
+  "  },\n"
+  "  {\n"
+  "    \"directory\": \"/project/build\",\n"
+  "    \"command\": \"cc -DSECOND -c ../src/foo.c\",\n"
+  "    \"file\": \"../src/foo.c\"\n"
+  "  }\n"
+  "]\n";
+
+static GFile *
+write_commands (const gchar *dir,
+                const gchar *contents)
+{
+  g_autofree gchar *path = g_build_filename (dir, "compile_commands.json", NULL);
+  g_autoptr(GError) error = NULL;
+
+  g_file_set_contents (path, contents, -1, &error);
+  g_assert_no_error (error);
+
+  return g_file_new_for_path (path);
+}
+
+static void
+test_compile_commands_basic (void)
+{
+  g_autoptr(IdeCompileCommands) commands = ide_compile_commands_new ();
+  g_autoptr(GFile) foo = g_file_new_for_path ("/project/src/foo.c");
+  g_autoptr(GFile) bar = g_file_new_for_path ("/project/src/bar.cpp");
+  g_autoptr(GFile) baz = g_file_new_for_path ("/project/src/baz.c");
+  g_autoptr(GFile) directory = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *dirpath = NULL;
+  g_auto(GStrv) argv = NULL;
+  gboolean r;
+
+  tmpdir = g_dir_make_tmp ("test-ide-compile-commands-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  file = write_commands (tmpdir, basic_json);
+
+  r = ide_compile_commands_load (commands, file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  /* First entry wins when a file is listed more than once */
+  argv = ide_compile_commands_lookup (commands, foo, &directory, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (argv);
+  g_assert_cmpint (g_strv_length (argv), ==, 7);
+  g_assert_cmpstr (argv[1], ==, "-I../include");
+  g_assert_cmpstr (argv[2], ==, "-DNAME=a b");
+  dirpath = g_file_get_path (directory);
+  g_assert_cmpstr (dirpath, ==, "/project/build");
+  g_clear_pointer (&argv, g_strfreev);
+
+  argv = ide_compile_commands_lookup (commands, bar, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (argv);
+  g_assert_cmpint (g_strv_length (argv), ==, 4);
+  g_assert_cmpstr (argv[1], ==, "-std=c++11");
+  g_clear_pointer (&argv, g_strfreev);
+
+  argv = ide_compile_commands_lookup (commands, baz, NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (argv);
+  g_clear_error (&error);
+
+  g_file_delete (file, NULL, NULL);
+  g_rmdir (tmpdir);
+}
+
+static void
+test_compile_commands_reload (void)
+{
+  g_autoptr(IdeCompileCommands) commands = ide_compile_commands_new ();
+  g_autoptr(GFile) foo = g_file_new_for_path ("/project/src/foo.c");
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_auto(GStrv) argv = NULL;
+  gboolean r;
+
+  tmpdir = g_dir_make_tmp ("test-ide-compile-commands-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  file = write_commands (tmpdir, "[]");
+
+  r = ide_compile_commands_load (commands, file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  argv = ide_compile_commands_lookup (commands, foo, NULL, &error);
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&error);
+
+  /* Make sure the modification time changes */
+  g_object_unref (write_commands (tmpdir, basic_json));
+  g_file_set_attribute_uint64 (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                               g_get_real_time () / G_USEC_PER_SEC + 10,
+                               G_FILE_QUERY_INFO_NONE, NULL, &error);
+  g_assert_no_error (error);
+
+  r = ide_compile_commands_load (commands, file, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (r);
+
+  argv = ide_compile_commands_lookup (commands, foo, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (argv);
+
+  g_file_delete (file, NULL, NULL);
+  g_rmdir (tmpdir);
+}
+
+static void
+test_compile_commands_invalid (void)
+{
+  static const gchar *invalid[] = {
+    "",
+    "{}",
+    "[",
+    "[{\"file\": \"foo.c\"",
+    "[{\"file\": \"foo.c\" \"command\": \"cc\"}]",
+    "[{\"file\": \"\\q\"}]",
+    "[{\"extra\": [1, 2}]",
+  };
+  g_autofree gchar *tmpdir = NULL;
+  g_autoptr(GError) error = NULL;
+
+  tmpdir = g_dir_make_tmp ("test-ide-compile-commands-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  for (guint i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      g_autoptr(IdeCompileCommands) commands = ide_compile_commands_new ();
+      g_autoptr(GFile) file = write_commands (tmpdir, invalid[i]);
+      gboolean r;
+
+      r = ide_compile_commands_load (commands, file, NULL, &error);
+      g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+      g_assert_false (r);
+      g_clear_error (&error);
+
+      g_file_delete (file, NULL, NULL);
+    }
+
+  g_rmdir (tmpdir);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/CompileCommands/basic", test_compile_commands_basic);
+  g_test_add_func ("/Ide/CompileCommands/reload", test_compile_commands_reload);
+  g_test_add_func ("/Ide/CompileCommands/invalid", test_compile_commands_invalid);
+
+  return g_test_run ();
+}
@@ -0,0 +1,156 @@
+/* test-ide-ctags-trie.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "ide-ctags-trie.h"
+
+/* Names must be sorted, as they are in an index */
+static IdeCtagsIndexEntry *
+make_entries (const gchar * const *names)
+{
+  guint n_names = g_strv_length ((gchar **)names);
+  IdeCtagsIndexEntry *entries = g_new0 (IdeCtagsIndexEntry, n_names + 1);
+
+  for (guint i = 0; i < n_names; i++)
+    {
+      entries[i].name = names[i];
+      entries[i].path = "file.c";
+      entries[i].pattern = "/^pattern$/";
+      entries[i].kind = IDE_CTAGS_INDEX_ENTRY_FUNCTION;
+    }
+
+  return entries;
+}
+
+static void
+assert_lookup (IdeCtagsTrie        *trie,
+               const gchar         *word,
+               const gchar * const *expected)
+{
+  g_autoptr(GArray) matches = g_array_new (FALSE, FALSE, sizeof (IdeCtagsIndexMatch));
+  g_autofree gchar *casefold = g_utf8_casefold (word, -1);
+  guint n_expected = g_strv_length ((gchar **)expected);
+
+  ide_ctags_trie_lookup_fuzzy (trie, word, casefold, matches);
+
+  g_assert_cmpint (matches->len, ==, n_expected);
+
+  /* Matches are emitted in sorted order */
+  for (guint i = 0; i < matches->len; i++)
+    g_assert_cmpstr (g_array_index (matches, IdeCtagsIndexMatch, i).entries->name, ==, expected[i]);
+}
+
+static void
+test_ctags_trie_empty (void)
+{
+  g_autoptr(IdeCtagsTrie) trie = ide_ctags_trie_new (NULL, 0);
+  static const gchar *none[] = { NULL };
+
+  g_assert_cmpint (ide_ctags_trie_get_n_names (trie), ==, 0);
+  assert_lookup (trie, "foo", none);
+  assert_lookup (trie, "", none);
+}
+
+static void
+test_ctags_trie_prefix (void)
+{
+  static const gchar *names[] = { "foo", "foo", "foobar", "food", "fox", "gtk_widget_show", NULL };
+  static const gchar *foo[] = { "foo", "foobar", "food", NULL };
+  static const gchar *fo[] = { "foo", "foobar", "food", "fox", NULL };
+  static const gchar *foob[] = { "foobar", NULL };
+  static const gchar *gtk[] = { "gtk_widget_show", NULL };
+  static const gchar *none[] = { NULL };
+  g_autofree IdeCtagsIndexEntry *entries = make_entries (names);
+  g_autoptr(IdeCtagsTrie) trie = ide_ctags_trie_new (entries, 6);
+  g_autoptr(GArray) matches = g_array_new (FALSE, FALSE, sizeof (IdeCtagsIndexMatch));
+
+  /* Duplicate names are collapsed into a single match */
+  g_assert_cmpint (ide_ctags_trie_get_n_names (trie), ==, 5);
+
+  ide_ctags_trie_lookup_fuzzy (trie, "foo", "foo", matches);
+  g_assert_cmpint (matches->len, ==, 3);
+  g_assert_cmpint (g_array_index (matches, IdeCtagsIndexMatch, 0).n_entries, ==, 2);
+  g_assert_cmpint (g_array_index (matches, IdeCtagsIndexMatch, 1).n_entries, ==, 1);
+
+  assert_lookup (trie, "foo", foo);
+  assert_lookup (trie, "fo", fo);
+  assert_lookup (trie, "foob", foob);
+  assert_lookup (trie, "gtk", gtk);
+  assert_lookup (trie, "foobarbaz", none);
+  assert_lookup (trie, "x", none);
+
+  /* After the shared prefix, the rest of the word is a subsequence */
+  assert_lookup (trie, "gtkshow", gtk);
+  assert_lookup (trie, "fb", foob);
+}
+
+static void
+test_ctags_trie_split (void)
+{
+  static const gchar *names[] = { "foobar", "foobaz", NULL };
+  static const gchar *both[] = { "foobar", "foobaz", NULL };
+  static const gchar *bar[] = { "foobar", NULL };
+  static const gchar *none[] = { NULL };
+  g_autofree IdeCtagsIndexEntry *entries = make_entries (names);
+  g_autoptr(IdeCtagsTrie) trie = ide_ctags_trie_new (entries, 2);
+
+  /* The words end within the shared "fooba" edge */
+  assert_lookup (trie, "f", both);
+  assert_lookup (trie, "fooba", both);
+
+  /* The edge splits at the last character */
+  assert_lookup (trie, "foobar", bar);
+  assert_lookup (trie, "foobaq", none);
+
+  /* Diverges in the middle of the edge */
+  assert_lookup (trie, "fox", none);
+}
+
+static void
+test_ctags_trie_empty_key (void)
+{
+  static const gchar *names[] = { "", "a", "ab", NULL };
+  static const gchar *a[] = { "a", "ab", NULL };
+  static const gchar *ab[] = { "ab", NULL };
+  static const gchar *none[] = { NULL };
+  g_autofree IdeCtagsIndexEntry *entries = make_entries (names);
+  g_autoptr(IdeCtagsTrie) trie = ide_ctags_trie_new (entries, 3);
+
+  g_assert_cmpint (ide_ctags_trie_get_n_names (trie), ==, 3);
+
+  /* The empty name terminates at the root but never matches a word */
+  assert_lookup (trie, "", none);
+  assert_lookup (trie, "a", a);
+  assert_lookup (trie, "ab", ab);
+  assert_lookup (trie, "b", none);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/CtagsTrie/empty", test_ctags_trie_empty);
+  g_test_add_func ("/Ide/CtagsTrie/prefix", test_ctags_trie_prefix);
+  g_test_add_func ("/Ide/CtagsTrie/split", test_ctags_trie_split);
+  g_test_add_func ("/Ide/CtagsTrie/empty-key", test_ctags_trie_empty_key);
+
+  return g_test_run ();
+}
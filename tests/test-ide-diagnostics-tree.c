@@ -0,0 +1,274 @@
+/* test-ide-diagnostics-tree.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+
+#include "diagnostics/ide-diagnostics-tree-private.h"
+
+typedef struct
+{
+  IdeDiagnostic *diagnostic;
+  gint           part;
+  guint          begin;
+  guint          end;
+} Entry;
+
+static gint
+compare_entry (gconstpointer a,
+               gconstpointer b)
+{
+  const Entry *entry_a = a;
+  const Entry *entry_b = b;
+
+  if (entry_a->begin != entry_b->begin)
+    return entry_a->begin < entry_b->begin ? -1 : 1;
+  else if (entry_a->end != entry_b->end)
+    return entry_a->end < entry_b->end ? -1 : 1;
+  else if (entry_a->diagnostic != entry_b->diagnostic)
+    return entry_a->diagnostic < entry_b->diagnostic ? -1 : 1;
+  else
+    return entry_a->part - entry_b->part;
+}
+
+static void
+collect_entry (IdeDiagnostic *diagnostic,
+               gint           part,
+               guint          begin_line,
+               guint          end_line,
+               gpointer       user_data)
+{
+  GArray *found = user_data;
+  Entry entry = { diagnostic, part, begin_line, end_line };
+
+  g_array_append_val (found, entry);
+}
+
+static gboolean
+remove_odd_parts (IdeDiagnostic *diagnostic,
+                  gint           part,
+                  guint          begin_line,
+                  guint          end_line,
+                  gpointer       user_data)
+{
+  return (part & 1) != 0;
+}
+
+static gboolean
+remove_diagnostic (IdeDiagnostic *diagnostic,
+                   gint           part,
+                   guint          begin_line,
+                   guint          end_line,
+                   gpointer       user_data)
+{
+  return diagnostic == user_data;
+}
+
+/* Checks the tree against a naive scan of @model */
+static void
+check_range (IdeDiagnosticsTree *tree,
+             GArray             *model,
+             guint               first,
+             guint               last)
+{
+  g_autoptr(GArray) expected = g_array_new (FALSE, FALSE, sizeof (Entry));
+  g_autoptr(GArray) found = g_array_new (FALSE, FALSE, sizeof (Entry));
+
+  for (guint i = 0; i < model->len; i++)
+    {
+      const Entry *entry = &g_array_index (model, Entry, i);
+
+      if (entry->begin <= last && entry->end >= first)
+        g_array_append_val (expected, *entry);
+    }
+
+  ide_diagnostics_tree_foreach_in_range (tree, first, last, collect_entry, found);
+
+  /* Results are ordered by their first line */
+  for (guint i = 1; i < found->len; i++)
+    g_assert_cmpint (g_array_index (found, Entry, i - 1).begin, <=, g_array_index (found, Entry, i).begin);
+
+  g_array_sort (expected, compare_entry);
+  g_array_sort (found, compare_entry);
+
+  g_assert_cmpint (found->len, ==, expected->len);
+
+  for (guint i = 0; i < found->len; i++)
+    g_assert_cmpint (compare_entry (&g_array_index (found, Entry, i),
+                                    &g_array_index (expected, Entry, i)), ==, 0);
+}
+
+static guint
+collapse (guint line,
+          guint first,
+          guint n_lines)
+{
+  if (line <= first)
+    return line;
+  else if (line <= first + n_lines)
+    return first;
+  else
+    return line - n_lines;
+}
+
+static void
+test_diagnostics_tree_basic (void)
+{
+  IdeDiagnosticsTree *tree = ide_diagnostics_tree_new ();
+  g_autoptr(GArray) found = g_array_new (FALSE, FALSE, sizeof (Entry));
+  IdeDiagnostic *diag1 = ide_diagnostic_new (IDE_DIAGNOSTIC_ERROR, "error", NULL);
+  IdeDiagnostic *diag2 = ide_diagnostic_new (IDE_DIAGNOSTIC_WARNING, "warning", NULL);
+
+  ide_diagnostics_tree_insert (tree, diag1, IDE_DIAGNOSTICS_TREE_LOCATION, 10, 10);
+  ide_diagnostics_tree_insert (tree, diag1, 0, 10, 12);
+  ide_diagnostics_tree_insert (tree, diag2, IDE_DIAGNOSTICS_TREE_LOCATION, 20, 20);
+
+  g_assert_cmpint (ide_diagnostics_tree_get_size (tree), ==, 3);
+  g_assert_true (ide_diagnostics_tree_contains (tree, diag1));
+  g_assert_true (ide_diagnostics_tree_contains (tree, diag2));
+
+  ide_diagnostics_tree_foreach_in_range (tree, 12, 12, collect_entry, found);
+  g_assert_cmpint (found->len, ==, 1);
+  g_assert_true (g_array_index (found, Entry, 0).diagnostic == diag1);
+  g_assert_cmpint (g_array_index (found, Entry, 0).part, ==, 0);
+  g_array_set_size (found, 0);
+
+  /* Typing a newline in the middle of line 11 grows the range */
+  ide_diagnostics_tree_insert_lines (tree, 12, 1);
+  ide_diagnostics_tree_foreach_in_range (tree, 13, 13, collect_entry, found);
+  g_assert_cmpint (found->len, ==, 1);
+  g_assert_cmpint (g_array_index (found, Entry, 0).end, ==, 13);
+  g_array_set_size (found, 0);
+
+  /* The warning moved with its line */
+  ide_diagnostics_tree_foreach_in_range (tree, 21, 21, collect_entry, found);
+  g_assert_cmpint (found->len, ==, 1);
+  g_assert_true (g_array_index (found, Entry, 0).diagnostic == diag2);
+  g_array_set_size (found, 0);
+
+  /* Joining lines 15 to 21 with line 14 moves the warning to line 14 */
+  ide_diagnostics_tree_delete_lines (tree, 14, 7);
+  ide_diagnostics_tree_foreach_in_range (tree, 14, 14, collect_entry, found);
+  g_assert_cmpint (found->len, ==, 1);
+  g_assert_true (g_array_index (found, Entry, 0).diagnostic == diag2);
+  g_array_set_size (found, 0);
+
+  g_assert_cmpint (ide_diagnostics_tree_remove_if (tree, remove_diagnostic, diag2), ==, 1);
+  g_assert_cmpint (ide_diagnostics_tree_get_size (tree), ==, 2);
+  g_assert_true (ide_diagnostics_tree_contains (tree, diag1));
+  g_assert_false (ide_diagnostics_tree_contains (tree, diag2));
+
+  ide_diagnostics_tree_clear (tree);
+  g_assert_cmpint (ide_diagnostics_tree_get_size (tree), ==, 0);
+  g_assert_false (ide_diagnostics_tree_contains (tree, diag1));
+
+  ide_diagnostics_tree_free (tree);
+  ide_diagnostic_unref (diag1);
+  ide_diagnostic_unref (diag2);
+}
+
+static void
+test_diagnostics_tree_random (void)
+{
+  IdeDiagnosticsTree *tree = ide_diagnostics_tree_new ();
+  g_autoptr(GArray) model = g_array_new (FALSE, FALSE, sizeof (Entry));
+  IdeDiagnostic *diagnostic = ide_diagnostic_new (IDE_DIAGNOSTIC_WARNING, "warning", NULL);
+  GRand *rand = g_rand_new_with_seed (1234);
+  gint next_part = 0;
+
+  for (guint i = 0; i < 5000; i++)
+    {
+      guint op = g_rand_int_range (rand, 0, 100);
+      guint line = g_rand_int_range (rand, 0, 500);
+      guint n_lines = g_rand_int_range (rand, 1, 10);
+
+      if (op < 50)
+        {
+          Entry entry = { diagnostic, next_part++, line, line + g_rand_int_range (rand, 0, 6) };
+
+          ide_diagnostics_tree_insert (tree, entry.diagnostic, entry.part, entry.begin, entry.end);
+          g_array_append_val (model, entry);
+        }
+      else if (op < 70)
+        {
+          ide_diagnostics_tree_insert_lines (tree, line, n_lines);
+
+          for (guint j = 0; j < model->len; j++)
+            {
+              Entry *entry = &g_array_index (model, Entry, j);
+
+              if (entry->begin >= line)
+                {
+                  entry->begin += n_lines;
+                  entry->end += n_lines;
+                }
+              else if (entry->end >= line)
+                entry->end += n_lines;
+            }
+        }
+      else if (op < 90)
+        {
+          ide_diagnostics_tree_delete_lines (tree, line, n_lines);
+
+          for (guint j = 0; j < model->len; j++)
+            {
+              Entry *entry = &g_array_index (model, Entry, j);
+
+              entry->begin = collapse (entry->begin, line, n_lines);
+              entry->end = collapse (entry->end, line, n_lines);
+            }
+        }
+      else if (op < 91)
+        {
+          guint n_removed = ide_diagnostics_tree_remove_if (tree, remove_odd_parts, NULL);
+
+          for (guint j = model->len; j > 0; j--)
+            {
+              if (g_array_index (model, Entry, j - 1).part & 1)
+                {
+                  g_array_remove_index (model, j - 1);
+                  n_removed--;
+                }
+            }
+
+          g_assert_cmpint (n_removed, ==, 0);
+        }
+
+      g_assert_cmpint (ide_diagnostics_tree_get_size (tree), ==, model->len);
+
+      check_range (tree, model, line, line);
+      check_range (tree, model, line, line + n_lines * 10);
+    }
+
+  check_range (tree, model, 0, G_MAXUINT);
+
+  ide_diagnostics_tree_free (tree);
+  ide_diagnostic_unref (diagnostic);
+  g_rand_free (rand);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/DiagnosticsTree/basic", test_diagnostics_tree_basic);
+  g_test_add_func ("/Ide/DiagnosticsTree/random", test_diagnostics_tree_random);
+
+  return g_test_run ();
+}
@@ -0,0 +1,193 @@
+/* test-ide-git-line-model.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "ide-git-line-model.h"
+
+static IdeGitLineModel *
+model_new (const gchar *text)
+{
+  g_autoptr(GBytes) bytes = g_bytes_new (text, strlen (text));
+
+  return ide_git_line_model_new (bytes);
+}
+
+static void
+test_line_model_basic (void)
+{
+  g_autoptr(IdeGitLineModel) empty = model_new ("");
+  g_autoptr(IdeGitLineModel) old_model = model_new ("a\nb\nc\nd\n");
+  g_autoptr(IdeGitLineModel) new_model = model_new ("a\nx\nc\nd\ne");
+  gboolean deleted[4] = { 0 };
+  gboolean added[5] = { 0 };
+
+  g_assert_cmpint (ide_git_line_model_get_n_lines (empty), ==, 0);
+  g_assert_cmpint (ide_git_line_model_get_n_lines (old_model), ==, 4);
+  g_assert_cmpint (ide_git_line_model_get_n_lines (new_model), ==, 5);
+
+  g_assert_true (ide_git_line_model_diff (old_model, 0, 4, new_model, 0, 5, 10, deleted, added));
+
+  g_assert_false (deleted[0]);
+  g_assert_true (deleted[1]);
+  g_assert_false (deleted[2]);
+  g_assert_false (deleted[3]);
+
+  g_assert_false (added[0]);
+  g_assert_true (added[1]);
+  g_assert_false (added[2]);
+  g_assert_false (added[3]);
+  g_assert_true (added[4]);
+
+  /* Three edits are needed */
+  memset (deleted, 0, sizeof deleted);
+  memset (added, 0, sizeof added);
+  g_assert_false (ide_git_line_model_diff (old_model, 0, 4, new_model, 0, 5, 2, deleted, added));
+
+  /* Only compare the lines in the middle */
+  memset (deleted, 0, sizeof deleted);
+  memset (added, 0, sizeof added);
+  g_assert_true (ide_git_line_model_diff (old_model, 2, 4, new_model, 2, 4, 0, deleted, added));
+}
+
+static void
+test_line_model_trailing_newline (void)
+{
+  g_autoptr(IdeGitLineModel) old_model = model_new ("a\nb");
+  g_autoptr(IdeGitLineModel) new_model = model_new ("a\nb\n");
+  gboolean deleted[2] = { 0 };
+  gboolean added[2] = { 0 };
+
+  /* Like git, a missing newline at the end of the file is a change */
+  g_assert_true (ide_git_line_model_diff (old_model, 0, 2, new_model, 0, 2, 10, deleted, added));
+
+  g_assert_false (deleted[0]);
+  g_assert_true (deleted[1]);
+  g_assert_false (added[0]);
+  g_assert_true (added[1]);
+}
+
+static guint
+longest_common_subsequence (gchar **a,
+                            guint   n,
+                            gchar **b,
+                            guint   m)
+{
+  g_autofree guint *table = g_new0 (guint, (n + 1) * (m + 1));
+
+  for (guint i = n; i > 0; i--)
+    {
+      for (guint j = m; j > 0; j--)
+        {
+          guint *cell = &table[(i - 1) * (m + 1) + (j - 1)];
+
+          if (g_str_equal (a[i - 1], b[j - 1]))
+            *cell = table[i * (m + 1) + j] + 1;
+          else
+            *cell = MAX (table[i * (m + 1) + (j - 1)], table[(i - 1) * (m + 1) + j]);
+        }
+    }
+
+  return table[0];
+}
+
+static void
+test_line_model_random (void)
+{
+  GRand *rand = g_rand_new_with_seed (4321);
+
+  for (guint iter = 0; iter < 2000; iter++)
+    {
+      g_autoptr(IdeGitLineModel) old_model = NULL;
+      g_autoptr(IdeGitLineModel) new_model = NULL;
+      g_autoptr(GString) old_text = g_string_new (NULL);
+      g_autoptr(GString) new_text = g_string_new (NULL);
+      g_autofree gboolean *deleted = NULL;
+      g_autofree gboolean *added = NULL;
+      g_auto(GStrv) old_lines = NULL;
+      g_auto(GStrv) new_lines = NULL;
+      guint n = g_rand_int_range (rand, 0, 30);
+      guint m = g_rand_int_range (rand, 0, 30);
+      guint max_edits = g_rand_int_range (rand, 0, 40);
+      guint n_edits = 0;
+      guint lcs;
+      guint i = 0;
+      guint j = 0;
+
+      old_lines = g_new0 (gchar *, n + 1);
+      new_lines = g_new0 (gchar *, m + 1);
+
+      for (guint k = 0; k < n; k++)
+        {
+          old_lines[k] = g_strdup_printf ("%c\n", 'a' + g_rand_int_range (rand, 0, 3));
+          g_string_append (old_text, old_lines[k]);
+        }
+
+      for (guint k = 0; k < m; k++)
+        {
+          new_lines[k] = g_strdup_printf ("%c\n", 'a' + g_rand_int_range (rand, 0, 3));
+          g_string_append (new_text, new_lines[k]);
+        }
+
+      old_model = model_new (old_text->str);
+      new_model = model_new (new_text->str);
+      deleted = g_new0 (gboolean, n + 1);
+      added = g_new0 (gboolean, m + 1);
+
+      lcs = longest_common_subsequence (old_lines, n, new_lines, m);
+
+      if (!ide_git_line_model_diff (old_model, 0, n, new_model, 0, m, max_edits, deleted, added))
+        {
+          g_assert_cmpint (n + m - 2 * lcs, >, max_edits);
+          continue;
+        }
+
+      /* Replaying the edits must line up equal lines, with as few edits as possible */
+      while (i < n || j < m)
+        {
+          if (j < m && added[j])
+            j++, n_edits++;
+          else if (i < n && deleted[i])
+            i++, n_edits++;
+          else
+            {
+              g_assert_cmpint (i, <, n);
+              g_assert_cmpint (j, <, m);
+              g_assert_cmpstr (old_lines[i], ==, new_lines[j]);
+              i++, j++;
+            }
+        }
+
+      g_assert_cmpint (n_edits, ==, n + m - 2 * lcs);
+    }
+
+  g_rand_free (rand);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/Git/LineModel/basic", test_line_model_basic);
+  g_test_add_func ("/Ide/Git/LineModel/trailing-newline", test_line_model_trailing_newline);
+  g_test_add_func ("/Ide/Git/LineModel/random", test_line_model_random);
+
+  return g_test_run ();
+}
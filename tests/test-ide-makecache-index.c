@@ -0,0 +1,165 @@
+/* test-ide-makecache-index.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "ide-makecache-index.h"
+#include "ide-makecache-target.h"
+
+static const gchar *database =
+  "# Not a rule: foo.c\n"
+  ".PHONY: all\n"
+  "subdir = src\n"
+  "libfoo_la-foo.lo: foo.c foo.h ../include/bar.h\n"
+  "foo.c:\n"
+  "subdir = tests\n"
+  "test-foo.o: test-foo.c ../src/foo.h\n";
+
+static void
+assert_targets (GHashTable          *index,
+                const gchar         *path,
+                const gchar * const *expected)
+{
+  g_autoptr(GPtrArray) targets = ide_makecache_index_lookup (index, path);
+
+  if (expected == NULL)
+    {
+      g_assert (targets == NULL);
+      return;
+    }
+
+  g_assert (targets != NULL);
+  g_assert_cmpint (targets->len, ==, g_strv_length ((gchar **)expected) / 2);
+
+  /* Expected entries are pairs of subdir and target, in database order */
+  for (guint i = 0; i < targets->len; i++)
+    {
+      IdeMakecacheTarget *target = g_ptr_array_index (targets, i);
+
+      g_assert_cmpstr (ide_makecache_target_get_subdir (target), ==, expected[i * 2]);
+      g_assert_cmpstr (ide_makecache_target_get_target (target), ==, expected[i * 2 + 1]);
+    }
+}
+
+static void
+assert_database_index (GHashTable *index)
+{
+  static const gchar *foo_c[] = { "src", "libfoo_la-foo.lo", NULL };
+  static const gchar *foo_h[] = { "src", "libfoo_la-foo.lo", "tests", "test-foo.o", NULL };
+  static const gchar *bar_h[] = { "src", "libfoo_la-foo.lo", NULL };
+  static const gchar *test_foo_c[] = { "tests", "test-foo.o", NULL };
+
+  g_assert (index != NULL);
+
+  assert_targets (index, "src/foo.c", foo_c);
+  assert_targets (index, "src/foo.h", foo_h);
+  assert_targets (index, "include/bar.h", bar_h);
+  assert_targets (index, "tests/test-foo.c", test_foo_c);
+  assert_targets (index, "src/missing.c", NULL);
+  assert_targets (index, "all", NULL);
+}
+
+static void
+test_makecache_index_build (void)
+{
+  g_autoptr(GHashTable) index = NULL;
+
+  index = ide_makecache_index_build (database, strlen (database));
+  assert_database_index (index);
+}
+
+static void
+test_makecache_index_saved (void)
+{
+  g_autoptr(GHashTable) index = NULL;
+  g_autoptr(GHashTable) loaded = NULL;
+  g_autoptr(GHashTable) stale = NULL;
+  g_autoptr(GHashTable) missing = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *tmpdir = NULL;
+  g_autofree gchar *index_path = NULL;
+  g_autofree gchar *missing_path = NULL;
+  gboolean r;
+
+  tmpdir = g_dir_make_tmp ("test-ide-makecache-index-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  index_path = g_build_filename (tmpdir, "Makecache.index", NULL);
+  missing_path = g_build_filename (tmpdir, "Missing.index", NULL);
+
+  index = ide_makecache_index_build (database, strlen (database));
+
+  r = ide_makecache_index_save (index_path, "checksum-a", index, &error);
+  g_assert_no_error (error);
+  g_assert (r);
+
+  /* The saved index is only reused for the database it was built from */
+  loaded = ide_makecache_index_load (index_path, "checksum-a");
+  g_assert_cmpint (g_hash_table_size (loaded), ==, g_hash_table_size (index));
+  assert_database_index (loaded);
+
+  stale = ide_makecache_index_load (index_path, "checksum-b");
+  g_assert (stale == NULL);
+
+  missing = ide_makecache_index_load (missing_path, "checksum-a");
+  g_assert (missing == NULL);
+
+  g_unlink (index_path);
+  g_rmdir (tmpdir);
+}
+
+static void
+test_makecache_find_compile_line (void)
+{
+  static const gchar *lines[] = {
+    "make: Entering directory '/build/src'",
+    "echo a/util.c",
+    FAKE_CC " -DA -c -o a/libfoo_la-util.lo a/util.cc",
+    FAKE_CC " -DA -c -o a/libfoo_la-util.lo a/util.c",
+    FAKE_CXX " -DB -c -o b/libfoo_la-util.lo 'b/util.c'",
+    FAKE_VALAC " --pkg gio-2.0 main.vala",
+    "",
+    NULL
+  };
+
+  /* Files sharing a basename get their own line */
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "a/util.c"), ==, 3);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "b/util.c"), ==, 4);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "util.c"), ==, 3);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "a/util.cc"), ==, 2);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "main.vala"), ==, 5);
+
+  /* Only compiler invocations are considered */
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "c/util.c"), ==, -1);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "til.c"), ==, -1);
+  g_assert_cmpint (ide_makecache_find_compile_line (lines, "/build/src"), ==, -1);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/MakecacheIndex/build", test_makecache_index_build);
+  g_test_add_func ("/Ide/MakecacheIndex/saved", test_makecache_index_saved);
+  g_test_add_func ("/Ide/MakecacheIndex/find-compile-line", test_makecache_find_compile_line);
+
+  return g_test_run ();
+}
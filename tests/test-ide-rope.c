@@ -0,0 +1,138 @@
+/* test-ide-rope.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ide.h>
+#include <string.h>
+
+static void
+assert_rope_equal (IdeRope     *rope,
+                   const gchar *str)
+{
+  g_autoptr(GBytes) bytes = ide_rope_flatten (rope);
+  gsize len = 0;
+  const gchar *data = g_bytes_get_data (bytes, &len);
+
+  g_assert_cmpint (len, ==, strlen (str));
+  g_assert_cmpint (ide_rope_get_length (rope), ==, strlen (str));
+  g_assert_cmpint (ide_rope_get_n_chars (rope), ==, g_utf8_strlen (str, -1));
+  g_assert_cmpstr (data, ==, str);
+}
+
+static void
+test_rope_basic (void)
+{
+  g_autoptr(IdeRope) empty = ide_rope_new (NULL, 0);
+  g_autoptr(IdeRope) a = NULL;
+  g_autoptr(IdeRope) b = NULL;
+  g_autoptr(IdeRope) c = NULL;
+
+  assert_rope_equal (empty, "");
+
+  a = ide_rope_insert (empty, 0, "hello world", -1);
+  b = ide_rope_insert (a, 5, ", ünïcödé", -1);
+  c = ide_rope_delete (b, 0, 7);
+
+  /* Older snapshots must be unchanged by later edits */
+  assert_rope_equal (empty, "");
+  assert_rope_equal (a, "hello world");
+  assert_rope_equal (b, "hello, ünïcödé world");
+  assert_rope_equal (c, "ünïcödé world");
+}
+
+static void
+test_rope_trailing_newline (void)
+{
+  g_autoptr(IdeRope) rope = ide_rope_new ("abc", -1);
+  g_autoptr(GBytes) plain = ide_rope_flatten (rope);
+  g_autoptr(GBytes) newline = ide_rope_flatten_full (rope, TRUE);
+  g_autoptr(GBytes) again = ide_rope_flatten_full (rope, TRUE);
+
+  g_assert_cmpstr (g_bytes_get_data (plain, NULL), ==, "abc");
+  g_assert_cmpint (g_bytes_get_size (plain), ==, 3);
+  g_assert_cmpstr (g_bytes_get_data (newline, NULL), ==, "abc\n");
+  g_assert_cmpint (g_bytes_get_size (newline), ==, 4);
+
+  /* The copy is only made once per rope */
+  g_assert (newline == again);
+}
+
+static void
+test_rope_random (void)
+{
+  static const gchar *pieces[] = { "a", "é", "€€", "line\n", "" };
+  g_autoptr(GString) str = g_string_new (NULL);
+  g_autoptr(IdeRope) rope = ide_rope_new (NULL, 0);
+  g_autofree gchar *large = g_strnfill (5000, 'x');
+  GRand *rand = g_rand_new_with_seed (1234);
+
+  for (guint i = 0; i < 10000; i++)
+    {
+      glong n_chars = g_utf8_strlen (str->str, str->len);
+      IdeRope *next;
+
+      if (n_chars == 0 || g_rand_int_range (rand, 0, 4) != 0)
+        {
+          const gchar *piece;
+          glong offset = g_rand_int_range (rand, 0, n_chars + 1);
+          gsize pos = g_utf8_offset_to_pointer (str->str, offset) - str->str;
+
+          if (g_rand_int_range (rand, 0, 100) == 0)
+            piece = large;
+          else
+            piece = pieces[g_rand_int_range (rand, 0, G_N_ELEMENTS (pieces))];
+
+          g_string_insert (str, pos, piece);
+          next = ide_rope_insert (rope, offset, piece, -1);
+        }
+      else
+        {
+          glong begin = g_rand_int_range (rand, 0, n_chars + 1);
+          glong end = MIN (n_chars, begin + g_rand_int_range (rand, 0, 100));
+          gsize begin_pos = g_utf8_offset_to_pointer (str->str, begin) - str->str;
+          gsize end_pos = g_utf8_offset_to_pointer (str->str, end) - str->str;
+
+          g_string_erase (str, begin_pos, end_pos - begin_pos);
+          next = ide_rope_delete (rope, begin, end);
+        }
+
+      g_clear_pointer (&rope, ide_rope_unref);
+      rope = next;
+
+      g_assert_cmpint (ide_rope_get_length (rope), ==, str->len);
+
+      if (i % 100 == 0)
+        assert_rope_equal (rope, str->str);
+    }
+
+  assert_rope_equal (rope, str->str);
+
+  g_rand_free (rand);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/Rope/basic", test_rope_basic);
+  g_test_add_func ("/Ide/Rope/trailing-newline", test_rope_trailing_newline);
+  g_test_add_func ("/Ide/Rope/random", test_rope_random);
+
+  return g_test_run ();
+}
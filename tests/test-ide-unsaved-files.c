@@ -0,0 +1,158 @@
+/* test-ide-unsaved-files.c
+ *
+ * Copyright (C) 2017 Christian Hergert <chergert@redhat.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gstdio.h>
+#include <ide.h>
+
+#define N_VERSIONS 40
+
+static GBytes *
+make_content (guint version)
+{
+  GString *str = g_string_new (NULL);
+
+  /* Each version only changes a line or two, so it is saved as a delta */
+  for (guint line = 0; line < 100; line++)
+    g_string_append_printf (str, "line %u of version %u\n",
+                            line, line == version % 100 ? version : 0);
+
+  return g_string_free_to_bytes (str);
+}
+
+static void
+save_cb (GObject      *object,
+         GAsyncResult *result,
+         gpointer      user_data)
+{
+  GMainLoop *main_loop = user_data;
+  GError *error = NULL;
+  gboolean ret;
+
+  ret = ide_unsaved_files_save_finish (IDE_UNSAVED_FILES (object), result, &error);
+  g_assert_no_error (error);
+  g_assert_true (ret);
+
+  g_main_loop_quit (main_loop);
+}
+
+static void
+restore_cb (GObject      *object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+  GMainLoop *main_loop = user_data;
+  GError *error = NULL;
+  gboolean ret;
+
+  ret = ide_unsaved_files_restore_finish (IDE_UNSAVED_FILES (object), result, &error);
+  g_assert_no_error (error);
+  g_assert_true (ret);
+
+  g_main_loop_quit (main_loop);
+}
+
+static void
+assert_restored (IdeContext *context,
+                 GFile      *file,
+                 guint       version)
+{
+  g_autoptr(IdeUnsavedFiles) unsaved_files = NULL;
+  g_autoptr(IdeUnsavedFile) unsaved_file = NULL;
+  g_autoptr(GMainLoop) main_loop = NULL;
+  g_autoptr(GBytes) expected = NULL;
+
+  unsaved_files = g_object_new (IDE_TYPE_UNSAVED_FILES,
+                                "context", context,
+                                NULL);
+  main_loop = g_main_loop_new (NULL, FALSE);
+
+  ide_unsaved_files_restore_async (unsaved_files, NULL, restore_cb, main_loop);
+  g_main_loop_run (main_loop);
+
+  unsaved_file = ide_unsaved_files_get_unsaved_file (unsaved_files, file);
+  g_assert (unsaved_file != NULL);
+
+  expected = make_content (version);
+  g_assert_true (g_bytes_equal (ide_unsaved_file_get_content (unsaved_file), expected));
+}
+
+static void
+test_unsaved_files_journal (void)
+{
+  g_autoptr(IdeContext) context = NULL;
+  g_autoptr(GMainLoop) main_loop = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *journal_path = NULL;
+  g_autofree gchar *contents = NULL;
+  IdeUnsavedFiles *unsaved_files;
+  GError *error = NULL;
+  gsize len = 0;
+
+  context = g_object_new (IDE_TYPE_CONTEXT, NULL);
+  unsaved_files = ide_context_get_unsaved_files (context);
+  file = g_file_new_for_path (TEST_DATA_DIR"/project1/project1.c");
+  main_loop = g_main_loop_new (NULL, FALSE);
+
+  /* Enough saves to write full records, deltas and a checkpoint */
+  for (guint i = 1; i <= N_VERSIONS; i++)
+    {
+      g_autoptr(GBytes) content = make_content (i);
+
+      ide_unsaved_files_update (unsaved_files, file, content);
+      ide_unsaved_files_save_async (unsaved_files, NULL, save_cb, main_loop);
+      g_main_loop_run (main_loop);
+    }
+
+  assert_restored (context, file, N_VERSIONS);
+
+  /* Tear the last record, as a crash in the middle of a write would */
+  journal_path = g_build_filename (g_get_user_data_dir (),
+                                   ide_get_program_name (),
+                                   "drafts",
+                                   "journal",
+                                   NULL);
+  g_file_get_contents (journal_path, &contents, &len, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (len, >, 5);
+
+  g_file_set_contents (journal_path, contents, len - 5, &error);
+  g_assert_no_error (error);
+
+  assert_restored (context, file, N_VERSIONS - 1);
+
+  g_unlink (journal_path);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+  g_autofree gchar *tmpdir = NULL;
+
+  /* Keep the drafts and temporary files out of the real user directories */
+  tmpdir = g_dir_make_tmp ("test-ide-unsaved-files-XXXXXX", NULL);
+  g_assert (tmpdir != NULL);
+  g_setenv ("XDG_DATA_HOME", tmpdir, TRUE);
+  g_setenv ("XDG_CACHE_HOME", tmpdir, TRUE);
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Ide/UnsavedFiles/journal", test_unsaved_files_journal);
+
+  return g_test_run ();
+}